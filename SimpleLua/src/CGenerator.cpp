@@ -0,0 +1,448 @@
+#include "CGenerator.h"
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Prototypes in depth-first order; a prototype's index names its function
+static void collectProtos(const Prototype* proto, std::vector<const Prototype*>& all) {
+    all.push_back(proto);
+    for (const auto& child : proto->protos) collectProtos(child.get(), all);
+}
+
+static int protoIndex(const Prototype* proto, const std::vector<const Prototype*>& all) {
+    for (size_t i = 0; i < all.size(); ++i) {
+        if (all[i] == proto) return (int)i;
+    }
+    throw std::runtime_error("Unknown prototype");
+}
+
+// C string literal; '?' is escaped so that no trigraph can form
+static std::string quoteC(const std::string& s) {
+    std::string out = "\"";
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\' || c == '?') {
+            out += '\\';
+            out += (char)c;
+        } else if (c >= 32 && c < 127) {
+            out += (char)c;
+        } else {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\%03o", c);
+            out += buf;
+        }
+    }
+    return out + "\"";
+}
+
+// Constant k of the function with index id, as a C expression
+static std::string constantExpr(const Prototype* proto, int id, int k) {
+    if (k < 0 || k >= (int)proto->constants.size()) throw std::runtime_error("Constant index out of range");
+    const Value& v = proto->constants[k];
+    if (is_boolean(v)) return as_boolean(v) ? "sl_bool(1)" : "sl_bool(0)";
+    if (is_string(v)) return "sl_k" + std::to_string(id) + "[" + std::to_string(k) + "]";
+    if (!is_number(v)) return "sl_nil";
+    char buf[64];
+    if (is_integer(v)) {
+        // INT64_MIN has no literal of its own
+        if (as_integer(v) == INT64_MIN) return "sl_int(INT64_MIN)";
+        std::snprintf(buf, sizeof(buf), "sl_int(%lldLL)", (long long)as_integer(v));
+        return buf;
+    }
+    double d = as_number(v);
+    if (d != d) return "sl_flt(NAN)";
+    if (std::isinf(d)) return d > 0 ? "sl_flt(HUGE_VAL)" : "sl_flt(-HUGE_VAL)";
+    std::snprintf(buf, sizeof(buf), "%.17g", d);
+    std::string text = buf;
+    if (text.find_first_of(".e") == std::string::npos) text += ".0";
+    return "sl_flt(" + text + ")";
+}
+
+// Registers the function needs, computed like the native interpreter's frame size
+static int frameSize(const Prototype* proto) {
+    int maxReg = proto->numParams;
+    auto use = [&maxReg](int reg) { if (reg + 1 > maxReg) maxReg = reg + 1; };
+    for (const Instruction& inst : proto->instructions) {
+        if (inst.op >= OP_SUPER0) throw std::runtime_error("C backend cannot compile superinstructions");
+        if (inst.a < 0 || inst.a > 255) throw std::runtime_error("Register out of range");
+        use(inst.a);
+        switch (inst.op) {
+        case OP_MOVE: case OP_LEN: case OP_NOT:
+            use(inst.b);
+            break;
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_IDIV: case OP_MOD:
+        case OP_ADD_INT: case OP_SUB_INT: case OP_MUL_INT: case OP_IDIV_INT: case OP_MOD_INT:
+        case OP_CONCAT: case OP_EQ: case OP_LT: case OP_LE: case OP_GETTABLE: case OP_SETTABLE:
+            use(inst.b);
+            use(inst.c);
+            break;
+        case OP_CALL:
+            use(inst.a + inst.b - 1);
+            use(inst.a + inst.c - 2);
+            break;
+        case OP_VARARG:
+            use(inst.a + inst.c - 2);
+            break;
+        case OP_FORPREP: case OP_FORLOOP: case OP_FORLOOP_UP: case OP_FORLOOP_DOWN:
+            use(inst.a + 3);
+            break;
+        case OP_TFORCALL: case OP_TFORIPAIRS: case OP_TFORPAIRS:
+            use(inst.a + 2 + inst.c);
+            break;
+        case OP_TFORLOOP:
+            use(inst.a + 1);
+            break;
+        case OP_BUFINIT: case OP_BUFFLUSH:
+            use(inst.b);
+            break;
+        case OP_BUFAPPEND:
+            use(inst.c);
+            break;
+        case OP_LOADNIL:
+            use(inst.a + inst.b);
+            break;
+        case OP_RETURN:
+            use(inst.a + inst.b - 2);
+            break;
+        default:
+            break;
+        }
+    }
+    return maxReg > 0 ? maxReg : 1;
+}
+
+// Destination of a jump at pc, or -1 for other instructions
+static int jumpTarget(const Instruction& inst, int pc) {
+    switch (inst.op) {
+    case OP_JMP: case OP_JMP_FALSE: case OP_JMP_TRUE: case OP_FORPREP: case OP_FORLOOP: case OP_FORLOOP_UP:
+    case OP_FORLOOP_DOWN: case OP_TFORLOOP:
+        return pc + 1 + inst.b;
+    default:
+        return -1;
+    }
+}
+
+// Whether the instruction can raise an error or call a function, and so
+// needs the frame's current line to be up to date
+static bool needsLine(OpCode op) {
+    switch (op) {
+    case OP_MOVE: case OP_LOADK: case OP_NOT: case OP_JMP: case OP_JMP_FALSE: case OP_JMP_TRUE: case OP_NEWTABLE:
+    case OP_CLOSURE: case OP_GETUPVAL: case OP_SETUPVAL: case OP_VARARG: case OP_TFORLOOP:
+    case OP_ADD_INT: case OP_SUB_INT: case OP_MUL_INT: case OP_BUFINIT: case OP_BUFFLUSH:
+    case OP_LOADNIL: case OP_LOADBOOL: case OP_LOADI: case OP_LOADF: case OP_SWITCH:
+        return false;
+    default:
+        return true;
+    }
+}
+
+static const char* arithHelper(OpCode op) {
+    switch (op) {
+    case OP_ADD: return "sl_add";
+    case OP_SUB: return "sl_sub";
+    case OP_MUL: return "sl_mul";
+    case OP_DIV: return "sl_div";
+    case OP_IDIV: return "sl_idiv";
+    case OP_MOD: return "sl_mod";
+    case OP_LT: return "sl_lt";
+    default: return "sl_le";
+    }
+}
+
+void CGenerator::generateProto(const Prototype* proto, std::ostream& out, const std::vector<const Prototype*>& all) {
+    const int id = protoIndex(proto, all);
+    const int numInsts = (int)proto->instructions.size();
+    const int size = frameSize(proto);
+    const int numParams = proto->numParams;
+
+    std::vector<bool> isTarget(numInsts + 1, false);
+    bool usesVarargs = false;
+    for (int pc = 0; pc < numInsts; ++pc) {
+        const Instruction& inst = proto->instructions[pc];
+        int target = jumpTarget(inst, pc);
+        if (target >= 0) {
+            if (target > numInsts) throw std::runtime_error("Jump target out of range");
+            isTarget[target] = true;
+        }
+        if (inst.op == OP_VARARG) usesVarargs = true;
+    }
+
+    out << "/* " << (proto->name.empty() ? "function" : proto->name) << ", line " << proto->lineDefined << " */\n";
+    out << "static int sl_f" << id << "(sl_Func *self, sl_Value *args, int nargs) {\n";
+    out << "    sl_Value R[" << size << "];\n";
+    out << "    sl_Frame fr;\n";
+    out << "    int i;\n";
+    if (usesVarargs) {
+        out << "    const sl_Value *va = args + " << numParams << ";\n";
+        out << "    int nva = nargs > " << numParams << " ? nargs - " << numParams << " : 0;\n";
+    }
+    out << "    (void)self;\n";
+    if (numParams > 0) {
+        out << "    for (i = 0; i < " << numParams << " && i < nargs; i++) R[i] = args[i];\n";
+        out << "    for (; i < " << size << "; i++) R[i] = sl_nil;\n";
+    } else {
+        out << "    (void)args;\n";
+        out << "    (void)nargs;\n";
+        out << "    for (i = 0; i < " << size << "; i++) R[i] = sl_nil;\n";
+    }
+    out << "    sl_enter(&fr, R, " << size << ", " << proto->lineDefined << ");\n";
+
+    auto K = [&](int k) { return constantExpr(proto, id, k); };
+    auto label = [](int pc) { return "L" + std::to_string(pc); };
+    auto reg = [](int r) { return "R[" + std::to_string(r) + "]"; };
+
+    int line = -1; // Line last stored in fr.line on the current straight-line path
+    for (int pc = 0; pc < numInsts; ++pc) {
+        const Instruction& inst = proto->instructions[pc];
+        if (isTarget[pc]) {
+            out << label(pc) << ":;\n";
+            line = -1;
+        }
+        int instLine = proto->lineAt(pc);
+        if (needsLine(inst.op) && instLine != line) {
+            out << "    fr.line = " << instLine << ";\n";
+            line = instLine;
+        }
+        std::string a = reg(inst.a), b = reg(inst.b), c = reg(inst.c);
+        switch (inst.op) {
+        case OP_MOVE:
+            out << "    " << a << " = " << b << ";\n";
+            break;
+        case OP_LOADK:
+            out << "    " << a << " = " << K(inst.b) << ";\n";
+            break;
+        case OP_LOADNIL:
+            for (int r = inst.a; r <= inst.a + inst.b; ++r) out << "    " << reg(r) << " = sl_nil;\n";
+            break;
+        case OP_LOADBOOL:
+            out << "    " << a << " = sl_bool(" << (inst.b != 0) << ");\n";
+            break;
+        case OP_LOADI:
+            out << "    " << a << " = sl_int(" << inst.b << ");\n";
+            break;
+        case OP_LOADF:
+            out << "    " << a << " = sl_flt(" << inst.b << ".0);\n";
+            break;
+        // Jumps straight to where the JMP after the switch for each arm goes
+        case OP_SWITCH: {
+            if (pc + 1 + inst.c >= numInsts) throw std::runtime_error("Switch out of range");
+            out << "    {\n";
+            out << "        sl_Value arm = sl_tget(sl_sw" << id << "_" << pc << ", " << a << ");\n";
+            out << "        switch (arm.type == SL_INT ? (int)arm.u.i : " << inst.c << ") {\n";
+            for (int i = 0; i <= inst.c; ++i) {
+                int slot = pc + 1 + i;
+                int target = jumpTarget(proto->instructions[slot], slot);
+                if (target < 0) throw std::runtime_error("Switch arm is not a jump");
+                out << "        " << (i < inst.c ? "case " + std::to_string(i) + ":" : "default:") << " goto "
+                    << label(target) << ";\n";
+            }
+            out << "        }\n";
+            out << "    }\n";
+            break;
+        }
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_IDIV: case OP_MOD:
+            out << "    " << a << " = " << arithHelper(inst.op) << "(" << b << ", " << c << ");\n";
+            break;
+        // Operands of the _INT forms are known to be integers
+        case OP_ADD_INT: case OP_SUB_INT: case OP_MUL_INT: {
+            const char* sign = inst.op == OP_ADD_INT ? " + " : inst.op == OP_SUB_INT ? " - " : " * ";
+            out << "    " << a << " = sl_int((int64_t)((uint64_t)" << b << ".u.i" << sign << "(uint64_t)" << c
+                << ".u.i));\n";
+            break;
+        }
+        case OP_IDIV_INT: case OP_MOD_INT:
+            out << "    " << a << " = " << (inst.op == OP_IDIV_INT ? "sl_idivint(" : "sl_modint(") << b << ".u.i, " << c
+                << ".u.i);\n";
+            break;
+        case OP_CONCAT:
+            out << "    sl_checkgc();\n";
+            if (inst.c == inst.b + 1) {
+                out << "    " << a << " = sl_concat(" << b << ", " << c << ");\n";
+            } else {
+                out << "    " << a << " = sl_concatn(&" << b << ", " << inst.c - inst.b + 1 << ");\n";
+            }
+            break;
+        case OP_LEN:
+            out << "    " << a << " = sl_len(" << b << ");\n";
+            break;
+        case OP_NOT:
+            out << "    " << a << " = sl_bool(sl_falsy(" << b << "));\n";
+            break;
+        case OP_EQ:
+            out << "    " << a << " = sl_bool(sl_eq(" << b << ", " << c << "));\n";
+            break;
+        case OP_LT: case OP_LE:
+            out << "    " << a << " = sl_bool(" << arithHelper(inst.op) << "(" << b << ", " << c << "));\n";
+            break;
+        case OP_JMP:
+            out << "    goto " << label(pc + 1 + inst.b) << ";\n";
+            break;
+        case OP_JMP_FALSE:
+            out << "    if (sl_falsy(" << a << ")) goto " << label(pc + 1 + inst.b) << ";\n";
+            break;
+        case OP_JMP_TRUE:
+            out << "    if (!sl_falsy(" << a << ")) goto " << label(pc + 1 + inst.b) << ";\n";
+            break;
+        case OP_GETGLOBAL:
+            out << "    " << a << " = sl_getglobal(" << K(inst.b) << ");\n";
+            break;
+        case OP_SETGLOBAL:
+            out << "    sl_setglobal(" << K(inst.b) << ", " << a << ");\n";
+            break;
+        case OP_NEWTABLE:
+            out << "    sl_checkgc();\n";
+            out << "    " << a << " = sl_newtable();\n";
+            break;
+        case OP_GETTABLE:
+            out << "    " << a << " = sl_gettable(" << b << ", " << c << ");\n";
+            break;
+        case OP_SETTABLE:
+            out << "    sl_settable(" << a << ", " << b << ", " << c << ");\n";
+            break;
+        case OP_CALL:
+            out << "    sl_callr(&" << a << ", " << inst.b - 1 << ", " << (inst.c > 0 ? inst.c - 1 : 0) << ");\n";
+            break;
+        case OP_CLOSURE: {
+            if (inst.b < 0 || inst.b >= (int)proto->protos.size()) throw std::runtime_error("Prototype index out of range");
+            const Prototype* child = proto->protos[inst.b].get();
+            out << "    sl_checkgc();\n";
+            out << "    {\n";
+            out << "        sl_Func *cl = sl_newfunc(sl_f" << protoIndex(child, all) << ", " << child->upvalues.size()
+                << ", NULL);\n";
+            for (size_t u = 0; u < child->upvalues.size(); ++u) {
+                const UpvalueInfo& info = child->upvalues[u];
+                out << "        cl->up[" << u << "] = ";
+                if (info.isLocal) out << "sl_findupval(R, " << info.index << ");\n";
+                else out << "self->up[" << info.index << "];\n";
+            }
+            out << "        " << a << " = sl_obj(SL_FUNC, cl);\n";
+            out << "    }\n";
+            break;
+        }
+        case OP_GETUPVAL:
+            out << "    " << a << " = *self->up[" << inst.b << "]->v;\n";
+            break;
+        case OP_SETUPVAL:
+            out << "    *self->up[" << inst.b << "]->v = " << a << ";\n";
+            break;
+        case OP_VARARG:
+            out << "    sl_varargs(&" << a << ", va, nva, " << inst.c - 1 << ", " << size - inst.a << ");\n";
+            break;
+        case OP_FORPREP:
+            out << "    sl_forprep(&" << a << ");\n";
+            out << "    goto " << label(pc + 1 + inst.b) << ";\n";
+            break;
+        case OP_FORLOOP:
+            // Each iteration gets a fresh loop variable for closures to capture
+            out << "    sl_closeloop(" << inst.a + 3 << ");\n";
+            out << "    if (sl_forloop(&" << a << ")) goto " << label(pc + 1 + inst.b) << ";\n";
+            break;
+        case OP_FORLOOP_UP: case OP_FORLOOP_DOWN:
+            out << "    sl_closeloop(" << inst.a + 3 << ");\n";
+            out << "    if (" << (inst.op == OP_FORLOOP_UP ? "sl_forloopup(&" : "sl_forloopdown(&") << a << ")) goto "
+                << label(pc + 1 + inst.b) << ";\n";
+            break;
+        case OP_TFORCALL:
+            out << "    sl_closeloop(" << inst.a + 3 << ");\n";
+            out << "    sl_tforcall(&" << a << ", " << inst.c << ");\n";
+            break;
+        case OP_TFORIPAIRS: case OP_TFORPAIRS:
+            out << "    sl_closeloop(" << inst.a + 3 << ");\n";
+            out << "    " << (inst.op == OP_TFORIPAIRS ? "sl_tforipairs(&" : "sl_tforpairs(&") << a << ", " << inst.c
+                << ");\n";
+            break;
+        case OP_BUFINIT:
+            out << "    sl_checkgc();\n";
+            out << "    " << a << " = sl_bufinit(" << b << ");\n";
+            break;
+        case OP_BUFAPPEND:
+            out << "    sl_checkgc();\n";
+            out << "    sl_bufappend(" << a << ", &" << b << ", " << inst.c - inst.b + 1 << ");\n";
+            break;
+        case OP_BUFFLUSH:
+            out << "    sl_checkgc();\n";
+            out << "    " << a << " = sl_bufflush(" << b << ");\n";
+            break;
+        case OP_TFORLOOP:
+            out << "    if (" << reg(inst.a + 1) << ".type != SL_NIL) {\n";
+            out << "        " << a << " = " << reg(inst.a + 1) << ";\n";
+            out << "        goto " << label(pc + 1 + inst.b) << ";\n";
+            out << "    }\n";
+            break;
+        case OP_RETURN:
+            out << "    return sl_return(&fr, &" << a << ", " << (inst.b > 0 ? inst.b - 1 : 0) << ");\n";
+            break;
+        default:
+            throw std::runtime_error(std::string("C backend cannot compile ") + opName(inst.op));
+        }
+    }
+    if (isTarget[numInsts]) out << label(numInsts) << ":;\n";
+    out << "    return sl_return(&fr, R, 0);\n";
+    out << "}\n\n";
+}
+
+void CGenerator::generate(Prototype* proto, std::ostream& out, const GeneratorOptions& options) {
+    std::vector<const Prototype*> all;
+    collectProtos(proto, all);
+
+    for (int i = 0; kCRuntime[i]; ++i) out << kCRuntime[i];
+    out << "\n/* ---- Compiled from " << options.chunkName << " ---- */\n\n";
+
+    // String constants live in one array per function, filled by sl_load()
+    for (size_t id = 0; id < all.size(); ++id) {
+        for (const Value& v : all[id]->constants) {
+            if (is_string(v)) {
+                out << "static sl_Value sl_k" << id << "[" << all[id]->constants.size() << "];\n";
+                break;
+            }
+        }
+    }
+    // Jump tables of OP_SWITCH, from key to arm, also built by sl_load()
+    for (size_t id = 0; id < all.size(); ++id) {
+        const std::vector<Instruction>& code = all[id]->instructions;
+        for (size_t pc = 0; pc < code.size(); ++pc) {
+            if (code[pc].op == OP_SWITCH) out << "static sl_Table *sl_sw" << id << "_" << pc << ";\n";
+        }
+    }
+    for (size_t id = 0; id < all.size(); ++id) {
+        out << "static int sl_f" << id << "(sl_Func *self, sl_Value *args, int nargs);\n";
+    }
+    out << "\n";
+
+    for (const Prototype* p : all) generateProto(p, out, all);
+
+    out << "static void sl_load(void) {\n";
+    for (size_t id = 0; id < all.size(); ++id) {
+        const std::vector<Value>& constants = all[id]->constants;
+        for (size_t k = 0; k < constants.size(); ++k) {
+            if (!is_string(constants[k])) continue;
+            const std::string& s = as_string_ref(constants[k]);
+            out << "    sl_k" << id << "[" << k << "] = sl_const(" << quoteC(s) << ", " << s.size() << ");\n";
+        }
+    }
+    for (size_t id = 0; id < all.size(); ++id) {
+        const std::vector<Instruction>& code = all[id]->instructions;
+        for (size_t pc = 0; pc < code.size(); ++pc) {
+            if (code[pc].op != OP_SWITCH) continue;
+            std::string table = "sl_sw" + std::to_string(id) + "_" + std::to_string(pc);
+            out << "    " << table << " = sl_newtable_();\n";
+            out << "    " << table << "->gc.fixed = 1;\n";
+            for (int i = 0; i < code[pc].c; ++i) {
+                out << "    sl_tset(" << table << ", " << constantExpr(all[id], (int)id, code[pc].b + i) << ", sl_int(" << i
+                    << "));\n";
+            }
+        }
+    }
+    out << "}\n\n";
+
+    out << "int simplelua_run(void) {\n";
+    out << "    return sl_run(sl_f0, sl_load, " << quoteC(options.chunkName) << ");\n";
+    out << "}\n\n";
+    out << "#ifdef SIMPLELUA_MAIN\n";
+    out << "int main(void) {\n";
+    out << "    return simplelua_run();\n";
+    out << "}\n";
+    out << "#endif\n";
+}
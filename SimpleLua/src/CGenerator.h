@@ -0,0 +1,31 @@
+#ifndef CGENERATOR_H
+#define CGENERATOR_H
+
+#include "Compiler.h"
+#include "LuaGenerator.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Source of the C runtime bundled into every generated file (CRuntime.cpp),
+// split in pieces that stay below compiler string literal limits; ends with
+// nullptr
+extern const char* const kCRuntime[];
+
+// Translates a Prototype tree into one self-contained C99 file: each
+// prototype becomes a C function whose registers are a local array of
+// tagged values, jumps become gotos and string constants are static data
+// created at startup. OpCodes.h is the contract, as for the Lua VM.
+//
+// The file exports `int simplelua_run(void)`, which runs the main chunk and
+// returns 0, or 1 after printing an uncaught error; compiled with
+// -DSIMPLELUA_MAIN it also defines main(). Build with e.g.
+//   cc -O2 -shared -fPIC out.c -o libout.so -lm
+class CGenerator {
+public:
+    static void generate(Prototype* proto, std::ostream& out, const GeneratorOptions& options = GeneratorOptions());
+private:
+    static void generateProto(const Prototype* proto, std::ostream& out, const std::vector<const Prototype*>& all);
+};
+
+#endif
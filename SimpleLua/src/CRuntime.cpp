@@ -0,0 +1,2826 @@
+// C runtime bundled into the output of -emit-c (see CGenerator.h). It is
+// written in C99 and only uses the standard library and libm.
+
+#include "CGenerator.h"
+
+const char* const kCRuntime[] = {
+R"SLRT(/*
+ * SimpleLua C runtime, bundled into every file generated with -emit-c.
+ *
+ * Compiled functions keep their registers in a local array registered as a
+ * sl_Frame; arguments and results travel on a separate value stack. Errors
+ * unwind with longjmp to the innermost pcall. Objects are reclaimed by a
+ * mark-and-sweep collector that only runs at allocation points in compiled
+ * code, so runtime functions never see an object move or vanish under them.
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Lua calls recurse on the C stack: keep the limit within a default 8 MB stack */
+#ifndef SL_MAXDEPTH
+#define SL_MAXDEPTH 7000
+#endif
+#ifndef SL_STACKSIZE
+#define SL_STACKSIZE 1000000
+#endif
+/* Objects allocated before the first collection */
+#ifndef SL_GCMIN
+#define SL_GCMIN 100000
+#endif
+
+#if defined(__GNUC__)
+#define SL_API static __attribute__((unused))
+#define SL_NORETURN __attribute__((noreturn))
+#else
+#define SL_API static
+#define SL_NORETURN
+#endif
+#define SL_INLINE SL_API inline
+
+enum { SL_NIL, SL_BOOL, SL_INT, SL_FLT, SL_STR, SL_TABLE, SL_FUNC, SL_UPVAL };
+
+typedef struct sl_GC {
+    struct sl_GC *next;
+    unsigned char type, marked, fixed;
+} sl_GC;
+
+typedef struct sl_Value {
+    int type;
+    union {
+        int b;
+        int64_t i;
+        double n;
+        sl_GC *gc;
+    } u;
+} sl_Value;
+
+typedef struct sl_String {
+    sl_GC gc;
+    struct sl_String *chain; /* Next string in the same intern bucket */
+    uint32_t hash;
+    size_t len;
+    char data[1];
+} sl_String;
+
+typedef struct sl_Node {
+    sl_Value key, val; /* A nil val with a non-nil key is a deleted entry */
+} sl_Node;
+
+typedef struct sl_Table {
+    sl_GC gc;
+    sl_Value *arr; /* Keys 1..asize; never ends in nil */
+    size_t asize, acap;
+    sl_Node *node; /* Open addressing, linear probing */
+    size_t hcap, hused;
+    struct sl_Table *meta;
+} sl_Table;
+
+typedef struct sl_Upval {
+    sl_GC gc;
+    sl_Value *v; /* A frame register while open, &closed afterwards */
+    sl_Value closed;
+    int level;   /* (depth << 8) | register of the owning frame */
+    struct sl_Upval *open;
+} sl_Upval;
+
+typedef struct sl_Func sl_Func;
+/* Results are pushed on the value stack; returns their count */
+typedef int (*sl_Fn)(sl_Func *self, sl_Value *args, int nargs);
+
+struct sl_Func {
+    sl_GC gc;
+    sl_Fn fn;
+    const char *name;
+    sl_Value state[4]; /* Builtin iterator state */
+    int nups;
+    sl_Upval *up[];
+};
+
+typedef struct sl_Frame {
+    struct sl_Frame *prev;
+    sl_Value *R;
+    int n;
+    int line; /* -1 for builtins */
+} sl_Frame;
+
+typedef struct sl_Catch {
+    struct sl_Catch *prev;
+    int depth;
+    jmp_buf jb;
+} sl_Catch;
+
+typedef struct sl_Buffer {
+    char *data;
+    size_t len, cap;
+} sl_Buffer;
+
+enum {
+    SL_EV_INDEX, SL_EV_NEWINDEX, SL_EV_CALL, SL_EV_TOSTRING, SL_EV_LEN, SL_EV_EQ, SL_EV_LT, SL_EV_LE,
+    SL_EV_CONCAT, SL_EV_ADD, SL_EV_SUB, SL_EV_MUL, SL_EV_DIV, SL_EV_MOD, SL_EV_IDIV, SL_EV_PAIRS,
+    SL_EV_METATABLE, SL_NUMEVENTS
+};
+
+enum { SL_OPADD, SL_OPSUB, SL_OPMUL, SL_OPDIV, SL_OPMOD, SL_OPIDIV };
+
+static const sl_Value sl_nil = {SL_NIL, {0}};
+
+static sl_Value *sl_stack, *sl_top, *sl_stacklast;
+static sl_Frame *sl_frames;
+static int sl_depth;
+static sl_Catch *sl_catch;
+static sl_Value sl_errval;
+static sl_Upval *sl_openuv; /* Sorted by level, highest first */
+static sl_GC *sl_objects;
+static size_t sl_gccount, sl_gcthreshold;
+static sl_GC **sl_gray;
+static size_t sl_graycount, sl_graycap;
+static sl_String **sl_strtab;
+static size_t sl_strcap, sl_strcount;
+static sl_Table *sl_globals, *sl_strmeta;
+static sl_String *sl_ev[SL_NUMEVENTS];
+static const char *sl_chunkname = "?";
+static uint64_t sl_randstate;
+
+SL_API void sl_error(const char *fmt, ...) SL_NORETURN;
+
+/* ---- Values ---- */
+
+#define sl_str(v) ((sl_String *)(v).u.gc)
+#define sl_tab(v) ((sl_Table *)(v).u.gc)
+#define sl_fun(v) ((sl_Func *)(v).u.gc)
+#define sl_isnum(v) ((v).type == SL_INT || (v).type == SL_FLT)
+#define sl_falsy(v) ((v).type == SL_NIL || ((v).type == SL_BOOL && !(v).u.b))
+
+SL_INLINE sl_Value sl_bool(int b) { sl_Value v; v.type = SL_BOOL; v.u.b = b != 0; return v; }
+SL_INLINE sl_Value sl_int(int64_t i) { sl_Value v; v.type = SL_INT; v.u.i = i; return v; }
+SL_INLINE sl_Value sl_flt(double n) { sl_Value v; v.type = SL_FLT; v.u.n = n; return v; }
+SL_INLINE sl_Value sl_obj(int type, void *p) { sl_Value v; v.type = type; v.u.gc = (sl_GC *)p; return v; }
+SL_INLINE double sl_tofloat(sl_Value v) { return v.type == SL_INT ? (double)v.u.i : v.u.n; }
+
+SL_API const char *sl_typename(sl_Value v) {
+    switch (v.type) {
+    case SL_NIL: return "nil";
+    case SL_BOOL: return "boolean";
+    case SL_INT: case SL_FLT: return "number";
+    case SL_STR: return "string";
+    case SL_TABLE: return "table";
+    default: return "function";
+    }
+}
+
+SL_API int sl_rawequal(sl_Value x, sl_Value y) {
+    if (x.type == y.type) {
+        switch (x.type) {
+        case SL_NIL: return 1;
+        case SL_BOOL: return x.u.b == y.u.b;
+        case SL_INT: return x.u.i == y.u.i;
+        case SL_FLT: return x.u.n == y.u.n;
+        default: return x.u.gc == y.u.gc;
+        }
+    }
+    if (x.type == SL_INT && y.type == SL_FLT) return (double)x.u.i == y.u.n;
+    if (x.type == SL_FLT && y.type == SL_INT) return x.u.n == (double)y.u.i;
+    return 0;
+}
+
+/* ---- Memory ---- */
+
+SL_API void *sl_alloc(size_t size) {
+    void *p = malloc(size);
+    if (!p) {
+        fputs("Error: not enough memory\n", stderr);
+        exit(1);
+    }
+    return p;
+}
+
+SL_API void *sl_realloc(void *p, size_t size) {
+    p = realloc(p, size);
+    if (!p) {
+        fputs("Error: not enough memory\n", stderr);
+        exit(1);
+    }
+    return p;
+}
+
+SL_API void sl_track(sl_GC *o, int type) {
+    o->type = (unsigned char)type;
+    o->marked = 0;
+    o->fixed = 0;
+    o->next = sl_objects;
+    sl_objects = o;
+    sl_gccount++;
+}
+
+SL_API void sl_bufadd(sl_Buffer *b, const char *s, size_t n) {
+    if (n == 0) return;
+    if (b->len + n > b->cap) {
+        size_t cap = b->cap ? b->cap : 64;
+        while (cap < b->len + n) cap *= 2;
+        b->data = (char *)sl_realloc(b->data, cap);
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+}
+
+SL_API void sl_bufaddc(sl_Buffer *b, char c) { sl_bufadd(b, &c, 1); }
+SL_API void sl_bufadds(sl_Buffer *b, const char *s) { sl_bufadd(b, s, strlen(s)); }
+
+/* ---- Strings ---- */
+
+SL_API uint32_t sl_hashbytes(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    size_t i;
+    for (i = 0; i < len; i++) h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
+}
+
+SL_API void sl_strresize(size_t cap) {
+    sl_String **tab = (sl_String **)sl_alloc(cap * sizeof(sl_String *));
+    size_t i;
+    memset(tab, 0, cap * sizeof(sl_String *));
+    for (i = 0; i < sl_strcap; i++) {
+        sl_String *s = sl_strtab[i];
+        while (s) {
+            sl_String *next = s->chain;
+            size_t b = s->hash & (cap - 1);
+            s->chain = tab[b];
+            tab[b] = s;
+            s = next;
+        }
+    }
+    free(sl_strtab);
+    sl_strtab = tab;
+    sl_strcap = cap;
+}
+
+/* Strings are interned: equal contents share one object */
+SL_API sl_String *sl_newstr(const char *data, size_t len) {
+    uint32_t h = sl_hashbytes(data, len);
+    sl_String *s;
+    for (s = sl_strtab[h & (sl_strcap - 1)]; s; s = s->chain) {
+        if (s->hash == h && s->len == len && memcmp(s->data, data, len) == 0) return s;
+    }
+    if (sl_strcount >= sl_strcap) sl_strresize(sl_strcap * 2);
+    s = (sl_String *)sl_alloc(sizeof(sl_String) + len);
+    memcpy(s->data, data, len);
+    s->data[len] = '\0';
+    s->len = len;
+    s->hash = h;
+    s->chain = sl_strtab[h & (sl_strcap - 1)];
+    sl_strtab[h & (sl_strcap - 1)] = s;
+    sl_strcount++;
+    sl_track(&s->gc, SL_STR);
+    return s;
+}
+
+SL_API sl_Value sl_string(const char *data, size_t len) { return sl_obj(SL_STR, sl_newstr(data, len)); }
+SL_API sl_Value sl_cstring(const char *s) { return sl_string(s, strlen(s)); }
+
+/* A string that is never collected (constants, metamethod names) */
+SL_API sl_Value sl_const(const char *data, size_t len) {
+    sl_String *s = sl_newstr(data, len);
+    s->gc.fixed = 1;
+    return sl_obj(SL_STR, s);
+}
+
+/* ---- Numbers ---- */
+
+SL_API void sl_fmtnum(sl_Value v, char *buf) {
+    if (v.type == SL_INT) {
+        sprintf(buf, "%lld", (long long)v.u.i);
+        return;
+    }
+    sprintf(buf, "%.14g", v.u.n);
+    /* Floats that look like integers keep a ".0" suffix */
+    if (strspn(buf, "-0123456789") == strlen(buf)) strcat(buf, ".0");
+}
+
+SL_API int sl_str2num(const char *s, size_t len, sl_Value *out) {
+    char text[128];
+    const char *digits;
+    char *stop;
+    double d;
+    while (len > 0 && isspace((unsigned char)*s)) s++, len--;
+    while (len > 0 && isspace((unsigned char)s[len - 1])) len--;
+    if (len == 0 || len >= sizeof(text) || memchr(s, '\0', len)) return 0;
+    memcpy(text, s, len);
+    text[len] = '\0';
+    digits = text + (text[0] == '-' || text[0] == '+');
+    if (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) {
+        /* Hexadecimal integers wrap around like in Lua */
+        uint64_t value = 0;
+        const char *q = digits + 2;
+        if (!isxdigit((unsigned char)*q)) return 0;
+        for (; isxdigit((unsigned char)*q); ++q) {
+            int c = tolower((unsigned char)*q);
+            value = value * 16 + (uint64_t)(isdigit(c) ? c - '0' : c - 'a' + 10);
+        }
+        if (*q != '\0') return 0;
+        *out = sl_int(text[0] == '-' ? (int64_t)(0 - value) : (int64_t)value);
+        return 1;
+    }
+    if (strpbrk(text, "nN")) return 0; /* No "inf"/"nan" spellings */
+    if (digits[0] != '\0' && strspn(digits, "0123456789") == strlen(digits)) {
+        long long value;
+        errno = 0;
+        value = strtoll(text, NULL, 10);
+        if (errno != ERANGE) {
+            *out = sl_int(value);
+            return 1;
+        }
+    }
+    d = strtod(text, &stop);
+    if (stop == text || *stop != '\0') return 0;
+    *out = sl_flt(d);
+    return 1;
+}
+
+SL_API int sl_tonumber(sl_Value v, sl_Value *out) {
+    if (sl_isnum(v)) {
+        *out = v;
+        return 1;
+    }
+    if (v.type == SL_STR) return sl_str2num(sl_str(v)->data, sl_str(v)->len, out);
+    return 0;
+}
+
+/* Float to integer if the value is integral and in range */
+SL_API int sl_flt2int(double d, int64_t *out) {
+    if (floor(d) != d || d < -9223372036854775808.0 || d >= 9223372036854775808.0) return 0;
+    *out = (int64_t)d;
+    return 1;
+}
+
+/* ---- Tables ---- */
+
+SL_API sl_Table *sl_newtable_(void) {
+    sl_Table *t = (sl_Table *)sl_alloc(sizeof(sl_Table));
+    t->arr = NULL;
+    t->asize = t->acap = 0;
+    t->node = NULL;
+    t->hcap = t->hused = 0;
+    t->meta = NULL;
+    sl_track(&t->gc, SL_TABLE);
+    return t;
+}
+
+SL_API sl_Value sl_newtable(void) { return sl_obj(SL_TABLE, sl_newtable_()); }
+
+SL_API uint32_t sl_hashval(sl_Value k) {
+    uint64_t h;
+    switch (k.type) {
+    case SL_BOOL: return (uint32_t)k.u.b;
+    case SL_INT: h = (uint64_t)k.u.i; break;
+    case SL_FLT: memcpy(&h, &k.u.n, sizeof(h)); break;
+    case SL_STR: return sl_str(k)->hash;
+    default: h = (uint64_t)(uintptr_t)k.u.gc; break;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
+
+SL_INLINE int sl_keyequal(sl_Value x, sl_Value y) {
+    if (x.type != y.type) return 0;
+    switch (x.type) {
+    case SL_BOOL: return x.u.b == y.u.b;
+    case SL_INT: return x.u.i == y.u.i;
+    case SL_FLT: return x.u.n == y.u.n;
+    default: return x.u.gc == y.u.gc;
+    }
+}
+
+/* Integral floats index the same slot as the equal integer */
+SL_API int sl_normkey(sl_Value key, sl_Value *out) {
+    if (key.type == SL_FLT) {
+        int64_t i;
+        if (key.u.n != key.u.n) return 0;
+        if (sl_flt2int(key.u.n, &i)) {
+            *out = sl_int(i);
+            return 1;
+        }
+    }
+    *out = key;
+    return key.type != SL_NIL;
+}
+)SLRT",
+R"SLRT(
+SL_API sl_Node *sl_hfind(const sl_Table *t, sl_Value key) {
+    size_t mask, i;
+    if (t->hcap == 0) return NULL;
+    mask = t->hcap - 1;
+    for (i = sl_hashval(key) & mask; t->node[i].key.type != SL_NIL; i = (i + 1) & mask) {
+        if (sl_keyequal(t->node[i].key, key)) return &t->node[i];
+    }
+    return NULL;
+}
+
+SL_API void sl_hinsert(sl_Table *t, sl_Value key, sl_Value val) {
+    size_t mask = t->hcap - 1, i;
+    for (i = sl_hashval(key) & mask; t->node[i].key.type != SL_NIL; i = (i + 1) & mask) {}
+    t->node[i].key = key;
+    t->node[i].val = val;
+    t->hused++;
+}
+
+/* Rebuilds the hash part without deleted entries, with room for one more key */
+SL_API void sl_hrehash(sl_Table *t) {
+    sl_Node *old = t->node;
+    size_t oldcap = t->hcap, live = 1, cap = 4, i;
+    for (i = 0; i < oldcap; i++) live += old[i].val.type != SL_NIL;
+    while (cap * 3 < live * 4 + 4) cap *= 2;
+    t->node = (sl_Node *)sl_alloc(cap * sizeof(sl_Node));
+    for (i = 0; i < cap; i++) t->node[i].key = t->node[i].val = sl_nil;
+    t->hcap = cap;
+    t->hused = 0;
+    for (i = 0; i < oldcap; i++) {
+        if (old[i].val.type != SL_NIL) sl_hinsert(t, old[i].key, old[i].val);
+    }
+    free(old);
+}
+
+SL_API void sl_hset(sl_Table *t, sl_Value key, sl_Value val) {
+    sl_Node *n = sl_hfind(t, key);
+    if (n) {
+        n->val = val;
+        return;
+    }
+    if (val.type == SL_NIL) return;
+    if ((t->hused + 1) * 4 > t->hcap * 3) sl_hrehash(t);
+    sl_hinsert(t, key, val);
+}
+
+SL_INLINE sl_Value sl_tgetint(const sl_Table *t, int64_t key) {
+    sl_Node *n;
+    if ((uint64_t)key - 1 < t->asize) return t->arr[key - 1];
+    n = sl_hfind(t, sl_int(key));
+    return n ? n->val : sl_nil;
+}
+
+SL_INLINE sl_Value sl_tgetstr(const sl_Table *t, sl_String *key) {
+    sl_Node *n = sl_hfind(t, sl_obj(SL_STR, key));
+    return n ? n->val : sl_nil;
+}
+
+SL_API sl_Value sl_tget(const sl_Table *t, sl_Value key) {
+    sl_Value k;
+    sl_Node *n;
+    if (key.type == SL_INT) return sl_tgetint(t, key.u.i);
+    if (key.type == SL_STR) return sl_tgetstr(t, sl_str(key));
+    if (!sl_normkey(key, &k)) return sl_nil;
+    if (k.type == SL_INT) return sl_tgetint(t, k.u.i);
+    n = sl_hfind(t, k);
+    return n ? n->val : sl_nil;
+}
+
+SL_API void sl_tsetint(sl_Table *t, int64_t key, sl_Value val) {
+    if ((uint64_t)key - 1 < t->asize) {
+        t->arr[key - 1] = val;
+        if (val.type == SL_NIL && (size_t)key == t->asize) {
+            while (t->asize > 0 && t->arr[t->asize - 1].type == SL_NIL) t->asize--;
+        }
+        return;
+    }
+    if (key >= 1 && (uint64_t)key == t->asize + 1) {
+        if (val.type == SL_NIL) return; /* Key n+1 is never stored in the hash */
+        if (t->asize == t->acap) {
+            t->acap = t->acap ? t->acap * 2 : 4;
+            t->arr = (sl_Value *)sl_realloc(t->arr, t->acap * sizeof(sl_Value));
+        }
+        t->arr[t->asize++] = val;
+        /* Keys n+1, n+2, ... that were stored in the hash move to the array part */
+        while (t->hcap) {
+            sl_Node *n = sl_hfind(t, sl_int((int64_t)t->asize + 1));
+            if (!n || n->val.type == SL_NIL) break;
+            if (t->asize == t->acap) {
+                t->acap *= 2;
+                t->arr = (sl_Value *)sl_realloc(t->arr, t->acap * sizeof(sl_Value));
+            }
+            t->arr[t->asize++] = n->val;
+            n->val = sl_nil;
+        }
+        return;
+    }
+    sl_hset(t, sl_int(key), val);
+}
+
+SL_API void sl_tset(sl_Table *t, sl_Value key, sl_Value val) {
+    sl_Value k;
+    if (key.type == SL_INT) {
+        sl_tsetint(t, key.u.i, val);
+        return;
+    }
+    if (!sl_normkey(key, &k)) {
+        if (key.type == SL_NIL) sl_error("table index is nil");
+        sl_error("table index is NaN");
+    }
+    if (k.type == SL_INT) sl_tsetint(t, k.u.i, val);
+    else sl_hset(t, k, val);
+}
+
+/* The array part never ends in nil and key n+1 never lives in the hash, so
+   its size is a border */
+SL_INLINE int64_t sl_tlen(const sl_Table *t) { return (int64_t)t->asize; }
+
+SL_API int sl_tnext(const sl_Table *t, sl_Value key, sl_Value *k, sl_Value *v) {
+    size_t i = 0, j;
+    if (key.type != SL_NIL) {
+        sl_Value nk;
+        sl_Node *n = NULL;
+        sl_normkey(key, &nk);
+        if (nk.type == SL_INT && (uint64_t)nk.u.i - 1 < t->asize) {
+            i = (size_t)nk.u.i;
+        } else if ((n = sl_hfind(t, nk)) != NULL) {
+            i = t->asize + (size_t)(n - t->node) + 1;
+        } else if (nk.type == SL_INT && nk.u.i >= 1) {
+            i = t->asize; /* An array key; the array shrank since it was returned */
+        } else {
+            sl_error("invalid key to 'next'");
+        }
+    }
+    for (; i < t->asize; i++) {
+        if (t->arr[i].type != SL_NIL) {
+            *k = sl_int((int64_t)i + 1);
+            *v = t->arr[i];
+            return 1;
+        }
+    }
+    for (j = i - t->asize; j < t->hcap; j++) {
+        if (t->node[j].val.type != SL_NIL) {
+            *k = t->node[j].key;
+            *v = t->node[j].val;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* ---- Functions and upvalues ---- */
+
+SL_API sl_Func *sl_newfunc(sl_Fn fn, int nups, const char *name) {
+    sl_Func *f = (sl_Func *)sl_alloc(sizeof(sl_Func) + (size_t)nups * sizeof(sl_Upval *));
+    int i;
+    f->fn = fn;
+    f->name = name;
+    for (i = 0; i < 4; i++) f->state[i] = sl_nil;
+    f->nups = nups;
+    for (i = 0; i < nups; i++) f->up[i] = NULL;
+    sl_track(&f->gc, SL_FUNC);
+    return f;
+}
+
+SL_API sl_Upval *sl_findupval(sl_Value *R, int reg) {
+    int level = (sl_depth << 8) | reg;
+    sl_Upval **pp = &sl_openuv, *uv;
+    while (*pp && (*pp)->level > level) pp = &(*pp)->open;
+    if (*pp && (*pp)->level == level) return *pp;
+    uv = (sl_Upval *)sl_alloc(sizeof(sl_Upval));
+    uv->v = &R[reg];
+    uv->closed = sl_nil;
+    uv->level = level;
+    uv->open = *pp;
+    *pp = uv;
+    sl_track(&uv->gc, SL_UPVAL);
+    return uv;
+}
+
+SL_API void sl_closeupvals(int level) {
+    while (sl_openuv && sl_openuv->level >= level) {
+        sl_Upval *uv = sl_openuv;
+        uv->closed = *uv->v;
+        uv->v = &uv->closed;
+        sl_openuv = uv->open;
+        uv->open = NULL;
+    }
+}
+
+/* Each loop iteration gets fresh variables from register reg upwards */
+SL_INLINE void sl_closeloop(int reg) {
+    int level = (sl_depth << 8) | reg;
+    if (sl_openuv && sl_openuv->level >= level) sl_closeupvals(level);
+}
+
+/* ---- Errors ---- */
+
+SL_API void sl_throw(sl_Value v) SL_NORETURN;
+SL_API void sl_throw(sl_Value v) {
+    sl_errval = v;
+    /* Upvalues of the frames being unwound must be closed while they still exist */
+    sl_closeupvals((sl_catch->depth + 1) << 8);
+    longjmp(sl_catch->jb, 1);
+}
+
+/* Prefixes a string message with the position of the function `level`
+   levels up: 1 is the function that raised the error (for a builtin, its
+   caller), 2 the function that called that one, and so on. Builtins have no
+   position. */
+SL_API sl_Value sl_where(sl_Value msg, int level) {
+    sl_Frame *f = sl_frames;
+    sl_Buffer b = {NULL, 0, 0};
+    char pos[64];
+    sl_Value s;
+    if (level <= 0 || msg.type != SL_STR) return msg;
+    if (f && f->line < 0) level++;
+    while (f && level > 1) {
+        f = f->prev;
+        level--;
+    }
+    if (!f || f->line < 0) return msg;
+    sl_bufadds(&b, sl_chunkname);
+    sprintf(pos, ":%d: ", f->line);
+    sl_bufadds(&b, pos);
+    sl_bufadd(&b, sl_str(msg)->data, sl_str(msg)->len);
+    s = sl_string(b.data, b.len);
+    free(b.data);
+    return s;
+}
+
+SL_API void sl_error(const char *fmt, ...) {
+    char msg[512];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    sl_throw(sl_where(sl_cstring(msg), 1));
+}
+
+/* ---- Value stack and calls ---- */
+
+SL_INLINE void sl_checkstack(int n) {
+    if (sl_top + n > sl_stacklast) sl_error("stack overflow");
+}
+
+SL_INLINE void sl_push(sl_Value v) {
+    if (sl_top >= sl_stacklast) sl_error("stack overflow");
+    *sl_top++ = v;
+}
+
+SL_INLINE void sl_enter(sl_Frame *fr, sl_Value *R, int n, int line) {
+    if (sl_depth >= SL_MAXDEPTH) sl_error("stack overflow");
+    fr->prev = sl_frames;
+    fr->R = R;
+    fr->n = n;
+    fr->line = line;
+    sl_frames = fr;
+    sl_depth++;
+}
+
+/* Leaves the frame and pushes its n results */
+SL_INLINE int sl_return(sl_Frame *fr, const sl_Value *r, int n) {
+    int i;
+    sl_closeupvals(sl_depth << 8);
+    sl_frames = fr->prev;
+    sl_depth--;
+    sl_checkstack(n);
+    for (i = 0; i < n; i++) sl_top[i] = r[i];
+    sl_top += n;
+    return n;
+}
+
+SL_INLINE sl_Value sl_metamethod(sl_Value v, int event) {
+    sl_Table *mt = v.type == SL_TABLE ? sl_tab(v)->meta : v.type == SL_STR ? sl_strmeta : NULL;
+    return mt ? sl_tgetstr(mt, sl_ev[event]) : sl_nil;
+}
+
+/* Calls func[0] with the nargs values above it, which must end at sl_top.
+   The results replace them starting at func; returns their count. */
+SL_API int sl_call(sl_Value *func, int nargs) {
+    sl_Value *res;
+    sl_Func *f;
+    int n;
+    if (func->type != SL_FUNC) {
+        sl_Value h = sl_metamethod(*func, SL_EV_CALL);
+        if (h.type == SL_NIL) {
+            char msg[64];
+            sprintf(msg, "attempt to call a %s value", sl_typename(*func));
+            /* A call made by a builtin has no position */
+            if (sl_frames && sl_frames->line < 0) sl_throw(sl_cstring(msg));
+            sl_error("%s", msg);
+        }
+        /* The called object becomes the first argument */
+        sl_checkstack(1);
+        memmove(func + 1, func, (size_t)(nargs + 1) * sizeof(sl_Value));
+        func[0] = h;
+        sl_top++;
+        return sl_call(func, nargs + 1);
+    }
+    f = sl_fun(*func);
+    if (f->name) {
+        /* Builtins get a frame without registers so that error levels count them */
+        sl_Frame fr;
+        sl_enter(&fr, NULL, 0, -1);
+        n = f->fn(f, func + 1, nargs);
+        sl_frames = fr.prev;
+        sl_depth--;
+    } else {
+        n = f->fn(f, func + 1, nargs);
+    }
+    res = sl_top - n;
+    if (res != func) memmove(func, res, (size_t)n * sizeof(sl_Value));
+    sl_top = func + n;
+    return n;
+}
+
+/* OP_CALL: calls r[0] with r[1..nargs] and stores nres results back in r */
+SL_API void sl_callr(sl_Value *r, int nargs, int nres) {
+    sl_Value *f = sl_top;
+    int n, i;
+    sl_checkstack(nargs + 1);
+    for (i = 0; i <= nargs; i++) f[i] = r[i];
+    sl_top = f + nargs + 1;
+    n = sl_call(f, nargs);
+    for (i = 0; i < nres; i++) r[i] = i < n ? f[i] : sl_nil;
+    sl_top = f;
+}
+
+/* Calls fn with up to three arguments and returns its first result */
+SL_API sl_Value sl_call1(sl_Value fn, int nargs, sl_Value a, sl_Value b, sl_Value c) {
+    sl_Value *f = sl_top, r;
+    int n;
+    sl_checkstack(4);
+    f[0] = fn;
+    f[1] = a;
+    f[2] = b;
+    f[3] = c;
+    sl_top = f + 1 + nargs;
+    n = sl_call(f, nargs);
+    r = n > 0 ? f[0] : sl_nil;
+    sl_top = f;
+    return r;
+}
+
+/* ---- Operators ---- */
+
+SL_API sl_String *sl_tostr(sl_Value v);
+
+SL_API sl_Value sl_index(sl_Value o, sl_Value key) {
+    int loop;
+    for (loop = 0; loop < 100; loop++) {
+        sl_Value h;
+        if (o.type == SL_TABLE) {
+            sl_Table *t = sl_tab(o);
+            sl_Value v = sl_tget(t, key);
+            if (v.type != SL_NIL || !t->meta) return v;
+            h = sl_tgetstr(t->meta, sl_ev[SL_EV_INDEX]);
+            if (h.type == SL_NIL) return v;
+        } else {
+            h = sl_metamethod(o, SL_EV_INDEX);
+            if (h.type == SL_NIL) sl_error("attempt to index a %s value", sl_typename(o));
+        }
+        if (h.type == SL_FUNC) return sl_call1(h, 2, o, key, sl_nil);
+        o = h;
+    }
+    sl_error("'__index' chain too long; possible loop");
+}
+
+SL_API void sl_setindex(sl_Value o, sl_Value key, sl_Value val) {
+    int loop;
+    for (loop = 0; loop < 100; loop++) {
+        sl_Value h = sl_nil;
+        if (o.type == SL_TABLE) {
+            sl_Table *t = sl_tab(o);
+            if (!t->meta || sl_tget(t, key).type != SL_NIL ||
+                (h = sl_tgetstr(t->meta, sl_ev[SL_EV_NEWINDEX])).type == SL_NIL) {
+                sl_tset(t, key, val);
+                return;
+            }
+        } else {
+            h = sl_metamethod(o, SL_EV_NEWINDEX);
+            if (h.type == SL_NIL) sl_error("attempt to index a %s value", sl_typename(o));
+        }
+        if (h.type == SL_FUNC) {
+            sl_call1(h, 3, o, key, val);
+            return;
+        }
+        o = h;
+    }
+    sl_error("'__newindex' chain too long; possible loop");
+}
+)SLRT",
+R"SLRT(
+SL_INLINE sl_Value sl_gettable(sl_Value t, sl_Value key) {
+    if (t.type == SL_TABLE) {
+        sl_Table *h = sl_tab(t);
+        sl_Value v = key.type == SL_INT ? sl_tgetint(h, key.u.i)
+                   : key.type == SL_STR ? sl_tgetstr(h, sl_str(key))
+                   : sl_tget(h, key);
+        if (v.type != SL_NIL || !h->meta) return v;
+    }
+    return sl_index(t, key);
+}
+
+SL_INLINE void sl_settable(sl_Value t, sl_Value key, sl_Value val) {
+    if (t.type == SL_TABLE && !sl_tab(t)->meta) sl_tset(sl_tab(t), key, val);
+    else sl_setindex(t, key, val);
+}
+
+SL_INLINE sl_Value sl_getglobal(sl_Value name) {
+    if (!sl_globals->meta) return sl_tgetstr(sl_globals, sl_str(name));
+    return sl_index(sl_obj(SL_TABLE, sl_globals), name);
+}
+
+SL_INLINE void sl_setglobal(sl_Value name, sl_Value val) {
+    sl_setindex(sl_obj(SL_TABLE, sl_globals), name, val);
+}
+
+SL_API sl_Value sl_arith(int op, sl_Value x, sl_Value y) {
+    static const int events[] = {SL_EV_ADD, SL_EV_SUB, SL_EV_MUL, SL_EV_DIV, SL_EV_MOD, SL_EV_IDIV};
+    sl_Value a, b;
+    double p, q, m;
+    if (!sl_tonumber(x, &a) || !sl_tonumber(y, &b)) {
+        sl_Value h = sl_metamethod(x, events[op]);
+        if (h.type == SL_NIL) h = sl_metamethod(y, events[op]);
+        if (h.type != SL_NIL) return sl_call1(h, 2, x, y, sl_nil);
+        sl_error("attempt to perform arithmetic on a %s value", sl_typename(sl_tonumber(x, &a) ? y : x));
+    }
+    /* As in Lua 5.3, strings coerced for arithmetic always take the float path */
+    if (a.type == SL_INT && b.type == SL_INT && op != SL_OPDIV && x.type != SL_STR && y.type != SL_STR) {
+        uint64_t u = (uint64_t)a.u.i, v = (uint64_t)b.u.i;
+        switch (op) {
+        case SL_OPADD: return sl_int((int64_t)(u + v));
+        case SL_OPSUB: return sl_int((int64_t)(u - v));
+        case SL_OPMUL: return sl_int((int64_t)(u * v));
+        case SL_OPIDIV: {
+            int64_t d;
+            if (b.u.i == 0) sl_error("attempt to perform 'n//0'");
+            if (b.u.i == -1) return sl_int((int64_t)(0 - u));
+            d = a.u.i / b.u.i;
+            if (a.u.i % b.u.i != 0 && (a.u.i ^ b.u.i) < 0) d--;
+            return sl_int(d);
+        }
+        default: {
+            int64_t r;
+            if (b.u.i == 0) sl_error("attempt to perform 'n%%0'");
+            if (b.u.i == -1) return sl_int(0);
+            r = a.u.i % b.u.i;
+            if (r != 0 && (r ^ b.u.i) < 0) r += b.u.i;
+            return sl_int(r);
+        }
+        }
+    }
+    p = sl_tofloat(a);
+    q = sl_tofloat(b);
+    switch (op) {
+    case SL_OPADD: return sl_flt(p + q);
+    case SL_OPSUB: return sl_flt(p - q);
+    case SL_OPMUL: return sl_flt(p * q);
+    case SL_OPDIV: return sl_flt(p / q);
+    case SL_OPIDIV: return sl_flt(floor(p / q));
+    default:
+        m = fmod(p, q);
+        if (m != 0 && (m > 0) != (q > 0)) m += q;
+        return sl_flt(m);
+    }
+}
+
+SL_INLINE sl_Value sl_add(sl_Value x, sl_Value y) {
+    if (x.type == SL_INT && y.type == SL_INT) return sl_int((int64_t)((uint64_t)x.u.i + (uint64_t)y.u.i));
+    if (sl_isnum(x) && sl_isnum(y)) return sl_flt(sl_tofloat(x) + sl_tofloat(y));
+    return sl_arith(SL_OPADD, x, y);
+}
+
+SL_INLINE sl_Value sl_sub(sl_Value x, sl_Value y) {
+    if (x.type == SL_INT && y.type == SL_INT) return sl_int((int64_t)((uint64_t)x.u.i - (uint64_t)y.u.i));
+    if (sl_isnum(x) && sl_isnum(y)) return sl_flt(sl_tofloat(x) - sl_tofloat(y));
+    return sl_arith(SL_OPSUB, x, y);
+}
+
+SL_INLINE sl_Value sl_mul(sl_Value x, sl_Value y) {
+    if (x.type == SL_INT && y.type == SL_INT) return sl_int((int64_t)((uint64_t)x.u.i * (uint64_t)y.u.i));
+    if (sl_isnum(x) && sl_isnum(y)) return sl_flt(sl_tofloat(x) * sl_tofloat(y));
+    return sl_arith(SL_OPMUL, x, y);
+}
+
+SL_INLINE sl_Value sl_div(sl_Value x, sl_Value y) {
+    if (sl_isnum(x) && sl_isnum(y)) return sl_flt(sl_tofloat(x) / sl_tofloat(y));
+    return sl_arith(SL_OPDIV, x, y);
+}
+
+SL_INLINE sl_Value sl_idiv(sl_Value x, sl_Value y) {
+    if (x.type == SL_INT && y.type == SL_INT && y.u.i > 0) {
+        int64_t q = x.u.i / y.u.i;
+        if (x.u.i % y.u.i != 0 && x.u.i < 0) q--;
+        return sl_int(q);
+    }
+    return sl_arith(SL_OPIDIV, x, y);
+}
+
+SL_INLINE sl_Value sl_mod(sl_Value x, sl_Value y) {
+    if (x.type == SL_INT && y.type == SL_INT && y.u.i > 0) {
+        int64_t r = x.u.i % y.u.i;
+        return sl_int(r < 0 ? r + y.u.i : r);
+    }
+    return sl_arith(SL_OPMOD, x, y);
+}
+
+/* OP_IDIV_INT and OP_MOD_INT: operands the compiler proved to be integers */
+SL_INLINE sl_Value sl_idivint(int64_t x, int64_t y) {
+    int64_t q;
+    if (y == 0) sl_error("attempt to perform 'n//0'");
+    if (y == -1) return sl_int((int64_t)(0 - (uint64_t)x));
+    q = x / y;
+    if (x % y != 0 && (x ^ y) < 0) q--;
+    return sl_int(q);
+}
+
+SL_INLINE sl_Value sl_modint(int64_t x, int64_t y) {
+    int64_t r;
+    if (y == 0) sl_error("attempt to perform 'n%%0'");
+    if (y == -1) return sl_int(0);
+    r = x % y;
+    if (r != 0 && (r ^ y) < 0) r += y;
+    return sl_int(r);
+}
+
+SL_API int sl_eq(sl_Value x, sl_Value y) {
+    sl_Value h;
+    if (sl_rawequal(x, y)) return 1;
+    if (x.type != SL_TABLE || y.type != SL_TABLE) return 0;
+    h = sl_metamethod(x, SL_EV_EQ);
+    if (h.type == SL_NIL) h = sl_metamethod(y, SL_EV_EQ);
+    if (h.type == SL_NIL) return 0;
+    h = sl_call1(h, 2, x, y, sl_nil);
+    return !sl_falsy(h);
+}
+
+SL_API int sl_strcmp(const sl_String *a, const sl_String *b) {
+    size_t n = a->len < b->len ? a->len : b->len;
+    int c = memcmp(a->data, b->data, n);
+    if (c != 0) return c;
+    return a->len < b->len ? -1 : a->len > b->len;
+}
+
+SL_API void sl_compareerror(sl_Value x, sl_Value y) SL_NORETURN;
+SL_API void sl_compareerror(sl_Value x, sl_Value y) {
+    const char *t1 = sl_typename(x), *t2 = sl_typename(y);
+    if (strcmp(t1, t2) == 0) sl_error("attempt to compare two %s values", t1);
+    sl_error("attempt to compare %s with %s", t1, t2);
+}
+
+SL_API int sl_lessthan(sl_Value x, sl_Value y) {
+    sl_Value h;
+    if (sl_isnum(x) && sl_isnum(y)) {
+        if (x.type == SL_INT && y.type == SL_INT) return x.u.i < y.u.i;
+        return sl_tofloat(x) < sl_tofloat(y);
+    }
+    if (x.type == SL_STR && y.type == SL_STR) return sl_strcmp(sl_str(x), sl_str(y)) < 0;
+    h = sl_metamethod(x, SL_EV_LT);
+    if (h.type == SL_NIL) h = sl_metamethod(y, SL_EV_LT);
+    if (h.type == SL_NIL) sl_compareerror(x, y);
+    h = sl_call1(h, 2, x, y, sl_nil);
+    return !sl_falsy(h);
+}
+
+SL_API int sl_lessequal(sl_Value x, sl_Value y) {
+    sl_Value h;
+    if (sl_isnum(x) && sl_isnum(y)) {
+        if (x.type == SL_INT && y.type == SL_INT) return x.u.i <= y.u.i;
+        return sl_tofloat(x) <= sl_tofloat(y);
+    }
+    if (x.type == SL_STR && y.type == SL_STR) return sl_strcmp(sl_str(x), sl_str(y)) <= 0;
+    h = sl_metamethod(x, SL_EV_LE);
+    if (h.type == SL_NIL) h = sl_metamethod(y, SL_EV_LE);
+    if (h.type != SL_NIL) {
+        h = sl_call1(h, 2, x, y, sl_nil);
+        return !sl_falsy(h);
+    }
+    /* Like Lua 5.3, fall back to not (y < x) */
+    h = sl_metamethod(x, SL_EV_LT);
+    if (h.type == SL_NIL) h = sl_metamethod(y, SL_EV_LT);
+    if (h.type == SL_NIL) sl_compareerror(x, y);
+    h = sl_call1(h, 2, y, x, sl_nil);
+    return sl_falsy(h);
+}
+
+SL_INLINE int sl_lt(sl_Value x, sl_Value y) {
+    if (x.type == SL_INT && y.type == SL_INT) return x.u.i < y.u.i;
+    return sl_lessthan(x, y);
+}
+
+SL_INLINE int sl_le(sl_Value x, sl_Value y) {
+    if (x.type == SL_INT && y.type == SL_INT) return x.u.i <= y.u.i;
+    return sl_lessequal(x, y);
+}
+
+SL_API sl_Value sl_concat(sl_Value x, sl_Value y) {
+    int xs = x.type == SL_STR || sl_isnum(x), ys = y.type == SL_STR || sl_isnum(y);
+    char nx[64], ny[64];
+    const char *px, *py;
+    size_t lx, ly;
+    sl_Buffer b = {NULL, 0, 0};
+    sl_Value r;
+    if (!xs || !ys) {
+        sl_Value h = sl_metamethod(x, SL_EV_CONCAT);
+        if (h.type == SL_NIL) h = sl_metamethod(y, SL_EV_CONCAT);
+        if (h.type != SL_NIL) return sl_call1(h, 2, x, y, sl_nil);
+        sl_error("attempt to concatenate a %s value", sl_typename(xs ? y : x));
+    }
+    if (x.type == SL_STR) {
+        px = sl_str(x)->data;
+        lx = sl_str(x)->len;
+    } else {
+        sl_fmtnum(x, nx);
+        px = nx;
+        lx = strlen(nx);
+    }
+    if (y.type == SL_STR) {
+        py = sl_str(y)->data;
+        ly = sl_str(y)->len;
+    } else {
+        sl_fmtnum(y, ny);
+        py = ny;
+        ly = strlen(ny);
+    }
+    sl_bufadd(&b, px, lx);
+    sl_bufadd(&b, py, ly);
+    r = sl_string(b.data ? b.data : "", b.len);
+    free(b.data);
+    return r;
+}
+
+/* r[0] .. ... .. r[n-1], right to left as in Lua: each run of strings and
+   numbers becomes one new string, metamethods combine the rest pairwise */
+SL_API sl_Value sl_concatn(const sl_Value *r, int n) {
+    sl_Value acc = r[n - 1];
+    int i = n - 2, j, k;
+    char num[64];
+    while (i >= 0) {
+        sl_Buffer b = {NULL, 0, 0};
+        if (!(acc.type == SL_STR || sl_isnum(acc)) || !(r[i].type == SL_STR || sl_isnum(r[i]))) {
+            acc = sl_concat(r[i], acc);
+            i--;
+            continue;
+        }
+        for (j = i; j > 0 && (r[j - 1].type == SL_STR || sl_isnum(r[j - 1])); j--) {}
+        for (k = j; k <= i + 1; k++) {
+            sl_Value v = k <= i ? r[k] : acc;
+            if (v.type == SL_STR) {
+                sl_bufadd(&b, sl_str(v)->data, sl_str(v)->len);
+            } else {
+                sl_fmtnum(v, num);
+                sl_bufadds(&b, num);
+            }
+        }
+        acc = sl_string(b.data ? b.data : "", b.len);
+        free(b.data);
+        i = j - 1;
+    }
+    return acc;
+}
+
+SL_API sl_Value sl_len(sl_Value v) {
+    sl_Value h;
+    if (v.type == SL_STR) return sl_int((int64_t)sl_str(v)->len);
+    if (v.type == SL_TABLE && !sl_tab(v)->meta) return sl_int(sl_tlen(sl_tab(v)));
+    h = sl_metamethod(v, SL_EV_LEN);
+    if (h.type != SL_NIL) return sl_call1(h, 1, v, sl_nil, sl_nil);
+    if (v.type == SL_TABLE) return sl_int(sl_tlen(sl_tab(v)));
+    sl_error("attempt to get length of a %s value", sl_typename(v));
+}
+
+/* OP_FORPREP: the control values become all integers or all floats */
+SL_API void sl_forprep(sl_Value *ra) {
+    if (!sl_isnum(ra[0])) sl_error("'for' initial value must be a number");
+    if (!sl_isnum(ra[1])) sl_error("'for' limit must be a number");
+    if (!sl_isnum(ra[2])) sl_error("'for' step must be a number");
+    if (ra[0].type == SL_INT && ra[2].type == SL_INT) {
+        /* Integer loop: clip a float limit to the integers it admits */
+        if (ra[1].type == SL_FLT) {
+            double limit = ra[2].u.i > 0 ? floor(ra[1].u.n) : ceil(ra[1].u.n);
+            if (limit != limit) limit = ra[2].u.i > 0 ? -9223372036854775808.0 : 9223372036854775807.0;
+            if (limit >= 9223372036854775807.0) ra[1] = sl_int(INT64_MAX);
+            else if (limit <= -9223372036854775808.0) ra[1] = sl_int(INT64_MIN);
+            else ra[1] = sl_int((int64_t)limit);
+        }
+        ra[0].u.i = (int64_t)((uint64_t)ra[0].u.i - (uint64_t)ra[2].u.i);
+    } else {
+        int i;
+        for (i = 0; i < 3; i++) ra[i] = sl_flt(sl_tofloat(ra[i]));
+        ra[0].u.n -= ra[2].u.n;
+    }
+}
+
+/* OP_FORLOOP: returns whether to run the body again */
+SL_INLINE int sl_forloop(sl_Value *ra) {
+    if (ra[0].type == SL_INT) {
+        int64_t step = ra[2].u.i;
+        int64_t idx = (int64_t)((uint64_t)ra[0].u.i + (uint64_t)step);
+        ra[0].u.i = idx;
+        if (step > 0 ? idx <= ra[1].u.i : idx >= ra[1].u.i) {
+            ra[3] = sl_int(idx);
+            return 1;
+        }
+    } else {
+        double step = ra[2].u.n;
+        double idx = ra[0].u.n + step;
+        ra[0].u.n = idx;
+        if (step > 0 ? idx <= ra[1].u.n : idx >= ra[1].u.n) {
+            ra[3] = sl_flt(idx);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* OP_FORLOOP_UP and OP_FORLOOP_DOWN: the step's sign is known */
+SL_INLINE int sl_forloopup(sl_Value *ra) {
+    if (ra[0].type == SL_INT) {
+        int64_t idx = (int64_t)((uint64_t)ra[0].u.i + (uint64_t)ra[2].u.i);
+        ra[0].u.i = idx;
+        if (idx > ra[1].u.i) return 0;
+        ra[3] = sl_int(idx);
+    } else {
+        double idx = ra[0].u.n + ra[2].u.n;
+        ra[0].u.n = idx;
+        if (!(idx <= ra[1].u.n)) return 0;
+        ra[3] = sl_flt(idx);
+    }
+    return 1;
+}
+
+SL_INLINE int sl_forloopdown(sl_Value *ra) {
+    if (ra[0].type == SL_INT) {
+        int64_t idx = (int64_t)((uint64_t)ra[0].u.i + (uint64_t)ra[2].u.i);
+        ra[0].u.i = idx;
+        if (idx < ra[1].u.i) return 0;
+        ra[3] = sl_int(idx);
+    } else {
+        double idx = ra[0].u.n + ra[2].u.n;
+        ra[0].u.n = idx;
+        if (!(idx >= ra[1].u.n)) return 0;
+        ra[3] = sl_flt(idx);
+    }
+    return 1;
+}
+
+/* OP_VARARG: copies n varargs (all of them when n < 0), at most room */
+SL_INLINE void sl_varargs(sl_Value *ra, const sl_Value *va, int nva, int n, int room) {
+    int i;
+    if (n < 0) n = nva;
+    if (n > room) n = room;
+    for (i = 0; i < n; i++) ra[i] = i < nva ? va[i] : sl_nil;
+}
+
+/* OP_TFORCALL: ra[3..3+nvars) := ra[0](ra[1], ra[2]) */
+SL_API void sl_tforcall(sl_Value *ra, int nvars) {
+    sl_Value *f = sl_top;
+    int n, i;
+    sl_checkstack(3);
+    f[0] = ra[0];
+    f[1] = ra[1];
+    f[2] = ra[2];
+    sl_top = f + 3;
+    n = sl_call(f, 2);
+    for (i = 0; i < nvars; i++) ra[3 + i] = i < n ? f[i] : sl_nil;
+    sl_top = f;
+}
+
+)SLRT",
+R"SLRT(
+/* ---- String buffers ---- */
+
+/* A loop accumulator's buffer: a hidden table whose array part holds the
+   accumulator's first value and the pieces appended since */
+SL_API sl_Value sl_bufinit(sl_Value v) {
+    sl_Table *t = sl_newtable_();
+    t->acap = 8;
+    t->arr = (sl_Value *)sl_realloc(NULL, t->acap * sizeof(sl_Value));
+    t->arr[0] = v;
+    t->asize = 1;
+    return sl_obj(SL_TABLE, t);
+}
+
+/* The pieces joined; a buffer holding only its first value gives it back */
+SL_API sl_Value sl_bufflush(sl_Value buf) {
+    sl_Table *t = sl_tab(buf);
+    sl_Buffer b = {NULL, 0, 0};
+    char num[64];
+    size_t i;
+    sl_Value r;
+    if (t->asize == 1) return t->arr[0];
+    for (i = 0; i < t->asize; i++) {
+        if (t->arr[i].type == SL_STR) {
+            sl_bufadd(&b, sl_str(t->arr[i])->data, sl_str(t->arr[i])->len);
+        } else {
+            sl_fmtnum(t->arr[i], num);
+            sl_bufadds(&b, num);
+        }
+    }
+    r = sl_string(b.data ? b.data : "", b.len);
+    free(b.data);
+    return r;
+}
+
+/* buf := buf .. r[0] .. ... .. r[n-1] */
+SL_API void sl_bufappend(sl_Value buf, const sl_Value *r, int n) {
+    sl_Table *t = sl_tab(buf);
+    int i, plain = t->arr[0].type == SL_STR || sl_isnum(t->arr[0]);
+    sl_Value rest;
+    for (i = 0; plain && i < n; i++) plain = r[i].type == SL_STR || sl_isnum(r[i]);
+    if (plain) {
+        if (t->asize + n > t->acap) {
+            while (t->asize + n > t->acap) t->acap *= 2;
+            t->arr = (sl_Value *)sl_realloc(t->arr, t->acap * sizeof(sl_Value));
+        }
+        memcpy(t->arr + t->asize, r, n * sizeof(sl_Value));
+        t->asize += n;
+        return;
+    }
+    /* Metamethods see the accumulated string, as without the buffer */
+    t->arr[0] = sl_bufflush(buf);
+    t->asize = 1;
+    rest = n > 1 ? sl_concatn(r, n) : r[0];
+    t->arr[0] = sl_concat(t->arr[0], rest);
+}
+
+/* ---- Garbage collector ---- */
+
+SL_API void sl_markobj(sl_GC *o) {
+    if (o->marked) return;
+    o->marked = 1;
+    if (o->type == SL_STR) return;
+    if (sl_graycount == sl_graycap) {
+        sl_graycap = sl_graycap ? sl_graycap * 2 : 256;
+        sl_gray = (sl_GC **)sl_realloc(sl_gray, sl_graycap * sizeof(sl_GC *));
+    }
+    sl_gray[sl_graycount++] = o;
+}
+
+SL_INLINE void sl_markval(sl_Value v) {
+    if (v.type >= SL_STR) sl_markobj(v.u.gc);
+}
+
+SL_API void sl_propagate(void) {
+    size_t i;
+    while (sl_graycount > 0) {
+        sl_GC *o = sl_gray[--sl_graycount];
+        if (o->type == SL_TABLE) {
+            sl_Table *t = (sl_Table *)o;
+            for (i = 0; i < t->asize; i++) sl_markval(t->arr[i]);
+            /* Keys of deleted entries stay marked: probing compares them */
+            for (i = 0; i < t->hcap; i++) {
+                sl_markval(t->node[i].key);
+                sl_markval(t->node[i].val);
+            }
+            if (t->meta) sl_markobj(&t->meta->gc);
+        } else if (o->type == SL_FUNC) {
+            sl_Func *f = (sl_Func *)o;
+            int k;
+            for (k = 0; k < 4; k++) sl_markval(f->state[k]);
+            for (k = 0; k < f->nups; k++) {
+                if (f->up[k]) sl_markobj(&f->up[k]->gc);
+            }
+        } else if (o->type == SL_UPVAL) {
+            sl_markval(*((sl_Upval *)o)->v);
+        }
+    }
+}
+)SLRT",
+R"SLRT(
+SL_API void sl_freeobj(sl_GC *o) {
+    if (o->type == SL_TABLE) {
+        free(((sl_Table *)o)->arr);
+        free(((sl_Table *)o)->node);
+    }
+    free(o);
+}
+
+SL_API void sl_collect(void) {
+    sl_Value *v;
+    sl_Frame *f;
+    sl_Upval *uv;
+    sl_GC **pp;
+    size_t live = 0, i;
+    int k;
+    for (v = sl_stack; v < sl_top; v++) sl_markval(*v);
+    for (f = sl_frames; f; f = f->prev) {
+        for (k = 0; k < f->n; k++) sl_markval(f->R[k]);
+    }
+    for (uv = sl_openuv; uv; uv = uv->open) sl_markobj(&uv->gc);
+    sl_markobj(&sl_globals->gc);
+    sl_markobj(&sl_strmeta->gc);
+    sl_markval(sl_errval);
+    sl_propagate();
+    /* Drop dead strings from the intern table before freeing them */
+    for (i = 0; i < sl_strcap; i++) {
+        sl_String **sp = &sl_strtab[i];
+        while (*sp) {
+            if (!(*sp)->gc.marked && !(*sp)->gc.fixed) {
+                *sp = (*sp)->chain;
+                sl_strcount--;
+            } else {
+                sp = &(*sp)->chain;
+            }
+        }
+    }
+    pp = &sl_objects;
+    while (*pp) {
+        sl_GC *o = *pp;
+        if (o->marked || o->fixed) {
+            o->marked = 0;
+            live++;
+            pp = &o->next;
+        } else {
+            *pp = o->next;
+            sl_freeobj(o);
+        }
+    }
+    sl_gccount = live;
+    sl_gcthreshold = live * 2 > SL_GCMIN ? live * 2 : SL_GCMIN;
+}
+
+SL_INLINE void sl_checkgc(void) {
+    if (sl_gccount >= sl_gcthreshold) sl_collect();
+}
+
+/* ---- Conversions ---- */
+
+/* Appends tostring(v) */
+SL_API void sl_addvalue(sl_Buffer *b, sl_Value v) {
+    char buf[64];
+    switch (v.type) {
+    case SL_NIL: sl_bufadds(b, "nil"); return;
+    case SL_BOOL: sl_bufadds(b, v.u.b ? "true" : "false"); return;
+    case SL_INT: case SL_FLT: sl_fmtnum(v, buf); sl_bufadds(b, buf); return;
+    case SL_STR: sl_bufadd(b, sl_str(v)->data, sl_str(v)->len); return;
+    case SL_TABLE: {
+        sl_Value h = sl_metamethod(v, SL_EV_TOSTRING);
+        if (h.type != SL_NIL) {
+            h = sl_call1(h, 1, v, sl_nil, sl_nil);
+            if (h.type != SL_STR) sl_error("'__tostring' must return a string");
+            sl_bufadd(b, sl_str(h)->data, sl_str(h)->len);
+            return;
+        }
+        sprintf(buf, "table: %p", (void *)v.u.gc);
+        sl_bufadds(b, buf);
+        return;
+    }
+    default:
+        sprintf(buf, sl_fun(v)->name ? "builtin: %p" : "function: %p", (void *)v.u.gc);
+        sl_bufadds(b, buf);
+        return;
+    }
+}
+
+SL_API sl_String *sl_tostr(sl_Value v) {
+    sl_Buffer b = {NULL, 0, 0};
+    sl_String *s;
+    if (v.type == SL_STR) return sl_str(v);
+    sl_addvalue(&b, v);
+    s = sl_newstr(b.data ? b.data : "", b.len);
+    free(b.data);
+    return s;
+}
+
+/* ---- Standard library ---- */
+
+/* Subset of the Lua 5.3 library: the base functions plus math, string (with
+   Lua patterns), table, os.clock/os.time and io.write */
+
+#define SL_ARG(i) ((i) < nargs ? args[i] : sl_nil)
+
+SL_API void sl_argerror(sl_Func *self, int i, const char *msg) SL_NORETURN;
+SL_API void sl_argerror(sl_Func *self, int i, const char *msg) {
+    sl_error("bad argument #%d to '%s' (%s)", i + 1, self->name, msg);
+}
+
+SL_API void sl_typeerror(sl_Func *self, sl_Value *args, int nargs, int i, const char *expected) SL_NORETURN;
+SL_API void sl_typeerror(sl_Func *self, sl_Value *args, int nargs, int i, const char *expected) {
+    char msg[128];
+    sprintf(msg, "%s expected, got %s", expected, i < nargs ? sl_typename(args[i]) : "no value");
+    sl_argerror(self, i, msg);
+}
+
+SL_API void sl_checkany(sl_Func *self, sl_Value *args, int nargs, int i) {
+    (void)args;
+    if (i >= nargs) sl_argerror(self, i, "value expected");
+}
+
+SL_API sl_Value sl_checknumber(sl_Func *self, sl_Value *args, int nargs, int i) {
+    sl_Value v;
+    if (!sl_tonumber(SL_ARG(i), &v)) sl_typeerror(self, args, nargs, i, "number");
+    return v;
+}
+
+SL_API int64_t sl_checkint(sl_Func *self, sl_Value *args, int nargs, int i) {
+    sl_Value v = sl_checknumber(self, args, nargs, i);
+    int64_t n;
+    if (v.type == SL_INT) return v.u.i;
+    if (!sl_flt2int(v.u.n, &n)) sl_argerror(self, i, "number has no integer representation");
+    return n;
+}
+
+SL_API int64_t sl_optint(sl_Func *self, sl_Value *args, int nargs, int i, int64_t def) {
+    return SL_ARG(i).type == SL_NIL ? def : sl_checkint(self, args, nargs, i);
+}
+
+SL_API double sl_checkflt(sl_Func *self, sl_Value *args, int nargs, int i) {
+    return sl_tofloat(sl_checknumber(self, args, nargs, i));
+}
+
+/* Numbers are converted in place, which keeps the new string reachable */
+SL_API sl_String *sl_checkstr(sl_Func *self, sl_Value *args, int nargs, int i) {
+    sl_Value v = SL_ARG(i);
+    if (v.type == SL_STR) return sl_str(v);
+    if (!sl_isnum(v)) sl_typeerror(self, args, nargs, i, "string");
+    args[i] = sl_obj(SL_STR, sl_tostr(v));
+    return sl_str(args[i]);
+}
+
+SL_API sl_Table *sl_checktable(sl_Func *self, sl_Value *args, int nargs, int i) {
+    if (SL_ARG(i).type != SL_TABLE) sl_typeerror(self, args, nargs, i, "table");
+    return sl_tab(args[i]);
+}
+
+#define CHECKANY(i) sl_checkany(self, args, nargs, i)
+#define CHECKNUM(i) sl_checknumber(self, args, nargs, i)
+#define CHECKINT(i) sl_checkint(self, args, nargs, i)
+#define OPTINT(i, d) sl_optint(self, args, nargs, i, d)
+#define CHECKFLT(i) sl_checkflt(self, args, nargs, i)
+#define CHECKSTR(i) sl_checkstr(self, args, nargs, i)
+#define CHECKTABLE(i) sl_checktable(self, args, nargs, i)
+
+SL_API void sl_write(const char *s, size_t len) { fwrite(s, 1, len, stdout); }
+
+SL_API int sl_print(sl_Func *self, sl_Value *args, int nargs) {
+    sl_Buffer b = {NULL, 0, 0};
+    int i;
+    (void)self;
+    for (i = 0; i < nargs; i++) {
+        if (i > 0) sl_bufaddc(&b, '\t');
+        sl_addvalue(&b, args[i]);
+    }
+    sl_bufaddc(&b, '\n');
+    sl_write(b.data, b.len);
+    free(b.data);
+    return 0;
+}
+
+SL_API int sl_type(sl_Func *self, sl_Value *args, int nargs) {
+    CHECKANY(0);
+    sl_push(sl_cstring(sl_typename(args[0])));
+    return 1;
+}
+
+SL_API int sl_tostring(sl_Func *self, sl_Value *args, int nargs) {
+    CHECKANY(0);
+    sl_push(sl_obj(SL_STR, sl_tostr(args[0])));
+    return 1;
+}
+
+SL_API int sl_tonumber_(sl_Func *self, sl_Value *args, int nargs) {
+    sl_String *s;
+    int64_t base;
+    uint64_t value = 0;
+    size_t i = 0, end;
+    int neg = 0;
+    if (SL_ARG(1).type == SL_NIL) {
+        sl_Value v = sl_nil;
+        CHECKANY(0);
+        if (sl_isnum(args[0])) v = args[0];
+        else if (args[0].type == SL_STR) sl_str2num(sl_str(args[0])->data, sl_str(args[0])->len, &v);
+        sl_push(v);
+        return 1;
+    }
+    base = CHECKINT(1);
+    if (base < 2 || base > 36) sl_argerror(self, 1, "base out of range");
+    s = CHECKSTR(0);
+    end = s->len;
+    while (i < end && isspace((unsigned char)s->data[i])) i++;
+    while (end > i && isspace((unsigned char)s->data[end - 1])) end--;
+    if (i < end && s->data[i] == '-') {
+        neg = 1;
+        i++;
+    }
+    if (i >= end) {
+        sl_push(sl_nil);
+        return 1;
+    }
+    for (; i < end; i++) {
+        int c = tolower((unsigned char)s->data[i]);
+        int digit = isdigit(c) ? c - '0' : isalpha(c) ? c - 'a' + 10 : 99;
+        if (digit >= base) {
+            sl_push(sl_nil);
+            return 1;
+        }
+        value = value * (uint64_t)base + (uint64_t)digit;
+    }
+    sl_push(sl_int(neg ? (int64_t)(0 - value) : (int64_t)value));
+    return 1;
+}
+
+SL_API int sl_next(sl_Func *self, sl_Value *args, int nargs) {
+    sl_Table *t = CHECKTABLE(0);
+    sl_Value k, v;
+    if (!sl_tnext(t, SL_ARG(1), &k, &v)) {
+        sl_push(sl_nil);
+        return 1;
+    }
+    sl_push(k);
+    sl_push(v);
+    return 2;
+}
+
+SL_API int sl_pairs(sl_Func *self, sl_Value *args, int nargs) {
+    sl_Value h;
+    CHECKANY(0);
+    h = sl_metamethod(args[0], SL_EV_PAIRS);
+    if (h.type != SL_NIL) {
+        sl_Value *f = sl_top;
+        int n, i;
+        sl_push(h);
+        sl_push(args[0]);
+        n = sl_call(f, 1);
+        for (i = n; i < 3; i++) sl_push(sl_nil);
+        sl_top = f + 3;
+        return 3;
+    }
+    CHECKTABLE(0);
+    sl_push(self->state[0]);
+    sl_push(args[0]);
+    sl_push(sl_nil);
+    return 3;
+}
+
+SL_API int sl_ipairsaux(sl_Func *self, sl_Value *args, int nargs) {
+    int64_t i = CHECKINT(1) + 1;
+    sl_Value t = args[0], v;
+    v = t.type == SL_TABLE && !sl_tab(t)->meta ? sl_tgetint(sl_tab(t), i) : sl_index(t, sl_int(i));
+    if (v.type == SL_NIL) {
+        sl_push(sl_nil);
+        return 1;
+    }
+    sl_push(sl_int(i));
+    sl_push(v);
+    return 2;
+}
+
+SL_API int sl_ipairs(sl_Func *self, sl_Value *args, int nargs) {
+    CHECKANY(0);
+    sl_push(self->state[0]);
+    sl_push(args[0]);
+    sl_push(sl_int(0));
+    return 3;
+}
+
+/* OP_TFORIPAIRS and OP_TFORPAIRS: sl_tforcall, stepping inline while the
+   iterator is the stock ipairs_aux or next over a table */
+SL_INLINE void sl_tforipairs(sl_Value *ra, int nvars) {
+    sl_Value v;
+    int i;
+    if (ra[0].type != SL_FUNC || sl_fun(ra[0])->fn != sl_ipairsaux || ra[1].type != SL_TABLE ||
+        sl_tab(ra[1])->meta || ra[2].type != SL_INT) {
+        sl_tforcall(ra, nvars);
+        return;
+    }
+    v = sl_tgetint(sl_tab(ra[1]), ra[2].u.i + 1);
+    ra[3] = v.type == SL_NIL ? sl_nil : sl_int(ra[2].u.i + 1);
+    if (nvars > 1) ra[4] = v;
+    for (i = 2; i < nvars; i++) ra[3 + i] = sl_nil;
+}
+
+SL_INLINE void sl_tforpairs(sl_Value *ra, int nvars) {
+    sl_Value k, v;
+    int i;
+    if (ra[0].type != SL_FUNC || sl_fun(ra[0])->fn != sl_next || ra[1].type != SL_TABLE) {
+        sl_tforcall(ra, nvars);
+        return;
+    }
+    if (!sl_tnext(sl_tab(ra[1]), ra[2], &k, &v)) k = v = sl_nil;
+    ra[3] = k;
+    if (nvars > 1) ra[4] = v;
+    for (i = 2; i < nvars; i++) ra[3 + i] = sl_nil;
+}
+
+SL_API int sl_select(sl_Func *self, sl_Value *args, int nargs) {
+    int64_t i;
+    int k;
+    if (SL_ARG(0).type == SL_STR && sl_str(args[0])->len == 1 && sl_str(args[0])->data[0] == '#') {
+        sl_push(sl_int(nargs - 1));
+        return 1;
+    }
+    i = CHECKINT(0);
+    if (i < 0) i = nargs + i;
+    else if (i == 0) sl_argerror(self, 0, "index out of range");
+    if (i < 1) sl_argerror(self, 0, "index out of range");
+    for (k = (int)i; k < nargs; k++) sl_push(args[k]);
+    return i < nargs ? nargs - (int)i : 0;
+}
+
+SL_API int sl_error_(sl_Func *self, sl_Value *args, int nargs) {
+    int level = (int)OPTINT(1, 1);
+    sl_throw(sl_where(SL_ARG(0), level));
+}
+
+SL_API int sl_assert(sl_Func *self, sl_Value *args, int nargs) {
+    int i;
+    CHECKANY(0);
+    if (!sl_falsy(args[0])) {
+        for (i = 0; i < nargs; i++) sl_push(args[i]);
+        return nargs;
+    }
+    if (nargs < 2) sl_error("assertion failed!");
+    sl_throw(args[1]);
+}
+
+SL_API int sl_pcall(sl_Func *self, sl_Value *args, int nargs) {
+    sl_Catch c;
+    sl_Frame *frames = sl_frames;
+    int depth = sl_depth;
+    CHECKANY(0);
+    c.prev = sl_catch;
+    c.depth = depth;
+    sl_catch = &c;
+    if (setjmp(c.jb) == 0) {
+        int n = sl_call(args, nargs - 1);
+        sl_catch = c.prev;
+        /* The results are at args[0..n): insert true before them */
+        sl_checkstack(1);
+        memmove(args + 1, args, (size_t)n * sizeof(sl_Value));
+        args[0] = sl_bool(1);
+        sl_top = args + n + 1;
+        return n + 1;
+    }
+    sl_catch = c.prev;
+    sl_frames = frames;
+    sl_depth = depth;
+    sl_top = args;
+    sl_push(sl_bool(0));
+    sl_push(sl_errval);
+    sl_errval = sl_nil;
+    return 2;
+}
+
+SL_API int sl_rawget(sl_Func *self, sl_Value *args, int nargs) {
+    sl_Table *t = CHECKTABLE(0);
+    sl_push(sl_tget(t, SL_ARG(1)));
+    return 1;
+}
+
+SL_API int sl_rawset(sl_Func *self, sl_Value *args, int nargs) {
+    sl_Table *t = CHECKTABLE(0);
+    sl_tset(t, SL_ARG(1), SL_ARG(2));
+    sl_push(args[0]);
+    return 1;
+}
+
+SL_API int sl_rawequal_(sl_Func *self, sl_Value *args, int nargs) {
+    CHECKANY(0);
+    CHECKANY(1);
+    sl_push(sl_bool(sl_rawequal(args[0], args[1])));
+    return 1;
+}
+
+SL_API int sl_rawlen(sl_Func *self, sl_Value *args, int nargs) {
+    sl_Value v = SL_ARG(0);
+    if (v.type == SL_TABLE) sl_push(sl_int(sl_tlen(sl_tab(v))));
+    else if (v.type == SL_STR) sl_push(sl_int((int64_t)sl_str(v)->len));
+    else sl_argerror(self, 0, "table or string expected");
+    return 1;
+}
+
+SL_API int sl_setmetatable(sl_Func *self, sl_Value *args, int nargs) {
+    sl_Table *t = CHECKTABLE(0);
+    sl_Value mt = SL_ARG(1);
+    if (mt.type != SL_NIL && mt.type != SL_TABLE) sl_typeerror(self, args, nargs, 1, "nil or table");
+    if (t->meta && sl_tgetstr(t->meta, sl_ev[SL_EV_METATABLE]).type != SL_NIL) {
+        sl_error("cannot change a protected metatable");
+    }
+    t->meta = mt.type == SL_NIL ? NULL : sl_tab(mt);
+    sl_push(args[0]);
+    return 1;
+}
+
+SL_API int sl_getmetatable(sl_Func *self, sl_Value *args, int nargs) {
+    sl_Table *mt;
+    sl_Value protect;
+    CHECKANY(0);
+    mt = args[0].type == SL_TABLE ? sl_tab(args[0])->meta : args[0].type == SL_STR ? sl_strmeta : NULL;
+    if (!mt) {
+        sl_push(sl_nil);
+        return 1;
+    }
+    protect = sl_tgetstr(mt, sl_ev[SL_EV_METATABLE]);
+    sl_push(protect.type != SL_NIL ? protect : sl_obj(SL_TABLE, mt));
+    return 1;
+}
+)SLRT",
+R"SLRT(
+/* -- math -- */
+
+SL_API void sl_pushfloor(double d) {
+    int64_t i;
+    if (sl_flt2int(d, &i)) sl_push(sl_int(i));
+    else sl_push(sl_flt(d));
+}
+
+SL_API int sl_mathfloor(sl_Func *self, sl_Value *args, int nargs) {
+    sl_Value v = CHECKNUM(0);
+    if (v.type == SL_INT) sl_push(v);
+    else sl_pushfloor(floor(v.u.n));
+    return 1;
+}
+
+SL_API int sl_mathceil(sl_Func *self, sl_Value *args, int nargs) {
+    sl_Value v = CHECKNUM(0);
+    if (v.type == SL_INT) sl_push(v);
+    else sl_pushfloor(ceil(v.u.n));
+    return 1;
+}
+
+SL_API int sl_mathabs(sl_Func *self, sl_Value *args, int nargs) {
+    sl_Value v = CHECKNUM(0);
+    if (v.type == SL_INT) sl_push(sl_int(v.u.i < 0 ? (int64_t)(0 - (uint64_t)v.u.i) : v.u.i));
+    else sl_push(sl_flt(fabs(v.u.n)));
+    return 1;
+}
+
+SL_API int sl_mathminmax(sl_Func *self, sl_Value *args, int nargs, int max) {
+    sl_Value best = CHECKNUM(0);
+    int i;
+    for (i = 1; i < nargs; i++) {
+        sl_Value v = CHECKNUM(i);
+        if (max ? sl_lessthan(best, v) : sl_lessthan(v, best)) best = v;
+    }
+    sl_push(best);
+    return 1;
+}
+
+SL_API int sl_mathmax(sl_Func *self, sl_Value *args, int nargs) { return sl_mathminmax(self, args, nargs, 1); }
+SL_API int sl_mathmin(sl_Func *self, sl_Value *args, int nargs) { return sl_mathminmax(self, args, nargs, 0); }
+
+#define SL_MATH_UNARY(name, expr) \
+    SL_API int name(sl_Func *self, sl_Value *args, int nargs) { \
+        double x = CHECKFLT(0); \
+        sl_push(sl_flt(expr)); \
+        return 1; \
+    }
+
+SL_MATH_UNARY(sl_mathsqrt, sqrt(x))
+SL_MATH_UNARY(sl_mathsin, sin(x))
+SL_MATH_UNARY(sl_mathcos, cos(x))
+SL_MATH_UNARY(sl_mathtan, tan(x))
+SL_MATH_UNARY(sl_mathasin, asin(x))
+SL_MATH_UNARY(sl_mathacos, acos(x))
+SL_MATH_UNARY(sl_mathexp, exp(x))
+
+SL_API int sl_mathatan(sl_Func *self, sl_Value *args, int nargs) {
+    double y = CHECKFLT(0);
+    double x = SL_ARG(1).type == SL_NIL ? 1.0 : CHECKFLT(1);
+    sl_push(sl_flt(atan2(y, x)));
+    return 1;
+}
+
+SL_API int sl_mathlog(sl_Func *self, sl_Value *args, int nargs) {
+    double x = CHECKFLT(0), b;
+    if (SL_ARG(1).type == SL_NIL) {
+        sl_push(sl_flt(log(x)));
+        return 1;
+    }
+    b = CHECKFLT(1);
+    sl_push(sl_flt(b == 2.0 ? log2(x) : b == 10.0 ? log10(x) : log(x) / log(b)));
+    return 1;
+}
+
+SL_API int sl_mathfmod(sl_Func *self, sl_Value *args, int nargs) {
+    sl_Value a = CHECKNUM(0), b = CHECKNUM(1);
+    if (a.type == SL_INT && b.type == SL_INT) {
+        if (b.u.i == 0) sl_argerror(self, 1, "zero");
+        sl_push(sl_int(b.u.i == -1 ? 0 : a.u.i % b.u.i));
+    } else {
+        sl_push(sl_flt(fmod(sl_tofloat(a), sl_tofloat(b))));
+    }
+    return 1;
+}
+
+SL_API int sl_mathmodf(sl_Func *self, sl_Value *args, int nargs) {
+    double x = CHECKFLT(0);
+    double ip = x >= 0 ? floor(x) : ceil(x);
+    sl_push(sl_flt(ip));
+    sl_push(sl_flt(isinf(x) ? 0.0 : x - ip));
+    return 2;
+}
+
+SL_API int sl_mathtointeger(sl_Func *self, sl_Value *args, int nargs) {
+    sl_Value x = SL_ARG(0);
+    int64_t i;
+    (void)self;
+    if (x.type == SL_INT) sl_push(x);
+    else if (x.type == SL_FLT && sl_flt2int(x.u.n, &i)) sl_push(sl_int(i));
+    else sl_push(sl_nil);
+    return 1;
+}
+
+SL_API int sl_mathtype(sl_Func *self, sl_Value *args, int nargs) {
+    CHECKANY(0);
+    if (args[0].type == SL_INT) sl_push(sl_cstring("integer"));
+    else if (args[0].type == SL_FLT) sl_push(sl_cstring("float"));
+    else sl_push(sl_nil);
+    return 1;
+}
+
+SL_API uint64_t sl_nextrandom(void) {
+    /* xorshift64* */
+    sl_randstate ^= sl_randstate >> 12;
+    sl_randstate ^= sl_randstate << 25;
+    sl_randstate ^= sl_randstate >> 27;
+    return sl_randstate * 0x2545F4914F6CDD1DULL;
+}
+
+SL_API int sl_mathrandom(sl_Func *self, sl_Value *args, int nargs) {
+    double r = (double)(sl_nextrandom() >> 11) * (1.0 / 9007199254740992.0);
+    int64_t low = 1, up;
+    uint64_t span;
+    if (nargs == 0) {
+        sl_push(sl_flt(r));
+        return 1;
+    }
+    if (nargs == 1) {
+        up = CHECKINT(0);
+    } else {
+        low = CHECKINT(0);
+        up = CHECKINT(1);
+    }
+    if (low > up) sl_argerror(self, nargs == 1 ? 0 : 1, "interval is empty");
+    span = (uint64_t)up - (uint64_t)low;
+    sl_push(sl_int((int64_t)((uint64_t)low + (span == UINT64_MAX ? sl_nextrandom() : sl_nextrandom() % (span + 1)))));
+    return 1;
+}
+
+SL_API int sl_mathrandomseed(sl_Func *self, sl_Value *args, int nargs) {
+    sl_Value v = CHECKNUM(0);
+    int i;
+    sl_randstate = (v.type == SL_INT ? (uint64_t)v.u.i : (uint64_t)(int64_t)v.u.n) ^ 0x9E3779B97F4A7C15ULL;
+    if (sl_randstate == 0) sl_randstate = 1;
+    for (i = 0; i < 16; i++) sl_nextrandom();
+    return 0;
+}
+
+/* -- string -- */
+
+/* Lua's relative string positions: negative values count from the end */
+SL_API int64_t sl_startpos(int64_t pos, size_t len) {
+    if (pos > 0) return pos;
+    if (pos == 0) return 1;
+    if (pos < -(int64_t)len) return 1;
+    return (int64_t)len + pos + 1;
+}
+
+SL_API int64_t sl_endpos(int64_t pos, size_t len) {
+    if (pos > (int64_t)len) return (int64_t)len;
+    if (pos >= 0) return pos;
+    if (pos < -(int64_t)len) return 0;
+    return (int64_t)len + pos + 1;
+}
+
+SL_API int sl_strlen(sl_Func *self, sl_Value *args, int nargs) {
+    sl_push(sl_int((int64_t)CHECKSTR(0)->len));
+    return 1;
+}
+
+SL_API int sl_strsub(sl_Func *self, sl_Value *args, int nargs) {
+    sl_String *s = CHECKSTR(0);
+    int64_t i = sl_startpos(OPTINT(1, 1), s->len);
+    int64_t j = sl_endpos(OPTINT(2, -1), s->len);
+    if (i > j) sl_push(sl_string("", 0));
+    else sl_push(sl_string(s->data + i - 1, (size_t)(j - i + 1)));
+    return 1;
+}
+
+SL_API int sl_strcase(sl_Func *self, sl_Value *args, int nargs, int upper) {
+    sl_String *s = CHECKSTR(0);
+    char *buf = (char *)sl_alloc(s->len + 1);
+    size_t i;
+    for (i = 0; i < s->len; i++) {
+        unsigned char c = (unsigned char)s->data[i];
+        buf[i] = (char)(upper ? toupper(c) : tolower(c));
+    }
+    sl_push(sl_string(buf, s->len));
+    free(buf);
+    return 1;
+}
+
+SL_API int sl_strupper(sl_Func *self, sl_Value *args, int nargs) { return sl_strcase(self, args, nargs, 1); }
+SL_API int sl_strlower(sl_Func *self, sl_Value *args, int nargs) { return sl_strcase(self, args, nargs, 0); }
+
+SL_API int sl_strrep(sl_Func *self, sl_Value *args, int nargs) {
+    sl_String *s = CHECKSTR(0), *sep = NULL;
+    int64_t n = CHECKINT(1), i;
+    sl_Buffer b = {NULL, 0, 0};
+    if (SL_ARG(2).type != SL_NIL) sep = CHECKSTR(2);
+    if (n > 0 && (s->len + (sep ? sep->len : 0)) * (uint64_t)n >= (1u << 30)) sl_error("resulting string too large");
+    for (i = 0; i < n; i++) {
+        if (i > 0 && sep) sl_bufadd(&b, sep->data, sep->len);
+        sl_bufadd(&b, s->data, s->len);
+    }
+    sl_push(sl_string(b.data ? b.data : "", b.len));
+    free(b.data);
+    return 1;
+}
+
+SL_API int sl_strreverse(sl_Func *self, sl_Value *args, int nargs) {
+    sl_String *s = CHECKSTR(0);
+    char *buf = (char *)sl_alloc(s->len + 1);
+    size_t i;
+    for (i = 0; i < s->len; i++) buf[i] = s->data[s->len - 1 - i];
+    sl_push(sl_string(buf, s->len));
+    free(buf);
+    return 1;
+}
+
+SL_API int sl_strbyte(sl_Func *self, sl_Value *args, int nargs) {
+    sl_String *s = CHECKSTR(0);
+    int64_t i = sl_startpos(OPTINT(1, 1), s->len);
+    int64_t j = sl_endpos(SL_ARG(2).type == SL_NIL ? i : CHECKINT(2), s->len);
+    int64_t k;
+    for (k = i; k <= j; k++) sl_push(sl_int((unsigned char)s->data[k - 1]));
+    return i <= j ? (int)(j - i + 1) : 0;
+}
+
+SL_API int sl_strchar(sl_Func *self, sl_Value *args, int nargs) {
+    char *buf = (char *)sl_alloc((size_t)nargs + 1);
+    int i;
+    for (i = 0; i < nargs; i++) {
+        int64_t c = CHECKINT(i);
+        if (c < 0 || c > 255) {
+            free(buf);
+            sl_argerror(self, i, "value out of range");
+        }
+        buf[i] = (char)c;
+    }
+    sl_push(sl_string(buf, (size_t)nargs));
+    free(buf);
+    return 1;
+}
+
+SL_API int sl_strformat(sl_Func *self, sl_Value *args, int nargs) {
+    sl_String *fs = CHECKSTR(0);
+    const char *fmt = fs->data, *end = fs->data + fs->len;
+    sl_Buffer b = {NULL, 0, 0};
+    int arg = 1;
+    char spec[32], buf[512];
+    while (fmt < end) {
+        const char *start;
+        size_t n;
+        if (*fmt != '%') {
+            sl_bufaddc(&b, *fmt++);
+            continue;
+        }
+        if (++fmt >= end) {
+            free(b.data);
+            sl_error("invalid conversion '%%' to 'format'");
+        }
+        if (*fmt == '%') {
+            sl_bufaddc(&b, *fmt++);
+            continue;
+        }
+        start = fmt;
+        while (fmt < end && strchr("-+ #0", *fmt)) fmt++;
+        while (fmt < end && isdigit((unsigned char)*fmt)) fmt++;
+        if (fmt < end && *fmt == '.') {
+            fmt++;
+            while (fmt < end && isdigit((unsigned char)*fmt)) fmt++;
+        }
+        n = (size_t)(fmt - start);
+        if (fmt >= end || n > 20) {
+            free(b.data);
+            sl_error("invalid conversion to 'format'");
+        }
+        spec[0] = '%';
+        memcpy(spec + 1, start, n);
+        spec[n + 1] = '\0';
+        if (arg >= nargs) {
+            free(b.data);
+            sl_argerror(self, arg, "no value");
+        }
+        switch (*fmt) {
+        case 'd': case 'i':
+            strcat(spec, "lld");
+            snprintf(buf, sizeof(buf), spec, (long long)CHECKINT(arg));
+            sl_bufadds(&b, buf);
+            break;
+        case 'c':
+            strcat(spec, "c");
+            snprintf(buf, sizeof(buf), spec, (int)CHECKINT(arg));
+            sl_bufadds(&b, buf);
+            break;
+        case 'u': case 'x': case 'X': case 'o': {
+            size_t len = strlen(spec);
+            spec[len] = 'l';
+            spec[len + 1] = 'l';
+            spec[len + 2] = *fmt;
+            spec[len + 3] = '\0';
+            snprintf(buf, sizeof(buf), spec, (unsigned long long)CHECKINT(arg));
+            sl_bufadds(&b, buf);
+            break;
+        }
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A': {
+            size_t len = strlen(spec);
+            spec[len] = *fmt;
+            spec[len + 1] = '\0';
+            snprintf(buf, sizeof(buf), spec, CHECKFLT(arg));
+            sl_bufadds(&b, buf);
+            break;
+        }
+        case 's': {
+            sl_String *s = sl_tostr(args[arg]);
+            if (n == 0) {
+                sl_bufadd(&b, s->data, s->len);
+            } else {
+                strcat(spec, "s");
+                snprintf(buf, sizeof(buf), spec, s->data);
+                sl_bufadds(&b, buf);
+            }
+            break;
+        }
+        case 'q': {
+            sl_String *s = CHECKSTR(arg);
+            size_t i;
+            sl_bufaddc(&b, '"');
+            for (i = 0; i < s->len; i++) {
+                char c = s->data[i];
+                if (c == '"' || c == '\\' || c == '\n') {
+                    sl_bufaddc(&b, '\\');
+                    sl_bufaddc(&b, c);
+                } else if (c == '\r') {
+                    sl_bufadds(&b, "\\r");
+                } else if (c == '\0') {
+                    sl_bufadds(&b, "\\0");
+                } else {
+                    sl_bufaddc(&b, c);
+                }
+            }
+            sl_bufaddc(&b, '"');
+            break;
+        }
+        default:
+            free(b.data);
+            sl_error("invalid option '%%%c' to 'format'", *fmt);
+        }
+        fmt++;
+        arg++;
+    }
+    sl_push(sl_string(b.data ? b.data : "", b.len));
+    free(b.data);
+    return 1;
+}
+
+/* Lua patterns, following lstrlib.c */
+
+#define SL_MAXCAPTURES 32
+#define SL_CAP_UNFINISHED (-1)
+#define SL_CAP_POSITION (-2)
+#define SL_ESC '%'
+
+typedef struct sl_MatchState {
+    const char *src_init, *src_end, *p_end;
+    int level, depth;
+    struct {
+        const char *init;
+        ptrdiff_t len;
+    } capture[SL_MAXCAPTURES];
+} sl_MatchState;
+
+SL_API const char *sl_domatch(sl_MatchState *ms, const char *s, const char *p);
+
+SL_API int sl_checkcapture(sl_MatchState *ms, int l) {
+    l -= '1';
+    if (l < 0 || l >= ms->level || ms->capture[l].len == SL_CAP_UNFINISHED) {
+        sl_error("invalid capture index %%%d", l + 1);
+    }
+    return l;
+}
+)SLRT",
+R"SLRT(
+SL_API int sl_capturetoclose(sl_MatchState *ms) {
+    int level = ms->level;
+    for (level--; level >= 0; level--) {
+        if (ms->capture[level].len == SL_CAP_UNFINISHED) return level;
+    }
+    sl_error("invalid pattern capture");
+}
+
+SL_API const char *sl_classend(sl_MatchState *ms, const char *p) {
+    switch (*p++) {
+    case SL_ESC:
+        if (p == ms->p_end) sl_error("malformed pattern (ends with '%%')");
+        return p + 1;
+    case '[':
+        if (*p == '^') p++;
+        do {
+            if (p == ms->p_end) sl_error("malformed pattern (missing ']')");
+            if (*(p++) == SL_ESC && p < ms->p_end) p++;
+        } while (*p != ']');
+        return p + 1;
+    default:
+        return p;
+    }
+}
+
+SL_API int sl_matchclass(int c, int cl) {
+    int res;
+    switch (tolower(cl)) {
+    case 'a': res = isalpha(c); break;
+    case 'c': res = iscntrl(c); break;
+    case 'd': res = isdigit(c); break;
+    case 'g': res = isgraph(c); break;
+    case 'l': res = islower(c); break;
+    case 'p': res = ispunct(c); break;
+    case 's': res = isspace(c); break;
+    case 'u': res = isupper(c); break;
+    case 'w': res = isalnum(c); break;
+    case 'x': res = isxdigit(c); break;
+    default: return cl == c;
+    }
+    if (isupper(cl)) res = !res;
+    return res != 0;
+}
+
+SL_API int sl_matchbracketclass(int c, const char *p, const char *ec) {
+    int sig = 1;
+    if (*(p + 1) == '^') {
+        sig = 0;
+        p++;
+    }
+    while (++p < ec) {
+        if (*p == SL_ESC) {
+            p++;
+            if (sl_matchclass(c, (unsigned char)*p)) return sig;
+        } else if (*(p + 1) == '-' && p + 2 < ec) {
+            p += 2;
+            if ((unsigned char)*(p - 2) <= c && c <= (unsigned char)*p) return sig;
+        } else if ((unsigned char)*p == c) {
+            return sig;
+        }
+    }
+    return !sig;
+}
+
+SL_API int sl_singlematch(sl_MatchState *ms, const char *s, const char *p, const char *ep) {
+    int c;
+    if (s >= ms->src_end) return 0;
+    c = (unsigned char)*s;
+    switch (*p) {
+    case '.': return 1;
+    case SL_ESC: return sl_matchclass(c, (unsigned char)*(p + 1));
+    case '[': return sl_matchbracketclass(c, p, ep - 1);
+    default: return (unsigned char)*p == c;
+    }
+}
+
+SL_API const char *sl_matchbalance(sl_MatchState *ms, const char *s, const char *p) {
+    int b, e, cont = 1;
+    if (p >= ms->p_end - 1) sl_error("malformed pattern (missing arguments to '%%b')");
+    if (*s != *p) return NULL;
+    b = *p;
+    e = *(p + 1);
+    while (++s < ms->src_end) {
+        if (*s == e) {
+            if (--cont == 0) return s + 1;
+        } else if (*s == b) {
+            cont++;
+        }
+    }
+    return NULL;
+}
+
+SL_API const char *sl_maxexpand(sl_MatchState *ms, const char *s, const char *p, const char *ep) {
+    ptrdiff_t i = 0;
+    while (sl_singlematch(ms, s + i, p, ep)) i++;
+    while (i >= 0) {
+        const char *res = sl_domatch(ms, s + i, ep + 1);
+        if (res) return res;
+        i--;
+    }
+    return NULL;
+}
+
+SL_API const char *sl_minexpand(sl_MatchState *ms, const char *s, const char *p, const char *ep) {
+    for (;;) {
+        const char *res = sl_domatch(ms, s, ep + 1);
+        if (res) return res;
+        if (sl_singlematch(ms, s, p, ep)) s++;
+        else return NULL;
+    }
+}
+
+SL_API const char *sl_startcapture(sl_MatchState *ms, const char *s, const char *p, int what) {
+    const char *res;
+    if (ms->level >= SL_MAXCAPTURES) sl_error("too many captures");
+    ms->capture[ms->level].init = s;
+    ms->capture[ms->level].len = what;
+    ms->level++;
+    res = sl_domatch(ms, s, p);
+    if (!res) ms->level--;
+    return res;
+}
+
+SL_API const char *sl_endcapture(sl_MatchState *ms, const char *s, const char *p) {
+    int l = sl_capturetoclose(ms);
+    const char *res;
+    ms->capture[l].len = s - ms->capture[l].init;
+    res = sl_domatch(ms, s, p);
+    if (!res) ms->capture[l].len = SL_CAP_UNFINISHED;
+    return res;
+}
+
+SL_API const char *sl_matchcapture(sl_MatchState *ms, const char *s, int l) {
+    size_t len;
+    l = sl_checkcapture(ms, l);
+    len = (size_t)ms->capture[l].len;
+    if ((size_t)(ms->src_end - s) >= len && memcmp(ms->capture[l].init, s, len) == 0) return s + len;
+    return NULL;
+}
+
+SL_API const char *sl_domatch(sl_MatchState *ms, const char *s, const char *p) {
+    if (ms->depth-- == 0) sl_error("pattern too complex");
+    while (p != ms->p_end) {
+        switch (*p) {
+        case '(':
+            s = *(p + 1) == ')' ? sl_startcapture(ms, s, p + 2, SL_CAP_POSITION)
+                                : sl_startcapture(ms, s, p + 1, SL_CAP_UNFINISHED);
+            goto done;
+        case ')':
+            s = sl_endcapture(ms, s, p + 1);
+            goto done;
+        case '$':
+            if (p + 1 != ms->p_end) goto dflt;
+            s = s == ms->src_end ? s : NULL;
+            goto done;
+        case SL_ESC:
+            switch (*(p + 1)) {
+            case 'b':
+                s = sl_matchbalance(ms, s, p + 2);
+                if (s) {
+                    p += 4;
+                    continue;
+                }
+                goto done;
+            case 'f': {
+                const char *ep;
+                int previous, current;
+                p += 2;
+                if (*p != '[') sl_error("missing '[' after '%%f' in pattern");
+                ep = sl_classend(ms, p);
+                previous = s == ms->src_init ? '\0' : (unsigned char)*(s - 1);
+                current = s < ms->src_end ? (unsigned char)*s : '\0';
+                if (!sl_matchbracketclass(previous, p, ep - 1) && sl_matchbracketclass(current, p, ep - 1)) {
+                    p = ep;
+                    continue;
+                }
+                s = NULL;
+                goto done;
+            }
+            case '0': case '1': case '2': case '3': case '4':
+            case '5': case '6': case '7': case '8': case '9':
+                s = sl_matchcapture(ms, s, (unsigned char)*(p + 1));
+                if (s) {
+                    p += 2;
+                    continue;
+                }
+                goto done;
+            default:
+                goto dflt;
+            }
+        default:
+        dflt: {
+            const char *ep = sl_classend(ms, p);
+            if (!sl_singlematch(ms, s, p, ep)) {
+                if (*ep == '*' || *ep == '?' || *ep == '-') {
+                    p = ep + 1;
+                    continue;
+                }
+                s = NULL;
+            } else {
+                switch (*ep) {
+                case '?': {
+                    const char *res = sl_domatch(ms, s + 1, ep + 1);
+                    if (res) {
+                        s = res;
+                    } else {
+                        p = ep + 1;
+                        continue;
+                    }
+                    break;
+                }
+                case '+': s = sl_maxexpand(ms, s + 1, p, ep); break;
+                case '*': s = sl_maxexpand(ms, s, p, ep); break;
+                case '-': s = sl_minexpand(ms, s, p, ep); break;
+                default:
+                    s++;
+                    p = ep;
+                    continue;
+                }
+            }
+            goto done;
+        }
+        }
+    }
+done:
+    ms->depth++;
+    return s;
+}
+
+SL_API void sl_preparematch(sl_MatchState *ms, const sl_String *s, const sl_String *p) {
+    ms->src_init = s->data;
+    ms->src_end = s->data + s->len;
+    ms->p_end = p->data + p->len;
+    ms->level = 0;
+    ms->depth = 200;
+}
+
+SL_API sl_Value sl_getcapture(sl_MatchState *ms, int i, const char *s, const char *e) {
+    ptrdiff_t l;
+    if (i >= ms->level) {
+        if (i != 0) sl_error("invalid capture index %%%d", i + 1);
+        return sl_string(s, (size_t)(e - s));
+    }
+    l = ms->capture[i].len;
+    if (l == SL_CAP_UNFINISHED) sl_error("unfinished capture");
+    if (l == SL_CAP_POSITION) return sl_int(ms->capture[i].init - ms->src_init + 1);
+    return sl_string(ms->capture[i].init, (size_t)l);
+}
+
+/* Pushes the captures (or the whole match when there are none) */
+SL_API int sl_pushcaptures(sl_MatchState *ms, const char *s, const char *e, int wholeifnone) {
+    int n = ms->level == 0 && wholeifnone ? 1 : ms->level, i;
+    for (i = 0; i < n; i++) sl_push(sl_getcapture(ms, i, s, e));
+    return n;
+}
+
+SL_API const char *sl_memfind(const char *s, size_t ls, const char *p, size_t lp) {
+    if (lp == 0) return s;
+    while (ls >= lp) {
+        const char *q = (const char *)memchr(s, *p, ls - lp + 1);
+        if (!q) return NULL;
+        if (memcmp(q, p, lp) == 0) return q;
+        ls -= (size_t)(q + 1 - s);
+        s = q + 1;
+    }
+    return NULL;
+}
+
+SL_API int sl_strfindaux(sl_Func *self, sl_Value *args, int nargs, int find) {
+    sl_String *s = CHECKSTR(0), *p = CHECKSTR(1);
+    int64_t init = sl_startpos(OPTINT(2, 1), s->len);
+    sl_MatchState ms;
+    const char *pat = p->data, *s1;
+    int anchor;
+    if (init > (int64_t)s->len + 1) {
+        sl_push(sl_nil);
+        return 1;
+    }
+    if (find && (!sl_falsy(SL_ARG(3)) || !strpbrk(p->data, "^$*+?.([%-"))) {
+        const char *q = sl_memfind(s->data + init - 1, s->len - (size_t)(init - 1), p->data, p->len);
+        if (!q) {
+            sl_push(sl_nil);
+            return 1;
+        }
+        sl_push(sl_int(q - s->data + 1));
+        sl_push(sl_int((int64_t)(q - s->data) + (int64_t)p->len));
+        return 2;
+    }
+    sl_preparematch(&ms, s, p);
+    anchor = *pat == '^';
+    if (anchor) pat++;
+    s1 = s->data + init - 1;
+    do {
+        const char *e;
+        ms.level = 0;
+        e = sl_domatch(&ms, s1, pat);
+        if (e) {
+            if (find) {
+                sl_push(sl_int(s1 - s->data + 1));
+                sl_push(sl_int(e - s->data));
+                return 2 + sl_pushcaptures(&ms, NULL, NULL, 0);
+            }
+            return sl_pushcaptures(&ms, s1, e, 1);
+        }
+    } while (s1++ < ms.src_end && !anchor);
+    sl_push(sl_nil);
+    return 1;
+}
+
+SL_API int sl_strfind(sl_Func *self, sl_Value *args, int nargs) { return sl_strfindaux(self, args, nargs, 1); }
+SL_API int sl_strmatch(sl_Func *self, sl_Value *args, int nargs) { return sl_strfindaux(self, args, nargs, 0); }
+
+/* gmatch iterator state: subject, pattern, next offset, end of the last match */
+SL_API int sl_gmatchaux(sl_Func *self, sl_Value *args, int nargs) {
+    sl_String *s = sl_str(self->state[0]), *p = sl_str(self->state[1]);
+    sl_MatchState ms;
+    const char *src;
+    (void)args;
+    (void)nargs;
+    sl_preparematch(&ms, s, p);
+    for (src = s->data + self->state[2].u.i; src <= ms.src_end; src++) {
+        const char *e;
+        ms.level = 0;
+        e = sl_domatch(&ms, src, p->data);
+        /* An empty match right after the previous one does not count */
+        if (e && e - s->data != self->state[3].u.i) {
+            self->state[2] = sl_int(e - s->data);
+            self->state[3] = self->state[2];
+            return sl_pushcaptures(&ms, src, e, 1);
+        }
+    }
+    self->state[2] = sl_int((int64_t)s->len + 1);
+    sl_push(sl_nil);
+    return 1;
+}
+
+SL_API int sl_strgmatch(sl_Func *self, sl_Value *args, int nargs) {
+    sl_String *s = CHECKSTR(0), *p = CHECKSTR(1);
+    sl_Func *iter = sl_newfunc(sl_gmatchaux, 0, "gmatch_aux");
+    iter->state[0] = sl_obj(SL_STR, s);
+    iter->state[1] = sl_obj(SL_STR, p);
+    iter->state[2] = sl_int(0);
+    iter->state[3] = sl_int(-1);
+    sl_push(sl_obj(SL_FUNC, iter));
+    return 1;
+}
+
+SL_API int sl_strgsub(sl_Func *self, sl_Value *args, int nargs) {
+    sl_String *src = CHECKSTR(0), *p = CHECKSTR(1);
+    sl_Value repl = SL_ARG(2);
+    int64_t maxn, n = 0;
+    sl_MatchState ms;
+    const char *pat = p->data, *s = src->data;
+    int anchor;
+    /* The result is built in a string on the stack so that it is freed if a
+       replacement function raises an error */
+    sl_Buffer b = {NULL, 0, 0};
+    if (sl_isnum(repl)) repl = sl_obj(SL_STR, CHECKSTR(2));
+    if (repl.type != SL_STR && repl.type != SL_TABLE && repl.type != SL_FUNC) {
+        sl_typeerror(self, args, nargs, 2, "string/function/table");
+    }
+    maxn = SL_ARG(3).type == SL_NIL ? (int64_t)src->len + 1 : CHECKINT(3);
+    sl_preparematch(&ms, src, p);
+    anchor = *pat == '^';
+    if (anchor) pat++;
+    while (n < maxn) {
+        const char *e;
+        ms.level = 0;
+        e = sl_domatch(&ms, s, pat);
+        if (e) {
+            n++;
+            if (repl.type == SL_STR) {
+                const sl_String *r = sl_str(repl);
+                size_t i;
+                for (i = 0; i < r->len; i++) {
+                    if (r->data[i] != SL_ESC) {
+                        sl_bufaddc(&b, r->data[i]);
+                        continue;
+                    }
+                    i++;
+                    if (i < r->len && r->data[i] == SL_ESC) {
+                        sl_bufaddc(&b, SL_ESC);
+                    } else if (i < r->len && isdigit((unsigned char)r->data[i])) {
+                        sl_Value cap = r->data[i] == '0' ? sl_string(s, (size_t)(e - s))
+                                                         : sl_getcapture(&ms, r->data[i] - '1', s, e);
+                        sl_addvalue(&b, cap);
+                    } else {
+                        free(b.data);
+                        sl_error("invalid use of '%%' in replacement string");
+                    }
+                }
+            } else {
+                sl_Value value;
+                if (repl.type == SL_TABLE) {
+                    value = sl_index(repl, sl_getcapture(&ms, 0, s, e));
+                } else {
+                    sl_Value *f = sl_top;
+                    int k, count = ms.level == 0 ? 1 : ms.level;
+                    sl_push(repl);
+                    for (k = 0; k < count; k++) sl_push(sl_getcapture(&ms, k, s, e));
+                    value = sl_call(f, count) > 0 ? f[0] : sl_nil;
+                    sl_top = f;
+                }
+                if (sl_falsy(value)) {
+                    sl_bufadd(&b, s, (size_t)(e - s)); /* Keep the original match */
+                } else if (value.type == SL_STR || sl_isnum(value)) {
+                    sl_addvalue(&b, value);
+                } else {
+                    free(b.data);
+                    sl_error("invalid replacement value (a %s)", sl_typename(value));
+                }
+            }
+        }
+        if (e && e > s) {
+            s = e;
+        } else if (s < ms.src_end) {
+            sl_bufaddc(&b, *s++);
+        } else {
+            break;
+        }
+        if (anchor) break;
+    }
+    sl_bufadd(&b, s, (size_t)(ms.src_end - s));
+    sl_push(sl_string(b.data ? b.data : "", b.len));
+    free(b.data);
+    sl_push(sl_int(n));
+    return 2;
+}
+)SLRT",
+R"SLRT(
+/* -- table -- */
+
+SL_API int sl_tinsert(sl_Func *self, sl_Value *args, int nargs) {
+    sl_Table *t = CHECKTABLE(0);
+    int64_t e = sl_tlen(t) + 1, pos, i;
+    if (nargs == 2) {
+        sl_tsetint(t, e, args[1]);
+        return 0;
+    }
+    if (nargs != 3) sl_error("wrong number of arguments to 'insert'");
+    pos = CHECKINT(1);
+    if (pos < 1 || pos > e) sl_argerror(self, 1, "position out of bounds");
+    for (i = e; i > pos; i--) sl_tsetint(t, i, sl_tgetint(t, i - 1));
+    sl_tsetint(t, pos, args[2]);
+    return 0;
+}
+
+SL_API int sl_tremove(sl_Func *self, sl_Value *args, int nargs) {
+    sl_Table *t = CHECKTABLE(0);
+    int64_t size = sl_tlen(t);
+    int64_t pos = OPTINT(1, size);
+    sl_Value removed;
+    if (nargs > 1 && size + 1 != pos && (pos < 1 || pos > size + 1)) sl_argerror(self, 1, "position out of bounds");
+    removed = sl_tgetint(t, pos);
+    for (; pos < size; pos++) sl_tsetint(t, pos, sl_tgetint(t, pos + 1));
+    if (pos <= size || nargs > 1) sl_tsetint(t, pos, sl_nil);
+    sl_push(removed);
+    return 1;
+}
+
+SL_API int sl_tconcat(sl_Func *self, sl_Value *args, int nargs) {
+    sl_Table *t = CHECKTABLE(0);
+    sl_String *sep = SL_ARG(1).type == SL_NIL ? NULL : CHECKSTR(1);
+    int64_t i = OPTINT(2, 1);
+    int64_t j = SL_ARG(3).type == SL_NIL ? sl_tlen(t) : CHECKINT(3), k;
+    sl_Buffer b = {NULL, 0, 0};
+    for (k = i; k <= j; k++) {
+        sl_Value v = sl_tgetint(t, k);
+        if (v.type != SL_STR && !sl_isnum(v)) {
+            free(b.data);
+            sl_error("invalid value (at index %lld) in table for 'concat'", (long long)k);
+        }
+        sl_addvalue(&b, v);
+        if (k < j && sep) sl_bufadd(&b, sep->data, sep->len);
+    }
+    sl_push(sl_string(b.data ? b.data : "", b.len));
+    free(b.data);
+    return 1;
+}
+
+SL_API int sl_tunpack(sl_Func *self, sl_Value *args, int nargs) {
+    sl_Table *t = CHECKTABLE(0);
+    int64_t i = OPTINT(1, 1);
+    int64_t j = SL_ARG(2).type == SL_NIL ? sl_tlen(t) : CHECKINT(2), k;
+    if (i > j) return 0;
+    if (j - i >= SL_STACKSIZE) sl_error("too many results to unpack");
+    sl_checkstack((int)(j - i + 1));
+    for (k = i; k <= j; k++) *sl_top++ = sl_tgetint(t, k);
+    return (int)(j - i + 1);
+}
+
+SL_API int sl_sortless(sl_Value comp, sl_Value x, sl_Value y) {
+    if (comp.type == SL_NIL) return sl_lessthan(x, y);
+    return !sl_falsy(sl_call1(comp, 2, x, y, sl_nil));
+}
+
+/* Merge sort over a copy on the value stack: a comparator that errors or is
+   inconsistent cannot corrupt the table */
+SL_API void sl_mergesort(sl_Value *v, sl_Value *tmp, size_t lo, size_t hi, sl_Value comp) {
+    size_t mid, i, j, k;
+    if (hi - lo < 2) return;
+    mid = lo + (hi - lo) / 2;
+    sl_mergesort(v, tmp, lo, mid, comp);
+    sl_mergesort(v, tmp, mid, hi, comp);
+    i = lo;
+    j = mid;
+    k = lo;
+    while (i < mid && j < hi) {
+        if (sl_sortless(comp, v[j], v[i])) tmp[k++] = v[j++];
+        else tmp[k++] = v[i++];
+    }
+    while (i < mid) tmp[k++] = v[i++];
+    while (j < hi) tmp[k++] = v[j++];
+    for (k = lo; k < hi; k++) v[k] = tmp[k];
+}
+
+SL_API int sl_tsort(sl_Func *self, sl_Value *args, int nargs) {
+    sl_Table *t = CHECKTABLE(0);
+    sl_Value comp = SL_ARG(1), *v;
+    int64_t n = sl_tlen(t), i;
+    if (comp.type != SL_NIL && comp.type != SL_FUNC) sl_typeerror(self, args, nargs, 1, "function");
+    if (n * 2 >= SL_STACKSIZE) sl_error("array too big");
+    sl_checkstack((int)(n * 2));
+    v = sl_top;
+    for (i = 0; i < n; i++) v[i] = v[n + i] = sl_tgetint(t, i + 1);
+    sl_top += n * 2;
+    sl_mergesort(v, v + n, 0, (size_t)n, comp);
+    for (i = 0; i < n; i++) sl_tsetint(t, i + 1, v[i]);
+    sl_top = v;
+    return 0;
+}
+
+/* -- os / io -- */
+
+SL_API int sl_osclock(sl_Func *self, sl_Value *args, int nargs) {
+    (void)self;
+    (void)args;
+    (void)nargs;
+    sl_push(sl_flt((double)clock() / CLOCKS_PER_SEC));
+    return 1;
+}
+
+SL_API int sl_ostime(sl_Func *self, sl_Value *args, int nargs) {
+    (void)self;
+    (void)args;
+    (void)nargs;
+    sl_push(sl_int((int64_t)time(NULL)));
+    return 1;
+}
+
+SL_API int sl_iowrite(sl_Func *self, sl_Value *args, int nargs) {
+    int i;
+    for (i = 0; i < nargs; i++) {
+        if (args[i].type == SL_FLT) {
+            /* Unlike tostring(), io.write prints floats without a ".0" suffix */
+            char buf[64];
+            sprintf(buf, "%.14g", args[i].u.n);
+            sl_write(buf, strlen(buf));
+        } else {
+            sl_String *s = CHECKSTR(i);
+            sl_write(s->data, s->len);
+        }
+    }
+    return 0;
+}
+
+/* ---- Setup ---- */
+
+typedef struct sl_Reg {
+    const char *name;
+    sl_Fn fn;
+} sl_Reg;
+
+SL_API sl_Func *sl_setfunc(sl_Table *t, const char *field, const char *name, sl_Fn fn) {
+    sl_Func *f = sl_newfunc(fn, 0, name);
+    f->gc.fixed = 1;
+    sl_tset(t, sl_const(field, strlen(field)), sl_obj(SL_FUNC, f));
+    return f;
+}
+
+/* Library functions are named "lib.name" in error messages; the name lives
+   in a fixed string */
+SL_API sl_Table *sl_openlib(const char *lib, const sl_Reg *reg) {
+    sl_Table *t = sl_newtable_();
+    t->gc.fixed = 1;
+    sl_tset(sl_globals, sl_const(lib, strlen(lib)), sl_obj(SL_TABLE, t));
+    for (; reg->name; reg++) {
+        char name[64];
+        snprintf(name, sizeof(name), "%s.%s", lib, reg->name);
+        sl_setfunc(t, reg->name, sl_str(sl_const(name, strlen(name)))->data, reg->fn);
+    }
+    return t;
+}
+
+static const sl_Reg sl_mathlib[] = {
+    {"floor", sl_mathfloor}, {"ceil", sl_mathceil}, {"abs", sl_mathabs}, {"max", sl_mathmax},
+    {"min", sl_mathmin}, {"sqrt", sl_mathsqrt}, {"sin", sl_mathsin}, {"cos", sl_mathcos},
+    {"tan", sl_mathtan}, {"asin", sl_mathasin}, {"acos", sl_mathacos}, {"atan", sl_mathatan},
+    {"exp", sl_mathexp}, {"log", sl_mathlog}, {"fmod", sl_mathfmod}, {"modf", sl_mathmodf},
+    {"tointeger", sl_mathtointeger}, {"type", sl_mathtype}, {"random", sl_mathrandom},
+    {"randomseed", sl_mathrandomseed}, {NULL, NULL}
+};
+
+static const sl_Reg sl_stringlib[] = {
+    {"len", sl_strlen}, {"sub", sl_strsub}, {"upper", sl_strupper}, {"lower", sl_strlower},
+    {"rep", sl_strrep}, {"reverse", sl_strreverse}, {"byte", sl_strbyte}, {"char", sl_strchar},
+    {"format", sl_strformat}, {"find", sl_strfind}, {"match", sl_strmatch}, {"gmatch", sl_strgmatch},
+    {"gsub", sl_strgsub}, {NULL, NULL}
+};
+
+static const sl_Reg sl_tablelib[] = {
+    {"insert", sl_tinsert}, {"remove", sl_tremove}, {"concat", sl_tconcat}, {"sort", sl_tsort},
+    {"unpack", sl_tunpack}, {NULL, NULL}
+};
+
+static const sl_Reg sl_oslib[] = {{"clock", sl_osclock}, {"time", sl_ostime}, {NULL, NULL}};
+static const sl_Reg sl_iolib[] = {{"write", sl_iowrite}, {NULL, NULL}};
+
+static const sl_Reg sl_baselib[] = {
+    {"print", sl_print}, {"type", sl_type}, {"tostring", sl_tostring}, {"tonumber", sl_tonumber_},
+    {"next", sl_next}, {"select", sl_select}, {"error", sl_error_}, {"assert", sl_assert},
+    {"pcall", sl_pcall}, {"rawget", sl_rawget}, {"rawset", sl_rawset}, {"rawequal", sl_rawequal_},
+    {"rawlen", sl_rawlen}, {"setmetatable", sl_setmetatable}, {"getmetatable", sl_getmetatable},
+    {NULL, NULL}
+};
+
+SL_API void sl_init(const char *chunkname) {
+    static const char *const events[SL_NUMEVENTS] = {
+        "__index", "__newindex", "__call", "__tostring", "__len", "__eq", "__lt", "__le",
+        "__concat", "__add", "__sub", "__mul", "__div", "__mod", "__idiv", "__pairs", "__metatable"
+    };
+    const sl_Reg *reg;
+    sl_Table *math;
+    sl_Value next;
+    int i;
+    sl_chunkname = chunkname;
+    sl_stack = (sl_Value *)sl_alloc(SL_STACKSIZE * sizeof(sl_Value));
+    sl_top = sl_stack;
+    sl_stacklast = sl_stack + SL_STACKSIZE;
+    sl_frames = NULL;
+    sl_depth = 0;
+    sl_catch = NULL;
+    sl_errval = sl_nil;
+    sl_openuv = NULL;
+    sl_objects = NULL;
+    sl_gccount = 0;
+    sl_gcthreshold = SL_GCMIN;
+    sl_strtab = NULL;
+    sl_strcap = 0;
+    sl_strcount = 0;
+    sl_strresize(1024);
+    for (i = 0; i < SL_NUMEVENTS; i++) sl_ev[i] = sl_str(sl_const(events[i], strlen(events[i])));
+
+    sl_globals = sl_newtable_();
+    sl_strmeta = sl_newtable_();
+    sl_globals->gc.fixed = 1;
+    sl_strmeta->gc.fixed = 1;
+    sl_tset(sl_globals, sl_const("_G", 2), sl_obj(SL_TABLE, sl_globals));
+    sl_tset(sl_globals, sl_const("_VERSION", 8), sl_const("Lua 5.3", 7));
+    for (reg = sl_baselib; reg->name; reg++) sl_setfunc(sl_globals, reg->name, reg->name, reg->fn);
+    next = sl_tgetstr(sl_globals, sl_str(sl_const("next", 4)));
+    sl_setfunc(sl_globals, "pairs", "pairs", sl_pairs)->state[0] = next;
+    sl_setfunc(sl_globals, "ipairs", "ipairs", sl_ipairs)->state[0] =
+        sl_obj(SL_FUNC, sl_newfunc(sl_ipairsaux, 0, "ipairs_aux"));
+
+    math = sl_openlib("math", sl_mathlib);
+    sl_tset(math, sl_const("pi", 2), sl_flt(3.141592653589793238462643383279502884));
+    sl_tset(math, sl_const("huge", 4), sl_flt(HUGE_VAL));
+    sl_tset(math, sl_const("maxinteger", 10), sl_int(INT64_MAX));
+    sl_tset(math, sl_const("mininteger", 10), sl_int(INT64_MIN));
+    sl_tset(sl_strmeta, sl_const("__index", 7), sl_obj(SL_TABLE, sl_openlib("string", sl_stringlib)));
+    sl_openlib("table", sl_tablelib);
+    sl_openlib("os", sl_oslib);
+    sl_openlib("io", sl_iolib);
+    sl_randstate = 0x2545F4914F6CDD1DULL;
+}
+
+SL_API void sl_freeall(void) {
+    while (sl_objects) {
+        sl_GC *next = sl_objects->next;
+        sl_freeobj(sl_objects);
+        sl_objects = next;
+    }
+    free(sl_strtab);
+    free(sl_gray);
+    free(sl_stack);
+    sl_strtab = NULL;
+    sl_gray = NULL;
+    sl_graycount = sl_graycap = 0;
+    sl_stack = NULL;
+}
+
+/* Runs a compiled main chunk after `load` has created its constants; errors
+   are reported on stderr */
+SL_API int sl_run(sl_Fn main, void (*load)(void), const char *chunkname) {
+    sl_Catch c;
+    volatile int status = 0;
+    sl_init(chunkname);
+    load();
+    c.prev = NULL;
+    c.depth = 0;
+    sl_catch = &c;
+    if (setjmp(c.jb) == 0) {
+        sl_Func *f = sl_newfunc(main, 0, NULL);
+        sl_push(sl_obj(SL_FUNC, f));
+        sl_call(sl_top - 1, 0);
+    } else {
+        sl_String *msg = sl_errval.type == SL_STR || sl_isnum(sl_errval) ? sl_tostr(sl_errval) : NULL;
+        fflush(stdout);
+        fprintf(stderr, "Error: %s\n", msg ? msg->data : "(error object is not a string)");
+        status = 1;
+    }
+    fflush(stdout);
+    sl_catch = NULL;
+    sl_freeall();
+    return status;
+}
+)SLRT",
+nullptr
+};
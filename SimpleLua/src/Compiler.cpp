@@ -1,16 +1,129 @@
 #include "Compiler.h"
 #include <stdexcept>
 #include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
 #include <iostream>
+#include <map>
+
+// Constant for a numeral: hex numerals and decimal ones without a point are
+// integers (hex wraps around, decimal falls back to a float when it
+// overflows, as in Lua 5.3); the rest are floats
+static Value numberConstant(const std::string& text) {
+    if (text.size() >= 2 && (text[1] == 'x' || text[1] == 'X')) {
+        if (text.size() == 2) throw std::runtime_error("Malformed number: " + text);
+        uint64_t v = 0;
+        for (size_t i = 2; i < text.size(); ++i) {
+            char ch = text[i];
+            int digit = ch <= '9' ? ch - '0' : (ch | 0x20) - 'a' + 10;
+            v = v * 16 + (uint64_t)digit;
+        }
+        return Value((int64_t)v);
+    }
+    if (text.find('.') == std::string::npos) {
+        uint64_t v = 0;
+        bool fits = true;
+        for (char ch : text) {
+            uint64_t digit = (uint64_t)(ch - '0');
+            if (v > ((uint64_t)INT64_MAX - digit) / 10) {
+                fits = false;
+                break;
+            }
+            v = v * 10 + digit;
+        }
+        if (fits) return Value((int64_t)v);
+    }
+    return Value(std::stod(text));
+}
 
-Compiler::Compiler() : currentTokenIdx(0), current(nullptr) {}
+// Integer-specialized form of an arithmetic opcode, or the opcode itself
+static OpCode integerForm(OpCode op) {
+    switch (op) {
+    case OP_ADD: return OP_ADD_INT;
+    case OP_SUB: return OP_SUB_INT;
+    case OP_MUL: return OP_MUL_INT;
+    case OP_IDIV: return OP_IDIV_INT;
+    case OP_MOD: return OP_MOD_INT;
+    default: return op;
+    }
+}
+
+// The number a constant load puts in its register, if it loads one
+static bool loadedNumber(const Prototype* proto, const Instruction& inst, double& out) {
+    switch (inst.op) {
+    case OP_LOADK:
+        if (!is_number(proto->constants[inst.b])) return false;
+        out = as_number(proto->constants[inst.b]);
+        return true;
+    case OP_LOADI: case OP_LOADF:
+        out = inst.b;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Clears the integer facts about registers an instruction writes
+static void clearWritten(std::bitset<256>& regs, const Instruction& inst) {
+    auto clear = [&regs](int from, int to) {
+        for (int r = std::max(from, 0); r <= to && r < 256; ++r) regs[r] = false;
+    };
+    switch (inst.op) {
+    case OP_SETGLOBAL: case OP_SETTABLE: case OP_SETUPVAL: case OP_JMP: case OP_JMP_FALSE: case OP_JMP_TRUE:
+    case OP_RETURN:
+        break;
+    case OP_CALL:
+        clear(inst.a, inst.a + inst.c - 2);
+        break;
+    case OP_VARARG:
+        clear(inst.a, inst.c > 0 ? inst.a + inst.c - 2 : 255);
+        break;
+    case OP_FORLOOP: case OP_FORLOOP_UP: case OP_FORLOOP_DOWN:
+        clear(inst.a, inst.a);
+        clear(inst.a + 3, inst.a + 3);
+        break;
+    case OP_TFORCALL: case OP_TFORIPAIRS: case OP_TFORPAIRS:
+        clear(inst.a + 3, inst.a + 2 + inst.c);
+        break;
+    case OP_LOADNIL:
+        clear(inst.a, inst.a + inst.b);
+        break;
+    default:
+        clear(inst.a, inst.a);
+        break;
+    }
+}
+
+Compiler::Compiler(const CompilerOptions& options)
+    : options(options), currentTokenIdx(0), current(nullptr), callResultSlots(1) {}
 
 std::unique_ptr<Prototype> Compiler::compile(const std::string& source) {
     Lexer lexer(source);
     tokens = lexer.tokenize();
+
+    // Integer specialization trusts locals that are never assigned after
+    // their declaration. Assignments can follow the uses they invalidate, so
+    // when the first pass relied on a local that turns out to be assigned,
+    // compile again knowing all of them.
+    reassignedLocals.clear();
+    integerLocals.clear();
+    std::unique_ptr<Prototype> proto = compileChunk();
+    bool stale = false;
+    for (int decl : integerLocals) stale = stale || reassignedLocals.count(decl) > 0;
+    if (stale) {
+        integerLocals.clear();
+        proto = compileChunk();
+    }
+    return proto;
+}
+
+std::unique_ptr<Prototype> Compiler::compileChunk() {
     currentTokenIdx = 0;
+    inlinedCalls = 0;
 
     auto topProto = std::make_unique<Prototype>();
+    topProto->name = "main";
     auto topState = std::make_unique<CompilerState>(nullptr, topProto.get());
     current = topState.get();
 
@@ -51,10 +164,11 @@ Token Compiler::consume(TokenType type, const std::string& errorMessage) {
 
 void Compiler::parseStatement() {
     parseStatementImpl();
-    current->allocatedRegs.reset();
+    current->allocatedRegs = current->pinnedRegs;
     for (const auto& kv : current->locals) {
         current->allocatedRegs[kv.second] = true;
     }
+    pruneBindings();
 }
 
 void Compiler::parseStatementImpl() {
@@ -63,21 +177,32 @@ void Compiler::parseStatementImpl() {
             Token name = consume(TokenType::ID, "Expect function name after 'local function'");
             current->locals[name.value] = allocateRegister();
             int varReg = current->locals[name.value];
-            int funcReg = parseFunctionExpression();
+            int paren = currentTokenIdx;
+            int funcReg = parseFunctionExpression(name.value);
             if (varReg != funcReg) {
                 emit(Instruction(OP_MOVE, varReg, funcReg, 0));
             }
+            noteInlineFunction(name.value, paren);
         } else {
             std::vector<std::string> names;
+            std::vector<int> declTokens;
             do {
                 names.push_back(consume(TokenType::ID, "Expect variable name after 'local'").value);
+                declTokens.push_back(currentTokenIdx - 1);
             } while (match(TokenType::COMMA));
+            if (names.size() == 1 && parseScalarTable(names[0])) {
+                if (match(TokenType::SEMICOLON)) {}
+                return;
+            }
 
             std::vector<int> exprRegs;
             if (match(TokenType::ASSIGN)) {
+                int outerSlots = callResultSlots;
+                callResultSlots = (int)names.size();
                 do {
                     exprRegs.push_back(parseExpression());
                 } while (match(TokenType::COMMA));
+                callResultSlots = outerSlots;
             }
 
             // Adjust results if last expression is a CALL and we need more values
@@ -105,12 +230,18 @@ void Compiler::parseStatementImpl() {
                 int varReg = current->locals[names[i]];
 
                 if (i < exprRegs.size()) {
+                    bool isInteger = current->intRegs[exprRegs[i]];
                     emit(Instruction(OP_MOVE, varReg, exprRegs[i], 0));
+                    declareLocal(varReg, declTokens[i], isInteger);
                 } else {
-                    int nilIdx = addConstant(Value(Nil{}));
-                    int nilReg = allocateRegister();
-                    emit(Instruction(OP_LOADK, nilReg, nilIdx));
-                    emit(Instruction(OP_MOVE, varReg, nilReg, 0));
+                    // Adjacent uninitialized locals share one LOADNIL
+                    Instruction& prev = current->proto->instructions.back();
+                    if (i > exprRegs.size() && prev.op == OP_LOADNIL && prev.a + prev.b + 1 == varReg) {
+                        prev.b++;
+                        current->intRegs[varReg] = false;
+                    } else {
+                        emit(Instruction(OP_LOADNIL, varReg, 0));
+                    }
                 }
             }
         }
@@ -138,6 +269,11 @@ void Compiler::parseStatementImpl() {
             advance();
             // Direct assignment: ID = expr
             if (match(TokenType::ASSIGN)) {
+                if (current->stringBuffers.count(t.value) && peek().type == TokenType::ID &&
+                    peek().value == t.value && tokens[currentTokenIdx + 1].type == TokenType::DOTDOT) {
+                    parseBufferAppend(t);
+                    return;
+                }
                 int exprReg = parseExpression();
                 parseVariable(t, true, exprReg);
                 if (match(TokenType::SEMICOLON)) {}
@@ -145,21 +281,34 @@ void Compiler::parseStatementImpl() {
             }
 
             // Prefix expression (l-value or call)
-            int valReg;
-            int localReg = resolveLocal(current, t.value);
-            if (localReg != -1) {
-                valReg = localReg;
-            } else {
-                int upvalIdx = resolveUpvalue(current, t.value);
-                if (upvalIdx != -1) {
-                    valReg = allocateRegister();
-                    emit(Instruction(OP_GETUPVAL, valReg, upvalIdx, 0));
-                } else {
-                    valReg = allocateRegister();
-                    int nameIdx = addConstant(t.value);
-                    emit(Instruction(OP_GETGLOBAL, valReg, nameIdx));
+            auto table = current->scalarTables.find(t.value);
+            if (table != current->scalarTables.end() && tokens[currentTokenIdx + 2].type == TokenType::ASSIGN) {
+                // A field of a scalar table: a register of its own
+                int reg = table->second.at(tokens[currentTokenIdx + 1].value);
+                currentTokenIdx += 3;
+                int rVal = parseExpression();
+                if (rVal != reg) emit(Instruction(OP_MOVE, reg, rVal, 0));
+                if (match(TokenType::SEMICOLON)) {}
+                return;
+            }
+            int valReg = loadScalarField(t.value);
+            if (valReg == -1) valReg = loadHoisted(t.value);
+            if (valReg == -1 && peek().type == TokenType::LPAREN) {
+                // A call standing alone, its result unused
+                int close = currentTokenIdx;
+                for (int depth = 0; close < (int)tokens.size(); ++close) {
+                    if (tokens[close].type == TokenType::LPAREN) depth++;
+                    if (tokens[close].type == TokenType::RPAREN && --depth == 0) break;
+                }
+                TokenType after = close + 1 < (int)tokens.size() ? tokens[close + 1].type : TokenType::END_OF_FILE;
+                bool alone = after != TokenType::DOT && after != TokenType::LBRACKET &&
+                             after != TokenType::LPAREN && after != TokenType::COLON;
+                if (alone && parseInlineCall(t.value, nullptr)) {
+                    if (match(TokenType::SEMICOLON)) {}
+                    return;
                 }
             }
+            if (valReg == -1 && !parseInlineCall(t.value, &valReg)) valReg = loadVariable(t.value);
 
             while (true) {
                 if (match(TokenType::DOT)) {
@@ -250,6 +399,7 @@ void Compiler::parseStatementImpl() {
 }
 
 void Compiler::parseVariable(Token name, bool isAssignment, int rValueReg) {
+    if (isAssignment) noteAssignment(name.value);
     int localReg = resolveLocal(current, name.value);
     if (localReg != -1) {
         if (isAssignment) {
@@ -271,16 +421,39 @@ void Compiler::parseVariable(Token name, bool isAssignment, int rValueReg) {
     }
 }
 
+// Records an assignment to the local `name` resolves to, in this function or
+// an enclosing one
+void Compiler::noteAssignment(const std::string& name) {
+    for (CompilerState* state = current; state; state = state->enclosing) {
+        auto it = state->locals.find(name);
+        if (it == state->locals.end()) continue;
+        auto decl = state->localDecls.find(it->second);
+        if (decl != state->localDecls.end()) reassignedLocals.insert(decl->second);
+        return;
+    }
+}
+
+// Registers the local just stored in `reg`; it counts as an integer if its
+// initial value is one and it is never assigned again
+void Compiler::declareLocal(int reg, int declToken, bool isInteger) {
+    current->localDecls[reg] = declToken;
+    current->intRegs[reg] = isInteger && !reassignedLocals.count(declToken);
+    if (current->intRegs[reg]) integerLocals.insert(declToken);
+}
+
 void Compiler::parseFunctionStatement() {
     Token name = consume(TokenType::ID, "Expect function name");
     consume(TokenType::LPAREN, "Expect '('");
 
     auto fnProto = std::make_unique<Prototype>();
     Prototype* fnProtoPtr = fnProto.get();
+    fnProtoPtr->name = name.value;
+    fnProtoPtr->lineDefined = name.line;
     current->proto->protos.push_back(std::move(fnProto));
     int protoIdx = (int)current->proto->protos.size() - 1;
 
     auto fnState = std::make_unique<CompilerState>(current, fnProtoPtr);
+    fnState->firstToken = currentTokenIdx;
     CompilerState* parent = current;
     current = fnState.get();
 
@@ -312,6 +485,7 @@ void Compiler::parseFunctionStatement() {
     resolveGotos();
 
     current = parent;
+    protoIdx = mergeFunction(protoIdx);
 
     int reg = allocateRegister();
     emit(Instruction(OP_CLOSURE, reg, protoIdx));
@@ -320,15 +494,18 @@ void Compiler::parseFunctionStatement() {
     emit(Instruction(OP_SETGLOBAL, reg, nameIdx));
 }
 
-int Compiler::parseFunctionExpression() {
-    consume(TokenType::LPAREN, "Expect '('");
+int Compiler::parseFunctionExpression(const std::string& name) {
+    Token paren = consume(TokenType::LPAREN, "Expect '('");
 
     auto fnProto = std::make_unique<Prototype>();
     Prototype* fnProtoPtr = fnProto.get();
+    fnProtoPtr->name = name;
+    fnProtoPtr->lineDefined = paren.line;
     current->proto->protos.push_back(std::move(fnProto));
     int protoIdx = (int)current->proto->protos.size() - 1;
 
     auto fnState = std::make_unique<CompilerState>(current, fnProtoPtr);
+    fnState->firstToken = currentTokenIdx;
     CompilerState* parent = current;
     current = fnState.get();
 
@@ -353,13 +530,308 @@ int Compiler::parseFunctionExpression() {
     resolveGotos();
 
     current = parent;
+    protoIdx = mergeFunction(protoIdx);
 
     int reg = allocateRegister();
     emit(Instruction(OP_CLOSURE, reg, protoIdx));
     return reg;
 }
 
+// Hash of what a prototype does: its code, constants, parameters, upvalue
+// descriptors and nested prototypes, but not its name or source lines
+static size_t structuralHash(const Prototype* proto) {
+    size_t h = std::hash<int>()(proto->numParams);
+    auto mix = [&h](size_t v) { h ^= v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2); };
+    for (const Instruction& inst : proto->instructions) {
+        mix(inst.op);
+        mix((size_t)inst.a);
+        mix((size_t)inst.b);
+        mix((size_t)inst.c);
+    }
+    for (const Value& k : proto->constants) {
+        if (is_string(k)) mix(std::hash<std::string>()(as_string_ref(k)));
+        if (is_number(k)) mix(std::hash<double>()(as_number(k)));
+    }
+    for (const UpvalueInfo& up : proto->upvalues) mix((size_t)up.index * 2 + up.isLocal);
+    for (const auto& child : proto->protos) mix(structuralHash(child.get()));
+    return h;
+}
+
+// Constants are the same only with the same subtype and bits: 1 and 1.0, or
+// 0.0 and -0.0, compile to different code
+static bool sameConstant(const Value& x, const Value& y) {
+    if (is_number(x) && is_number(y)) {
+        if (is_integer(x) != is_integer(y)) return false;
+        if (is_integer(x)) return as_integer(x) == as_integer(y);
+        double dx = as_number(x), dy = as_number(y);
+        return std::memcmp(&dx, &dy, sizeof dx) == 0;
+    }
+    return x == y;
+}
+
+static bool sameFunction(const Prototype* x, const Prototype* y) {
+    if (x->numParams != y->numParams || x->instructions.size() != y->instructions.size() ||
+        x->constants.size() != y->constants.size() || x->upvalues.size() != y->upvalues.size() ||
+        x->protos.size() != y->protos.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < x->instructions.size(); ++i) {
+        const Instruction& a = x->instructions[i];
+        const Instruction& b = y->instructions[i];
+        if (a.op != b.op || a.a != b.a || a.b != b.b || a.c != b.c) return false;
+    }
+    for (size_t i = 0; i < x->constants.size(); ++i) {
+        if (!sameConstant(x->constants[i], y->constants[i])) return false;
+    }
+    for (size_t i = 0; i < x->upvalues.size(); ++i) {
+        if (x->upvalues[i].isLocal != y->upvalues[i].isLocal || x->upvalues[i].index != y->upvalues[i].index) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < x->protos.size(); ++i) {
+        if (!sameFunction(x->protos[i].get(), y->protos[i].get())) return false;
+    }
+    return true;
+}
+
+// With the function just compiled as nested prototype `protoIdx`, the last
+// of the current function's: if an earlier one compiled to the same code,
+// constants and upvalues (such as a comparator written out at several
+// calls), drops the new one and returns the index of the earlier, so that
+// both closures are made from one prototype and the backends emit it once.
+// Errors in either then report the earlier one's lines.
+int Compiler::mergeFunction(int protoIdx) {
+    if (!options.mergeFunctions) return protoIdx;
+    std::vector<std::unique_ptr<Prototype>>& protos = current->proto->protos;
+    size_t hash = structuralHash(protos[protoIdx].get());
+    for (int i = 0; i < protoIdx; ++i) {
+        if (current->protoHashes[i] == hash && sameFunction(protos[i].get(), protos[protoIdx].get())) {
+            protos.pop_back();
+            return i;
+        }
+    }
+    current->protoHashes.push_back(hash);
+    return protoIdx;
+}
+
+// Records the local function `name`, just declared with its parameter list
+// opening at token `paren`, as one to compile in place at its calls if it is
+// small and simple enough and never assigned again: a body within the
+// inline budget, no nested function, varargs or goto, no call of itself, and
+// no return of several values. Its body is compiled seeing the locals it
+// sees here, at calls where none of them is shadowed, so that its upvalues
+// are the same variables.
+void Compiler::noteInlineFunction(const std::string& name, int paren) {
+    current->inlineFunctions.erase(name);
+    if (options.inlineBudget <= 0) return;
+
+    InlineFunction fn;
+    fn.reg = current->locals[name];
+    fn.endToken = currentTokenIdx - 1;
+    fn.returns = false;
+    int i = paren + 1;
+    for (; tokens[i].type == TokenType::ID || tokens[i].type == TokenType::COMMA; ++i) {
+        if (tokens[i].type == TokenType::ID) fn.params.push_back(tokens[i].value);
+    }
+    if (tokens[i].type != TokenType::RPAREN) return; // Varargs
+    fn.bodyToken = i + 1;
+    if (fn.endToken - fn.bodyToken > options.inlineBudget) return;
+
+    int depth = 0;
+    for (i = fn.bodyToken; i < fn.endToken; ++i) {
+        TokenType type = tokens[i].type;
+        if (type == TokenType::FUNCTION || type == TokenType::DOTDOTDOT || type == TokenType::GOTO ||
+            type == TokenType::DOUBLE_COLON) {
+            return;
+        } else if (type == TokenType::ID && tokens[i].value == name && tokens[i - 1].type != TokenType::DOT &&
+                   tokens[i - 1].type != TokenType::COLON) {
+            return;
+        } else if (type == TokenType::IF || type == TokenType::WHILE || type == TokenType::FOR) {
+            depth++;
+        } else if (type == TokenType::END) {
+            depth--;
+        } else if (type == TokenType::RETURN) {
+            // Its values run to the end of the block
+            fn.returns = fn.returns || depth == 0;
+            int brackets = 0;
+            for (int j = i + 1; j < fn.endToken; ++j) {
+                TokenType t = tokens[j].type;
+                if (t == TokenType::LPAREN || t == TokenType::LBRACE || t == TokenType::LBRACKET) brackets++;
+                if (t == TokenType::RPAREN || t == TokenType::RBRACE || t == TokenType::RBRACKET) brackets--;
+                if (brackets > 0) continue;
+                if (t == TokenType::COMMA) return;
+                if (t == TokenType::END || t == TokenType::ELSE || t == TokenType::ELSEIF ||
+                    t == TokenType::SEMICOLON) {
+                    break;
+                }
+            }
+        }
+    }
+
+    // Nor may the local be assigned another function later in its scope
+    depth = 0;
+    for (i = fn.endToken + 1; i < (int)tokens.size() && depth >= 0; ++i) {
+        TokenType type = tokens[i].type;
+        if (type == TokenType::IF || type == TokenType::WHILE || type == TokenType::FOR ||
+            type == TokenType::FUNCTION) {
+            depth++;
+        } else if (type == TokenType::END) {
+            depth--;
+        } else if (type == TokenType::ID && tokens[i].value == name && tokens[i + 1].type == TokenType::ASSIGN &&
+                   tokens[i - 1].type != TokenType::DOT && tokens[i - 1].type != TokenType::COLON) {
+            return;
+        }
+    }
+
+    for (const auto& local : current->locals) {
+        if (local.first[0] != '(') fn.scope.insert(local);
+    }
+    current->inlineFunctions[name] = fn;
+}
+
+// Forgets the inlinable functions and scalar tables whose locals went out of
+// scope or were shadowed, before their registers can be reused
+void Compiler::pruneBindings() {
+    if (current->inlineSite) return; // The body sees its own scope
+    auto it = current->inlineFunctions.begin();
+    while (it != current->inlineFunctions.end()) {
+        auto local = current->locals.find(it->first);
+        if (local == current->locals.end() || local->second != it->second.reg) {
+            it = current->inlineFunctions.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    auto table = current->scalarTables.begin();
+    while (table != current->scalarTables.end()) {
+        auto local = current->locals.find(table->first);
+        bool visible = false;
+        for (const auto& field : table->second) {
+            visible = visible || (local != current->locals.end() && local->second == field.second);
+        }
+        if (!visible) {
+            table = current->scalarTables.erase(table);
+        } else {
+            ++table;
+        }
+    }
+}
+
+// With the name `name` just consumed: if it is an inlinable local function
+// called here with one result wanted, compiles its body in place of the
+// call, consuming the arguments, and stores the register of the result in
+// `resultReg` (left alone for a null one, when the result is unused).
+bool Compiler::parseInlineCall(const std::string& name, int* resultReg) {
+    const int kMaxInlineDepth = 3;
+    if (peek().type != TokenType::LPAREN || callResultSlots != 1 || inlineDepth >= kMaxInlineDepth) return false;
+    auto found = current->inlineFunctions.find(name);
+    auto local = current->locals.find(name);
+    if (found == current->inlineFunctions.end() || local == current->locals.end() ||
+        local->second != found->second.reg) {
+        return false;
+    }
+    const InlineFunction fn = found->second;
+    for (const auto& kv : fn.scope) {
+        auto visible = current->locals.find(kv.first);
+        if (visible == current->locals.end() || visible->second != kv.second) return false;
+    }
+    advance();
+
+    std::vector<int> args;
+    if (!match(TokenType::RPAREN)) {
+        do {
+            args.push_back(parseExpression());
+        } while (match(TokenType::COMMA));
+        consume(TokenType::RPAREN, "Expect ')' after arguments");
+    }
+    int resumeToken = currentTokenIdx;
+
+    // Parameters take over argument temporaries; locals passed are copied
+    std::unordered_set<int> localRegs;
+    for (const auto& kv : current->locals) localRegs.insert(kv.second);
+    std::vector<int> paramRegs;
+    for (size_t i = 0; i < fn.params.size(); ++i) {
+        int reg;
+        if (i < args.size() && !localRegs.count(args[i])) {
+            reg = args[i];
+            localRegs.insert(reg);
+        } else {
+            reg = allocateRegister();
+            if (i < args.size()) {
+                emit(Instruction(OP_MOVE, reg, args[i], 0));
+            } else {
+                emit(Instruction(OP_LOADNIL, reg, 0));
+            }
+        }
+        current->intRegs[reg] = false;
+        current->localDecls.erase(reg);
+        paramRegs.push_back(reg);
+    }
+
+    InlineSite site;
+    site.resultReg = resultReg ? allocateRegister() : -1;
+    site.endToken = fn.endToken;
+    if (site.resultReg != -1 && !fn.returns) emit(Instruction(OP_LOADNIL, site.resultReg, 0));
+
+    // The body sees the scope of the declaration; the caches and constants
+    // of the loops around the call, and its scalar tables, are the caller's
+    std::unordered_map<std::string, int> callerLocals = fn.scope;
+    std::swap(callerLocals, current->locals);
+    for (size_t i = 0; i < fn.params.size(); ++i) current->locals[fn.params[i]] = paramRegs[i];
+    std::unordered_map<std::string, int> callerBuffers;
+    std::unordered_map<std::string, int> callerHoisted;
+    std::unordered_map<std::string, Value> callerConstants;
+    std::unordered_map<std::string, std::unordered_map<std::string, int>> callerTables;
+    std::swap(callerBuffers, current->stringBuffers);
+    std::swap(callerHoisted, current->hoistedLoads);
+    std::swap(callerConstants, current->constantLocals);
+    std::swap(callerTables, current->scalarTables);
+    InlineSite* callerSite = current->inlineSite;
+    std::bitset<256> callerPinned = current->pinnedRegs;
+    std::bitset<256> callRegs = current->allocatedRegs;
+    current->inlineSite = &site;
+    current->pinnedRegs = callRegs;
+    inlineDepth++;
+
+    currentTokenIdx = fn.bodyToken;
+    while (currentTokenIdx < fn.endToken) {
+        parseStatement();
+    }
+    for (int j : site.exits) patchJump(j);
+
+    inlineDepth--;
+    current->inlineSite = callerSite;
+    current->pinnedRegs = callerPinned;
+    current->allocatedRegs = callRegs;
+    for (int reg : paramRegs) current->allocatedRegs[reg] = false;
+    std::swap(callerLocals, current->locals);
+    std::swap(callerBuffers, current->stringBuffers);
+    std::swap(callerHoisted, current->hoistedLoads);
+    std::swap(callerConstants, current->constantLocals);
+    std::swap(callerTables, current->scalarTables);
+    currentTokenIdx = resumeToken;
+    inlinedCalls++;
+    if (resultReg) *resultReg = site.resultReg;
+    return true;
+}
+
 void Compiler::parseReturnStatement() {
+    if (current->inlineSite) {
+        // Of a body compiled in place: leave its value and go to the end
+        InlineSite* site = current->inlineSite;
+        TokenType next = peek().type;
+        if (next == TokenType::SEMICOLON || next == TokenType::END || next == TokenType::ELSE ||
+            next == TokenType::ELSEIF) {
+            if (site->resultReg != -1) emit(Instruction(OP_LOADNIL, site->resultReg, 0));
+        } else {
+            int reg = parseExpression();
+            if (site->resultReg != -1) emit(Instruction(OP_MOVE, site->resultReg, reg, 0));
+        }
+        if (match(TokenType::SEMICOLON)) {}
+        if (currentTokenIdx != site->endToken) site->exits.push_back(emitJump(OP_JMP));
+        return;
+    }
+
     if (peek().type == TokenType::SEMICOLON || peek().type == TokenType::END || peek().type == TokenType::ELSE) {
         emit(Instruction(OP_RETURN, 0, 1, 0));
     } else {
@@ -406,37 +878,26 @@ void Compiler::restoreLocals(const std::vector<std::string>& snapshot) {
             ++it;
         }
     }
+    pruneBindings();
 }
 
 void Compiler::parseIfStatement() {
-    int condReg = parseExpression();
-    consume(TokenType::THEN, "Expect 'then' after condition");
-
-    int jumpFalse = emitJump(OP_JMP_FALSE, condReg);
-
-    std::vector<std::string> snapshot = snapshotLocals();
-    while (peek().type != TokenType::ELSEIF && peek().type != TokenType::ELSE && peek().type != TokenType::END && peek().type != TokenType::END_OF_FILE) {
-        parseStatement();
-    }
-    restoreLocals(snapshot);
-
     std::vector<int> jumpEnds;
-    jumpEnds.push_back(emitJump(OP_JMP));
-    patchJump(jumpFalse);
+    bool arm = !parseSwitchArms(jumpEnds) || match(TokenType::ELSEIF);
+    while (arm) {
+        std::vector<int> falseJumps;
+        parseCondition(falseJumps);
+        consume(TokenType::THEN, "Expect 'then' after condition");
 
-    while (match(TokenType::ELSEIF)) {
-         int cond = parseExpression();
-         consume(TokenType::THEN, "Expect 'then'");
-         int jmpF = emitJump(OP_JMP_FALSE, cond);
-
-         std::vector<std::string> loopSnapshot = snapshotLocals();
-         while (peek().type != TokenType::ELSEIF && peek().type != TokenType::ELSE && peek().type != TokenType::END && peek().type != TokenType::END_OF_FILE) {
-             parseStatement();
-         }
-         restoreLocals(loopSnapshot);
+        std::vector<std::string> snapshot = snapshotLocals();
+        while (peek().type != TokenType::ELSEIF && peek().type != TokenType::ELSE && peek().type != TokenType::END && peek().type != TokenType::END_OF_FILE) {
+            parseStatement();
+        }
+        restoreLocals(snapshot);
 
-         jumpEnds.push_back(emitJump(OP_JMP));
-         patchJump(jmpF);
+        jumpEnds.push_back(emitJump(OP_JMP));
+        for (int j : falseJumps) patchJump(j);
+        arm = match(TokenType::ELSEIF);
     }
 
     if (match(TokenType::ELSE)) {
@@ -451,14 +912,108 @@ void Compiler::parseIfStatement() {
     for (int j : jumpEnds) patchJump(j);
 }
 
+// Whether two constants would be the same table key
+static bool sameKey(const Value& x, const Value& y) {
+    if (is_integer(x) && is_integer(y)) return as_integer(x) == as_integer(y);
+    if (is_number(x) && is_number(y)) return as_number(x) == as_number(y);
+    if (is_string(x) && is_string(y)) return as_string_ref(x) == as_string_ref(y);
+    if (is_boolean(x) && is_boolean(y)) return as_boolean(x) == as_boolean(y);
+    return false;
+}
+
+// Compiles the leading arms of an if statement that compare one local
+// against distinct constants (`if cmd == "a" then ... elseif cmd == "b"`)
+// as an OP_SWITCH over a jump table, when there are at least
+// kMinSwitchArms of them. The comparisons have no side effects and the
+// local cannot change between them, so picking the arm by table lookup
+// gives the same result as testing them in order. Leaves the parser at the
+// first arm not covered, or returns false without consuming anything.
+bool Compiler::parseSwitchArms(std::vector<int>& jumpEnds) {
+    const int kMinSwitchArms = 4;
+    std::string name;
+    std::vector<Value> keys;
+    std::vector<int> bodies; // First token of each arm's block
+    int pos = currentTokenIdx;
+    for (;;) {
+        int t = pos;
+        if (tokens[t].type != TokenType::ID || (!keys.empty() && tokens[t].value != name)) break;
+        if (tokens[t + 1].type != TokenType::EQ) break;
+        t += 2;
+        bool negate = tokens[t].type == TokenType::MINUS;
+        if (negate) t++;
+        Value key;
+        if (tokens[t].type == TokenType::NUMBER) {
+            key = numberConstant(tokens[t].value);
+            if (negate) key = is_integer(key) ? Value((int64_t)(0 - (uint64_t)as_integer(key))) : Value(-as_number(key));
+        } else if (negate) {
+            break;
+        } else if (tokens[t].type == TokenType::STRING) {
+            key = Value(tokens[t].value);
+        } else if (tokens[t].type == TokenType::TRUE || tokens[t].type == TokenType::FALSE) {
+            key = Value(tokens[t].type == TokenType::TRUE);
+        } else {
+            break;
+        }
+        if (tokens[t + 1].type != TokenType::THEN) break;
+        bool duplicate = false;
+        for (const Value& k : keys) duplicate = duplicate || sameKey(k, key);
+        if (duplicate) break;
+        name = tokens[pos].value;
+        keys.push_back(key);
+        bodies.push_back(t + 2);
+
+        // Find the next arm at this nesting level
+        int depth = 0;
+        for (t += 2; t < (int)tokens.size(); ++t) {
+            TokenType type = tokens[t].type;
+            if (type == TokenType::IF || type == TokenType::WHILE || type == TokenType::FOR ||
+                type == TokenType::FUNCTION) {
+                depth++;
+            } else if (type == TokenType::END && depth > 0) {
+                depth--;
+            } else if (depth == 0 && (type == TokenType::ELSEIF || type == TokenType::ELSE ||
+                                      type == TokenType::END || type == TokenType::END_OF_FILE)) {
+                break;
+            }
+        }
+        if (t >= (int)tokens.size() || tokens[t].type != TokenType::ELSEIF) break;
+        pos = t + 1;
+    }
+    if ((int)keys.size() < kMinSwitchArms || !current->locals.count(name) || current->stringBuffers.count(name) ||
+        current->constantLocals.count(name)) {
+        return false;
+    }
+
+    int firstKey = (int)current->proto->constants.size();
+    for (const Value& key : keys) addConstant(key);
+    emit(Instruction(OP_SWITCH, current->locals[name], firstKey, (int)keys.size()));
+    // One jump per arm, then one for the remaining arms
+    std::vector<int> armJumps;
+    for (size_t i = 0; i <= keys.size(); ++i) armJumps.push_back(emitJump(OP_JMP));
+
+    for (size_t i = 0; i < keys.size(); ++i) {
+        currentTokenIdx = bodies[i];
+        patchJump(armJumps[i]);
+        std::vector<std::string> snapshot = snapshotLocals();
+        while (peek().type != TokenType::ELSEIF && peek().type != TokenType::ELSE && peek().type != TokenType::END && peek().type != TokenType::END_OF_FILE) {
+            parseStatement();
+        }
+        restoreLocals(snapshot);
+        jumpEnds.push_back(emitJump(OP_JMP));
+    }
+    patchJump(armJumps.back());
+    return true;
+}
+
 void Compiler::parseWhileStatement() {
+    std::vector<std::string> buffers = openStringBuffers(currentTokenIdx - 1);
+    std::vector<std::string> hoisted = openHoistedLoads(currentTokenIdx - 1);
     int loopStart = (int)current->proto->instructions.size();
 
-    int condReg = parseExpression();
+    std::vector<int> falseJumps;
+    parseCondition(falseJumps);
     consume(TokenType::DO, "Expect 'do' after while condition");
 
-    int jumpFalse = emitJump(OP_JMP_FALSE, condReg);
-
     current->breakJumps.emplace_back();
 
     std::vector<std::string> snapshot = snapshotLocals();
@@ -469,18 +1024,28 @@ void Compiler::parseWhileStatement() {
 
     emit(Instruction(OP_JMP, 0, loopStart - (int)current->proto->instructions.size() - 1));
 
-    patchJump(jumpFalse);
+    for (int j : falseJumps) patchJump(j);
     consume(TokenType::END, "Expect 'end' after while loop");
 
     for (int j : current->breakJumps.back()) patchJump(j);
     current->breakJumps.pop_back();
+    closeHoistedLoads(hoisted);
+    closeStringBuffers(buffers);
 }
 
 void Compiler::parseForStatement() {
+    std::vector<std::string> buffers = openStringBuffers(currentTokenIdx - 1);
+    std::vector<std::string> hoisted = openHoistedLoads(currentTokenIdx - 1);
     Token name = consume(TokenType::ID, "Expect variable name after 'for'");
+    int nameToken = currentTokenIdx - 1;
 
     if (match(TokenType::ASSIGN)) {
         // Numeric for
+        if (parseUnrolledFor(name, nameToken)) {
+            closeHoistedLoads(hoisted);
+            closeStringBuffers(buffers);
+            return;
+        }
         int startReg = parseExpression();
         consume(TokenType::COMMA, "Expect ',' after start value");
         int limitReg = parseExpression();
@@ -490,10 +1055,20 @@ void Compiler::parseForStatement() {
             stepReg = parseExpression();
         } else {
             stepReg = allocateRegister();
-            int oneIdx = addConstant(1.0);
-            emit(Instruction(OP_LOADK, stepReg, oneIdx));
+            emitLoad(stepReg, Value((int64_t)1));
         }
 
+        // A constant step fixes the direction of the loop, so the loop test
+        // need not check the sign of the step on every iteration
+        OpCode loopOp = OP_FORLOOP;
+        const Instruction& stepLoad = current->proto->instructions.back();
+        double step;
+        if (stepLoad.a == stepReg && loadedNumber(current->proto, stepLoad, step)) {
+            if (step > 0) loopOp = OP_FORLOOP_UP;
+            if (step < 0) loopOp = OP_FORLOOP_DOWN;
+        }
+        bool integerLoop = current->intRegs[startReg] && current->intRegs[stepReg];
+
         consume(TokenType::DO, "Expect 'do' after for parameters");
 
         // index, limit, step, and external variable must be contiguous
@@ -520,6 +1095,7 @@ void Compiler::parseForStatement() {
 
         int loopStart = (int)current->proto->instructions.size();
         emit(Instruction(OP_FORPREP, base, 0));
+        declareLocal(varReg, nameToken, integerLoop);
 
         current->breakJumps.emplace_back();
 
@@ -532,7 +1108,7 @@ void Compiler::parseForStatement() {
         consume(TokenType::END, "Expect 'end' after for loop");
 
         int loopEnd = (int)current->proto->instructions.size();
-        emit(Instruction(OP_FORLOOP, base, 0));
+        emit(Instruction(loopOp, base, 0));
 
         for (int j : current->breakJumps.back()) patchJump(j);
         current->breakJumps.pop_back();
@@ -542,6 +1118,8 @@ void Compiler::parseForStatement() {
 
         int loopOffset = loopStart - loopEnd;
         current->proto->instructions[loopEnd].b = loopOffset;
+        closeHoistedLoads(hoisted);
+        closeStringBuffers(buffers);
 
         if (hadOld) {
             current->locals[name.value] = oldReg;
@@ -571,8 +1149,13 @@ void Compiler::parseForStatement() {
         int base = allocateBlock(3 + (int)varNames.size());
 
         // Parse explist (expecting 3 values: iterator, state, control)
+        int exprStart = currentTokenIdx;
+        int outerSlots = callResultSlots;
+        callResultSlots = 3;
         int firstExpr = parseExpression();
+        callResultSlots = outerSlots;
         emit(Instruction(OP_MOVE, base, firstExpr, 0));
+        OpCode callOp = stockIteratorCall(exprStart);
 
         bool patchedCall = false;
         if (!match(TokenType::COMMA)) {
@@ -587,24 +1170,19 @@ void Compiler::parseForStatement() {
                 }
             }
             if (!patchedCall) {
+                 callOp = OP_TFORCALL;
                  // std::cerr << "WARNING: Could not patch call in generic for" << std::endl;
-                 int nilIdx = addConstant(Value(Nil{}));
-                 int nilReg = allocateRegister();
-                 emit(Instruction(OP_LOADK, nilReg, nilIdx));
-                 emit(Instruction(OP_MOVE, base + 1, nilReg, 0));
-                 emit(Instruction(OP_MOVE, base + 2, nilReg, 0));
+                 emit(Instruction(OP_LOADNIL, base + 1, 1));
             }
         } else {
+            callOp = OP_TFORCALL;
             int second = parseExpression();
             emit(Instruction(OP_MOVE, base + 1, second, 0));
             if (match(TokenType::COMMA)) {
                 int third = parseExpression();
                 emit(Instruction(OP_MOVE, base + 2, third, 0));
             } else {
-                int nilIdx = addConstant(Value(Nil{}));
-                int nilReg = allocateRegister();
-                emit(Instruction(OP_LOADK, nilReg, nilIdx));
-                emit(Instruction(OP_MOVE, base + 2, nilReg, 0));
+                emit(Instruction(OP_LOADNIL, base + 2, 0));
             }
         }
 
@@ -632,11 +1210,20 @@ void Compiler::parseForStatement() {
 
         consume(TokenType::DO, "Expect 'do'");
 
+        // Lock the iterator registers for the loop duration
+        current->locals["(generator " + std::to_string(base) + ")"] = base;
+        current->locals["(state " + std::to_string(base) + ")"] = base + 1;
+        current->locals["(control " + std::to_string(base) + ")"] = base + 2;
+
         // Registers for loop variables are already allocated at base+3...
+        // Outer locals they shadow come back after the loop.
         std::vector<int> loopVars;
+        std::vector<std::pair<std::string, int>> shadowed;
         for (size_t i = 0; i < varNames.size(); ++i) {
             int r = base + 3 + i;
             loopVars.push_back(r);
+            auto outer = current->locals.find(varNames[i]);
+            if (outer != current->locals.end()) shadowed.push_back(*outer);
             current->locals[varNames[i]] = r;
         }
 
@@ -655,19 +1242,680 @@ void Compiler::parseForStatement() {
 
         patchJump(jumpInst);
 
-        emit(Instruction(OP_TFORCALL, base, 0, (int)varNames.size()));
+        emit(Instruction(callOp, base, 0, (int)varNames.size()));
         emit(Instruction(OP_TFORLOOP, base + 2, 0, 0));
 
         for (int j : current->breakJumps.back()) patchJump(j);
         current->breakJumps.pop_back();
         current->proto->instructions.back().b = loopStart - (int)current->proto->instructions.size();
+        closeHoistedLoads(hoisted);
+        closeStringBuffers(buffers);
 
         // Cleanup
         current->allocatedRegs[base] = false;
         current->allocatedRegs[base + 1] = false;
         current->allocatedRegs[base + 2] = false;
         for (int r : loopVars) current->allocatedRegs[r] = false;
+        current->locals.erase("(generator " + std::to_string(base) + ")");
+        current->locals.erase("(state " + std::to_string(base) + ")");
+        current->locals.erase("(control " + std::to_string(base) + ")");
+        for (const std::string& var : varNames) current->locals.erase(var);
+        for (const auto& outer : shadowed) current->locals[outer.first] = outer.second;
+    }
+}
+
+// With `for name =` consumed: unrolls a numeric for loop whose start, limit
+// and step are integer literals and whose body makes no closure, has no
+// break, goto or label and never assigns or redeclares the loop variable.
+// If all its passes fit the unroll budget, the body is repeated once per
+// pass with the variable a constant; else, given at least two full rounds,
+// a loop runs kUnrollFactor copies per pass, the variable offset by the
+// step in each, and the passes left over follow as constant copies.
+// Returns false, consuming nothing, for any other loop.
+bool Compiler::parseUnrolledFor(const Token& name, int nameToken) {
+    const int kMaxUnrolledPasses = 16;
+    const int kUnrollFactor = 4;
+    if (options.unrollBudget <= 0) return false;
+
+    // The header: small integer literals only
+    int pos = currentTokenIdx;
+    int64_t bounds[3] = {0, 0, 1};
+    for (int k = 0; k < 3; ++k) {
+        if (k == 2 && tokens[pos].type == TokenType::DO) break;
+        if (k > 0 && tokens[pos++].type != TokenType::COMMA) return false;
+        bool negate = tokens[pos].type == TokenType::MINUS;
+        if (negate) pos++;
+        if (tokens[pos].type != TokenType::NUMBER) return false;
+        Value v = numberConstant(tokens[pos++].value);
+        if (!is_integer(v) || as_integer(v) >= kImmediateLimit) return false;
+        bounds[k] = negate ? -as_integer(v) : as_integer(v);
+    }
+    if (tokens[pos].type != TokenType::DO) return false;
+    int64_t start = bounds[0], limit = bounds[1], step = bounds[2];
+    if (step == 0) return false;
+    int body = pos + 1;
+
+    int end = body;
+    bool declaring = false; // Within the names of a local or for
+    for (int depth = 0; end < (int)tokens.size(); ++end) {
+        const Token& tok = tokens[end];
+        if (tok.type == TokenType::FUNCTION || tok.type == TokenType::BREAK || tok.type == TokenType::GOTO ||
+            tok.type == TokenType::DOUBLE_COLON || tok.type == TokenType::END_OF_FILE) {
+            return false;
+        } else if (tok.type == TokenType::IF || tok.type == TokenType::WHILE || tok.type == TokenType::FOR) {
+            depth++;
+        } else if (tok.type == TokenType::END && --depth < 0) {
+            break;
+        } else if (tok.type == TokenType::ID && tok.value == name.value &&
+                   (declaring || tokens[end + 1].type == TokenType::ASSIGN)) {
+            return false;
+        }
+        declaring = (tok.type == TokenType::LOCAL || tok.type == TokenType::FOR) ||
+                    (declaring && (tok.type == TokenType::ID || tok.type == TokenType::COMMA));
+    }
+
+    int64_t passes = step > 0 ? (limit >= start ? (limit - start) / step + 1 : 0)
+                              : (limit <= start ? (start - limit) / -step + 1 : 0);
+    int64_t bodyTokens = std::max(end - body, 1);
+    int64_t rounds = 0; // Passes of the unrolled loop, each covering kUnrollFactor
+    if (passes > kMaxUnrolledPasses || passes * bodyTokens > options.unrollBudget) {
+        rounds = passes / kUnrollFactor;
+        if (rounds < 2 || (kUnrollFactor + passes % kUnrollFactor) * bodyTokens > options.unrollBudget) return false;
+    }
+    // The loop variable is declared afresh for every copy: as a constant, or
+    // in the unrolled loop as the index plus an offset
+    auto copyBody = [&]() {
+        currentTokenIdx = body;
+        std::vector<std::string> snapshot = snapshotLocals();
+        while (currentTokenIdx < end) {
+            parseStatement();
+        }
+        restoreLocals(snapshot);
+    };
+    auto outer = current->locals.find(name.value);
+    bool hadOld = outer != current->locals.end();
+    int oldReg = hadOld ? outer->second : -1;
+
+    if (rounds > 0) {
+        int base = allocateBlock(4);
+        int varReg = base + 3;
+        current->locals["(base " + std::to_string(base) + ")"] = base;
+        current->locals["(limit " + std::to_string(base) + ")"] = base + 1;
+        current->locals["(step " + std::to_string(base) + ")"] = base + 2;
+        current->locals["(index " + std::to_string(base) + ")"] = varReg; // Copies see offsets of it
+        emitLoad(base, Value(start));
+        emitLoad(base + 1, Value(start + (rounds - 1) * kUnrollFactor * step));
+        emitLoad(base + 2, Value(kUnrollFactor * step));
+        int loopStart = (int)current->proto->instructions.size();
+        emit(Instruction(OP_FORPREP, base, 0));
+        declareLocal(varReg, nameToken, true);
+
+        for (int k = 0; k < kUnrollFactor; ++k) {
+            int reg = varReg;
+            if (k > 0) {
+                reg = allocateRegister();
+                int offset = allocateRegister();
+                emitLoad(offset, Value(k * step));
+                emitArith(OP_ADD, reg, varReg, offset);
+            }
+            current->locals[name.value] = reg;
+            copyBody();
+            if (k > 0) current->allocatedRegs[reg] = false;
+        }
+        int loopEnd = (int)current->proto->instructions.size();
+        emit(Instruction(step > 0 ? OP_FORLOOP_UP : OP_FORLOOP_DOWN, base, loopStart - loopEnd));
+        current->proto->instructions[loopStart].b = loopEnd - loopStart - 1;
+
+        for (int r = base; r < base + 4; ++r) current->allocatedRegs[r] = false;
+        current->locals.erase("(base " + std::to_string(base) + ")");
+        current->locals.erase("(limit " + std::to_string(base) + ")");
+        current->locals.erase("(step " + std::to_string(base) + ")");
+        current->locals.erase("(index " + std::to_string(base) + ")");
+        current->locals.erase(name.value);
+    }
+    for (int64_t pass = rounds * kUnrollFactor; pass < passes; ++pass) {
+        current->constantLocals[name.value] = Value(start + pass * step);
+        copyBody();
+    }
+    current->constantLocals.erase(name.value);
+    if (hadOld) current->locals[name.value] = oldReg;
+
+    currentTokenIdx = end;
+    consume(TokenType::END, "Expect 'end' after for loop");
+    return true;
+}
+
+// The call opcode for a generic for whose explist, starting at token
+// `start` and just parsed, is exactly `ipairs(...)` or `pairs(...)` on the
+// global functions: its iterator runs inline while it is still the stock
+// one. Anything else goes through OP_TFORCALL.
+OpCode Compiler::stockIteratorCall(int start) {
+    const Token& callee = tokens[start];
+    if (callee.type != TokenType::ID || (callee.value != "ipairs" && callee.value != "pairs")) return OP_TFORCALL;
+    if (tokens[start + 1].type != TokenType::LPAREN) return OP_TFORCALL;
+    for (CompilerState* state = current; state; state = state->enclosing) {
+        if (state->locals.count(callee.value)) return OP_TFORCALL;
+    }
+    // The argument list must close right where the expression ended
+    int depth = 0;
+    int close = start + 1;
+    for (; close < currentTokenIdx; ++close) {
+        if (tokens[close].type == TokenType::LPAREN) depth++;
+        if (tokens[close].type == TokenType::RPAREN && --depth == 0) break;
+    }
+    if (close != currentTokenIdx - 1) return OP_TFORCALL;
+    return callee.value == "ipairs" ? OP_TFORIPAIRS : OP_TFORPAIRS;
+}
+
+// Locals of this function that the loop starting at token `loopToken` only
+// ever extends, with statements `s = s .. x`, and that no closure in the
+// function mentions (a closure made before the loop, even in an earlier pass
+// of an enclosing loop, could read them during it). While the loop runs,
+// each is kept in a hidden string buffer that appends in place and is
+// flushed back into the local where the loop exits; nothing can observe the
+// local in between. Opens the buffers and returns the locals, to be passed
+// to closeStringBuffers() after the loop.
+std::vector<std::string> Compiler::openStringBuffers(int loopToken) {
+    // The loop runs to its matching 'end'; with gotos or labels inside, it
+    // could also be left or entered elsewhere
+    int end = loopToken;
+    int depth = 0;
+    for (; end < (int)tokens.size(); ++end) {
+        TokenType type = tokens[end].type;
+        if (type == TokenType::IF || type == TokenType::WHILE || type == TokenType::FOR ||
+            type == TokenType::FUNCTION) {
+            depth++;
+        } else if (type == TokenType::END && --depth == 0) {
+            break;
+        } else if (type == TokenType::GOTO || type == TokenType::DOUBLE_COLON) {
+            return {};
+        } else if (type == TokenType::END_OF_FILE) {
+            break;
+        }
+    }
+
+    if (!current->closureNames) {
+        current->closureNames = std::make_unique<std::unordered_set<std::string>>();
+        std::vector<int> functionDepths; // Block depths at which nested functions opened
+        depth = 0;
+        for (int i = current->firstToken; i < (int)tokens.size(); ++i) {
+            TokenType type = tokens[i].type;
+            if (type == TokenType::IF || type == TokenType::WHILE || type == TokenType::FOR ||
+                type == TokenType::FUNCTION) {
+                depth++;
+                if (type == TokenType::FUNCTION) functionDepths.push_back(depth);
+            } else if (type == TokenType::END) {
+                if (!functionDepths.empty() && functionDepths.back() == depth) functionDepths.pop_back();
+                if (--depth < 0) break; // The end of this function
+            } else if (type == TokenType::ID && !functionDepths.empty()) {
+                current->closureNames->insert(tokens[i].value);
+            }
+        }
+    }
+
+    std::vector<std::string> names;
+    for (const auto& local : current->locals) {
+        const std::string& name = local.first;
+        if (name[0] == '(' || current->stringBuffers.count(name) || current->closureNames->count(name)) continue;
+        int uses = 0;
+        int appends = 0;
+        for (int i = loopToken; i < end; ++i) {
+            if (tokens[i].type != TokenType::ID || tokens[i].value != name) continue;
+            TokenType prev = tokens[i - 1].type;
+            if (prev == TokenType::DOT || prev == TokenType::COLON) continue; // A field or method name
+            uses++;
+            // Not a table constructor field: those follow '{', ',' or ';'
+            bool statement = prev != TokenType::LBRACE && prev != TokenType::COMMA && prev != TokenType::SEMICOLON;
+            if (statement && i + 3 < (int)tokens.size() && tokens[i + 1].type == TokenType::ASSIGN &&
+                tokens[i + 2].type == TokenType::ID && tokens[i + 2].value == name &&
+                tokens[i + 3].type == TokenType::DOTDOT) {
+                appends++;
+                i += 2;
+            }
+        }
+        if (appends > 0 && uses == appends) names.push_back(name);
+    }
+    std::sort(names.begin(), names.end());
+
+    for (const std::string& name : names) {
+        int buffer = allocateRegister();
+        current->locals["(buffer " + std::to_string(buffer) + ")"] = buffer;
+        current->stringBuffers[name] = buffer;
+        emit(Instruction(OP_BUFINIT, buffer, current->locals[name], 0));
+    }
+    return names;
+}
+
+// Writes the buffers back into their locals where the loop exits
+void Compiler::closeStringBuffers(const std::vector<std::string>& names) {
+    for (const std::string& name : names) {
+        int buffer = current->stringBuffers[name];
+        emit(Instruction(OP_BUFFLUSH, current->locals[name], buffer, 0));
+        current->stringBuffers.erase(name);
+        current->locals.erase("(buffer " + std::to_string(buffer) + ")");
+        current->allocatedRegs[buffer] = false;
+    }
+}
+
+// `name = name .. x .. y ...` for a local held in a string buffer, with
+// the '=' consumed
+void Compiler::parseBufferAppend(const Token& name) {
+    noteAssignment(name.value);
+    int buffer = current->stringBuffers[name.value];
+    advance();
+    consume(TokenType::DOTDOT, "Expect '..'");
+    std::vector<int> operands;
+    do {
+        operands.push_back(parseTerm());
+    } while (match(TokenType::DOTDOT));
+
+    TokenType next = peek().type;
+    if (next == TokenType::EQ || next == TokenType::NE || next == TokenType::LT || next == TokenType::LE ||
+        next == TokenType::GT || next == TokenType::GE || next == TokenType::AND || next == TokenType::OR) {
+        // The chain is only the left operand of a looser operator: evaluate
+        // the whole expression on the flushed value, then restart the buffer
+        // from its result
+        int localReg = current->locals[name.value];
+        int flushed = allocateRegister();
+        emit(Instruction(OP_BUFFLUSH, flushed, buffer, 0));
+        operands.insert(operands.begin(), flushed);
+        int first = contiguous(operands);
+        int joined = allocateRegister();
+        emit(Instruction(OP_CONCAT, joined, first, first + (int)operands.size() - 1));
+        int result = parseLogic(joined);
+        emit(Instruction(OP_MOVE, localReg, result, 0));
+        emit(Instruction(OP_BUFINIT, buffer, localReg, 0));
+    } else {
+        int first = contiguous(operands);
+        emit(Instruction(OP_BUFAPPEND, buffer, first, first + (int)operands.size() - 1));
+    }
+    if (match(TokenType::SEMICOLON)) {}
+}
+
+// Field chains `a.b.c` that the loop starting at token `loopToken` reads on
+// every pass and does not change itself: no name in the chain is assigned or
+// declared in the loop, no field it names is stored to there, and the loop
+// stores no field under a computed key (a numeric index cannot alias a named
+// field). Only when the options assume calls are pure: a call, or an
+// __index metamethod run by the read itself, could return something else on
+// each pass. Each chain gets a hidden register, nil before the loop, that
+// its first read in the loop fills and later reads reuse (a value of nil or
+// false is loaded again). Loading on first use rather than ahead of the loop
+// keeps the errors of a loop that never gets to the read. Opens the caches
+// and returns the chains, to be passed to closeHoistedLoads() after the loop.
+std::vector<std::string> Compiler::openHoistedLoads(int loopToken) {
+    const int kMaxHoistedLoads = 8;
+    if (!options.assumePureCalls) return {};
+
+    // The loop runs to its matching 'end'; a while condition runs on every
+    // pass too, a for header only once
+    int end = loopToken;
+    int body = tokens[loopToken].type == TokenType::WHILE ? loopToken + 1 : -1;
+    int depth = 0;
+    for (; end < (int)tokens.size(); ++end) {
+        TokenType type = tokens[end].type;
+        if (type == TokenType::IF || type == TokenType::WHILE || type == TokenType::FOR ||
+            type == TokenType::FUNCTION) {
+            depth++;
+        } else if (type == TokenType::END && --depth == 0) {
+            break;
+        } else if (type == TokenType::DO && depth == 1 && body == -1) {
+            body = end + 1;
+        } else if (type == TokenType::END_OF_FILE) {
+            break;
+        }
+    }
+    if (body == -1 || end >= (int)tokens.size() - 1) return {};
+
+    std::unordered_set<std::string> assigned;     // Names assigned or declared in the loop
+    std::unordered_set<std::string> written;      // The same, less numeric for variables
+    std::unordered_set<std::string> indices;      // Numeric for variables
+    std::unordered_set<std::string> storedFields; // Field names stored to in the loop
+    std::vector<std::pair<int, int>> keyedStores; // Key token ranges of `t[key] = v` stores
+    std::vector<std::vector<std::string>> chains; // Name chains read on every pass
+    std::vector<int> functionDepths;              // Block depths at which nested functions opened
+
+    depth = 0;
+    for (int i = loopToken; i < end; ++i) {
+        const Token& tok = tokens[i];
+        TokenType prev = i > 0 ? tokens[i - 1].type : TokenType::END_OF_FILE;
+        TokenType next = tokens[i + 1].type;
+        bool nested = !functionDepths.empty();
+        if (tok.type == TokenType::IF || tok.type == TokenType::WHILE || tok.type == TokenType::FOR) {
+            depth++;
+            if (tok.type == TokenType::FOR) {
+                bool numeric = tokens[i + 2].type == TokenType::ASSIGN;
+                for (int j = i + 1; tokens[j].type == TokenType::ID || tokens[j].type == TokenType::COMMA; ++j) {
+                    if (tokens[j].type != TokenType::ID) continue;
+                    assigned.insert(tokens[j].value);
+                    (numeric ? indices : written).insert(tokens[j].value);
+                }
+            }
+        } else if (tok.type == TokenType::FUNCTION) {
+            depth++;
+            functionDepths.push_back(depth);
+            // The name it is stored under and its parameters; the header is
+            // no call
+            int j = i + 1;
+            if (tokens[j].type == TokenType::ID) {
+                assigned.insert(tokens[j].value);
+                written.insert(tokens[j].value);
+                for (j++; tokens[j].type == TokenType::DOT || tokens[j].type == TokenType::COLON; j += 2) {
+                    if (tokens[j + 2].type == TokenType::LPAREN) storedFields.insert(tokens[j + 1].value);
+                }
+            }
+            for (; j < end && tokens[j].type != TokenType::RPAREN; ++j) {
+                if (tokens[j].type != TokenType::ID) continue;
+                assigned.insert(tokens[j].value);
+                written.insert(tokens[j].value);
+            }
+            i = j;
+            continue;
+        } else if (tok.type == TokenType::END) {
+            if (nested && functionDepths.back() == depth) functionDepths.pop_back();
+            depth--;
+        } else if (tok.type == TokenType::LOCAL) {
+            for (int j = i + 1; tokens[j].type == TokenType::ID || tokens[j].type == TokenType::COMMA; ++j) {
+                if (tokens[j].type != TokenType::ID) continue;
+                assigned.insert(tokens[j].value);
+                written.insert(tokens[j].value);
+            }
+        } else if (tok.type == TokenType::ID && next == TokenType::ASSIGN) {
+            if (prev == TokenType::DOT) {
+                storedFields.insert(tok.value);
+            } else {
+                assigned.insert(tok.value);
+                written.insert(tok.value);
+            }
+        } else if (tok.type == TokenType::LBRACKET && prev != TokenType::LBRACE && prev != TokenType::COMMA &&
+                   prev != TokenType::SEMICOLON) {
+            // Not a table constructor key: an index, maybe stored to
+            int close = i + 1;
+            for (int brackets = 1; close < end; ++close) {
+                if (tokens[close].type == TokenType::LBRACKET) brackets++;
+                if (tokens[close].type == TokenType::RBRACKET && --brackets == 0) break;
+            }
+            if (tokens[close + 1].type == TokenType::ASSIGN) keyedStores.push_back({i + 1, close});
+        }
+
+        if (nested || i < body) continue;
+        if (tok.type == TokenType::ID && prev != TokenType::DOT && prev != TokenType::COLON &&
+            next == TokenType::DOT && tokens[i + 2].type == TokenType::ID) {
+            std::vector<std::string> names{tok.value};
+            int j = i + 1;
+            for (; tokens[j].type == TokenType::DOT && tokens[j + 1].type == TokenType::ID; j += 2) {
+                names.push_back(tokens[j + 1].value);
+            }
+            if (tokens[j].type == TokenType::ASSIGN) names.pop_back(); // Its last field is stored to
+            chains.push_back(names);
+        }
+    }
+    // A store under a string literal names its field; under an integer
+    // expression, no field at all
+    for (const auto& key : keyedStores) {
+        if (key.second == key.first + 1 && tokens[key.first].type == TokenType::STRING) {
+            storedFields.insert(tokens[key.first].value);
+            continue;
+        }
+        for (int j = key.first; j < key.second; ++j) {
+            const Token& tok = tokens[j];
+            if (tok.type == TokenType::HASH) {
+                while (tokens[j + 1].type == TokenType::ID || tokens[j + 1].type == TokenType::DOT) j++;
+                continue;
+            }
+            bool index = false;
+            if (tok.type == TokenType::ID) {
+                auto local = current->locals.find(tok.value);
+                index = indices.count(tok.value) ? !written.count(tok.value)
+                                                 : !assigned.count(tok.value) && local != current->locals.end() &&
+                                                       current->intRegs[local->second];
+            }
+            bool arithmetic = tok.type == TokenType::NUMBER || tok.type == TokenType::PLUS ||
+                              tok.type == TokenType::MINUS || tok.type == TokenType::MUL ||
+                              tok.type == TokenType::DIV || tok.type == TokenType::PERCENT ||
+                              tok.type == TokenType::IDIV || tok.type == TokenType::LPAREN ||
+                              tok.type == TokenType::RPAREN;
+            if (!index && !arithmetic) return {};
+        }
+    }
+
+    // The longest unchanged prefix of each chain, most read first
+    std::map<std::string, int> reads;
+    for (const std::vector<std::string>& names : chains) {
+        if (assigned.count(names[0]) || storedFields.count(names[0]) || current->scalarTables.count(names[0])) {
+            continue;
+        }
+        size_t length = 1;
+        while (length < names.size() && !storedFields.count(names[length])) length++;
+        if (length < 2) continue;
+        std::string chain = names[0];
+        for (size_t f = 1; f < length; ++f) chain += "." + names[f];
+        if (!current->hoistedLoads.count(chain)) reads[chain]++; // Else an enclosing loop caches it
+    }
+    std::vector<std::pair<std::string, int>> ranked(reads.begin(), reads.end());
+    std::stable_sort(ranked.begin(), ranked.end(),
+                     [](const std::pair<std::string, int>& x, const std::pair<std::string, int>& y) {
+                         return x.second > y.second;
+                     });
+    if ((int)ranked.size() > kMaxHoistedLoads) ranked.resize(kMaxHoistedLoads);
+    std::vector<std::string> hoisted;
+    for (const auto& chain : ranked) hoisted.push_back(chain.first);
+    std::sort(hoisted.begin(), hoisted.end());
+
+    int first = (int)current->proto->instructions.size();
+    for (const std::string& chain : hoisted) {
+        int reg = allocateRegister();
+        current->locals["(hoist " + std::to_string(reg) + ")"] = reg;
+        current->hoistedLoads[chain] = reg;
+        std::vector<Instruction>& code = current->proto->instructions;
+        if ((int)code.size() > first && code.back().a + code.back().b + 1 == reg) {
+            code.back().b++;
+        } else {
+            emit(Instruction(OP_LOADNIL, reg, 0));
+        }
+    }
+    return hoisted;
+}
+
+void Compiler::closeHoistedLoads(const std::vector<std::string>& chains) {
+    for (const std::string& chain : chains) {
+        int reg = current->hoistedLoads[chain];
+        current->hoistedLoads.erase(chain);
+        current->locals.erase("(hoist " + std::to_string(reg) + ")");
+        current->allocatedRegs[reg] = false;
+    }
+}
+
+// With the name `name` just consumed: if it starts a chain cached by
+// openHoistedLoads(), consumes the longest such chain and returns the
+// register holding it, filling it first if empty. Else returns -1.
+int Compiler::loadHoisted(const std::string& name) {
+    if (current->hoistedLoads.empty()) return -1;
+    std::vector<std::string> names{name};
+    std::vector<std::string> chains{name}; // chains[k]: the name and its first k fields
+    for (int i = currentTokenIdx;
+         tokens[i].type == TokenType::DOT && tokens[i + 1].type == TokenType::ID; i += 2) {
+        names.push_back(tokens[i + 1].value);
+        chains.push_back(chains.back() + "." + names.back());
+    }
+    // The cached chains it starts with; a field about to be stored to is no read
+    std::vector<int> cached;
+    for (int k = 1; k < (int)chains.size(); ++k) {
+        if (current->hoistedLoads.count(chains[k]) && tokens[currentTokenIdx + 2 * k].type != TokenType::ASSIGN) {
+            cached.push_back(k);
+        }
+    }
+    if (cached.empty()) return -1;
+
+    // Test the longest cache first; each miss fills from the next shorter one
+    std::vector<int> hits(cached.size());
+    for (int i = (int)cached.size() - 1; i >= 0; --i) {
+        hits[i] = emitJump(OP_JMP_TRUE, current->hoistedLoads[chains[cached[i]]]);
+    }
+    int valReg = loadVariable(name);
+    int loaded = 0;
+    for (size_t i = 0; i < cached.size(); ++i) {
+        int reg = current->hoistedLoads[chains[cached[i]]];
+        for (int k = loaded + 1; k <= cached[i]; ++k) {
+            int keyReg = allocateRegister();
+            emit(Instruction(OP_LOADK, keyReg, addConstant(names[k])));
+            int resReg = k == cached[i] ? reg : allocateRegister();
+            emit(Instruction(OP_GETTABLE, resReg, valReg, keyReg));
+            valReg = resReg;
+        }
+        patchJump(hits[i]);
+        loaded = cached[i];
+    }
+    currentTokenIdx += 2 * loaded;
+    return valReg;
+}
+
+// With `local name` consumed: if `= {f = e, ...}` follows and the table never
+// escapes, compiles it with no table at all. Escaping is found on the tokens
+// of the rest of the local's scope: each use must read or assign a field by
+// name (`name.f`), outside any nested function, and the name is never
+// declared again. Then each field lives in a register of its own, nil until
+// set, which loadScalarField() and the field assignments use in place of the
+// table. Else returns false, consuming nothing.
+bool Compiler::parseScalarTable(const std::string& name) {
+    const int kMaxScalarFields = 8;
+    int pos = currentTokenIdx;
+    if (tokens[pos].type != TokenType::ASSIGN || tokens[pos + 1].type != TokenType::LBRACE) return false;
+    if (current->locals.count(name)) return false; // Shadows a local
+
+    // The constructor may only have named fields, each set once
+    std::vector<std::string> fields;
+    int i = pos + 2;
+    while (tokens[i].type != TokenType::RBRACE) {
+        if (tokens[i].type != TokenType::ID || tokens[i + 1].type != TokenType::ASSIGN ||
+            std::find(fields.begin(), fields.end(), tokens[i].value) != fields.end()) {
+            return false;
+        }
+        fields.push_back(tokens[i].value);
+        for (int depth = 0; ; ++i) {
+            TokenType t = tokens[i + 2].type;
+            if (t == TokenType::END_OF_FILE || t == TokenType::FUNCTION) return false;
+            if (t == TokenType::LPAREN || t == TokenType::LBRACE || t == TokenType::LBRACKET) depth++;
+            if (t == TokenType::RPAREN || t == TokenType::RBRACE || t == TokenType::RBRACKET) {
+                if (depth == 0) break;
+                depth--;
+            }
+            if (depth == 0 && (t == TokenType::COMMA || t == TokenType::SEMICOLON)) break;
+        }
+        i += 2;
+        if (tokens[i].type == TokenType::COMMA || tokens[i].type == TokenType::SEMICOLON) i++;
     }
+    int numInitialized = (int)fields.size();
+    TokenType after = tokens[i + 1].type;
+    if (after != TokenType::LOCAL && after != TokenType::ID && after != TokenType::IF &&
+        after != TokenType::WHILE && after != TokenType::FOR && after != TokenType::FUNCTION &&
+        after != TokenType::RETURN && after != TokenType::BREAK && after != TokenType::GOTO &&
+        after != TokenType::DOUBLE_COLON && after != TokenType::END && after != TokenType::ELSE &&
+        after != TokenType::ELSEIF && after != TokenType::SEMICOLON && after != TokenType::END_OF_FILE) {
+        return false; // The table is an operand
+    }
+
+    // Its uses, up to the end of the enclosing block
+    int depth = 0;
+    std::vector<int> functionDepths;
+    bool declaring = false;
+    for (int j = i + 1; j < (int)tokens.size(); ++j) {
+        const Token& tok = tokens[j];
+        TokenType prev = tokens[j - 1].type;
+        if (tok.type == TokenType::IF || tok.type == TokenType::WHILE || tok.type == TokenType::FOR) {
+            depth++;
+        } else if (tok.type == TokenType::FUNCTION) {
+            functionDepths.push_back(++depth);
+        } else if (tok.type == TokenType::END) {
+            if (depth == 0) break;
+            if (!functionDepths.empty() && functionDepths.back() == depth) functionDepths.pop_back();
+            depth--;
+        } else if ((tok.type == TokenType::ELSE || tok.type == TokenType::ELSEIF) && depth == 0) {
+            break;
+        } else if (tok.type == TokenType::END_OF_FILE) {
+            break;
+        }
+        if (tok.type == TokenType::LOCAL || tok.type == TokenType::FOR) {
+            declaring = true;
+        } else if (tok.type != TokenType::ID && tok.type != TokenType::COMMA) {
+            declaring = false;
+        }
+        if (tok.type != TokenType::ID || tok.value != name || prev == TokenType::DOT || prev == TokenType::COLON) {
+            continue;
+        }
+        if ((prev == TokenType::LBRACE || prev == TokenType::COMMA) && !declaring &&
+            tokens[j + 1].type == TokenType::ASSIGN) {
+            continue; // A key of another constructor
+        }
+        if (declaring || !functionDepths.empty() || tokens[j + 1].type != TokenType::DOT ||
+            tokens[j + 2].type != TokenType::ID) {
+            return false;
+        }
+        if (std::find(fields.begin(), fields.end(), tokens[j + 2].value) == fields.end()) {
+            fields.push_back(tokens[j + 2].value);
+        }
+    }
+    if (fields.empty() || (int)fields.size() > kMaxScalarFields) return false;
+
+    // The values, in order, before the fields come into scope
+    currentTokenIdx = pos + 2;
+    std::vector<int> valueRegs;
+    for (int f = 0; f < numInitialized; ++f) {
+        advance();
+        advance();
+        valueRegs.push_back(parseExpression());
+        if (!match(TokenType::COMMA)) match(TokenType::SEMICOLON);
+    }
+    consume(TokenType::RBRACE, "Expect '}' after table fields");
+
+    std::unordered_map<std::string, int> regs;
+    for (size_t f = 0; f < fields.size(); ++f) {
+        int reg = allocateRegister();
+        current->locals["(field " + std::to_string(reg) + ")"] = reg;
+        regs[fields[f]] = reg;
+        if ((int)f < numInitialized) {
+            emit(Instruction(OP_MOVE, reg, valueRegs[f], 0));
+            continue;
+        }
+        Instruction& last = current->proto->instructions.back();
+        if ((int)f > numInitialized && last.op == OP_LOADNIL && last.a + last.b + 1 == reg) {
+            last.b++;
+        } else {
+            emit(Instruction(OP_LOADNIL, reg, 0));
+        }
+    }
+    current->locals[name] = regs[fields[0]];
+    current->scalarTables[name] = regs;
+    return true;
+}
+
+// With the name `name` just consumed: if it is a scalar table, consumes the
+// field after it and returns the field's register. Else returns -1.
+int Compiler::loadScalarField(const std::string& name) {
+    auto table = current->scalarTables.find(name);
+    if (table == current->scalarTables.end()) return -1;
+    consume(TokenType::DOT, "Expect '.' after " + name);
+    return table->second.at(consume(TokenType::ID, "Expect field name").value);
+}
+
+// Loads the variable `name` into a register: a local's own, else a new one
+int Compiler::loadVariable(const std::string& name) {
+    auto constant = current->constantLocals.find(name);
+    if (constant != current->constantLocals.end()) {
+        int reg = allocateRegister();
+        emitLoad(reg, constant->second);
+        return reg;
+    }
+    int localReg = resolveLocal(current, name);
+    if (localReg != -1) return localReg;
+    int reg = allocateRegister();
+    int upvalIdx = resolveUpvalue(current, name);
+    if (upvalIdx != -1) {
+        emit(Instruction(OP_GETUPVAL, reg, upvalIdx, 0));
+    } else {
+        emit(Instruction(OP_GETGLOBAL, reg, addConstant(name)));
+    }
+    return reg;
 }
 
 void Compiler::parseBreakStatement() {
@@ -712,77 +1960,73 @@ int Compiler::parseExpression() {
     return parseLogic();
 }
 
-int Compiler::parseLogic() {
-    int leftReg = parseComparison();
-
-    while (peek().type == TokenType::AND || peek().type == TokenType::OR) {
-        TokenType op = advance().type;
-        // Short-circuit logic implementation using Jumps
-        // A and B: if A is false, jump to end (result is A), else result is B
-        // A or B: if A is true, jump to end (result is A), else result is B
-
-        // This requires 'TESTSET' or similar, or manual JMPs.
-        // Simplified: Evaluate both (no short circuit) or implement simple jumps.
-        // Let's implement full short-circuit logic?
-        // It requires patching.
-
-        // For simplicity in this demo, I will treat AND/OR as binary operators without short-circuit
-        // OR I can use the existing infrastructure.
-        // But Lua AND/OR returns the value, not bool.
-
-        // Let's defer proper short-circuit implementation and just parse the structure.
-        // I don't have logical opcodes (OP_AND/OP_OR) in my VM set.
-        // Using JMP_FALSE etc.
-
-        // "and":
-        //   res = left
-        //   JMP_FALSE res, done
-        //   right = parseComparison()
-        //   res = right
-        // done:
+// a or b: the value of a if it is true, else the value of b. `and` binds
+// tighter than `or`.
+int Compiler::parseLogic(int leftReg) {
+    leftReg = parseAnd(leftReg);
+    while (match(TokenType::OR)) {
+        int resReg = allocateRegister();
+        emit(Instruction(OP_MOVE, resReg, leftReg, 0));
+        int jmp = emitJump(OP_JMP_TRUE, resReg);
+        int rightReg = parseAnd();
+        emit(Instruction(OP_MOVE, resReg, rightReg, 0));
+        patchJump(jmp);
+        leftReg = resReg;
+    }
+    return leftReg;
+}
 
+// a and b: the value of a if it is false, else the value of b
+int Compiler::parseAnd(int leftReg) {
+    leftReg = parseComparison(leftReg);
+    while (match(TokenType::AND)) {
         int resReg = allocateRegister();
         emit(Instruction(OP_MOVE, resReg, leftReg, 0));
+        int jmp = emitJump(OP_JMP_FALSE, resReg);
+        int rightReg = parseComparison();
+        emit(Instruction(OP_MOVE, resReg, rightReg, 0));
+        patchJump(jmp);
+        leftReg = resReg;
+    }
+    return leftReg;
+}
 
-        if (op == TokenType::AND) {
-            int jmp = emitJump(OP_JMP_FALSE, resReg);
-            int rightReg = parseComparison();
-            emit(Instruction(OP_MOVE, resReg, rightReg, 0));
-            patchJump(jmp);
+// Compiles an if/while condition for its truth value only: control falls
+// through when it holds and takes the jumps added to falseJumps when it
+// does not. `and` and `or` become conditional jumps on their operands, so
+// unlike parseLogic() no result register is filled in.
+void Compiler::parseCondition(std::vector<int>& falseJumps) {
+    std::vector<int> trueJumps; // To the code after the condition
+    do {
+        parseConditionGroup(falseJumps, trueJumps);
+    } while (match(TokenType::OR));
+    for (int j : trueJumps) patchJump(j);
+}
+
+// One `and` group of a condition. A group followed by `or` jumps to
+// trueJumps when it holds and falls through to the next group when it does
+// not; the last group falls through when it holds and jumps to falseJumps
+// when it does not.
+void Compiler::parseConditionGroup(std::vector<int>& falseJumps, std::vector<int>& trueJumps) {
+    std::vector<int> groupFalse; // Jumps taken when an operand before the last is false
+    for (;;) {
+        int reg = parseComparison();
+        if (match(TokenType::AND)) {
+            groupFalse.push_back(emitJump(OP_JMP_FALSE, reg));
+        } else if (peek().type == TokenType::OR) {
+            trueJumps.push_back(emitJump(OP_JMP_TRUE, reg));
+            for (int j : groupFalse) patchJump(j);
+            return;
         } else {
-            // "or"
-            //   res = left
-            //   JMP_TRUE res, done (Need JMP_TRUE or NOT + JMP_FALSE)
-            //   No JMP_TRUE.
-            //   Emulate:
-            //   TEST res (if true skip next)
-            //   JMP over_move
-            //   JMP done
-            // over_move:
-            //   right = parseComparison
-            //   res = right
-            // done:
-
-            // Or simpler if I add OP_TEST / OP_TESTSET which I haven't.
-            // I added OP_NOT.
-            // if not res then ... else jump done
-
-            int notReg = allocateRegister();
-            emit(Instruction(OP_NOT, notReg, resReg, 0));
-            int jmp = emitJump(OP_JMP_FALSE, notReg); // Jump if NOT(res) is false (meaning res is true)
-
-            int rightReg = parseComparison();
-            emit(Instruction(OP_MOVE, resReg, rightReg, 0));
-
-            patchJump(jmp);
+            falseJumps.push_back(emitJump(OP_JMP_FALSE, reg));
+            falseJumps.insert(falseJumps.end(), groupFalse.begin(), groupFalse.end());
+            return;
         }
-        leftReg = resReg;
     }
-    return leftReg;
 }
 
-int Compiler::parseComparison() {
-    int leftReg = parseConcatenation();
+int Compiler::parseComparison(int leftReg) {
+    if (leftReg < 0) leftReg = parseConcatenation();
 
     while (peek().type == TokenType::EQ || peek().type == TokenType::NE ||
            peek().type == TokenType::LT || peek().type == TokenType::LE ||
@@ -814,15 +2058,18 @@ int Compiler::parseComparison() {
 
 int Compiler::parseConcatenation() {
     int leftReg = parseTerm();
+    if (peek().type != TokenType::DOTDOT) return leftReg;
 
-    // Right associative ..
-    if (match(TokenType::DOTDOT)) {
-        int rightReg = parseConcatenation();
-        int resultReg = allocateRegister();
-        emit(Instruction(OP_CONCAT, resultReg, leftReg, rightReg));
-        return resultReg;
+    // A whole chain a .. b .. c is one CONCAT over consecutive registers, so
+    // no intermediate strings are built
+    std::vector<int> operands = {leftReg};
+    while (match(TokenType::DOTDOT)) {
+        operands.push_back(parseTerm());
     }
-    return leftReg;
+    int first = contiguous(operands);
+    int resultReg = allocateRegister();
+    emit(Instruction(OP_CONCAT, resultReg, first, first + (int)operands.size() - 1));
+    return resultReg;
 }
 
 int Compiler::parseTerm() {
@@ -831,11 +2078,7 @@ int Compiler::parseTerm() {
         TokenType op = advance().type;
         int rightReg = parseFactor();
         int resultReg = allocateRegister();
-        if (op == TokenType::PLUS) {
-            emit(Instruction(OP_ADD, resultReg, leftReg, rightReg));
-        } else {
-            emit(Instruction(OP_SUB, resultReg, leftReg, rightReg));
-        }
+        emitArith(op == TokenType::PLUS ? OP_ADD : OP_SUB, resultReg, leftReg, rightReg);
         leftReg = resultReg;
     }
     return leftReg;
@@ -848,13 +2091,13 @@ int Compiler::parseFactor() {
         int rightReg = parseUnary();
         int resultReg = allocateRegister();
         if (op == TokenType::MUL) {
-            emit(Instruction(OP_MUL, resultReg, leftReg, rightReg));
+            emitArith(OP_MUL, resultReg, leftReg, rightReg);
         } else if (op == TokenType::DIV) {
-            emit(Instruction(OP_DIV, resultReg, leftReg, rightReg));
+            emitArith(OP_DIV, resultReg, leftReg, rightReg);
         } else if (op == TokenType::IDIV) {
-            emit(Instruction(OP_IDIV, resultReg, leftReg, rightReg));
+            emitArith(OP_IDIV, resultReg, leftReg, rightReg);
         } else {
-            emit(Instruction(OP_MOD, resultReg, leftReg, rightReg));
+            emitArith(OP_MOD, resultReg, leftReg, rightReg);
         }
         leftReg = resultReg;
     }
@@ -873,13 +2116,24 @@ int Compiler::parseUnary() {
         emit(Instruction(OP_LEN, reg, operand, 0));
         return reg;
     } else if (match(TokenType::MINUS)) {
+        if (peek().type == TokenType::NUMBER) {
+            // A negated numeral is a constant of its own (-0.0 stays a float)
+            Value val = numberConstant(advance().value);
+            if (is_integer(val)) {
+                val = Value((int64_t)(0 - (uint64_t)as_integer(val)));
+            } else {
+                val = Value(-as_number(val));
+            }
+            int reg = allocateRegister();
+            emitLoad(reg, val);
+            return reg;
+        }
         // Unary minus: 0 - operand
         int operand = parseUnary();
         int reg = allocateRegister();
-        int zeroIdx = addConstant(0.0);
         int zeroReg = allocateRegister();
-        emit(Instruction(OP_LOADK, zeroReg, zeroIdx));
-        emit(Instruction(OP_SUB, reg, zeroReg, operand));
+        emitLoad(zeroReg, Value((int64_t)0));
+        emitArith(OP_SUB, reg, zeroReg, operand);
         return reg;
     }
     return parseAtom();
@@ -888,10 +2142,8 @@ int Compiler::parseUnary() {
 int Compiler::parseAtom() {
     Token t = peek();
     if (match(TokenType::NUMBER)) {
-        double val = std::stod(t.value);
-        int constIdx = addConstant(val);
         int reg = allocateRegister();
-        emit(Instruction(OP_LOADK, reg, constIdx));
+        emitLoad(reg, numberConstant(t.value));
         return reg;
     } else if (match(TokenType::STRING)) {
         int constIdx = addConstant(t.value);
@@ -899,19 +2151,16 @@ int Compiler::parseAtom() {
         emit(Instruction(OP_LOADK, reg, constIdx));
         return reg;
     } else if (match(TokenType::NIL)) {
-        int constIdx = addConstant(Value(Nil{}));
         int reg = allocateRegister();
-        emit(Instruction(OP_LOADK, reg, constIdx));
+        emitLoad(reg, Value(Nil{}));
         return reg;
     } else if (match(TokenType::TRUE)) {
-        int constIdx = addConstant(true);
         int reg = allocateRegister();
-        emit(Instruction(OP_LOADK, reg, constIdx));
+        emitLoad(reg, Value(true));
         return reg;
     } else if (match(TokenType::FALSE)) {
-        int constIdx = addConstant(false);
         int reg = allocateRegister();
-        emit(Instruction(OP_LOADK, reg, constIdx));
+        emitLoad(reg, Value(false));
         return reg;
     } else if (match(TokenType::DOTDOTDOT)) {
         int reg = allocateRegister();
@@ -928,23 +2177,9 @@ int Compiler::parseAtom() {
     } else if (match(TokenType::LBRACE)) {
         return parseTableConstructor();
     } else if (match(TokenType::ID)) {
-        int valReg;
-
-        // Resolve variable
-        int localReg = resolveLocal(current, t.value);
-        if (localReg != -1) {
-            valReg = localReg;
-        } else {
-            int upvalIdx = resolveUpvalue(current, t.value);
-            if (upvalIdx != -1) {
-                valReg = allocateRegister();
-                emit(Instruction(OP_GETUPVAL, valReg, upvalIdx, 0));
-            } else {
-                valReg = allocateRegister();
-                int nameIdx = addConstant(t.value);
-                emit(Instruction(OP_GETGLOBAL, valReg, nameIdx));
-            }
-        }
+        int valReg = loadScalarField(t.value);
+        if (valReg == -1) valReg = loadHoisted(t.value);
+        if (valReg == -1 && !parseInlineCall(t.value, &valReg)) valReg = loadVariable(t.value);
 
         while (true) {
             if (match(TokenType::DOT)) {
@@ -971,7 +2206,8 @@ int Compiler::parseAtom() {
                     consume(TokenType::RPAREN, "Expect ')'");
                 }
 
-                int base = allocateBlock(args.size() + 1);
+                int window = std::max((int)args.size() + 1, callResultSlots);
+                int base = allocateBlock(window);
                 emit(Instruction(OP_MOVE, base, valReg, 0));
                 valReg = base;
 
@@ -980,8 +2216,8 @@ int Compiler::parseAtom() {
                 }
                 emit(Instruction(OP_CALL, base, args.size() + 1, 2));
 
-                // Free registers base+1...base+args.size()
-                for (int r = base + 1; r < base + 1 + (int)args.size(); ++r) {
+                // Free registers base+1...
+                for (int r = base + 1; r < base + window; ++r) {
                     current->allocatedRegs[r] = false;
                 }
             } else if (match(TokenType::COLON)) {
@@ -1007,7 +2243,8 @@ int Compiler::parseAtom() {
                     consume(TokenType::RPAREN, "Expect ')'");
                 }
 
-                int base = allocateBlock(args.size() + 1);
+                int window = std::max((int)args.size() + 1, callResultSlots);
+                int base = allocateBlock(window);
                 emit(Instruction(OP_MOVE, base, funcReg, 0));
 
                 for (size_t i = 0; i < args.size(); ++i) {
@@ -1017,7 +2254,7 @@ int Compiler::parseAtom() {
                 valReg = base;
 
                 // Free registers base+1...
-                for (int r = base + 1; r < base + 1 + (int)args.size(); ++r) {
+                for (int r = base + 1; r < base + window; ++r) {
                     current->allocatedRegs[r] = false;
                 }
             } else {
@@ -1077,16 +2314,14 @@ int Compiler::parseTableConstructor() {
              } else {
                  currentTokenIdx--;
                  int valReg = parseExpression();
-                 int keyIdx = addConstant((double)arrayIdx++);
                  int keyReg = allocateRegister();
-                 emit(Instruction(OP_LOADK, keyReg, keyIdx));
+                 emitLoad(keyReg, Value((int64_t)arrayIdx++));
                  emit(Instruction(OP_SETTABLE, tableReg, keyReg, valReg));
              }
         } else {
             int valReg = parseExpression();
-            int keyIdx = addConstant((double)arrayIdx++);
             int keyReg = allocateRegister();
-            emit(Instruction(OP_LOADK, keyReg, keyIdx));
+            emitLoad(keyReg, Value((int64_t)arrayIdx++));
             emit(Instruction(OP_SETTABLE, tableReg, keyReg, valReg));
         }
     } while (match(TokenType::COMMA));
@@ -1138,7 +2373,40 @@ int Compiler::addConstant(Value v) {
 }
 
 void Compiler::emit(Instruction inst) {
+    clearWritten(current->intRegs, inst);
     current->proto->instructions.push_back(inst);
+    // Attribute the instruction to the last token consumed
+    current->proto->addLine(tokens[currentTokenIdx > 0 ? currentTokenIdx - 1 : 0].line);
+}
+
+// Loads v into R(reg). Nil, booleans and integral numbers below
+// kImmediateLimit are carried in the instruction and take no constant slot
+void Compiler::emitLoad(int reg, const Value& v) {
+    if (is_nil(v)) {
+        emit(Instruction(OP_LOADNIL, reg, 0));
+    } else if (is_boolean(v)) {
+        emit(Instruction(OP_LOADBOOL, reg, as_boolean(v) ? 1 : 0));
+    } else if (is_integer(v) && as_integer(v) > -kImmediateLimit && as_integer(v) < kImmediateLimit) {
+        emit(Instruction(OP_LOADI, reg, (int)as_integer(v)));
+    } else if (is_number(v) && !is_integer(v) && std::floor(as_number(v)) == as_number(v) &&
+               std::fabs(as_number(v)) < kImmediateLimit && !(as_number(v) == 0 && std::signbit(as_number(v)))) {
+        emit(Instruction(OP_LOADF, reg, (int)as_number(v)));
+    } else {
+        emit(Instruction(OP_LOADK, reg, addConstant(v)));
+    }
+    current->intRegs[reg] = is_integer(v);
+}
+
+// Emits R(dest) := R(left) op R(right), in the integer form when both
+// operands are known to be integers
+void Compiler::emitArith(OpCode op, int dest, int left, int right) {
+    OpCode intOp = integerForm(op);
+    if (intOp != op && current->intRegs[left] && current->intRegs[right]) {
+        emit(Instruction(intOp, dest, left, right));
+        current->intRegs[dest] = true;
+    } else {
+        emit(Instruction(op, dest, left, right));
+    }
 }
 
 int Compiler::emitJump(OpCode op, int condReg) {
@@ -1179,3 +2447,19 @@ int Compiler::allocateBlock(int size) {
     }
     throw std::runtime_error("Stack overflow: too many registers used (contiguous block)");
 }
+
+// First of consecutive registers holding the values of `regs` in order:
+// the registers themselves if they already are, else a block moved into
+int Compiler::contiguous(const std::vector<int>& regs) {
+    int n = (int)regs.size();
+    for (int i = 1; i < n; ++i) {
+        if (regs[i] != regs[0] + i) {
+            int first = allocateBlock(n);
+            for (int j = 0; j < n; ++j) {
+                emit(Instruction(OP_MOVE, first + j, regs[j], 0));
+            }
+            return first;
+        }
+    }
+    return regs[0];
+}
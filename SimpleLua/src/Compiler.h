@@ -6,6 +6,7 @@
 #include "Lexer.h"
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include <string>
 #include <bitset>
 #include <memory>
@@ -20,12 +21,56 @@ struct UpvalueInfo {
     int index;
 };
 
+// A run of consecutive instructions generated from the same source line
+struct LineRun {
+    int line;
+    int count;
+};
+
 struct Prototype {
     std::vector<Instruction> instructions;
     std::vector<Value> constants;
     std::vector<std::unique_ptr<Prototype>> protos; // Nested functions
     std::vector<UpvalueInfo> upvalues;
     int numParams;
+
+    // Debug info: run-length encoded source line of each instruction
+    std::vector<LineRun> lineInfo;
+    std::string name; // Declared name, empty for anonymous functions
+    int lineDefined = 0;
+
+    void addLine(int line) {
+        if (!lineInfo.empty() && lineInfo.back().line == line) {
+            lineInfo.back().count++;
+        } else {
+            lineInfo.push_back({line, 1});
+        }
+    }
+
+    int lineAt(int pc) const {
+        for (const LineRun& run : lineInfo) {
+            if (pc < run.count) return run.line;
+            pc -= run.count;
+        }
+        return lineInfo.empty() ? 0 : lineInfo.back().line;
+    }
+};
+
+// A local function small enough to compile in place at its calls
+struct InlineFunction {
+    int reg;                                    // The local holding it
+    std::vector<std::string> params;
+    int bodyToken;                              // First token of its body
+    int endToken;                               // Its closing 'end'
+    bool returns;                               // Ends in a return rather than falling off its end
+    std::unordered_map<std::string, int> scope; // Locals visible where it was declared
+};
+
+// A call being compiled in place
+struct InlineSite {
+    int resultReg;          // -1 when the result is unused
+    int endToken;           // The callee's closing 'end'
+    std::vector<int> exits; // Jumps from its returns to the end of the body
 };
 
 // Represents the state of the function currently being compiled
@@ -38,6 +83,20 @@ struct CompilerState {
 
     int nextReg;
     std::bitset<256> allocatedRegs;
+    std::bitset<256> intRegs; // Registers holding a value proved to be an integer
+    std::unordered_map<int, int> localDecls; // Register -> token index declaring the local in it
+    std::vector<size_t> protoHashes; // Structural hash of each nested prototype
+    int firstToken = 0; // First token of the function's parameters or body
+    // Names appearing in functions nested in this one, found on first use
+    std::unique_ptr<std::unordered_set<std::string>> closureNames;
+    std::unordered_map<std::string, int> stringBuffers; // Loop accumulator local -> its buffer register
+    std::unordered_map<std::string, int> hoistedLoads;  // Loop-invariant field chain -> its cache register
+    std::unordered_map<std::string, InlineFunction> inlineFunctions; // By the local's name
+    std::unordered_map<std::string, Value> constantLocals; // Loop variables of unrolled loops
+    // Locals of tables that never escape -> the register of each field
+    std::unordered_map<std::string, std::unordered_map<std::string, int>> scalarTables;
+    InlineSite* inlineSite = nullptr; // The call whose body is being compiled in place, if any
+    std::bitset<256> pinnedRegs;      // Registers of the expression around that call
     CompilerState* enclosing; // Parent scope
 
     CompilerState(CompilerState* parent, Prototype* p) : proto(p), nextReg(0), enclosing(parent) {
@@ -45,17 +104,41 @@ struct CompilerState {
     }
 };
 
+// What the compiler may assume about the program it compiles
+struct CompilerOptions {
+    bool assumePureCalls = false; // Calls and metamethods change no field, global or local a loop reads
+    int inlineBudget = 40;        // Most body tokens of a local function inlined at its calls; 0: none
+    int unrollBudget = 0;         // Most body tokens a numeric for loop is unrolled to; 0: none
+    bool mergeFunctions = false;  // Identical nested functions share one prototype and its debug info
+};
+
 class Compiler {
 public:
-    Compiler();
+    explicit Compiler(const CompilerOptions& options = CompilerOptions());
     std::unique_ptr<Prototype> compile(const std::string& source); // Returns the main chunk prototype
+    int inlinedCallSites() const { return inlinedCalls; }           // In the last compile
 
 private:
+    CompilerOptions options;
     std::vector<Token> tokens;
     int currentTokenIdx;
 
     CompilerState* current;
 
+    // Registers from its base that a call window keeps clear of locals, so
+    // the last call of an explist can be adjusted to that many results
+    int callResultSlots;
+
+    // Locals (by declaring token index) assigned after their declaration, and
+    // those whose integer initializer the current pass relied on
+    std::unordered_set<int> reassignedLocals;
+    std::unordered_set<int> integerLocals;
+
+    int inlinedCalls = 0;
+    int inlineDepth = 0; // Calls being compiled in place within one another
+
+    std::unique_ptr<Prototype> compileChunk();
+
     Token peek();
     Token advance();
     bool match(TokenType type);
@@ -64,19 +147,28 @@ private:
     void parseStatement();
     void parseStatementImpl();
     void parseIfStatement();
+    bool parseSwitchArms(std::vector<int>& jumpEnds);
+    void parseCondition(std::vector<int>& falseJumps);
+    void parseConditionGroup(std::vector<int>& falseJumps, std::vector<int>& trueJumps);
     void parseWhileStatement();
     void parseForStatement();
+    bool parseUnrolledFor(const Token& name, int nameToken);
     void parseBreakStatement();
     void parseGotoStatement();
     void parseLabelStatement();
     void parseFunctionStatement();
-    int parseFunctionExpression();
+    int parseFunctionExpression(const std::string& name = "");
+    int mergeFunction(int protoIdx);
+    void noteInlineFunction(const std::string& name, int paren);
+    bool parseInlineCall(const std::string& name, int* resultReg);
+    void pruneBindings();
     void parseReturnStatement();
     void parseBlock();
 
     int parseExpression();
-    int parseLogic();
-    int parseComparison();
+    int parseLogic(int leftReg = -1);       // leftReg: an already parsed first operand
+    int parseAnd(int leftReg = -1);
+    int parseComparison(int leftReg = -1);
     int parseConcatenation();
     int parseTerm();
     int parseFactor();
@@ -86,6 +178,18 @@ private:
 
     // Variable access
     void parseVariable(Token name, bool isAssignment, int rValueReg);
+    OpCode stockIteratorCall(int start);
+    std::vector<std::string> openStringBuffers(int loopToken);
+    void closeStringBuffers(const std::vector<std::string>& names);
+    void parseBufferAppend(const Token& name);
+    bool parseScalarTable(const std::string& name);
+    int loadScalarField(const std::string& name);
+    std::vector<std::string> openHoistedLoads(int loopToken);
+    void closeHoistedLoads(const std::vector<std::string>& chains);
+    int loadHoisted(const std::string& name);
+    int loadVariable(const std::string& name);
+    void noteAssignment(const std::string& name);
+    void declareLocal(int reg, int declToken, bool isInteger);
 
     // Upvalues
     int resolveLocal(CompilerState* state, const std::string& name);
@@ -98,10 +202,13 @@ private:
 
     int addConstant(Value v);
     void emit(Instruction inst);
+    void emitLoad(int reg, const Value& v);
+    void emitArith(OpCode op, int dest, int left, int right);
     int emitJump(OpCode op, int condReg = 0);
     void patchJump(int instructionIndex);
     int allocateRegister();
     int allocateBlock(int size);
+    int contiguous(const std::vector<int>& regs);
 };
 
 #endif
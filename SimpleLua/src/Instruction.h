@@ -13,4 +13,8 @@ struct Instruction {
     Instruction(OpCode op, int a, int bx) : op(op), a(a), b(bx), c(0) {} // For LOADK
 };
 
+// Bound on the immediate operand of OP_LOADI/OP_LOADF, so that it fits the
+// B field of every instruction encoding
+const int kImmediateLimit = 1 << 30;
+
 #endif
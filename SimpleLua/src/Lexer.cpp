@@ -136,8 +136,18 @@ Token Lexer::identifier() {
     return {TokenType::ID, text, line};
 }
 
+// Numerals keep their source text; the compiler turns it into an integer or
+// a float constant. Hex numerals are integers.
 Token Lexer::number() {
     std::string text;
+    if (peek() == '0' && (pos + 1 < (int)source.length()) && (source[pos + 1] == 'x' || source[pos + 1] == 'X')) {
+        text += advance();
+        text += advance();
+        while (isxdigit(peek())) {
+            text += advance();
+        }
+        return {TokenType::NUMBER, text, line};
+    }
     while (isdigit(peek())) {
         text += advance();
     }
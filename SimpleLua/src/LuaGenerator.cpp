@@ -1,49 +1,62 @@
 #include "LuaGenerator.h"
+#include "Superinstructions.h"
 #include <vector>
 #include <sstream>
 #include <iomanip>
 #include <cctype>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
 
 // Helper prototypes
 static std::string encryptString(const std::string& s);
 static std::string encryptInstruction(int op, int a, int b, int c, int pc);
+static long long packInstruction(int op, int a, int b, int c);
+static std::string quoteBinary(const std::string& bytes);
+static int countProtos(const Prototype* proto);
 static std::string minify(std::string code);
+static std::string opHandler(OpCode op);
+static std::string numberLiteral(const Value& v);
+static std::string superHandler(const std::vector<OpCode>& ops, const GeneratorOptions& options);
 
-void LuaGenerator::generate(Prototype* proto, std::ostream& out, const OpCodeStrategy& strategy, bool pack, bool encrypt) {
+// Order of the branches in the dispatch chain
+static const OpCode kHandlerOrder[] = {
+    OP_MOVE, OP_LOADK, OP_ADD, OP_SUB,
+    OP_MUL, OP_DIV, OP_IDIV, OP_MOD,
+    OP_CONCAT, OP_LEN, OP_NOT, OP_EQ,
+    OP_LT, OP_LE, OP_JMP, OP_JMP_FALSE,
+    OP_GETGLOBAL, OP_SETGLOBAL, OP_NEWTABLE, OP_GETTABLE,
+    OP_SETTABLE, OP_GETUPVAL, OP_SETUPVAL, OP_VARARG,
+    OP_FORPREP, OP_FORLOOP, OP_TFORCALL, OP_TFORLOOP,
+    OP_CLOSURE, OP_CALL, OP_RETURN, OP_ADD_INT,
+    OP_SUB_INT, OP_MUL_INT, OP_IDIV_INT, OP_MOD_INT,
+    OP_FORLOOP_UP, OP_FORLOOP_DOWN, OP_TFORIPAIRS, OP_TFORPAIRS,
+    OP_BUFINIT, OP_BUFAPPEND, OP_BUFFLUSH, OP_LOADNIL,
+    OP_LOADBOOL, OP_LOADI, OP_LOADF, OP_SWITCH,
+    OP_JMP_TRUE,
+};
+
+void LuaGenerator::generate(Prototype* proto, std::ostream& out, const OpCodeStrategy& strategy, const GeneratorOptions& requested) {
+    // The binary blob always stores packed instruction words
+    GeneratorOptions options = requested;
+    if (options.binary) options.compactCode = true;
+    if (options.profileTiming) options.profile = true;
+    bool encrypt = options.encrypt;
+    if (options.superinstructions.size() > (size_t)MAX_SUPERINSTRUCTIONS) {
+        throw std::runtime_error("Too many superinstructions");
+    }
+    // Unused superinstruction slots get no local and no handler
+    int numOpcodes = OP_SUPER0 + (int)options.superinstructions.size();
     std::stringstream ss;
 
     // 1. Opcodes definitions
-    ss << "local OP_MOVE = " << strategy.get(OP_MOVE) << "\n";
-    ss << "local OP_LOADK = " << strategy.get(OP_LOADK) << "\n";
-    ss << "local OP_ADD = " << strategy.get(OP_ADD) << "\n";
-    ss << "local OP_SUB = " << strategy.get(OP_SUB) << "\n";
-    ss << "local OP_MUL = " << strategy.get(OP_MUL) << "\n";
-    ss << "local OP_DIV = " << strategy.get(OP_DIV) << "\n";
-    ss << "local OP_IDIV = " << strategy.get(OP_IDIV) << "\n";
-    ss << "local OP_MOD = " << strategy.get(OP_MOD) << "\n";
-    ss << "local OP_CONCAT = " << strategy.get(OP_CONCAT) << "\n";
-    ss << "local OP_LEN = " << strategy.get(OP_LEN) << "\n";
-    ss << "local OP_NOT = " << strategy.get(OP_NOT) << "\n";
-    ss << "local OP_EQ = " << strategy.get(OP_EQ) << "\n";
-    ss << "local OP_LT = " << strategy.get(OP_LT) << "\n";
-    ss << "local OP_LE = " << strategy.get(OP_LE) << "\n";
-    ss << "local OP_JMP = " << strategy.get(OP_JMP) << "\n";
-    ss << "local OP_JMP_FALSE = " << strategy.get(OP_JMP_FALSE) << "\n";
-    ss << "local OP_GETGLOBAL = " << strategy.get(OP_GETGLOBAL) << "\n";
-    ss << "local OP_SETGLOBAL = " << strategy.get(OP_SETGLOBAL) << "\n";
-    ss << "local OP_NEWTABLE = " << strategy.get(OP_NEWTABLE) << "\n";
-    ss << "local OP_GETTABLE = " << strategy.get(OP_GETTABLE) << "\n";
-    ss << "local OP_SETTABLE = " << strategy.get(OP_SETTABLE) << "\n";
-    ss << "local OP_CALL = " << strategy.get(OP_CALL) << "\n";
-    ss << "local OP_CLOSURE = " << strategy.get(OP_CLOSURE) << "\n";
-    ss << "local OP_GETUPVAL = " << strategy.get(OP_GETUPVAL) << "\n";
-    ss << "local OP_SETUPVAL = " << strategy.get(OP_SETUPVAL) << "\n";
-    ss << "local OP_VARARG = " << strategy.get(OP_VARARG) << "\n";
-    ss << "local OP_FORPREP = " << strategy.get(OP_FORPREP) << "\n";
-    ss << "local OP_FORLOOP = " << strategy.get(OP_FORLOOP) << "\n";
-    ss << "local OP_TFORCALL = " << strategy.get(OP_TFORCALL) << "\n";
-    ss << "local OP_TFORLOOP = " << strategy.get(OP_TFORLOOP) << "\n";
-    ss << "local OP_RETURN = " << strategy.get(OP_RETURN) << "\n\n";
+    for (int i = 0; i < numOpcodes; ++i) {
+        OpCode op = static_cast<OpCode>(i);
+        ss << "local " << opName(op) << " = " << strategy.get(op) << "\n";
+    }
+    ss << "\n";
 
     if (encrypt) {
         ss << R"(
@@ -54,179 +67,714 @@ local function decrypt_string(t)
     end
     return table.concat(s)
 end
+)";
+        // Code is decrypted once per prototype, on first entry, into a plain
+        // array cached on the prototype; the dispatch loop never decrypts.
+        if (options.compactCode) {
+            ss << R"(
+local function decrypt_code(proto)
+    local code = proto.code
+    local plain = {}
+    for pc = 1, #code do
+        plain[pc] = code[pc] ~ (0xDEADBEEF ~ pc)
+    end
+    proto.plain = plain
+    return plain
+end
+)";
+        } else {
+            ss << R"(
+local function decrypt_code(proto)
+    local code = proto.code
+    local plain = {}
+    for pc = 1, #code do
+        local t = code[pc]
+        local key = 0xDEADBEEF ~ pc
+        plain[pc] = { t[1] ~ key, t[2] ~ key, t[3] ~ key, t[4] ~ key }
+    end
+    proto.plain = plain
+    return plain
+end
+)";
+        }
+    }
 
-local function decrypt_instruction(t, pc)
-    local key = 0xDEADBEEF ~ pc
-    return { t[1] ~ key, t[2] ~ key, t[3] ~ key, t[4] ~ key }
+    if (options.binary) {
+        std::string blob;
+        serializeProto(proto, blob, 0, strategy, options);
+        ss << "local blob = " << quoteBinary(blob) << "\n";
+        ss << R"(
+local sunpack = string.unpack
+)";
+        if (encrypt) {
+            ss << R"(
+local function decrypt_bytes(s)
+    return (s:gsub(".", function(ch) return string.char(ch:byte() ~ 0xAA) end))
+end
+)";
+        }
+        ss << R"(
+local load_proto
+
+-- Materialize a prototype body from the blob (layout: see serializeProto)
+local function load_body(proto, pos)
+    local nconst
+    nconst, pos = sunpack("<I4", blob, pos)
+    local constants = {}
+    for i = 0, nconst - 1 do
+        local tag
+        tag, pos = sunpack("B", blob, pos)
+        if tag == 1 then
+            constants[i] = false
+        elseif tag == 2 then
+            constants[i] = true
+        elseif tag == 3 then
+            constants[i], pos = sunpack("<i8", blob, pos)
+        elseif tag == 4 then
+            constants[i], pos = sunpack("<d", blob, pos)
+        elseif tag == 5 then
+)";
+        if (encrypt) {
+            ss << R"(            local s
+            s, pos = sunpack("<s4", blob, pos)
+            constants[i] = decrypt_bytes(s)
+)";
+        } else {
+            ss << R"(            constants[i], pos = sunpack("<s4", blob, pos)
+)";
+        }
+        ss << R"(        end
+    end
+    local ncode
+    ncode, pos = sunpack("<I4", blob, pos)
+    local code = {}
+    for pc = 1, ncode do
+        code[pc], pos = sunpack("<i8", blob, pos)
+    end
+)";
+        if (options.sample) {
+            ss << R"(    local nruns
+    nruns, pos = sunpack("<I4", blob, pos)
+    local lines = {}
+    for i = 1, 2 * nruns do
+        lines[i], pos = sunpack("<I4", blob, pos)
+    end
+    proto.lines = lines
+)";
+        }
+        ss << R"(    local nprotos
+    nprotos, pos = sunpack("<I4", blob, pos)
+    local protos = {}
+    for i = 0, nprotos - 1 do
+        local size
+        size, pos = sunpack("<I4", blob, pos)
+        protos[i] = load_proto(pos)
+        pos = pos + size
+    end
+    proto.constants = constants
+    proto.code = code
+    proto.protos = protos
+end
+
+-- Prototype header: what OP_CLOSURE needs to capture upvalues
+load_proto = function(pos)
+    local id, numParams, nups
+)";
+        if (options.profile) {
+            ss << R"(    id, numParams, nups, pos = sunpack("<I4I2I2", blob, pos)
+)";
+        } else {
+            ss << R"(    numParams, nups, pos = sunpack("<I2I2", blob, pos)
+)";
+        }
+        if (options.sample) {
+            ss << R"(    local name, linedefined
+    name, linedefined, pos = sunpack("<s2I4", blob, pos)
+)";
+        }
+        ss << R"(
+    local upvalues = {}
+    for i = 0, nups - 1 do
+        local isLocal, index
+        isLocal, index, pos = sunpack("<BI2", blob, pos)
+        upvalues[i] = { isLocal = isLocal == 1, index = index }
+    end
+    local proto = { id = id, numParams = numParams, nups = nups, upvalues = upvalues }
+)";
+        if (options.sample) {
+            ss << "    proto.name, proto.linedefined = name, linedefined\n";
+        }
+        if (options.lazyProtos) {
+            ss << R"(    proto.pending = pos -- body loaded on first call
+)";
+        } else {
+            ss << R"(    load_body(proto, pos)
+)";
+        }
+        ss << R"(    return proto
 end
+
+local main_proto = load_proto(1)
+)";
+        if (options.lazyProtos) {
+            ss << R"(load_body(main_proto, main_proto.pending)
+main_proto.pending = nil
 )";
+        }
+    } else {
+        ss << "local main_proto = ";
+        generateProto(proto, ss, 0, strategy, options);
+        ss << "\n";
     }
 
-    ss << "local main_proto = ";
-    generateProto(proto, ss, 0, strategy, encrypt);
-    ss << "\n";
+    if (options.lazyProtos) {
+        // Nested protos carry only their header until first entered; the body
+        // is a blob offset (binary) or a builder thunk (table literals)
+        ss << "\nlocal proto_stats = { loaded = 0, total = " << countProtos(proto) - 1 << " }\n";
+        ss << R"(
+local function materialize_proto(proto)
+)";
+        if (options.binary) {
+            ss << "    load_body(proto, proto.pending)\n";
+        } else {
+            ss << R"(    local body = proto.pending()
+    proto.constants = body.constants
+    proto.code = body.code
+    proto.protos = body.protos
+)";
+            if (options.sample) ss << "    proto.lines = body.lines\n";
+        }
+        ss << R"(    proto.pending = nil
+    proto_stats.loaded = proto_stats.loaded + 1
+end
+)";
+    }
 
     // 4. VM Logic - Part 1
     ss << R"(
 local _G = _G -- Global environment
 local unpack = table.unpack or unpack
+local concat = table.concat
+local type = type
+-- Iterators the stock ipairs and pairs return; loops over them run inline
+local stock_inext = ipairs({})
+local stock_next = next
 
 -- Forward declaration of run_vm
 local run_vm
+)";
+    if (options.profile || options.sample) {
+        // The output is written after the program has run, which may have
+        // replaced any global by then
+        ss << R"(
+-- Library functions the profile output uses, taken before the program runs
+local pcall, pairs, ipairs = pcall, pairs, ipairs
+local format, sort = string.format, table.sort
+local open, getenv = io.open, os.getenv
+)";
+    }
+
+    // Entry point used for closures and the main chunk
+    const char* enterVM = options.profileTiming ? "timed_run" : "run_vm";
+    if (options.profile) {
+        ss << R"(
+-- Profiling: per-proto call counts, per-pc execution counts (and timing)
+local OP_NAMES = {
+)";
+        for (int i = 0; i < numOpcodes; ++i) {
+            ss << "    [" << opName(static_cast<OpCode>(i)) << "] = \"" << opName(static_cast<OpCode>(i)) << "\",\n";
+        }
+        ss << "}\n\n-- Opcodes that always continue at the next pc (may start a superinstruction)\nlocal PROF_FALLTHROUGH = {\n";
+        for (int i = 0; i < numOpcodes; ++i) {
+            if (fallsThrough(static_cast<OpCode>(i))) ss << "    " << opName(static_cast<OpCode>(i)) << " = true,\n";
+        }
+        ss << R"(}
+local prof_protos = {}
 
--- Helper to wrap a closure table into a native Lua function
-local function wrap_if_needed(val)
-    if type(val) == "table" and val.type == "closure" then
-        if not val.wrapper then
-            val.wrapper = function(...)
-                local args = {...}
-                local proto = val.proto
-                local numParams = proto.numParams or 0
-                local fArgs = {}
-                local vArgs = {}
-                local n = select('#', ...)
-
-                for i = 1, n do
-                    if i <= numParams then
-                        fArgs[i] = args[i]
-                    else
-                        table.insert(vArgs, args[i])
+local function prof_record(proto)
+    local rec = prof_protos[proto.id]
+    if not rec then
+        rec = { calls = 0, seconds = 0, depth = 0, counts = {}, proto = proto }
+        prof_protos[proto.id] = rec
+    end
+    return rec
+end
+
+local function prof_dump()
+    local path = getenv("SIMPLELUA_PROFILE") or "simplelua.prof"
+    local f = open(path, "w")
+    if not f then return end
+    f:write("# simplelua profile\nruns 1\n")
+    local op_totals = {}
+    local seq_totals = {}
+    for id, rec in pairs(prof_protos) do
+        local code = rec.proto.plain or rec.proto.code
+        local counts = rec.counts
+        local names = {}
+        for pc = 1, #counts do
+)";
+        if (options.compactCode) {
+            ss << "            names[pc] = OP_NAMES[code[pc] & 0xFF]\n";
+        } else {
+            ss << "            names[pc] = OP_NAMES[code[pc][1]]\n";
+        }
+        ss << R"(        end
+        local total = 0
+        for pc = 1, #counts do
+            local n = counts[pc]
+            if n > 0 then
+                local name = names[pc]
+                f:write(format("pc %d %d %s %d\n", id, pc - 1, name, n))
+                op_totals[name] = (op_totals[name] or 0) + n
+                total = total + n
+                -- Straight-line successors run exactly as often as this pc
+                local second = names[pc + 1]
+                if second and PROF_FALLTHROUGH[name] then
+                    local key = name .. "," .. second
+                    seq_totals[key] = (seq_totals[key] or 0) + n
+                    local third = names[pc + 2]
+                    if third and PROF_FALLTHROUGH[second] then
+                        key = key .. "," .. third
+                        seq_totals[key] = (seq_totals[key] or 0) + n
                     end
                 end
-                vArgs.n = n - numParams
-                if vArgs.n < 0 then vArgs.n = 0 end
+            end
+        end
+        f:write(format("proto %d %d %d %.6f\n", id, rec.calls, total, rec.seconds))
+    end
+    for name, n in pairs(op_totals) do
+        f:write(format("op %s %d\n", name, n))
+    end
+    for key, n in pairs(seq_totals) do
+        f:write(format("seq %s %d\n", key, n))
+    end
+    f:close()
+end
+)";
+        if (options.profileTiming) {
+            ss << R"(
+local clock = os.clock
+
+local function prof_leave(rec, t0, ...)
+    rec.depth = rec.depth - 1
+    -- Inclusive time, counted once for recursive activations
+    if rec.depth == 0 then rec.seconds = rec.seconds + (clock() - t0) end
+    return ...
+end
+
+local function timed_run(closure, ...)
+    local rec = prof_record(closure.proto)
+    rec.depth = rec.depth + 1
+    local t0 = clock()
+    return prof_leave(rec, t0, run_vm(closure, ...))
+end
+)";
+        }
+    }
+
+    if (options.sample) {
+        ss << "\nlocal sample_chunk = " << quoteBinary(options.chunkName) << "\n";
+        ss << R"(
+-- Sampling: a count hook walks the host stack for run_vm frames and reads
+-- their proto/pc locals, so the dispatch loop itself is not instrumented
+local sample_stacks = {}
+local getinfo, getlocal, sethook = debug.getinfo, debug.getlocal, debug.sethook
+local proto_slot, pc_slot = 1, 1
+
+-- Source line of 0-based instruction pc from the (line, count) pairs
+local function sample_line(proto, pc)
+    local lines = proto.lines
+    if not lines then return 0 end
+    for i = 1, #lines, 2 do
+        pc = pc - lines[i + 1]
+        if pc < 0 then return lines[i] end
+    end
+    return lines[#lines - 1] or 0
+end
 
-                return run_vm(val, fArgs, vArgs)
+local function sample_hook()
+    local frames = {}
+    local level = 2
+    local info = getinfo(level, "f")
+    while info do
+        if info.func == run_vm then
+            -- proto and pc are declared at the top of run_vm, so their local
+            -- slots are stable; rescan only when the cached slots miss
+            local pname, proto = getlocal(level, proto_slot)
+            local cname, pc = getlocal(level, pc_slot)
+            if pname ~= "proto" or cname ~= "pc" then
+                proto, pc = nil, nil
+                local i = 1
+                local name, value = getlocal(level, i)
+                while name do
+                    if name == "proto" then proto, proto_slot = value, i
+                    elseif name == "pc" then pc, pc_slot = value, i end
+                    i = i + 1
+                    name, value = getlocal(level, i)
+                end
+            end
+            if proto and pc then
+                -- pc already points past the instruction being executed
+                local fname = proto.name
+                if not fname or fname == "" then fname = "anonymous:" .. (proto.linedefined or 0) end
+                frames[#frames + 1] = format("%s@%s:%d", fname, sample_chunk, sample_line(proto, pc - 2))
             end
         end
-        return val.wrapper
+        level = level + 1
+        info = getinfo(level, "f")
     end
-    return val
+    local n = #frames
+    if n == 0 then return end
+    -- Folded stacks list the outermost frame first
+    for i = 1, n // 2 do
+        frames[i], frames[n - i + 1] = frames[n - i + 1], frames[i]
+    end
+    local key = concat(frames, ";")
+    sample_stacks[key] = (sample_stacks[key] or 0) + 1
+end
+
+local function sample_start()
+    local period = tonumber(getenv("SIMPLELUA_SAMPLE_PERIOD")) or 100000
+    sethook(sample_hook, "", period)
 end
 
--- Metatable for closures to support pcall/xpcall(arg1)
-local closure_mt = {
-    __call = function(t, ...)
-        return wrap_if_needed(t)(...)
+local function sample_stop()
+    sethook()
+    local path = getenv("SIMPLELUA_SAMPLES") or "simplelua.folded"
+    local f = open(path, "w")
+    if not f then return end
+    local keys = {}
+    for key in pairs(sample_stacks) do keys[#keys + 1] = key end
+    sort(keys)
+    for _, key in ipairs(keys) do
+        f:write(key, " ", sample_stacks[key], "\n")
     end
-}
+    f:close()
+end
+)";
+    }
+
+    ss << R"(
+-- Materialize a prototype and its upvalue boxes as a genuine Lua function,
+-- so closures can be handed to native code (sort, gsub, pcall, metamethods)
+local function make_closure(proto, upvalues)
+    local closure = { proto = proto, upvalues = upvalues }
+    return function(...)
+        return )" << enterVM << R"((closure, ...)
+    end
+end
 
-run_vm = function(closure, args, varargs)
+run_vm = function(closure, ...)
     local proto = closure.proto
-    local stack = {}
+)";
+    if (options.lazyProtos) {
+        ss << "    if proto.pending then materialize_proto(proto) end\n";
+    }
+    ss << R"(    local stack = {}
 
     -- Open upvalues: map from stack index to upvalue box
     local open_upvalues = {}
 
     -- Initialize args
-    if args then
-        local numParams = proto.numParams or 0
+    local numParams = proto.numParams
+    local nargs = select('#', ...)
+    if nargs > 0 then
+        local args = { ... }
         for i = 1, numParams do
             stack[i-1] = args[i]
         end
     end
 
-    local vargs = varargs or {}
+    local vargs
+    if nargs > numParams then
+        vargs = { n = nargs - numParams, select(numParams + 1, ...) }
+    else
+        vargs = { n = 0 }
+    end
 
     local pc = 1
-    local code = proto.code
-    local constants = proto.constants
-    local protos = proto.protos
-    local upvalues = closure.upvalues or {}
-
-    while pc <= #code do
 )";
-
-    // VM Logic - Fetch Instruction
     if (encrypt) {
-        ss << "        local inst = decrypt_instruction(code[pc], pc)\n";
+        ss << "    local code = proto.plain or decrypt_code(proto)\n";
     } else {
-        ss << "        local inst = code[pc]\n";
+        ss << "    local code = proto.code\n";
+    }
+    ss << R"(    local constants = proto.constants
+    local protos = proto.protos
+    local upvalues = closure.upvalues
+    local ncode = #code
+)";
+    if (options.profile) {
+        ss << R"(    local prof = prof_record(proto)
+    prof.calls = prof.calls + 1
+    local prof_counts = prof.counts
+    if #prof_counts ~= ncode then
+        for i = 1, ncode do prof_counts[i] = 0 end
+    end
+)";
     }
+    ss << R"(
+    while pc <= ncode do
+)";
 
-    // VM Logic - Part 2
-    ss << R"(        pc = pc + 1
+    // VM Logic - Fetch and decode instruction
+    if (options.compactCode) {
+        // Packed layout (see packInstruction): op | a << 8 | c << 16 | (b + 2^30) << 32
+        ss << R"(        local inst = code[pc]
+)";
+        if (options.profile) ss << "        prof_counts[pc] = prof_counts[pc] + 1\n";
+        ss << R"(        pc = pc + 1
+
+        local op = inst & 0xFF
+        local a = (inst >> 8) & 0xFF
+        local c = (inst >> 16) & 0xFFFF
+        local b = (inst >> 32) - 0x40000000
+)";
+    } else {
+        ss << R"(        local inst = code[pc]
+)";
+        if (options.profile) ss << "        prof_counts[pc] = prof_counts[pc] + 1\n";
+        ss << R"(        pc = pc + 1
 
         local op = inst[1]
         local a = inst[2]
         local b = inst[3]
         local c = inst[4]
+)";
+    }
+
+    // VM Logic - Part 2: dispatch chain
+    // Superinstructions are the hottest sequences by construction, so they
+    // are tested first
+    bool firstHandler = true;
+    for (size_t k = 0; k < options.superinstructions.size(); ++k) {
+        OpCode op = static_cast<OpCode>(OP_SUPER0 + k);
+        ss << (firstHandler ? "\n        if" : "        elseif") << " op == " << opName(op) << " then\n"
+           << superHandler(options.superinstructions[k], options);
+        firstHandler = false;
+    }
+    // Then the requested (profiled) order, then the remaining opcodes in
+    // their default order
+    std::vector<OpCode> order;
+    std::vector<bool> placed(NUM_OPCODES, false);
+    for (OpCode op : options.handlerOrder) {
+        if (op >= 0 && op < OP_SUPER0 && !placed[op]) {
+            order.push_back(op);
+            placed[op] = true;
+        }
+    }
+    for (OpCode op : kHandlerOrder) {
+        if (!placed[op]) order.push_back(op);
+    }
+    for (OpCode op : order) {
+        ss << (firstHandler ? "\n        if" : "        elseif") << " op == " << opName(op) << " then\n" << opHandler(op);
+        firstHandler = false;
+    }
+    ss << R"(        else
+            error("Unknown opcode: " .. op)
+        end
+    end
+end
+
+-- Run main chunk
+)";
+    if (options.profile || options.sample) {
+        if (options.sample) ss << "sample_start()\n";
+        ss << "local ok, err = pcall(" << enterVM << ", { proto = main_proto, upvalues = {} })\n";
+        // A failed dump must not hide the program's error
+        if (options.sample) ss << "pcall(sample_stop)\n";
+        if (options.profile) ss << "pcall(prof_dump)\n";
+        ss << "if not ok then error(err, 0) end\n";
+    } else {
+        ss << "run_vm({ proto = main_proto, upvalues = {} })\n";
+    }
 
-        if op == OP_MOVE then
-            stack[a] = stack[b]
+    if (options.lazyProtos) {
+        ss << R"(
+if os.getenv("SIMPLELUA_VM_STATS") then
+    io.stderr:write(string.format("protos loaded: %d/%d\n", proto_stats.loaded, proto_stats.total))
+end
+)";
+    }
+
+    std::string result = ss.str();
+    if (options.pack) {
+        result = minify(result);
+    }
+    out << result;
+}
+
+
+// Body of the dispatch branch for one opcode. Handlers read the decoded
+// operands a, b, c and may advance pc; only the last handler of a
+// superinstruction may leave the frame.
+static std::string opHandler(OpCode op) {
+    switch (op) {
+    case OP_MOVE:
+        return R"(            stack[a] = stack[b]
             -- If 'a' has an open upvalue, update it
             if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-        elseif op == OP_LOADK then
-            stack[a] = constants[b]
+)";
+    case OP_LOADK:
+        return R"(            stack[a] = constants[b]
             if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-        elseif op == OP_ADD then
-            stack[a] = stack[b] + stack[c]
+)";
+    case OP_LOADNIL:
+        return R"(            for r = a, a + b do
+                stack[r] = nil
+                if open_upvalues[r] then open_upvalues[r].val = nil end
+            end
+)";
+    case OP_LOADBOOL:
+        return R"(            stack[a] = b ~= 0
             if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-        elseif op == OP_SUB then
-            stack[a] = stack[b] - stack[c]
+)";
+    case OP_LOADI:
+        return R"(            stack[a] = b
             if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-        elseif op == OP_MUL then
-            stack[a] = stack[b] * stack[c]
+)";
+    case OP_LOADF:
+        return R"(            stack[a] = b + 0.0
             if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-        elseif op == OP_DIV then
-            stack[a] = stack[b] / stack[c]
+)";
+    case OP_ADD:
+    case OP_ADD_INT:
+        return R"(            stack[a] = stack[b] + stack[c]
             if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-        elseif op == OP_IDIV then
-            stack[a] = math.floor(stack[b] / stack[c])
+)";
+    case OP_SUB:
+    case OP_SUB_INT:
+        return R"(            stack[a] = stack[b] - stack[c]
             if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-        elseif op == OP_MOD then
-            stack[a] = stack[b] % stack[c]
+)";
+    case OP_MUL:
+    case OP_MUL_INT:
+        return R"(            stack[a] = stack[b] * stack[c]
             if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-        elseif op == OP_CONCAT then
-            stack[a] = stack[b] .. stack[c]
+)";
+    case OP_DIV:
+        return R"(            stack[a] = stack[b] / stack[c]
+            if open_upvalues[a] then open_upvalues[a].val = stack[a] end
+)";
+    case OP_IDIV:
+    case OP_IDIV_INT:
+        return R"(            stack[a] = stack[b] // stack[c]
+            if open_upvalues[a] then open_upvalues[a].val = stack[a] end
+)";
+    case OP_MOD:
+    case OP_MOD_INT:
+        return R"(            stack[a] = stack[b] % stack[c]
+            if open_upvalues[a] then open_upvalues[a].val = stack[a] end
+)";
+    case OP_CONCAT:
+        // R(B)..R(C) in one table.concat when no operand needs __concat
+        return R"(            if c == b + 1 then
+                stack[a] = stack[b] .. stack[c]
+            else
+                local s = stack[c]
+                local plain = true
+                for i = b, c do
+                    local t = type(stack[i])
+                    if t ~= "string" and t ~= "number" then
+                        plain = false
+                        break
+                    end
+                end
+                if plain then
+                    s = concat(stack, "", b, c)
+                else
+                    for i = c - 1, b, -1 do
+                        s = stack[i] .. s
+                    end
+                end
+                stack[a] = s
+            end
             if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-        elseif op == OP_LEN then
-            stack[a] = #stack[b]
+)";
+    case OP_LEN:
+        return R"(            stack[a] = #stack[b]
             if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-        elseif op == OP_NOT then
-            stack[a] = not stack[b]
+)";
+    case OP_NOT:
+        return R"(            stack[a] = not stack[b]
             if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-        elseif op == OP_EQ then
-            stack[a] = (stack[b] == stack[c])
+)";
+    case OP_EQ:
+        return R"(            stack[a] = (stack[b] == stack[c])
             if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-        elseif op == OP_LT then
-            stack[a] = (stack[b] < stack[c])
+)";
+    case OP_LT:
+        return R"(            stack[a] = (stack[b] < stack[c])
             if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-        elseif op == OP_LE then
-            stack[a] = (stack[b] <= stack[c])
+)";
+    case OP_LE:
+        return R"(            stack[a] = (stack[b] <= stack[c])
             if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-        elseif op == OP_JMP then
-            pc = pc + b
-        elseif op == OP_JMP_FALSE then
-            if not stack[a] then
+)";
+    case OP_JMP:
+        return R"(            pc = pc + b
+)";
+    case OP_SWITCH:
+        // Each jump table is built from its keys on first use
+        return R"(            local switches = proto.switches
+            if not switches then
+                switches = {}
+                proto.switches = switches
+            end
+            local jt = switches[pc]
+            if not jt then
+                jt = {}
+                for i = 0, c - 1 do jt[constants[b + i]] = i end
+                switches[pc] = jt
+            end
+            pc = pc + (jt[stack[a]] or c)
+)";
+    case OP_JMP_FALSE:
+        return R"(            if not stack[a] then
+                pc = pc + b
+            end
+)";
+    case OP_JMP_TRUE:
+        return R"(            if stack[a] then
                 pc = pc + b
             end
-        elseif op == OP_GETGLOBAL then
-            stack[a] = _G[constants[b]]
+)";
+    case OP_GETGLOBAL:
+        return R"(            stack[a] = _G[constants[b]]
             if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-        elseif op == OP_SETGLOBAL then
-            _G[constants[b]] = stack[a]
-        elseif op == OP_NEWTABLE then
-            stack[a] = {}
+)";
+    case OP_SETGLOBAL:
+        return R"(            _G[constants[b]] = stack[a]
+)";
+    case OP_NEWTABLE:
+        return R"(            stack[a] = {}
             if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-        elseif op == OP_GETTABLE then
-            if stack[b] == nil then
+)";
+    case OP_GETTABLE:
+        return R"(            if stack[b] == nil then
                 error("OP_GETTABLE: stack[" .. b .. "] is nil. Key: " .. tostring(stack[c]))
             end
             stack[a] = stack[b][stack[c]]
             if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-        elseif op == OP_SETTABLE then
-            if stack[a] == nil then
+)";
+    case OP_SETTABLE:
+        return R"(            if stack[a] == nil then
                 error("OP_SETTABLE: stack[" .. a .. "] is nil. Key: " .. tostring(stack[b]))
             end
             stack[a][stack[b]] = stack[c]
-        elseif op == OP_GETUPVAL then
-            stack[a] = upvalues[b].val
+)";
+    case OP_GETUPVAL:
+        return R"(            stack[a] = upvalues[b].val
             if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-        elseif op == OP_SETUPVAL then
-            upvalues[b].val = stack[a]
-        elseif op == OP_VARARG then
-            -- R(A) ... R(A+C-2) = varargs
+)";
+    case OP_SETUPVAL:
+        return R"(            local uv = upvalues[b]
+            uv.val = stack[a]
+            -- Keep the owning frame's register in sync with the box
+            if uv.stack then uv.stack[uv.index] = uv.val end
+)";
+    case OP_VARARG:
+        return R"(            -- R(A) ... R(A+C-2) = varargs
             local n = c - 1
             if n < 0 then n = vargs.n or #vargs end -- All varargs? B=0.
             -- Using C to determine how many
@@ -235,11 +783,13 @@ run_vm = function(closure, args, varargs)
                 stack[a + i - 1] = vargs[i]
             end
             if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-        elseif op == OP_FORPREP then
-            stack[a] = stack[a] - stack[a+2]
+)";
+    case OP_FORPREP:
+        return R"(            stack[a] = stack[a] - stack[a+2]
             pc = pc + b
-        elseif op == OP_FORLOOP then
-            local step = stack[a+2]
+)";
+    case OP_FORLOOP:
+        return R"(            local step = stack[a+2]
             stack[a] = stack[a] + step
             local idx = stack[a]
             local limit = stack[a+1]
@@ -247,175 +797,214 @@ run_vm = function(closure, args, varargs)
                 pc = pc + b
                 stack[a+3] = idx
             end
-        elseif op == OP_TFORCALL then
-            local func = stack[a]
-            local state = stack[a+1]
-            local ctl = stack[a+2]
-            local n = c
-            local results
-            if type(func) == "function" then
-                 results = { func(state, ctl) }
-            elseif type(func) == "table" and func.type == "closure" then
-                 results = run_vm(func, {state, ctl})
-                 -- If results is not a table, wrap it?
-                 if type(results) ~= "table" then results = { results } end
-            else
-                 error("Attempt to call non-function in TFORCALL")
+)";
+    case OP_FORLOOP_UP:
+        return R"(            local idx = stack[a] + stack[a+2]
+            stack[a] = idx
+            if idx <= stack[a+1] then
+                pc = pc + b
+                stack[a+3] = idx
             end
-
-            for i = 1, n do
+)";
+    case OP_FORLOOP_DOWN:
+        return R"(            local idx = stack[a] + stack[a+2]
+            stack[a] = idx
+            if idx >= stack[a+1] then
+                pc = pc + b
+                stack[a+3] = idx
+            end
+)";
+    case OP_TFORCALL:
+        return R"(            local results = { stack[a](stack[a+1], stack[a+2]) }
+            for i = 1, c do
                 stack[a+2+i] = results[i]
             end
-        elseif op == OP_TFORLOOP then
-            local val = stack[a+1]
+)";
+    case OP_TFORIPAIRS:
+        return R"(            local f = stack[a]
+            if f == stock_inext then
+                local i = stack[a+2] + 1
+                local v = stack[a+1][i]
+                if v == nil then i = nil end
+                stack[a+3] = i
+                if c > 1 then stack[a+4] = v end
+                for j = 3, c do stack[a+2+j] = nil end
+            else
+                local results = { f(stack[a+1], stack[a+2]) }
+                for i = 1, c do
+                    stack[a+2+i] = results[i]
+                end
+            end
+)";
+    case OP_TFORPAIRS:
+        return R"(            local f = stack[a]
+            if f == stock_next then
+                local k, v = f(stack[a+1], stack[a+2])
+                stack[a+3] = k
+                if c > 1 then stack[a+4] = v end
+                for j = 3, c do stack[a+2+j] = nil end
+            else
+                local results = { f(stack[a+1], stack[a+2]) }
+                for i = 1, c do
+                    stack[a+2+i] = results[i]
+                end
+            end
+)";
+    // A string buffer is a hidden table of the accumulator's first value and
+    // the pieces appended since, with their count in n
+    case OP_BUFINIT:
+        return R"(            stack[a] = { stack[b], n = 1 }
+)";
+    case OP_BUFAPPEND:
+        return R"(            local buf = stack[a]
+            local n = buf.n
+            local t = type(buf[1])
+            local plain = t == "string" or t == "number"
+            for i = b, c do
+                t = type(stack[i])
+                if t ~= "string" and t ~= "number" then
+                    plain = false
+                    break
+                end
+            end
+            if plain then
+                for i = b, c do
+                    n = n + 1
+                    buf[n] = stack[i]
+                end
+                buf.n = n
+            else
+                -- Metamethods see the accumulated string, as without the buffer
+                local s = buf[1]
+                if n > 1 then
+                    s = concat(buf, "", 1, n)
+                    for i = n, 2, -1 do buf[i] = nil end
+                end
+                local rest = stack[c]
+                for i = c - 1, b, -1 do
+                    rest = stack[i] .. rest
+                end
+                buf[1] = s .. rest
+                buf.n = 1
+            end
+)";
+    case OP_BUFFLUSH:
+        return R"(            local buf = stack[b]
+            if buf.n == 1 then
+                stack[a] = buf[1]
+            else
+                stack[a] = concat(buf, "", 1, buf.n)
+            end
+            if open_upvalues[a] then open_upvalues[a].val = stack[a] end
+)";
+    case OP_TFORLOOP:
+        return R"(            local val = stack[a+1]
             if val ~= nil then
                 stack[a] = val
                 pc = pc + b
             end
-        elseif op == OP_CLOSURE then
-            local p = protos[b]
-            -- Check if upvalues exist (might be nil if no upvalues)
-            local nups = 0
-            if p.upvalues then
-                 while p.upvalues[nups] do nups = nups + 1 end
-            end
-
+)";
+    case OP_CLOSURE:
+        return R"(            local p = protos[b]
+            local info = p.upvalues
             local new_ups = {}
-            if p.upvalues then
-                for i=0, nups-1 do
-                    local info = p.upvalues[i]
-                    if info.isLocal then
-                        local idx = info.index
-                        if open_upvalues[idx] then
-                            new_ups[i] = open_upvalues[idx]
-                        else
-                            local uv = { val = stack[idx] }
-                            open_upvalues[idx] = uv
-                            new_ups[i] = uv
-                        end
-                    else
-                        new_ups[i] = upvalues[info.index]
+            for i = 0, p.nups - 1 do
+                local uv = info[i]
+                if uv.isLocal then
+                    local idx = uv.index
+                    local box = open_upvalues[idx]
+                    if not box then
+                        box = { val = stack[idx], stack = stack, index = idx }
+                        open_upvalues[idx] = box
                     end
+                    new_ups[i] = box
+                else
+                    new_ups[i] = upvalues[uv.index]
                 end
             end
-            stack[a] = { proto = p, upvalues = new_ups, type = "closure" }
-            setmetatable(stack[a], closure_mt)
+            stack[a] = make_closure(p, new_ups)
             if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-
-        elseif op == OP_CALL then
-            local func = stack[a]
-            local callArgs = {}
-            local numArgs = b - 1
-            for i = 1, numArgs do
-                callArgs[i] = stack[a + i]
-            end
-
-            if type(func) == "table" and func.type == "closure" then
-                -- Need to separate fixed args and varargs?
-                -- SimpleLua doesn't distinguish well in call site unless we change OP_CALL.
-                -- For now, all extra args are just args.
-                -- But VM needs to split them for params vs varargs.
-                local fixedParams = func.proto.numParams or 0
-                local fArgs = {}
-                local vArgs = {}
-                local fCount = 0
-                local vCount = 0
-                for i = 1, numArgs do
-                    if i <= fixedParams then
-                        fCount = fCount + 1
-                        fArgs[fCount] = callArgs[i]
-                    else
-                        vCount = vCount + 1
-                        vArgs[vCount] = callArgs[i]
-                    end
-                end
-                vArgs.n = vCount
-
-                local results = { run_vm(func, fArgs, vArgs) }
-                local numResults = c - 1
-                if numResults > 0 then
-                   for i = 1, numResults do
-                       stack[a + i - 1] = results[i]
-                   end
-                   if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-                end
-            elseif type(func) == "function" then
-                 -- Handle native functions that require function arguments (not callable tables)
-                 if func == table.sort then
-                     if numArgs >= 2 then callArgs[2] = wrap_if_needed(callArgs[2]) end
-                 elseif func == xpcall then
-                     if numArgs >= 2 then callArgs[2] = wrap_if_needed(callArgs[2]) end
-                 elseif func == string.gsub then
-                     if numArgs >= 3 then callArgs[3] = wrap_if_needed(callArgs[3]) end
-                 end
-
-                 local results = { func(unpack(callArgs, 1, numArgs)) }
-                 local numResults = c - 1
-                 if numResults > 0 then
-                     for i = 1, numResults do
-                         stack[a + i - 1] = results[i]
-                     end
-                     if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-                 elseif numResults < 0 then
-                     for i = 1, #results do
-                         stack[a + i - 1] = results[i]
-                     end
-                     if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-                 end
+)";
+    case OP_CALL:
+        return R"(            -- VM closures are plain Lua functions, so every callee (native,
+            -- VM closure or __call object) goes through the same path
+            local numResults = c - 1
+            if numResults == 0 then
+                stack[a](unpack(stack, a + 1, a + b - 1))
+            elseif numResults == 1 then
+                stack[a] = stack[a](unpack(stack, a + 1, a + b - 1))
+                if open_upvalues[a] then open_upvalues[a].val = stack[a] end
             else
-                -- Try __call metamethod
-                local mt = getmetatable(func)
-                if mt and mt.__call then
-                    -- call mt.__call(func, ...)
-                    local metaArgs = {func}
-                    for i = 1, numArgs do
-                        metaArgs[i + 1] = callArgs[i]
-                    end
-                    local res = mt.__call(unpack(metaArgs, 1, numArgs + 1))
-                     if c - 1 > 0 then
-                         stack[a] = res
-                         if open_upvalues[a] then open_upvalues[a].val = stack[a] end
-                     end
-                else
-                    error("Attempt to call non-function")
+                local results = { stack[a](unpack(stack, a + 1, a + b - 1)) }
+                if numResults < 0 then numResults = #results end
+                for i = 1, numResults do
+                    stack[a + i - 1] = results[i]
                 end
+                if open_upvalues[a] then open_upvalues[a].val = stack[a] end
             end
-
-        elseif op == OP_RETURN then
-            local n = b - 1
+)";
+    case OP_RETURN:
+        return R"(            local n = b - 1
             if n <= 0 then
                 return
             elseif n == 1 then
                 return stack[a]
             else
-                local res = {}
-                for i = 0, n - 1 do
-                    res[i + 1] = stack[a + i]
-                end
-                return unpack(res)
+                return unpack(stack, a, a + n - 1)
             end
-        else
-            error("Unknown opcode: " .. op)
-        end
-    end
-end
-
--- Run main chunk
-run_vm({ proto = main_proto, upvalues = {} }, {})
 )";
+    default:
+        return "";
+    }
+}
 
-    std::string result = ss.str();
-    if (pack) {
-        result = minify(result);
+// Fused handler: each opcode's body in turn, fetching the operands of the
+// instructions that follow the fused one in between
+static std::string superHandler(const std::vector<OpCode>& ops, const GeneratorOptions& options) {
+    std::string body;
+    for (size_t i = 0; i < ops.size(); ++i) {
+        if (i > 0) {
+            if (!fallsThrough(ops[i - 1])) {
+                throw std::runtime_error(std::string("Superinstruction cannot continue after ") + opName(ops[i - 1]));
+            }
+            body += "            inst = code[pc]\n";
+            if (options.profile) body += "            prof_counts[pc] = prof_counts[pc] + 1\n";
+            body += "            pc = pc + 1\n";
+            if (options.compactCode) {
+                body += "            a = (inst >> 8) & 0xFF\n";
+                body += "            c = (inst >> 16) & 0xFFFF\n";
+                body += "            b = (inst >> 32) - 0x40000000\n";
+            } else {
+                body += "            a, b, c = inst[2], inst[3], inst[4]\n";
+            }
+        }
+        body += opHandler(ops[i]);
     }
-    out << result;
+    return body;
 }
 
-void LuaGenerator::generateProto(Prototype* proto, std::ostream& out, int index, const OpCodeStrategy& strategy, bool encrypt) {
-    (void)index;
+void LuaGenerator::generateProto(Prototype* proto, std::ostream& out, int id, const OpCodeStrategy& strategy, const GeneratorOptions& options, bool deferBody) {
+    bool encrypt = options.encrypt;
     out << "{\n";
 
+    if (options.profile) out << "  id = " << id << ",\n";
+    if (options.sample) {
+        out << "  name = " << quoteBinary(proto->name) << ",\n";
+        out << "  linedefined = " << proto->lineDefined << ",\n";
+    }
     out << "  numParams = " << proto->numParams << ",\n";
+    out << "  nups = " << proto->upvalues.size() << ",\n";
+
+    // Upvalues metadata
+    out << "  upvalues = {\n";
+    for (size_t i = 0; i < proto->upvalues.size(); ++i) {
+        out << "    [" << i << "] = { isLocal = " << (proto->upvalues[i].isLocal ? "true" : "false")
+            << ", index = " << proto->upvalues[i].index << " },\n";
+    }
+    out << "  },\n";
+
+    // Lazy mode: the body is only built when the closure is first called
+    if (deferBody) out << "  pending = function() return {\n";
 
     // Constants
     out << "  constants = {\n";
@@ -423,14 +1012,14 @@ void LuaGenerator::generateProto(Prototype* proto, std::ostream& out, int index,
         const Value& v = proto->constants[i];
         out << "    [" << i << "] = ";
         if (is_number(v)) {
-            out << as_number(v);
+            out << numberLiteral(v);
         } else if (is_boolean(v)) {
             out << (as_boolean(v) ? "true" : "false");
         } else if (is_string(v)) {
             if (encrypt) {
-                out << encryptString(as_string(v));
+                out << encryptString(as_string_ref(v));
             } else {
-                out << "\"" << as_string(v) << "\"";
+                out << "\"" << as_string_ref(v) << "\"";
             }
         } else {
             out << "nil";
@@ -443,7 +1032,13 @@ void LuaGenerator::generateProto(Prototype* proto, std::ostream& out, int index,
     out << "  code = {\n";
     for (size_t i = 0; i < proto->instructions.size(); ++i) {
         const Instruction& inst = proto->instructions[i];
-        if (encrypt) {
+        if (options.compactCode) {
+            long long word = packInstruction(strategy.get(inst.op), inst.a, inst.b, inst.c);
+            if (encrypt) {
+                word ^= (long long)(0xDEADBEEFu ^ (unsigned int)(i + 1));
+            }
+            out << "    " << word << ",\n";
+        } else if (encrypt) {
              out << "    " << encryptInstruction(strategy.get(inst.op), inst.a, inst.b, inst.c, i + 1) << ",\n";
         } else {
              out << "    {" << strategy.get(inst.op) << ", " << inst.a << ", " << inst.b << ", " << inst.c << "},\n";
@@ -451,26 +1046,171 @@ void LuaGenerator::generateProto(Prototype* proto, std::ostream& out, int index,
     }
     out << "  },\n";
 
+    // Line table as flat (line, count) pairs
+    if (options.sample) {
+        out << "  lines = {";
+        for (const LineRun& run : proto->lineInfo) {
+            out << " " << run.line << ", " << run.count << ",";
+        }
+        out << " },\n";
+    }
+
     // Nested Prototypes (References)
+    // Proto ids number the tree in preorder
     out << "  protos = {\n";
+    int childId = id + 1;
     for (size_t i = 0; i < proto->protos.size(); ++i) {
          out << "    [" << i << "] = ";
-         generateProto(proto->protos[i].get(), out, i, strategy, encrypt);
+         generateProto(proto->protos[i].get(), out, childId, strategy, options, options.lazyProtos);
          out << ",\n";
-    }
-    out << "  },\n";
-
-    // Upvalues metadata
-    out << "  upvalues = {\n";
-    for (size_t i = 0; i < proto->upvalues.size(); ++i) {
-        out << "    [" << i << "] = { isLocal = " << (proto->upvalues[i].isLocal ? "true" : "false")
-            << ", index = " << proto->upvalues[i].index << " },\n";
+         childId += countProtos(proto->protos[i].get());
     }
     out << "  }\n";
 
+    if (deferBody) out << "  } end\n";
     out << "}";
 }
 
+static void writeU8(std::string& out, unsigned int v) {
+    out += (char)(v & 0xFF);
+}
+
+static void writeU16(std::string& out, unsigned int v) {
+    writeU8(out, v);
+    writeU8(out, v >> 8);
+}
+
+static void writeU32(std::string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) writeU8(out, (v >> (8 * i)) & 0xFF);
+}
+
+static void writeU64(std::string& out, uint64_t v) {
+    for (int i = 0; i < 8; ++i) writeU8(out, (unsigned int)((v >> (8 * i)) & 0xFF));
+}
+
+// Little-endian layout read back by load_proto (header) and load_body:
+//   header: [u32 id, with -profile] u16 numParams, u16 nups, nups x (u8 isLocal, u16 index)
+//           [with -sample: u16 name length, name bytes, u32 line defined]
+//   body:   u32 nconst, constants (u8 tag + payload), u32 ncode, i64 packed
+//           instructions, [with -sample: u32 nruns, nruns x (u32 line, u32 count)],
+//           u32 nprotos, nprotos x (u32 byte size, nested prototype)
+void LuaGenerator::serializeProto(Prototype* proto, std::string& out, int id, const OpCodeStrategy& strategy, const GeneratorOptions& options) {
+    if (proto->numParams > 0xFFFF || proto->upvalues.size() > 0xFFFF || proto->name.size() > 0xFFFF) {
+        throw std::runtime_error("Prototype too large for binary encoding");
+    }
+    if (options.profile) writeU32(out, id);
+    writeU16(out, proto->numParams);
+    writeU16(out, proto->upvalues.size());
+    if (options.sample) {
+        writeU16(out, proto->name.size());
+        out += proto->name;
+        writeU32(out, proto->lineDefined);
+    }
+    for (const UpvalueInfo& uv : proto->upvalues) {
+        writeU8(out, uv.isLocal ? 1 : 0);
+        writeU16(out, uv.index);
+    }
+
+    writeU32(out, proto->constants.size());
+    for (const Value& v : proto->constants) {
+        if (is_boolean(v)) {
+            writeU8(out, as_boolean(v) ? 2 : 1);
+        } else if (is_integer(v)) {
+            writeU8(out, 3);
+            writeU64(out, (uint64_t)as_integer(v));
+        } else if (is_number(v)) {
+            double d = as_number(v);
+            uint64_t bits;
+            std::memcpy(&bits, &d, sizeof(bits));
+            writeU8(out, 4);
+            writeU64(out, bits);
+        } else if (is_string(v)) {
+            std::string str = as_string(v);
+            if (options.encrypt) {
+                for (char& ch : str) ch = (char)((unsigned char)ch ^ 0xAA);
+            }
+            writeU8(out, 5);
+            writeU32(out, str.size());
+            out += str;
+        } else {
+            writeU8(out, 0);
+        }
+    }
+
+    writeU32(out, proto->instructions.size());
+    for (size_t i = 0; i < proto->instructions.size(); ++i) {
+        const Instruction& inst = proto->instructions[i];
+        long long word = packInstruction(strategy.get(inst.op), inst.a, inst.b, inst.c);
+        if (options.encrypt) {
+            word ^= (long long)(0xDEADBEEFu ^ (unsigned int)(i + 1));
+        }
+        writeU64(out, (uint64_t)word);
+    }
+
+    if (options.sample) {
+        writeU32(out, proto->lineInfo.size());
+        for (const LineRun& run : proto->lineInfo) {
+            writeU32(out, run.line);
+            writeU32(out, run.count);
+        }
+    }
+
+    writeU32(out, proto->protos.size());
+    int childId = id + 1;
+    for (const auto& child : proto->protos) {
+        std::string nested;
+        serializeProto(child.get(), nested, childId, strategy, options);
+        writeU32(out, nested.size());
+        out += nested;
+        childId += countProtos(child.get());
+    }
+}
+
+// Lua source for a number constant that reads back as the same value and
+// subtype: floats get all 17 significant digits and keep a point or exponent
+static std::string numberLiteral(const Value& v) {
+    if (is_integer(v)) {
+        int64_t i = as_integer(v);
+        // -9223372036854775808 would read as a float: the negation of a numeral too large for an integer
+        if (i == INT64_MIN) return "(-9223372036854775807 - 1)";
+        return std::to_string(i);
+    }
+    double d = as_number(v);
+    if (d != d) return "(0/0)";
+    if (d == HUGE_VAL) return "1e9999";
+    if (d == -HUGE_VAL) return "-1e9999";
+    char buf[32];
+    std::snprintf(buf, sizeof buf, "%.17g", d);
+    std::string text = buf;
+    if (text.find_first_of(".en") == std::string::npos) text += ".0";
+    return text;
+}
+
+static int countProtos(const Prototype* proto) {
+    int n = 1;
+    for (const auto& child : proto->protos) n += countProtos(child.get());
+    return n;
+}
+
+// Quotes arbitrary bytes as a Lua string literal. Bytes are kept raw except the
+// quote, backslash, line breaks and ^Z (text-mode EOF on Windows), written as \ddd.
+static std::string quoteBinary(const std::string& bytes) {
+    std::string res;
+    res.reserve(bytes.size() + bytes.size() / 8 + 2);
+    res += '"';
+    char esc[5];
+    for (unsigned char ch : bytes) {
+        if (ch == '"' || ch == '\\' || ch == '\n' || ch == '\r' || ch == 0x1A) {
+            std::snprintf(esc, sizeof(esc), "\\%03u", (unsigned int)ch);
+            res += esc;
+        } else {
+            res += (char)ch;
+        }
+    }
+    res += '"';
+    return res;
+}
+
 static std::string encryptString(const std::string& s) {
     std::stringstream ss;
     ss << "decrypt_string({";
@@ -483,12 +1223,23 @@ static std::string encryptString(const std::string& s) {
 }
 
 static std::string encryptInstruction(int op, int a, int b, int c, int pc) {
-    unsigned int key = 0xDEADBEEF ^ pc;
+    // 64-bit XOR so negative operands (backward jumps) survive the round trip
+    long long key = (long long)(0xDEADBEEFu ^ (unsigned int)pc);
     std::stringstream ss;
     ss << "{" << (op ^ key) << ", " << (a ^ key) << ", " << (b ^ key) << ", " << (c ^ key) << "}";
     return ss.str();
 }
 
+// Packs one instruction into a single non-negative Lua integer:
+// bits 0-7 op, 8-15 A, 16-31 C, 32-62 B biased by 2^30 (B carries jump offsets)
+static long long packInstruction(int op, int a, int b, int c) {
+    const long long bBias = 1LL << 30;
+    if (op < 0 || op > 0xFF || a < 0 || a > 0xFF || c < 0 || c > 0xFFFF || b < -bBias || b >= bBias) {
+        throw std::runtime_error("Instruction operands out of range for compact encoding");
+    }
+    return (long long)op | ((long long)a << 8) | ((long long)c << 16) | (((long long)b + bBias) << 32);
+}
+
 static std::string minify(std::string code) {
     std::string res;
     bool inString = false;
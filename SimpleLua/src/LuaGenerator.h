@@ -4,12 +4,29 @@
 #include "Compiler.h"
 #include "VMP/OpCodeStrategy.h"
 #include <iostream>
+#include <string>
+#include <vector>
+
+struct GeneratorOptions {
+    bool pack = false;        // Minify the emitted script
+    bool encrypt = false;     // Encrypt string constants and instructions
+    bool compactCode = false; // Emit each instruction as one packed integer instead of a table
+    bool binary = false;      // Serialize all prototypes into one string decoded with string.unpack
+    bool lazyProtos = false;  // Defer building nested prototypes until their first call
+    bool profile = false;     // Count executions per opcode, proto and pc; dump them at exit
+    bool profileTiming = false; // With profile: also time each proto with os.clock
+    bool sample = false;      // Sample call stacks from a count hook; dump folded stacks at exit
+    std::string chunkName = "?"; // Source name that samples are attributed to
+    std::vector<std::vector<OpCode>> superinstructions; // Opcodes fused by OP_SUPER0 + k
+    std::vector<OpCode> handlerOrder; // Opcodes tested first in the dispatch chain, hottest first
+};
 
 class LuaGenerator {
 public:
-    static void generate(Prototype* proto, std::ostream& out, const OpCodeStrategy& strategy, bool pack = false, bool encrypt = false);
+    static void generate(Prototype* proto, std::ostream& out, const OpCodeStrategy& strategy, const GeneratorOptions& options = GeneratorOptions());
 private:
-    static void generateProto(Prototype* proto, std::ostream& out, int index, const OpCodeStrategy& strategy, bool encrypt);
+    static void generateProto(Prototype* proto, std::ostream& out, int id, const OpCodeStrategy& strategy, const GeneratorOptions& options, bool deferBody = false);
+    static void serializeProto(Prototype* proto, std::string& out, int id, const OpCodeStrategy& strategy, const GeneratorOptions& options);
 };
 
 #endif
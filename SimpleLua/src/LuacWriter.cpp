@@ -0,0 +1,675 @@
+#include "LuacWriter.h"
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Lua 5.3 opcodes, numbered as in lopcodes.h
+enum LuaOpCode {
+    LOP_MOVE = 0, LOP_LOADK = 1, LOP_LOADKX = 2, LOP_LOADBOOL = 3, LOP_LOADNIL = 4,
+    LOP_GETUPVAL = 5, LOP_GETTABUP = 6, LOP_GETTABLE = 7, LOP_SETTABUP = 8, LOP_SETUPVAL = 9,
+    LOP_SETTABLE = 10, LOP_NEWTABLE = 11, LOP_ADD = 13, LOP_SUB = 14, LOP_MUL = 15,
+    LOP_MOD = 16, LOP_DIV = 18, LOP_IDIV = 19, LOP_NOT = 27, LOP_LEN = 28, LOP_CONCAT = 29,
+    LOP_JMP = 30, LOP_EQ = 31, LOP_LT = 32, LOP_LE = 33, LOP_TEST = 34, LOP_CALL = 36,
+    LOP_RETURN = 38, LOP_FORLOOP = 39, LOP_FORPREP = 40, LOP_TFORCALL = 41, LOP_TFORLOOP = 42,
+    LOP_CLOSURE = 44, LOP_VARARG = 45, LOP_EXTRAARG = 46
+};
+
+static const int kMaxArgBx = (1 << 18) - 1;
+static const int kMaxArgSBx = kMaxArgBx >> 1;
+static const int kMaxArgAx = (1 << 26) - 1;
+static const int kBitRK = 1 << 8;
+static const int kMaxIndexRK = kBitRK - 1;
+static const int kMaxStack = 255;
+
+static uint32_t encodeABC(LuaOpCode op, int a, int b, int c) {
+    return static_cast<uint32_t>(op) | static_cast<uint32_t>(a) << 6 |
+           static_cast<uint32_t>(c) << 14 | static_cast<uint32_t>(b) << 23;
+}
+
+static uint32_t encodeABx(LuaOpCode op, int a, int bx) {
+    return static_cast<uint32_t>(op) | static_cast<uint32_t>(a) << 6 | static_cast<uint32_t>(bx) << 14;
+}
+
+static uint32_t encodeAsBx(LuaOpCode op, int a, int sbx) {
+    return encodeABx(op, a, sbx + kMaxArgSBx);
+}
+
+typedef std::bitset<256> RegSet;
+
+static void addRange(RegSet& set, int from, int count) {
+    for (int r = from; r < from + count && r < 256; ++r) {
+        if (r >= 0) set.set(r);
+    }
+}
+
+// Registers the function touches, as in the other backends
+static int frameSize(const Prototype* proto) {
+    int maxReg = proto->numParams;
+    auto use = [&maxReg](int reg) { if (reg + 1 > maxReg) maxReg = reg + 1; };
+    for (const Instruction& inst : proto->instructions) {
+        if (inst.op >= OP_SUPER0) throw std::runtime_error("luac output cannot contain superinstructions");
+        if (inst.a < 0 || inst.a > 255) throw std::runtime_error("Register out of range");
+        use(inst.a);
+        switch (inst.op) {
+        case OP_MOVE: case OP_LEN: case OP_NOT:
+            use(inst.b);
+            break;
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_IDIV: case OP_MOD:
+        case OP_ADD_INT: case OP_SUB_INT: case OP_MUL_INT: case OP_IDIV_INT: case OP_MOD_INT:
+        case OP_CONCAT: case OP_EQ: case OP_LT: case OP_LE: case OP_GETTABLE: case OP_SETTABLE:
+            use(inst.b);
+            use(inst.c);
+            break;
+        case OP_CALL:
+            use(inst.a + inst.b - 1);
+            use(inst.a + inst.c - 2);
+            break;
+        case OP_VARARG:
+            use(inst.a + inst.c - 2);
+            break;
+        case OP_FORPREP: case OP_FORLOOP: case OP_FORLOOP_UP: case OP_FORLOOP_DOWN:
+            use(inst.a + 3);
+            break;
+        case OP_TFORCALL: case OP_TFORIPAIRS: case OP_TFORPAIRS:
+            use(inst.a + 2 + inst.c);
+            break;
+        case OP_TFORLOOP:
+            use(inst.a + 1);
+            break;
+        case OP_BUFINIT: case OP_BUFFLUSH:
+            use(inst.b);
+            break;
+        case OP_BUFAPPEND:
+            use(inst.c);
+            break;
+        case OP_LOADNIL:
+            use(inst.a + inst.b);
+            break;
+        case OP_RETURN:
+            use(inst.a + inst.b - 2);
+            break;
+        default:
+            break;
+        }
+    }
+    if (maxReg > 255) throw std::runtime_error("Register out of range");
+    return maxReg;
+}
+
+// Registers an instruction reads (use) and writes (def)
+static void effects(const Instruction& inst, int size, RegSet& use, RegSet& def) {
+    use.reset();
+    def.reset();
+    switch (inst.op) {
+    case OP_MOVE: case OP_LEN: case OP_NOT: case OP_BUFINIT: case OP_BUFFLUSH:
+        use.set(inst.b);
+        def.set(inst.a);
+        break;
+    case OP_BUFAPPEND:
+        use.set(inst.a);
+        addRange(use, inst.b, inst.c - inst.b + 1);
+        def.set(inst.a);
+        break;
+    case OP_LOADK: case OP_GETGLOBAL: case OP_NEWTABLE: case OP_CLOSURE: case OP_GETUPVAL:
+    case OP_LOADBOOL: case OP_LOADI: case OP_LOADF:
+        def.set(inst.a);
+        break;
+    case OP_LOADNIL:
+        addRange(def, inst.a, inst.b + 1);
+        break;
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_IDIV: case OP_MOD:
+    case OP_ADD_INT: case OP_SUB_INT: case OP_MUL_INT: case OP_IDIV_INT: case OP_MOD_INT:
+    case OP_EQ: case OP_LT: case OP_LE: case OP_GETTABLE:
+        use.set(inst.b);
+        use.set(inst.c);
+        def.set(inst.a);
+        break;
+    case OP_CONCAT:
+        addRange(use, inst.b, inst.c - inst.b + 1);
+        def.set(inst.a);
+        break;
+    case OP_SETTABLE:
+        use.set(inst.a);
+        use.set(inst.b);
+        use.set(inst.c);
+        break;
+    case OP_JMP_FALSE: case OP_JMP_TRUE: case OP_SETGLOBAL: case OP_SETUPVAL: case OP_SWITCH:
+        use.set(inst.a);
+        break;
+    case OP_CALL:
+        addRange(use, inst.a, inst.b);
+        addRange(def, inst.a, inst.c - 1);
+        break;
+    case OP_VARARG:
+        addRange(def, inst.a, inst.c >= 1 ? inst.c - 1 : size - inst.a);
+        break;
+    case OP_FORPREP:
+        addRange(use, inst.a, 3);
+        def.set(inst.a);
+        break;
+    case OP_FORLOOP: case OP_FORLOOP_UP: case OP_FORLOOP_DOWN:
+        addRange(use, inst.a, 3);
+        def.set(inst.a);
+        def.set(inst.a + 3);
+        break;
+    case OP_TFORCALL: case OP_TFORIPAIRS: case OP_TFORPAIRS:
+        addRange(use, inst.a, 3);
+        addRange(def, inst.a + 3, inst.c);
+        break;
+    case OP_TFORLOOP:
+        use.set(inst.a + 1);
+        def.set(inst.a);
+        break;
+    case OP_RETURN:
+        addRange(use, inst.a, inst.b - 1);
+        break;
+    default:
+        break;
+    }
+}
+
+// Destination of a jump at pc, or -1 for other instructions
+static int jumpTarget(const Instruction& inst, int pc) {
+    switch (inst.op) {
+    case OP_JMP: case OP_JMP_FALSE: case OP_JMP_TRUE: case OP_FORPREP: case OP_FORLOOP: case OP_FORLOOP_UP:
+    case OP_FORLOOP_DOWN: case OP_TFORLOOP:
+        return pc + 1 + inst.b;
+    default:
+        return -1;
+    }
+}
+
+// A function translated to Lua 5.3 instructions
+struct LuaFunction {
+    std::vector<uint32_t> code;
+    std::vector<int> lines;
+    int maxStack = 2;
+    bool vararg = false;
+    std::vector<Value> constants; // Immediate operands, after the prototype's constants
+};
+
+// Translates one prototype. Registers keep their SimpleLua numbers; the
+// registers from the frame size up serve as temporaries for operands that
+// Lua 5.3 instructions want in a different place (constants out of RK
+// range, call windows that would clobber live registers, ...).
+class FunctionTranslator {
+public:
+    FunctionTranslator(const Prototype* proto, bool isMain) : proto(proto), isMain(isMain) {}
+
+    LuaFunction translate() {
+        const int n = static_cast<int>(proto->instructions.size());
+        size = frameSize(proto);
+        result.vararg = isMain;
+        reserve(0);
+
+        bool capturesLocals = false;
+        std::vector<bool> isTarget(n + 1, false);
+        for (int pc = 0; pc < n; ++pc) {
+            const Instruction& inst = proto->instructions[pc];
+            int target = jumpTarget(inst, pc);
+            if (target >= 0) {
+                if (target > n) throw std::runtime_error("Jump target out of range");
+                isTarget[target] = true;
+            }
+            if (inst.op == OP_SWITCH) {
+                if (pc + 1 + inst.c >= n) throw std::runtime_error("Switch out of range");
+                for (int i = 0; i <= inst.c; ++i) isTarget[pc + 1 + i] = true;
+            }
+            if (inst.op == OP_VARARG) result.vararg = true;
+            if (inst.op == OP_CLOSURE) {
+                if (inst.b < 0 || inst.b >= static_cast<int>(proto->protos.size())) {
+                    throw std::runtime_error("Closure prototype out of range");
+                }
+                for (const UpvalueInfo& up : proto->protos[inst.b]->upvalues) {
+                    if (up.isLocal) {
+                        captured.set(up.index);
+                        capturesLocals = true;
+                    }
+                }
+            }
+        }
+        computeLiveness();
+
+        start.assign(n + 1, 0);
+        for (int pc = 0; pc < n; ++pc) {
+            start[pc] = static_cast<int>(result.code.size());
+            line = proto->lineAt(pc);
+            const Instruction& inst = proto->instructions[pc];
+            const Instruction* next = pc + 1 < n ? &proto->instructions[pc + 1] : nullptr;
+            switch (inst.op) {
+            case OP_MOVE:
+                emit(encodeABC(LOP_MOVE, inst.a, inst.b, 0));
+                break;
+            case OP_LOADK: {
+                const Value& k = constant(inst.b);
+                if (is_nil(k)) {
+                    emit(encodeABC(LOP_LOADNIL, inst.a, 0, 0));
+                } else if (is_boolean(k)) {
+                    emit(encodeABC(LOP_LOADBOOL, inst.a, as_boolean(k) ? 1 : 0, 0));
+                } else {
+                    loadConstant(inst.a, inst.b);
+                }
+                break;
+            }
+            case OP_LOADNIL: emit(encodeABC(LOP_LOADNIL, inst.a, inst.b, 0)); break;
+            case OP_LOADBOOL: emit(encodeABC(LOP_LOADBOOL, inst.a, inst.b != 0, 0)); break;
+            // Lua 5.3 has no immediate loads: the operand becomes a constant
+            case OP_LOADI: loadConstant(inst.a, immediate(Value((int64_t)inst.b))); break;
+            case OP_LOADF: loadConstant(inst.a, immediate(Value((double)inst.b))); break;
+            // Lua 5.3 has no integer-only forms; its generic ones take the integer path
+            case OP_ADD: case OP_ADD_INT: emit(encodeABC(LOP_ADD, inst.a, inst.b, inst.c)); break;
+            case OP_SUB: case OP_SUB_INT: emit(encodeABC(LOP_SUB, inst.a, inst.b, inst.c)); break;
+            case OP_MUL: case OP_MUL_INT: emit(encodeABC(LOP_MUL, inst.a, inst.b, inst.c)); break;
+            case OP_DIV: emit(encodeABC(LOP_DIV, inst.a, inst.b, inst.c)); break;
+            case OP_IDIV: case OP_IDIV_INT: emit(encodeABC(LOP_IDIV, inst.a, inst.b, inst.c)); break;
+            case OP_MOD: case OP_MOD_INT: emit(encodeABC(LOP_MOD, inst.a, inst.b, inst.c)); break;
+            case OP_CONCAT: {
+                // CONCAT joins R(B)..R(C) in place and its GC step clears the
+                // stack above its result, so operands go through temporaries
+                // unless nothing from the lowest of them up survives
+                int lowest = std::min(inst.a + 1, inst.b);
+                if (!liveFrom(live(pc), lowest, inst.a)) {
+                    emit(encodeABC(LOP_CONCAT, inst.a, inst.b, inst.c));
+                } else {
+                    int n = inst.c - inst.b + 1;
+                    reserve(n);
+                    for (int i = 0; i < n; ++i) emit(encodeABC(LOP_MOVE, size + i, inst.b + i, 0));
+                    emit(encodeABC(LOP_CONCAT, inst.a, size, size + n - 1));
+                }
+                break;
+            }
+            // A string buffer is just the string on the stock VM
+            case OP_BUFINIT: case OP_BUFFLUSH: emit(encodeABC(LOP_MOVE, inst.a, inst.b, 0)); break;
+            case OP_BUFAPPEND: {
+                int n = inst.c - inst.b + 2;
+                reserve(n);
+                emit(encodeABC(LOP_MOVE, size, inst.a, 0));
+                for (int i = 1; i < n; ++i) emit(encodeABC(LOP_MOVE, size + i, inst.b + i - 1, 0));
+                emit(encodeABC(LOP_CONCAT, inst.a, size, size + n - 1));
+                break;
+            }
+            case OP_LEN: emit(encodeABC(LOP_LEN, inst.a, inst.b, 0)); break;
+            case OP_NOT: emit(encodeABC(LOP_NOT, inst.a, inst.b, 0)); break;
+            case OP_EQ: case OP_LT: case OP_LE: {
+                LuaOpCode op = inst.op == OP_EQ ? LOP_EQ : inst.op == OP_LT ? LOP_LT : LOP_LE;
+                // A comparison only feeding the next conditional jump becomes
+                // a Lua test-and-skip; otherwise materialize the boolean
+                if (next && (next->op == OP_JMP_FALSE || next->op == OP_JMP_TRUE) && next->a == inst.a &&
+                    !isTarget[pc + 1] && !live(pc + 1).test(inst.a)) {
+                    emit(encodeABC(op, next->op == OP_JMP_TRUE, inst.b, inst.c));
+                    emitJump(0, pc + 2 + next->b);
+                    ++pc;
+                    start[pc] = start[pc - 1];
+                } else {
+                    emit(encodeABC(op, 1, inst.b, inst.c));
+                    emit(encodeAsBx(LOP_JMP, 0, 1));
+                    emit(encodeABC(LOP_LOADBOOL, inst.a, 0, 1));
+                    emit(encodeABC(LOP_LOADBOOL, inst.a, 1, 0));
+                }
+                break;
+            }
+            // Lua 5.3 has no indexed jump: test the keys in turn
+            case OP_SWITCH:
+                for (int i = 0; i < inst.c; ++i) {
+                    emit(encodeABC(LOP_EQ, 1, inst.a, constantRK(inst.b + i)));
+                    emitJump(0, pc + 1 + i);
+                }
+                emitJump(0, pc + 1 + inst.c);
+                break;
+            case OP_JMP:
+                emitJump(0, pc + 1 + inst.b);
+                break;
+            case OP_JMP_FALSE: case OP_JMP_TRUE:
+                emit(encodeABC(LOP_TEST, inst.a, 0, inst.op == OP_JMP_TRUE));
+                emitJump(0, pc + 1 + inst.b);
+                break;
+            case OP_GETGLOBAL:
+                emit(encodeABC(LOP_GETTABUP, inst.a, 0, constantRK(inst.b)));
+                break;
+            case OP_SETGLOBAL:
+                emit(encodeABC(LOP_SETTABUP, 0, constantRK(inst.b), inst.a));
+                break;
+            case OP_NEWTABLE:
+                buildAbove(pc, inst.a, encodeABC(LOP_NEWTABLE, 0, 0, 0));
+                break;
+            case OP_GETTABLE:
+                emit(encodeABC(LOP_GETTABLE, inst.a, inst.b, inst.c));
+                break;
+            case OP_SETTABLE:
+                emit(encodeABC(LOP_SETTABLE, inst.a, inst.b, inst.c));
+                break;
+            case OP_CALL:
+                translateCall(pc, inst);
+                break;
+            case OP_CLOSURE:
+                buildAbove(pc, inst.a, encodeABx(LOP_CLOSURE, 0, inst.b));
+                break;
+            case OP_GETUPVAL:
+                emit(encodeABC(LOP_GETUPVAL, inst.a, upvalue(inst.b), 0));
+                break;
+            case OP_SETUPVAL:
+                emit(encodeABC(LOP_SETUPVAL, inst.a, upvalue(inst.b), 0));
+                break;
+            case OP_VARARG: {
+                // "All varargs" has no fixed top to hand on in this compiler,
+                // so fill the rest of the frame, which reads the same
+                int count = inst.c >= 1 ? inst.c : size - inst.a + 1;
+                emit(encodeABC(LOP_VARARG, inst.a, count, 0));
+                break;
+            }
+            case OP_FORPREP:
+                emitJump(inst.a, pc + 1 + inst.b, LOP_FORPREP);
+                break;
+            case OP_FORLOOP: case OP_FORLOOP_UP: case OP_FORLOOP_DOWN:
+                if (capturesLocals) emit(encodeAsBx(LOP_JMP, inst.a + 3 + 1, 0));
+                emitJump(inst.a, pc + 1 + inst.b, LOP_FORLOOP);
+                break;
+            // The stock VM has no inline iterator steps; its TFORCALL calls them
+            case OP_TFORCALL: case OP_TFORIPAIRS: case OP_TFORPAIRS:
+                if (!next || next->op != OP_TFORLOOP || next->a != inst.a + 2) {
+                    throw std::runtime_error("Generic for call is not followed by its loop test");
+                }
+                // Captured registers from A+3 up are closed first, so only
+                // values read again after the call count here
+                for (int r = inst.a + 3 + inst.c; r < 256; ++r) {
+                    if (liveOut[pc].test(r)) throw std::runtime_error("Generic for call would clobber a live register");
+                }
+                if (capturesLocals) emit(encodeAsBx(LOP_JMP, inst.a + 3 + 1, 0));
+                emit(encodeABC(LOP_TFORCALL, inst.a, 0, inst.c));
+                break;
+            case OP_TFORLOOP:
+                emitJump(inst.a, pc + 1 + inst.b, LOP_TFORLOOP);
+                break;
+            case OP_RETURN:
+                emit(encodeABC(LOP_RETURN, inst.a, inst.b > 0 ? inst.b : 1, 0));
+                break;
+            default:
+                throw std::runtime_error(std::string("luac output cannot contain ") + opName(inst.op));
+            }
+        }
+        start[n] = static_cast<int>(result.code.size());
+        // Lua expects every function to end in a return
+        line = proto->lineAt(n > 0 ? n - 1 : 0);
+        emit(encodeABC(LOP_RETURN, 0, 1, 0));
+
+        for (size_t i = 0; i < result.code.size(); ++i) {
+            if (jumpTargets[i] < 0) continue;
+            int offset = start[jumpTargets[i]] - static_cast<int>(i + 1);
+            if (offset < -kMaxArgSBx || offset > kMaxArgSBx) throw std::runtime_error("Jump too long for a Lua 5.3 chunk");
+            result.code[i] = (result.code[i] & ((1u << 14) - 1)) | static_cast<uint32_t>(offset + kMaxArgSBx) << 14;
+        }
+        return result;
+    }
+
+private:
+    const Prototype* proto;
+    bool isMain;
+    int size = 0;
+    int line = 0;
+    LuaFunction result;
+    RegSet captured;              // Registers closures refer to
+    std::vector<RegSet> liveOut;  // Registers read again after each pc
+    std::vector<int> start;       // First Lua instruction of each SimpleLua pc
+    std::vector<int> jumpTargets; // SimpleLua pc each Lua jump lands on, or -1
+    std::map<std::pair<bool, double>, int> immediates; // Constant index of each immediate operand
+
+    void emit(uint32_t word, int target = -1) {
+        result.code.push_back(word);
+        result.lines.push_back(line);
+        jumpTargets.push_back(target);
+    }
+
+    // Jump-family instruction whose offset is fixed up once all pcs are known
+    void emitJump(int a, int target, LuaOpCode op = LOP_JMP) {
+        emit(encodeAsBx(op, a, 0), target);
+    }
+
+    // Makes room for `temps` temporaries above the frame
+    void reserve(int temps) {
+        int needed = std::max(size + temps, 2);
+        if (needed > kMaxStack) throw std::runtime_error("Function needs too many registers for a Lua 5.3 chunk");
+        result.maxStack = std::max(result.maxStack, needed);
+    }
+
+    const Value& constant(int k) const {
+        int n = static_cast<int>(proto->constants.size());
+        if (k >= n && k - n < static_cast<int>(result.constants.size())) return result.constants[k - n];
+        if (k < 0 || k >= n) throw std::runtime_error("Constant out of range");
+        return proto->constants[k];
+    }
+
+    // Index of the constant holding an immediate operand, added on first use
+    int immediate(const Value& v) {
+        auto key = std::make_pair(is_integer(v), as_number(v));
+        auto it = immediates.find(key);
+        if (it != immediates.end()) return it->second;
+        int k = static_cast<int>(proto->constants.size() + result.constants.size());
+        result.constants.push_back(v);
+        immediates[key] = k;
+        return k;
+    }
+
+    int upvalue(int index) const {
+        if (index < 0 || index >= static_cast<int>(proto->upvalues.size())) throw std::runtime_error("Upvalue out of range");
+        return index + 1; // Upvalue 0 is _ENV
+    }
+
+    void loadConstant(int reg, int k) {
+        constant(k);
+        if (k <= kMaxArgBx) {
+            emit(encodeABx(LOP_LOADK, reg, k));
+        } else {
+            if (k > kMaxArgAx) throw std::runtime_error("Too many constants for a Lua 5.3 chunk");
+            emit(encodeABx(LOP_LOADKX, reg, 0));
+            emit(static_cast<uint32_t>(LOP_EXTRAARG) | static_cast<uint32_t>(k) << 6);
+        }
+    }
+
+    // RK operand for constant k, loading it into a temporary when its index
+    // does not fit
+    int constantRK(int k) {
+        if (k >= 0 && k <= kMaxIndexRK) {
+            constant(k);
+            return k | kBitRK;
+        }
+        reserve(1);
+        loadConstant(size, k);
+        return size;
+    }
+
+    // Whether any register from `from` up, other than `except`, is live
+    static bool liveFrom(const RegSet& live, int from, int except) {
+        for (int r = std::max(from, 0); r < 256; ++r) {
+            if (r != except && live.test(r)) return true;
+        }
+        return false;
+    }
+
+    // NEWTABLE and CLOSURE run a GC step that clears the stack above their
+    // target, so build into a temporary when live registers sit above it
+    void buildAbove(int pc, int a, uint32_t word) {
+        if (!liveFrom(live(pc), a + 1, a)) {
+            emit(word | static_cast<uint32_t>(a) << 6);
+            return;
+        }
+        reserve(1);
+        emit(word | static_cast<uint32_t>(size) << 6);
+        emit(encodeABC(LOP_MOVE, a, size, 0));
+    }
+
+    // A Lua call overwrites its whole window from A up, while SimpleLua
+    // allocates registers from a bitset and can keep live locals above a call
+    // base; such calls run in a copy of the window above the frame
+    void translateCall(int pc, const Instruction& inst) {
+        int nargs = inst.b - 1;
+        int nresults = inst.c - 1;
+        bool clobbers = false;
+        for (int r = inst.a + 1; r < 256 && !clobbers; ++r) {
+            if (live(pc).test(r) && r >= inst.a + std::max(nresults, 1)) clobbers = true;
+        }
+        if (!clobbers) {
+            emit(encodeABC(LOP_CALL, inst.a, inst.b, inst.c));
+            return;
+        }
+        int base = size;
+        reserve(std::max(nargs + 1, nresults) + 1);
+        for (int i = 0; i <= nargs; ++i) emit(encodeABC(LOP_MOVE, base + i, inst.a + i, 0));
+        emit(encodeABC(LOP_CALL, base, inst.b, inst.c));
+        for (int i = 0; i < nresults; ++i) emit(encodeABC(LOP_MOVE, inst.a + i, base + i, 0));
+    }
+
+    // Registers that must survive pc: those read again plus any register a
+    // closure may still read through an open upvalue
+    RegSet live(int pc) const { return liveOut[pc] | captured; }
+
+    // Backward dataflow over registers
+    void computeLiveness() {
+        const int n = static_cast<int>(proto->instructions.size());
+        std::vector<RegSet> liveIn(n + 1), use(n), def(n);
+        liveOut.assign(n + 1, RegSet());
+        for (int pc = 0; pc < n; ++pc) effects(proto->instructions[pc], size, use[pc], def[pc]);
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (int pc = n - 1; pc >= 0; --pc) {
+                const Instruction& inst = proto->instructions[pc];
+                RegSet out;
+                int target = jumpTarget(inst, pc);
+                // FORPREP always jumps to its loop test
+                if (inst.op != OP_JMP && inst.op != OP_FORPREP && inst.op != OP_RETURN) out |= liveIn[pc + 1];
+                if (target >= 0) out |= liveIn[target];
+                if (inst.op == OP_SWITCH) {
+                    for (int i = 1; i <= inst.c; ++i) out |= liveIn[pc + 1 + i];
+                }
+                RegSet in = use[pc] | (out & ~def[pc]);
+                if (in != liveIn[pc] || out != liveOut[pc]) {
+                    liveIn[pc] = in;
+                    liveOut[pc] = out;
+                    changed = true;
+                }
+            }
+        }
+    }
+};
+
+// Serializes functions in the layout of ldump.c
+class ChunkBuffer {
+public:
+    std::string data;
+
+    void byte(int b) { data.push_back(static_cast<char>(b)); }
+
+    void bytes(uint64_t v, int n) {
+        for (int i = 0; i < n; ++i) byte(static_cast<int>((v >> (8 * i)) & 0xFF));
+    }
+
+    void integer(int v) { bytes(static_cast<uint32_t>(v), 4); }
+
+    void number(double d) {
+        uint64_t bits;
+        std::memcpy(&bits, &d, sizeof bits);
+        bytes(bits, 8);
+    }
+
+    void string(const std::string& s) {
+        size_t size = s.size() + 1;
+        if (size < 0xFF) {
+            byte(static_cast<int>(size));
+        } else {
+            byte(0xFF);
+            bytes(size, 8);
+        }
+        data += s;
+    }
+
+    void header() {
+        data += "\x1bLua";
+        byte(0x53); // Version
+        byte(0);    // Official format
+        data += "\x19\x93\r\n\x1a\n";
+        byte(4); // int
+        byte(8); // size_t
+        byte(4); // Instruction
+        byte(8); // lua_Integer
+        byte(8); // lua_Number
+        bytes(0x5678, 8);
+        number(370.5);
+    }
+
+    void function(const Prototype* proto, bool isMain, const std::string& source) {
+        LuaFunction fn = FunctionTranslator(proto, isMain).translate();
+        if (proto->upvalues.size() + 1 > 255) throw std::runtime_error("Too many upvalues for a Lua 5.3 chunk");
+
+        if (source.empty()) {
+            byte(0);
+        } else {
+            string(source);
+        }
+        int lastLine = 0;
+        for (int l : fn.lines) lastLine = std::max(lastLine, l);
+        integer(isMain ? 0 : proto->lineDefined);
+        integer(isMain ? 0 : lastLine);
+        byte(isMain ? 0 : proto->numParams);
+        byte(fn.vararg ? 1 : 0);
+        byte(fn.maxStack);
+
+        integer(static_cast<int>(fn.code.size()));
+        for (uint32_t word : fn.code) bytes(word, 4);
+
+        std::vector<Value> constants = proto->constants;
+        constants.insert(constants.end(), fn.constants.begin(), fn.constants.end());
+        integer(static_cast<int>(constants.size()));
+        for (const Value& k : constants) {
+            if (is_nil(k)) {
+                byte(0);
+            } else if (is_boolean(k)) {
+                byte(1);
+                byte(as_boolean(k) ? 1 : 0);
+            } else if (is_integer(k)) {
+                byte(3 | (1 << 4)); // Integer
+                bytes(static_cast<uint64_t>(as_integer(k)), 8);
+            } else if (is_number(k)) {
+                byte(3); // Float
+                number(as_number(k));
+            } else {
+                const std::string& s = as_string_ref(k);
+                byte(s.size() <= 40 ? 4 : 4 | (1 << 4)); // Short or long string
+                string(s);
+            }
+        }
+
+        // Upvalue 0 is _ENV: the main chunk's comes from the loader, nested
+        // functions take their parent's
+        integer(static_cast<int>(proto->upvalues.size()) + 1);
+        byte(isMain ? 1 : 0);
+        byte(0);
+        for (const UpvalueInfo& up : proto->upvalues) {
+            byte(up.isLocal ? 1 : 0);
+            byte(up.isLocal ? up.index : up.index + 1);
+        }
+
+        integer(static_cast<int>(proto->protos.size()));
+        for (const std::unique_ptr<Prototype>& child : proto->protos) function(child.get(), false, "");
+
+        integer(static_cast<int>(fn.lines.size()));
+        for (int l : fn.lines) integer(l);
+        integer(0); // Local variables
+        integer(static_cast<int>(proto->upvalues.size()) + 1);
+        string("_ENV");
+        for (size_t i = 0; i < proto->upvalues.size(); ++i) byte(0);
+    }
+};
+
+void LuacWriter::write(Prototype* proto, std::ostream& out, const GeneratorOptions& options) {
+    ChunkBuffer chunk;
+    chunk.header();
+    chunk.byte(1); // Upvalues of the main closure
+    chunk.function(proto, true, "@" + options.chunkName);
+    out.write(chunk.data.data(), static_cast<std::streamsize>(chunk.data.size()));
+}
@@ -0,0 +1,21 @@
+#ifndef LUACWRITER_H
+#define LUACWRITER_H
+
+#include "Compiler.h"
+#include "LuaGenerator.h"
+#include <iostream>
+
+// Writes a Prototype tree as a standard Lua 5.3 binary chunk (the format of
+// luac 5.3 on a little-endian host with 4-byte int, 8-byte size_t, 64-bit
+// integers and doubles) that lua5.3 and load() run directly, with no VM
+// script in between. Each SimpleLua instruction maps onto one or a few stock
+// Lua instructions; globals go through an _ENV upvalue added to every
+// function. Throws std::runtime_error for code that cannot be mapped
+// (superinstructions, register or jump overflow, or generic for loops whose
+// iterator call would clobber live registers).
+class LuacWriter {
+public:
+    static void write(Prototype* proto, std::ostream& out, const GeneratorOptions& options = GeneratorOptions());
+};
+
+#endif
@@ -0,0 +1,1287 @@
+#include "Interpreter.h"
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__GNUC__) && !defined(SIMPLELUA_NO_COMPUTED_GOTO)
+#define NATIVE_COMPUTED_GOTO 1
+#endif
+
+static const int kMaxCallDepth = 200000;
+// Native functions calling back into Lua recurse on the C++ stack
+static const int kMaxNativeDepth = 200;
+static const int kMaxStackSlots = 1 << 22;
+
+// --- CallInfo ---
+
+const LuaValue& CallInfo::arg(int i) const {
+    static const LuaValue nil;
+    return i < nargs ? vm.stack[base + i] : nil;
+}
+
+void CallInfo::push(LuaValue v) {
+    vm.ensureStack(top() + 1);
+    vm.stack[top()] = v;
+    nresults++;
+    vm.top = top();
+}
+
+void CallInfo::argError(int i, const std::string& msg) const {
+    vm.runtimeError("bad argument #" + std::to_string(i + 1) + " to '" + self->name + "' (" + msg + ")");
+}
+
+void CallInfo::checkAny(int i) const {
+    if (i >= nargs) argError(i, "value expected");
+}
+
+int64_t CallInfo::checkInteger(int i) const {
+    LuaValue v;
+    if (!Interpreter::toNumber(arg(i), v)) {
+        argError(i, std::string("number expected, got ") + (i < nargs ? Interpreter::typeName(arg(i)) : "no value"));
+    }
+    if (v.type == LuaType::Integer) return v.i;
+    double d = v.n;
+    if (std::floor(d) != d || d < -9223372036854775808.0 || d >= 9223372036854775808.0) {
+        argError(i, "number has no integer representation");
+    }
+    return (int64_t)d;
+}
+
+int64_t CallInfo::optInteger(int i, int64_t def) const {
+    return arg(i).isNil() ? def : checkInteger(i);
+}
+
+double CallInfo::checkNumber(int i) const {
+    LuaValue v;
+    if (!Interpreter::toNumber(arg(i), v)) {
+        argError(i, std::string("number expected, got ") + (i < nargs ? Interpreter::typeName(arg(i)) : "no value"));
+    }
+    return v.toFloat();
+}
+
+LuaString* CallInfo::checkString(int i) const {
+    const LuaValue& v = arg(i);
+    if (v.type == LuaType::String) return v.s;
+    if (v.isNumber()) {
+        LuaString* s = vm.intern(Interpreter::numberToString(v));
+        vm.stack[base + i] = LuaValue::string(s); // Keep the converted string reachable
+        return s;
+    }
+    argError(i, std::string("string expected, got ") + (i < nargs ? Interpreter::typeName(v) : "no value"));
+}
+
+LuaTable* CallInfo::checkTable(int i) const {
+    const LuaValue& v = arg(i);
+    if (v.type != LuaType::Table) {
+        argError(i, std::string("table expected, got ") + (i < nargs ? Interpreter::typeName(v) : "no value"));
+    }
+    return v.t;
+}
+
+// --- Setup ---
+
+Interpreter::Interpreter(std::ostream& out) : out(out) {
+    static const char* const eventNames[NUM_EVENTS] = {
+        "__index", "__newindex", "__call", "__tostring", "__len", "__eq", "__lt", "__le",
+        "__concat", "__add", "__sub", "__mul", "__div", "__mod", "__idiv", "__pairs",
+        "__metatable"
+    };
+    for (int i = 0; i < NUM_EVENTS; ++i) events[i] = intern(eventNames[i]);
+    stack.resize(1024);
+    globals = newTable();
+    stringMeta = newTable();
+    openStdlib(*this);
+}
+
+Interpreter::~Interpreter() {
+    while (objects) {
+        GCObject* next = objects->gcNext;
+        delete objects;
+        objects = next;
+    }
+}
+
+void Interpreter::track(GCObject* object) {
+    object->gcNext = objects;
+    objects = object;
+    gcCount++;
+}
+
+LuaString* Interpreter::intern(std::string_view s) {
+    auto it = strings.find(s);
+    if (it != strings.end()) return it->second;
+    LuaString* str = new LuaString();
+    str->data.assign(s.data(), s.size());
+    str->hash = std::hash<std::string_view>()(s);
+    track(str);
+    strings.emplace(std::string_view(str->data), str);
+    return str;
+}
+
+LuaTable* Interpreter::newTable() {
+    LuaTable* t = new LuaTable();
+    track(t);
+    return t;
+}
+
+LuaNativeFunction* Interpreter::newNative(const char* name, LuaCFunction fn) {
+    LuaNativeFunction* f = new LuaNativeFunction();
+    f->fn = fn;
+    f->name = name;
+    track(f);
+    return f;
+}
+
+void Interpreter::setField(LuaTable* table, const char* name, const LuaValue& value) {
+    table->set(string(name), value);
+}
+
+void Interpreter::setFunction(LuaTable* table, const char* name, LuaCFunction fn) {
+    setField(table, name, LuaValue::function(newNative(name, fn)));
+}
+
+void Interpreter::ensureStack(int size) {
+    if (size <= (int)stack.size()) return;
+    if (size > kMaxStackSlots) runtimeError("stack overflow");
+    size_t n = stack.size();
+    while ((int)n < size) n *= 2;
+    stack.resize(n);
+}
+
+NativeProto* Interpreter::loadProto(const Prototype* proto) {
+    protos.push_back(std::make_unique<NativeProto>());
+    NativeProto* p = protos.back().get();
+    p->source = proto;
+    p->numParams = proto->numParams;
+    p->upvalues = proto->upvalues;
+
+    for (const Value& v : proto->constants) {
+        LuaValue k;
+        if (is_boolean(v)) {
+            k = LuaValue::boolean(as_boolean(v));
+        } else if (is_integer(v)) {
+            k = LuaValue::integer(as_integer(v));
+        } else if (is_number(v)) {
+            k = LuaValue::number(as_number(v));
+        } else if (is_string(v)) {
+            k = string(as_string_ref(v));
+        }
+        p->constants.push_back(k);
+    }
+
+    // Frame size: highest register any instruction touches
+    int maxReg = proto->numParams;
+    auto use = [&maxReg](int reg) { if (reg + 1 > maxReg) maxReg = reg + 1; };
+    for (const Instruction& inst : proto->instructions) {
+        if (inst.op >= OP_SUPER0) {
+            throw std::runtime_error("native interpreter cannot run superinstructions");
+        }
+        if (inst.a < 0 || inst.a > 255) throw std::runtime_error("register out of range");
+        use(inst.a);
+        switch (inst.op) {
+        case OP_MOVE: case OP_LEN: case OP_NOT:
+            use(inst.b);
+            break;
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_IDIV: case OP_MOD:
+        case OP_ADD_INT: case OP_SUB_INT: case OP_MUL_INT: case OP_IDIV_INT: case OP_MOD_INT:
+        case OP_CONCAT: case OP_EQ: case OP_LT: case OP_LE: case OP_GETTABLE: case OP_SETTABLE:
+            use(inst.b);
+            use(inst.c);
+            break;
+        case OP_CALL:
+            use(inst.a + inst.b - 1);
+            use(inst.a + inst.c - 2);
+            break;
+        case OP_VARARG:
+            use(inst.a + inst.c - 2);
+            break;
+        case OP_FORPREP: case OP_FORLOOP: case OP_FORLOOP_UP: case OP_FORLOOP_DOWN:
+            use(inst.a + 3);
+            break;
+        case OP_TFORCALL: case OP_TFORIPAIRS: case OP_TFORPAIRS:
+            use(inst.a + 2 + inst.c);
+            break;
+        case OP_TFORLOOP:
+            use(inst.a + 1);
+            break;
+        case OP_BUFINIT: case OP_BUFFLUSH:
+            use(inst.b);
+            break;
+        case OP_BUFAPPEND:
+            use(inst.c);
+            break;
+        case OP_LOADNIL:
+            use(inst.a + inst.b);
+            break;
+        case OP_RETURN:
+            use(inst.a + inst.b - 2);
+            break;
+        default:
+            break;
+        }
+        if (inst.op == OP_SWITCH) {
+            // The keys become a table from key to arm, kept as an extra constant
+            if (inst.b < 0 || inst.c < 0 || inst.b + inst.c > (int)proto->constants.size()) {
+                throw std::runtime_error("switch keys out of range");
+            }
+            LuaTable* arms = newTable();
+            p->constants.push_back(LuaValue::table(arms));
+            for (int i = inst.c - 1; i >= 0; --i) arms->set(p->constants[inst.b + i], LuaValue::integer(i));
+            p->code.push_back({(uint8_t)inst.op, (uint8_t)inst.a, (int)p->constants.size() - 1, inst.c});
+            continue;
+        }
+        p->code.push_back({(uint8_t)inst.op, (uint8_t)inst.a, inst.b, inst.c});
+    }
+    p->frameSize = maxReg;
+
+    for (const auto& child : proto->protos) {
+        p->protos.push_back(loadProto(child.get()));
+    }
+    return p;
+}
+
+void Interpreter::run(const Prototype* main, const std::string& name) {
+    chunkName = name;
+    LuaClosure* closure = new LuaClosure();
+    closure->proto = loadProto(main);
+    track(closure);
+    stack[0] = LuaValue::function(closure);
+    top = 1;
+    try {
+        call(0, 0);
+    } catch (const LuaError& e) {
+        if (e.value.type == LuaType::String) throw std::runtime_error(e.value.s->data);
+        throw std::runtime_error(std::string("(error object is a ") + typeName(e.value) + " value)");
+    }
+}
+
+// --- Conversions ---
+
+const char* Interpreter::typeName(const LuaValue& v) {
+    switch (v.type) {
+    case LuaType::Nil: return "nil";
+    case LuaType::Boolean: return "boolean";
+    case LuaType::Integer: case LuaType::Float: return "number";
+    case LuaType::String: return "string";
+    case LuaType::Table: return "table";
+    case LuaType::Function: return "function";
+    }
+    return "?";
+}
+
+std::string Interpreter::numberToString(const LuaValue& v) {
+    char buf[64];
+    if (v.type == LuaType::Integer) {
+        std::snprintf(buf, sizeof(buf), "%lld", (long long)v.i);
+        return buf;
+    }
+    std::snprintf(buf, sizeof(buf), "%.14g", v.n);
+    // Floats that look like integers keep a ".0" suffix
+    if (std::strspn(buf, "-0123456789") == std::strlen(buf)) std::strcat(buf, ".0");
+    return buf;
+}
+
+bool Interpreter::stringToNumber(const std::string& s, LuaValue& out) {
+    size_t begin = s.find_first_not_of(" \t\n\r\f\v");
+    if (begin == std::string::npos) return false;
+    size_t end = s.find_last_not_of(" \t\n\r\f\v") + 1;
+    std::string text = s.substr(begin, end - begin);
+    const char* str = text.c_str();
+    const char* digits = str + (str[0] == '-' || str[0] == '+');
+    if (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) {
+        // Hexadecimal integers wrap around like in Lua
+        uint64_t value = 0;
+        const char* q = digits + 2;
+        if (!std::isxdigit((unsigned char)*q)) return false;
+        for (; std::isxdigit((unsigned char)*q); ++q) {
+            int d = std::isdigit((unsigned char)*q) ? *q - '0' : (std::tolower((unsigned char)*q) - 'a' + 10);
+            value = value * 16 + (uint64_t)d;
+        }
+        if (*q != '\0') return false;
+        out = LuaValue::integer(str[0] == '-' ? (int64_t)(0 - value) : (int64_t)value);
+        return true;
+    }
+    if (text.find_first_of("nN") != std::string::npos) return false; // No "inf"/"nan" spellings
+    bool integral = std::strspn(digits, "0123456789") == std::strlen(digits) && digits[0] != '\0';
+    if (integral) {
+        errno = 0;
+        long long value = std::strtoll(str, nullptr, 10);
+        if (errno != ERANGE) {
+            out = LuaValue::integer(value);
+            return true;
+        }
+    }
+    char* stop = nullptr;
+    double d = std::strtod(str, &stop);
+    if (stop == str || *stop != '\0') return false;
+    out = LuaValue::number(d);
+    return true;
+}
+
+bool Interpreter::toNumber(const LuaValue& v, LuaValue& out) {
+    if (v.isNumber()) {
+        out = v;
+        return true;
+    }
+    if (v.type == LuaType::String) return stringToNumber(v.s->data, out);
+    return false;
+}
+
+std::string Interpreter::toString(LuaValue v) {
+    char buf[64];
+    switch (v.type) {
+    case LuaType::Nil: return "nil";
+    case LuaType::Boolean: return v.b ? "true" : "false";
+    case LuaType::Integer: case LuaType::Float: return numberToString(v);
+    case LuaType::String: return v.s->data;
+    case LuaType::Table: {
+        LuaValue handler = metamethod(v, EVENT_TOSTRING);
+        if (!handler.isNil()) {
+            LuaValue s = call1(handler, {v});
+            if (s.type != LuaType::String) runtimeError("'__tostring' must return a string");
+            return s.s->data;
+        }
+        std::snprintf(buf, sizeof(buf), "table: %p", (void*)v.t);
+        return buf;
+    }
+    case LuaType::Function:
+        std::snprintf(buf, sizeof(buf), v.f->isNative ? "builtin: %p" : "function: %p", (void*)v.f);
+        return buf;
+    }
+    return "?";
+}
+
+// --- Metamethods ---
+
+LuaValue Interpreter::metamethod(const LuaValue& v, MetaEvent event) {
+    LuaTable* mt = nullptr;
+    if (v.type == LuaType::Table) mt = v.t->metatable;
+    else if (v.type == LuaType::String) mt = stringMeta;
+    return mt ? mt->getStr(events[event]) : LuaValue();
+}
+
+LuaValue Interpreter::call1(const LuaValue& fn, std::initializer_list<LuaValue> args) {
+    int slot = top;
+    ensureStack(slot + 1 + (int)args.size());
+    stack[slot] = fn;
+    int i = 1;
+    for (const LuaValue& v : args) stack[slot + i++] = v;
+    int n = call(slot, (int)args.size());
+    return n > 0 ? stack[slot] : LuaValue();
+}
+
+LuaValue Interpreter::index(LuaValue object, LuaValue key) {
+    for (int loop = 0; loop < 100; ++loop) {
+        LuaValue handler;
+        if (object.type == LuaType::Table) {
+            LuaValue v = object.t->get(key);
+            if (!v.isNil() || !object.t->metatable) return v;
+            handler = object.t->metatable->getStr(events[EVENT_INDEX]);
+            if (handler.isNil()) return v;
+        } else {
+            handler = metamethod(object, EVENT_INDEX);
+            if (handler.isNil()) runtimeError(std::string("attempt to index a ") + typeName(object) + " value");
+        }
+        if (handler.type == LuaType::Function) return call1(handler, {object, key});
+        object = handler;
+    }
+    runtimeError("'__index' chain too long; possible loop");
+}
+
+void Interpreter::setIndex(LuaValue object, LuaValue key, LuaValue value) {
+    for (int loop = 0; loop < 100; ++loop) {
+        LuaValue handler;
+        if (object.type == LuaType::Table) {
+            LuaTable* t = object.t;
+            if (!t->metatable || !t->get(key).isNil() ||
+                (handler = t->metatable->getStr(events[EVENT_NEWINDEX])).isNil()) {
+                try {
+                    t->set(key, value);
+                } catch (const std::invalid_argument& e) {
+                    runtimeError(e.what());
+                }
+                return;
+            }
+        } else {
+            handler = metamethod(object, EVENT_NEWINDEX);
+            if (handler.isNil()) runtimeError(std::string("attempt to index a ") + typeName(object) + " value");
+        }
+        if (handler.type == LuaType::Function) {
+            call1(handler, {object, key, value});
+            return;
+        }
+        object = handler;
+    }
+    runtimeError("'__newindex' chain too long; possible loop");
+}
+
+// --- Operators ---
+
+static MetaEvent arithEvent(int op) {
+    switch (op) {
+    case OP_ADD: return EVENT_ADD;
+    case OP_SUB: return EVENT_SUB;
+    case OP_MUL: return EVENT_MUL;
+    case OP_DIV: return EVENT_DIV;
+    case OP_MOD: return EVENT_MOD;
+    default: return EVENT_IDIV;
+    }
+}
+
+LuaValue Interpreter::arith(int op, const LuaValue& x, const LuaValue& y) {
+    LuaValue a, b;
+    if (!toNumber(x, a) || !toNumber(y, b)) {
+        LuaValue handler = metamethod(x, arithEvent(op));
+        if (handler.isNil()) handler = metamethod(y, arithEvent(op));
+        if (!handler.isNil()) return call1(handler, {x, y});
+        const LuaValue& bad = toNumber(x, a) ? y : x;
+        runtimeError(std::string("attempt to perform arithmetic on a ") + typeName(bad) + " value");
+    }
+    // As in Lua 5.3, strings coerced for arithmetic always take the float path
+    bool coerced = x.type == LuaType::String || y.type == LuaType::String;
+    if (a.type == LuaType::Integer && b.type == LuaType::Integer && op != OP_DIV && !coerced) {
+        uint64_t u = (uint64_t)a.i, v = (uint64_t)b.i;
+        switch (op) {
+        case OP_ADD: return LuaValue::integer((int64_t)(u + v));
+        case OP_SUB: return LuaValue::integer((int64_t)(u - v));
+        case OP_MUL: return LuaValue::integer((int64_t)(u * v));
+        case OP_IDIV: {
+            if (b.i == 0) runtimeError("attempt to perform 'n//0'");
+            if (b.i == -1) return LuaValue::integer((int64_t)(0 - u));
+            int64_t q = a.i / b.i;
+            if ((a.i % b.i != 0) && ((a.i ^ b.i) < 0)) q--;
+            return LuaValue::integer(q);
+        }
+        case OP_MOD: {
+            if (b.i == 0) runtimeError("attempt to perform 'n%%0'");
+            if (b.i == -1) return LuaValue::integer(0);
+            int64_t r = a.i % b.i;
+            if (r != 0 && (r ^ b.i) < 0) r += b.i;
+            return LuaValue::integer(r);
+        }
+        }
+    }
+    double p = a.toFloat(), q = b.toFloat();
+    switch (op) {
+    case OP_ADD: return LuaValue::number(p + q);
+    case OP_SUB: return LuaValue::number(p - q);
+    case OP_MUL: return LuaValue::number(p * q);
+    case OP_DIV: return LuaValue::number(p / q);
+    case OP_IDIV: return LuaValue::number(std::floor(p / q));
+    default: {
+        double m = std::fmod(p, q);
+        if (m != 0 && (m > 0) != (q > 0)) m += q;
+        return LuaValue::number(m);
+    }
+    }
+}
+
+static bool numLess(const LuaValue& x, const LuaValue& y) {
+    if (x.type == LuaType::Integer && y.type == LuaType::Integer) return x.i < y.i;
+    return x.toFloat() < y.toFloat();
+}
+
+static bool numLessEqual(const LuaValue& x, const LuaValue& y) {
+    if (x.type == LuaType::Integer && y.type == LuaType::Integer) return x.i <= y.i;
+    return x.toFloat() <= y.toFloat();
+}
+
+static std::string compareError(const LuaValue& x, const LuaValue& y) {
+    const char* t1 = Interpreter::typeName(x);
+    const char* t2 = Interpreter::typeName(y);
+    if (std::strcmp(t1, t2) == 0) return std::string("attempt to compare two ") + t1 + " values";
+    return std::string("attempt to compare ") + t1 + " with " + t2;
+}
+
+bool Interpreter::lessThan(const LuaValue& x, const LuaValue& y) {
+    if (x.isNumber() && y.isNumber()) return numLess(x, y);
+    if (x.type == LuaType::String && y.type == LuaType::String) return x.s->data < y.s->data;
+    LuaValue handler = metamethod(x, EVENT_LT);
+    if (handler.isNil()) handler = metamethod(y, EVENT_LT);
+    if (handler.isNil()) runtimeError(compareError(x, y));
+    return !call1(handler, {x, y}).isFalsy();
+}
+
+bool Interpreter::lessEqual(const LuaValue& x, const LuaValue& y) {
+    if (x.isNumber() && y.isNumber()) return numLessEqual(x, y);
+    if (x.type == LuaType::String && y.type == LuaType::String) return x.s->data <= y.s->data;
+    LuaValue handler = metamethod(x, EVENT_LE);
+    if (handler.isNil()) handler = metamethod(y, EVENT_LE);
+    if (!handler.isNil()) return !call1(handler, {x, y}).isFalsy();
+    // Like Lua 5.3, fall back to not (y < x)
+    handler = metamethod(x, EVENT_LT);
+    if (handler.isNil()) handler = metamethod(y, EVENT_LT);
+    if (handler.isNil()) runtimeError(compareError(x, y));
+    return call1(handler, {y, x}).isFalsy();
+}
+
+LuaValue Interpreter::concat(const LuaValue& x, const LuaValue& y) {
+    bool xs = x.type == LuaType::String || x.isNumber();
+    bool ys = y.type == LuaType::String || y.isNumber();
+    if (!xs || !ys) {
+        LuaValue handler = metamethod(x, EVENT_CONCAT);
+        if (handler.isNil()) handler = metamethod(y, EVENT_CONCAT);
+        if (!handler.isNil()) return call1(handler, {x, y});
+        runtimeError(std::string("attempt to concatenate a ") + typeName(xs ? y : x) + " value");
+    }
+    std::string s = x.type == LuaType::String ? x.s->data : numberToString(x);
+    if (y.type == LuaType::String) s += y.s->data;
+    else s += numberToString(y);
+    return string(s);
+}
+
+// Strings and numbers concatenate without metamethods
+static bool plain(const LuaValue& v) {
+    return v.type == LuaType::String || v.isNumber();
+}
+
+// Like Lua, works from the right: each maximal run of strings and numbers
+// is joined into one new string, and a metamethod combines the rest pairwise.
+// Operands stay in their registers, which keeps them reachable across calls
+LuaValue Interpreter::concat(int from, int to) {
+    LuaValue acc = stack[to];
+    int i = to - 1;
+    while (i >= from) {
+        if (!plain(acc) || !plain(stack[i])) {
+            acc = concat(stack[i], acc);
+            i--;
+            continue;
+        }
+        int j = i;
+        while (j > from && plain(stack[j - 1])) j--;
+        std::string s;
+        for (int k = j; k <= i; ++k) {
+            if (stack[k].type == LuaType::String) s += stack[k].s->data;
+            else s += numberToString(stack[k]);
+        }
+        if (acc.type == LuaType::String) s += acc.s->data;
+        else s += numberToString(acc);
+        acc = string(s);
+        i = j - 1;
+    }
+    return acc;
+}
+
+// The pieces of a string buffer joined; a buffer holding only the value it
+// started from gives that value back unchanged
+LuaValue Interpreter::bufferContents(const LuaTable* buffer) {
+    if (buffer->array.size() == 1) return buffer->array[0];
+    std::string s;
+    for (const LuaValue& piece : buffer->array) {
+        if (piece.type == LuaType::String) s += piece.s->data;
+        else s += numberToString(piece);
+    }
+    return string(s);
+}
+
+LuaValue Interpreter::length(const LuaValue& v) {
+    if (v.type == LuaType::String) return LuaValue::integer((int64_t)v.s->data.size());
+    LuaValue handler = metamethod(v, EVENT_LEN);
+    if (!handler.isNil()) return call1(handler, {v});
+    if (v.type == LuaType::Table) return LuaValue::integer(v.t->length());
+    runtimeError(std::string("attempt to get length of a ") + typeName(v) + " value");
+}
+
+void Interpreter::runtimeError(const std::string& msg, int level) {
+    throw LuaError(string(msg), msg, level, depth);
+}
+
+// --- Upvalues ---
+
+LuaUpvalue* Interpreter::findUpvalue(int index) {
+    auto it = openUpvalues.end();
+    while (it != openUpvalues.begin() && (*(it - 1))->index >= index) {
+        --it;
+        if ((*it)->index == index) return *it;
+    }
+    LuaUpvalue* uv = new LuaUpvalue();
+    uv->index = index;
+    track(uv);
+    openUpvalues.insert(it, uv);
+    return uv;
+}
+
+void Interpreter::closeUpvalues(int level) {
+    while (!openUpvalues.empty() && openUpvalues.back()->index >= level) {
+        LuaUpvalue* uv = openUpvalues.back();
+        uv->closed = stack[uv->index];
+        uv->open = false;
+        openUpvalues.pop_back();
+    }
+}
+
+// --- Calls ---
+
+// Restores the caller's view of the stack when a call returns or unwinds
+struct FrameGuard {
+    Interpreter& vm;
+    int savedTop;
+    int savedDepth;
+    size_t savedFrames;
+    int closeLevel;
+    FrameGuard(Interpreter& vm, int closeLevel)
+        : vm(vm), savedTop(vm.top), savedDepth(vm.depth), savedFrames(vm.frames.size()), closeLevel(closeLevel) {}
+    ~FrameGuard() {
+        if (closeLevel >= 0) vm.closeUpvalues(closeLevel);
+        vm.frames.resize(savedFrames);
+        vm.top = savedTop;
+        vm.depth = savedDepth;
+    }
+};
+
+int Interpreter::call(int funcSlot, int nargs) {
+    LuaValue fn = stack[funcSlot];
+    if (fn.type != LuaType::Function) {
+        LuaValue handler = metamethod(fn, EVENT_CALL);
+        if (handler.isNil()) runtimeError(std::string("attempt to call a ") + typeName(fn) + " value");
+        // The called object becomes the first argument
+        ensureStack(funcSlot + nargs + 2);
+        for (int i = nargs; i >= 0; --i) stack[funcSlot + 1 + i] = stack[funcSlot + i];
+        stack[funcSlot] = handler;
+        return call(funcSlot, nargs + 1);
+    }
+    if (!fn.f->isNative) return execute(static_cast<LuaClosure*>(fn.f), funcSlot, nargs);
+
+    LuaNativeFunction* native = static_cast<LuaNativeFunction*>(fn.f);
+    FrameGuard guard(*this, -1);
+    if (++depth > kMaxCallDepth) runtimeError("stack overflow");
+    CallInfo ci{*this, funcSlot + 1, nargs, 0, native};
+    top = ci.top();
+    int n;
+    try {
+        n = native->fn(ci);
+    } catch (LuaError& e) {
+        // Errors from further down count this frame as a level, but a native
+        // frame has no line to report
+        if (e.depth != depth && e.level > 0) e.level--;
+        throw;
+    }
+    int from = ci.top() - n;
+    for (int i = 0; i < n; ++i) stack[funcSlot + i] = stack[from + i];
+    return n;
+}
+
+void Interpreter::enterFrame(LuaClosure* closure, int funcSlot, int nargs) {
+    if (depth + 1 > kMaxCallDepth) runtimeError("stack overflow");
+    NativeProto* p = closure->proto;
+    int base = funcSlot + 1;
+    int numVarargs = 0;
+    if (nargs > p->numParams) {
+        // Extra arguments stay where they were passed; the frame moves above them
+        numVarargs = nargs - p->numParams;
+        base += nargs;
+        ensureStack(base + p->frameSize);
+        for (int i = 0; i < p->numParams; ++i) stack[base + i] = stack[funcSlot + 1 + i];
+        for (int i = p->numParams; i < p->frameSize; ++i) stack[base + i] = LuaValue();
+    } else {
+        ensureStack(base + p->frameSize);
+        for (int i = nargs; i < p->frameSize; ++i) stack[base + i] = LuaValue();
+    }
+    depth++;
+    frames.push_back({closure, p->code.data(), funcSlot, base, numVarargs});
+}
+
+int Interpreter::execute(LuaClosure* entry, int entrySlot, int nargs) {
+    // Only native-to-Lua transitions recurse on the C++ stack
+    if (nativeDepth >= kMaxNativeDepth) runtimeError("C stack overflow");
+    struct NativeDepthGuard {
+        int& d;
+        explicit NativeDepthGuard(int& d) : d(d) { d++; }
+        ~NativeDepthGuard() { d--; }
+    } nativeGuard(nativeDepth);
+
+    FrameGuard guard(*this, entrySlot);
+    const size_t entryFrame = frames.size();
+    enterFrame(entry, entrySlot, nargs);
+
+    LuaClosure* closure;
+    NativeProto* p;
+    const LuaValue* k;
+    int funcSlot, base, numVarargs, frameTop;
+    const NativeInstruction* pc;
+    const NativeInstruction* inst = nullptr;
+    LuaValue* R;
+
+#define RELOAD() (R = &stack[base])
+#define LOAD_FRAME() do { \
+        const LuaFrame& f = frames.back(); \
+        closure = f.closure; \
+        p = closure->proto; \
+        k = p->constants.data(); \
+        funcSlot = f.funcSlot; \
+        base = f.base; \
+        numVarargs = f.numVarargs; \
+        frameTop = base + p->frameSize; \
+        top = frameTop; \
+        pc = f.pc; \
+        RELOAD(); \
+    } while (0)
+#define RA (R[inst->a])
+#define RB (R[inst->b])
+#define RC (R[inst->c])
+
+#ifdef NATIVE_COMPUTED_GOTO
+    static const void* const dispatch[] = {
+        &&L_OP_MOVE, &&L_OP_LOADK, &&L_OP_ADD, &&L_OP_SUB, &&L_OP_MUL, &&L_OP_DIV, &&L_OP_IDIV, &&L_OP_MOD,
+        &&L_OP_CONCAT, &&L_OP_LEN, &&L_OP_NOT, &&L_OP_EQ, &&L_OP_LT, &&L_OP_LE, &&L_OP_JMP, &&L_OP_JMP_FALSE,
+        &&L_OP_GETGLOBAL, &&L_OP_SETGLOBAL, &&L_OP_NEWTABLE, &&L_OP_GETTABLE, &&L_OP_SETTABLE, &&L_OP_CALL,
+        &&L_OP_CLOSURE, &&L_OP_GETUPVAL, &&L_OP_SETUPVAL, &&L_OP_VARARG, &&L_OP_FORPREP, &&L_OP_FORLOOP,
+        &&L_OP_TFORCALL, &&L_OP_TFORLOOP, &&L_OP_RETURN, &&L_OP_ADD_INT, &&L_OP_SUB_INT, &&L_OP_MUL_INT,
+        &&L_OP_IDIV_INT, &&L_OP_MOD_INT, &&L_OP_FORLOOP_UP, &&L_OP_FORLOOP_DOWN, &&L_OP_TFORIPAIRS,
+        &&L_OP_TFORPAIRS, &&L_OP_BUFINIT, &&L_OP_BUFAPPEND, &&L_OP_BUFFLUSH, &&L_OP_LOADNIL,
+        &&L_OP_LOADBOOL, &&L_OP_LOADI, &&L_OP_LOADF, &&L_OP_SWITCH, &&L_OP_JMP_TRUE,
+        &&L_UNKNOWN, &&L_UNKNOWN, &&L_UNKNOWN, &&L_UNKNOWN,
+        &&L_UNKNOWN, &&L_UNKNOWN, &&L_UNKNOWN, &&L_UNKNOWN
+    };
+    static_assert(sizeof(dispatch) / sizeof(dispatch[0]) == NUM_OPCODES, "dispatch table out of sync with OpCode");
+#define VM_CASE(op) L_##op:
+#define VM_NEXT do { inst = pc++; goto *dispatch[inst->op]; } while (0)
+#else
+#define VM_CASE(op) case op:
+#define VM_NEXT break
+#endif
+
+#define ARITH(opcode, intExpr, floatExpr) { \
+        const LuaValue& x = RB; \
+        const LuaValue& y = RC; \
+        if (x.type == LuaType::Integer && y.type == LuaType::Integer) { \
+            RA = LuaValue::integer(intExpr); \
+        } else if (x.isNumber() && y.isNumber()) { \
+            RA = LuaValue::number(floatExpr); \
+        } else { \
+            LuaValue r = arith(opcode, x, y); \
+            RELOAD(); \
+            RA = r; \
+        } \
+    }
+
+    LOAD_FRAME();
+    try {
+#ifdef NATIVE_COMPUTED_GOTO
+        VM_NEXT;
+#else
+        for (;;) {
+            inst = pc++;
+            switch (inst->op) {
+#endif
+        VM_CASE(OP_MOVE) {
+            RA = RB;
+        } VM_NEXT;
+        VM_CASE(OP_LOADK) {
+            RA = k[inst->b];
+        } VM_NEXT;
+        VM_CASE(OP_LOADNIL) {
+            LuaValue* ra = &RA;
+            for (int i = 0; i <= inst->b; ++i) ra[i] = LuaValue();
+        } VM_NEXT;
+        VM_CASE(OP_LOADBOOL) {
+            RA = LuaValue::boolean(inst->b != 0);
+        } VM_NEXT;
+        VM_CASE(OP_LOADI) {
+            RA = LuaValue::integer(inst->b);
+        } VM_NEXT;
+        VM_CASE(OP_LOADF) {
+            RA = LuaValue::number(inst->b);
+        } VM_NEXT;
+        VM_CASE(OP_ADD) ARITH(OP_ADD, (int64_t)((uint64_t)x.i + (uint64_t)y.i), x.toFloat() + y.toFloat()) VM_NEXT;
+        VM_CASE(OP_SUB) ARITH(OP_SUB, (int64_t)((uint64_t)x.i - (uint64_t)y.i), x.toFloat() - y.toFloat()) VM_NEXT;
+        VM_CASE(OP_MUL) ARITH(OP_MUL, (int64_t)((uint64_t)x.i * (uint64_t)y.i), x.toFloat() * y.toFloat()) VM_NEXT;
+        VM_CASE(OP_DIV) {
+            const LuaValue& x = RB;
+            const LuaValue& y = RC;
+            if (x.isNumber() && y.isNumber()) {
+                RA = LuaValue::number(x.toFloat() / y.toFloat());
+            } else {
+                LuaValue r = arith(OP_DIV, x, y);
+                RELOAD();
+                RA = r;
+            }
+        } VM_NEXT;
+        VM_CASE(OP_IDIV) {
+            LuaValue r = arith(OP_IDIV, RB, RC);
+            RELOAD();
+            RA = r;
+        } VM_NEXT;
+        VM_CASE(OP_MOD) {
+            LuaValue r = arith(OP_MOD, RB, RC);
+            RELOAD();
+            RA = r;
+        } VM_NEXT;
+        // The compiler only emits the _INT forms for operands it proved to be integers
+        VM_CASE(OP_ADD_INT) {
+            RA = LuaValue::integer((int64_t)((uint64_t)RB.i + (uint64_t)RC.i));
+        } VM_NEXT;
+        VM_CASE(OP_SUB_INT) {
+            RA = LuaValue::integer((int64_t)((uint64_t)RB.i - (uint64_t)RC.i));
+        } VM_NEXT;
+        VM_CASE(OP_MUL_INT) {
+            RA = LuaValue::integer((int64_t)((uint64_t)RB.i * (uint64_t)RC.i));
+        } VM_NEXT;
+        VM_CASE(OP_IDIV_INT) {
+            int64_t x = RB.i, y = RC.i;
+            if (y == 0) runtimeError("attempt to perform 'n//0'");
+            if (y == -1) {
+                RA = LuaValue::integer((int64_t)(0 - (uint64_t)x));
+            } else {
+                int64_t q = x / y;
+                if ((x % y != 0) && ((x ^ y) < 0)) q--;
+                RA = LuaValue::integer(q);
+            }
+        } VM_NEXT;
+        VM_CASE(OP_MOD_INT) {
+            int64_t x = RB.i, y = RC.i;
+            if (y == 0) runtimeError("attempt to perform 'n%%0'");
+            int64_t r = y == -1 ? 0 : x % y;
+            if (r != 0 && (r ^ y) < 0) r += y;
+            RA = LuaValue::integer(r);
+        } VM_NEXT;
+        VM_CASE(OP_CONCAT) {
+            checkGC();
+            LuaValue r = concat(base + inst->b, base + inst->c);
+            RELOAD();
+            RA = r;
+        } VM_NEXT;
+        VM_CASE(OP_LEN) {
+            const LuaValue& v = RB;
+            if (v.type == LuaType::Table && !v.t->metatable) {
+                RA = LuaValue::integer(v.t->length());
+            } else {
+                LuaValue r = length(v);
+                RELOAD();
+                RA = r;
+            }
+        } VM_NEXT;
+        VM_CASE(OP_NOT) {
+            RA = LuaValue::boolean(RB.isFalsy());
+        } VM_NEXT;
+        VM_CASE(OP_EQ) {
+            const LuaValue& x = RB;
+            const LuaValue& y = RC;
+            bool eq = rawEquals(x, y);
+            if (!eq && x.type == LuaType::Table && y.type == LuaType::Table) {
+                LuaValue handler = metamethod(x, EVENT_EQ);
+                if (handler.isNil()) handler = metamethod(y, EVENT_EQ);
+                if (!handler.isNil()) {
+                    eq = !call1(handler, {x, y}).isFalsy();
+                    RELOAD();
+                }
+            }
+            RA = LuaValue::boolean(eq);
+        } VM_NEXT;
+        VM_CASE(OP_LT) {
+            const LuaValue& x = RB;
+            const LuaValue& y = RC;
+            bool r;
+            if (x.type == LuaType::Integer && y.type == LuaType::Integer) {
+                r = x.i < y.i;
+            } else {
+                r = lessThan(x, y);
+                RELOAD();
+            }
+            RA = LuaValue::boolean(r);
+        } VM_NEXT;
+        VM_CASE(OP_LE) {
+            const LuaValue& x = RB;
+            const LuaValue& y = RC;
+            bool r;
+            if (x.type == LuaType::Integer && y.type == LuaType::Integer) {
+                r = x.i <= y.i;
+            } else {
+                r = lessEqual(x, y);
+                RELOAD();
+            }
+            RA = LuaValue::boolean(r);
+        } VM_NEXT;
+        VM_CASE(OP_JMP) {
+            pc += inst->b;
+        } VM_NEXT;
+        VM_CASE(OP_JMP_FALSE) {
+            if (RA.isFalsy()) pc += inst->b;
+        } VM_NEXT;
+        VM_CASE(OP_JMP_TRUE) {
+            if (!RA.isFalsy()) pc += inst->b;
+        } VM_NEXT;
+        VM_CASE(OP_GETGLOBAL) {
+            if (globals->metatable) {
+                LuaValue v = index(LuaValue::table(globals), k[inst->b]);
+                RELOAD();
+                RA = v;
+            } else {
+                RA = globals->get(k[inst->b]);
+            }
+        } VM_NEXT;
+        VM_CASE(OP_SETGLOBAL) {
+            setIndex(LuaValue::table(globals), k[inst->b], RA);
+            RELOAD();
+        } VM_NEXT;
+        VM_CASE(OP_NEWTABLE) {
+            checkGC();
+            RA = LuaValue::table(newTable());
+        } VM_NEXT;
+        VM_CASE(OP_GETTABLE) {
+            const LuaValue& t = RB;
+            const LuaValue& key = RC;
+            if (t.type == LuaType::Table) {
+                LuaValue v = key.type == LuaType::Integer ? t.t->getInt(key.i)
+                           : key.type == LuaType::String ? t.t->getStr(key.s)
+                           : t.t->get(key);
+                if (!v.isNil() || !t.t->metatable) {
+                    RA = v;
+                    VM_NEXT;
+                }
+            }
+            LuaValue v = index(t, key);
+            RELOAD();
+            RA = v;
+        } VM_NEXT;
+        VM_CASE(OP_SETTABLE) {
+            const LuaValue& t = RA;
+            if (t.type == LuaType::Table && !t.t->metatable) {
+                const LuaValue& key = RB;
+                if (key.type == LuaType::Integer) {
+                    t.t->setInt(key.i, RC);
+                } else {
+                    try {
+                        t.t->set(key, RC);
+                    } catch (const std::invalid_argument& e) {
+                        runtimeError(e.what());
+                    }
+                }
+            } else {
+                setIndex(t, RB, RC);
+                RELOAD();
+            }
+        } VM_NEXT;
+        VM_CASE(OP_CALL) {
+            int a = inst->a;
+            int n = inst->b - 1;
+            // The callee gets a fresh window above this frame
+            ensureStack(frameTop + n + 1);
+            RELOAD();
+            for (int i = 0; i <= n; ++i) stack[frameTop + i] = R[a + i];
+            const LuaValue& fn = stack[frameTop];
+            if (fn.type == LuaType::Function && !fn.f->isNative) {
+                frames.back().pc = pc;
+                enterFrame(static_cast<LuaClosure*>(fn.f), frameTop, n);
+                LOAD_FRAME();
+                VM_NEXT;
+            }
+            int got = call(frameTop, n);
+            top = frameTop;
+            RELOAD();
+            for (int i = 0; i < inst->c - 1; ++i) R[a + i] = i < got ? stack[frameTop + i] : LuaValue();
+        } VM_NEXT;
+        VM_CASE(OP_CLOSURE) {
+            checkGC();
+            NativeProto* child = p->protos[inst->b];
+            LuaClosure* cl = new LuaClosure();
+            cl->proto = child;
+            cl->upvalues.reserve(child->upvalues.size());
+            for (const UpvalueInfo& info : child->upvalues) {
+                cl->upvalues.push_back(info.isLocal ? findUpvalue(base + info.index) : closure->upvalues[info.index]);
+            }
+            track(cl);
+            RA = LuaValue::function(cl);
+        } VM_NEXT;
+        VM_CASE(OP_GETUPVAL) {
+            LuaUpvalue* uv = closure->upvalues[inst->b];
+            RA = uv->open ? stack[uv->index] : uv->closed;
+        } VM_NEXT;
+        VM_CASE(OP_SETUPVAL) {
+            LuaUpvalue* uv = closure->upvalues[inst->b];
+            if (uv->open) stack[uv->index] = RA;
+            else uv->closed = RA;
+        } VM_NEXT;
+        VM_CASE(OP_VARARG) {
+            int n = inst->c - 1;
+            if (n < 0) n = numVarargs;
+            // Values past the frame would be clobbered by the next call anyway
+            if (inst->a + n > p->frameSize) n = p->frameSize - inst->a;
+            for (int i = 0; i < n; ++i) R[inst->a + i] = i < numVarargs ? stack[funcSlot + 1 + p->numParams + i] : LuaValue();
+        } VM_NEXT;
+        VM_CASE(OP_FORPREP) {
+            LuaValue* ra = &RA;
+            if (!ra[0].isNumber()) runtimeError("'for' initial value must be a number");
+            if (!ra[1].isNumber()) runtimeError("'for' limit must be a number");
+            if (!ra[2].isNumber()) runtimeError("'for' step must be a number");
+            if (ra[0].type == LuaType::Integer && ra[2].type == LuaType::Integer) {
+                // Integer loop: clip a float limit to the integers it admits
+                if (ra[1].type == LuaType::Float) {
+                    double limit = ra[2].i > 0 ? std::floor(ra[1].n) : std::ceil(ra[1].n);
+                    if (std::isnan(limit)) limit = ra[2].i > 0 ? -9223372036854775808.0 : 9223372036854775807.0;
+                    if (limit >= 9223372036854775807.0) ra[1] = LuaValue::integer(INT64_MAX);
+                    else if (limit <= -9223372036854775808.0) ra[1] = LuaValue::integer(INT64_MIN);
+                    else ra[1] = LuaValue::integer((int64_t)limit);
+                }
+                ra[0] = LuaValue::integer((int64_t)((uint64_t)ra[0].i - (uint64_t)ra[2].i));
+            } else {
+                for (int i = 0; i < 3; ++i) ra[i] = LuaValue::number(ra[i].toFloat());
+                ra[0].n -= ra[2].n;
+            }
+            pc += inst->b;
+        } VM_NEXT;
+        VM_CASE(OP_FORLOOP) {
+            LuaValue* ra = &RA;
+            // Each iteration gets a fresh loop variable for closures to capture
+            if (!openUpvalues.empty()) closeUpvalues(base + inst->a + 3);
+            // FORPREP made the control values all integers or all floats
+            if (ra[0].type == LuaType::Integer) {
+                int64_t step = ra[2].i;
+                int64_t idx = (int64_t)((uint64_t)ra[0].i + (uint64_t)step);
+                ra[0].i = idx;
+                if (step > 0 ? idx <= ra[1].i : idx >= ra[1].i) {
+                    pc += inst->b;
+                    ra[3] = LuaValue::integer(idx);
+                }
+            } else {
+                double step = ra[2].n;
+                double idx = ra[0].n + step;
+                ra[0].n = idx;
+                if (step > 0 ? idx <= ra[1].n : idx >= ra[1].n) {
+                    pc += inst->b;
+                    ra[3] = LuaValue::number(idx);
+                }
+            }
+        } VM_NEXT;
+        // FORLOOP for a step whose sign is known at compile time
+        VM_CASE(OP_FORLOOP_UP) {
+            LuaValue* ra = &RA;
+            if (!openUpvalues.empty()) closeUpvalues(base + inst->a + 3);
+            if (ra[0].type == LuaType::Integer) {
+                int64_t idx = (int64_t)((uint64_t)ra[0].i + (uint64_t)ra[2].i);
+                ra[0].i = idx;
+                if (idx <= ra[1].i) {
+                    pc += inst->b;
+                    ra[3] = LuaValue::integer(idx);
+                }
+            } else {
+                double idx = ra[0].n + ra[2].n;
+                ra[0].n = idx;
+                if (idx <= ra[1].n) {
+                    pc += inst->b;
+                    ra[3] = LuaValue::number(idx);
+                }
+            }
+        } VM_NEXT;
+        VM_CASE(OP_FORLOOP_DOWN) {
+            LuaValue* ra = &RA;
+            if (!openUpvalues.empty()) closeUpvalues(base + inst->a + 3);
+            if (ra[0].type == LuaType::Integer) {
+                int64_t idx = (int64_t)((uint64_t)ra[0].i + (uint64_t)ra[2].i);
+                ra[0].i = idx;
+                if (idx >= ra[1].i) {
+                    pc += inst->b;
+                    ra[3] = LuaValue::integer(idx);
+                }
+            } else {
+                double idx = ra[0].n + ra[2].n;
+                ra[0].n = idx;
+                if (idx >= ra[1].n) {
+                    pc += inst->b;
+                    ra[3] = LuaValue::number(idx);
+                }
+            }
+        } VM_NEXT;
+        VM_CASE(OP_TFORCALL) generic_tforcall: {
+            int a = inst->a;
+            if (!openUpvalues.empty()) closeUpvalues(base + a + 3);
+            ensureStack(frameTop + 3);
+            RELOAD();
+            stack[frameTop] = R[a];
+            stack[frameTop + 1] = R[a + 1];
+            stack[frameTop + 2] = R[a + 2];
+            int got = call(frameTop, 2);
+            top = frameTop;
+            RELOAD();
+            for (int i = 0; i < inst->c; ++i) R[a + 3 + i] = i < got ? stack[frameTop + i] : LuaValue();
+        } VM_NEXT;
+        // ipairs(t) and pairs(t) loops step inline while the iterator is the
+        // stock one over a plain table, and make the call otherwise
+        VM_CASE(OP_TFORIPAIRS) {
+            LuaValue* ra = &RA;
+            if (ra[0].type != LuaType::Function || ra[0].f != stockIpairsAux || ra[1].type != LuaType::Table ||
+                ra[1].t->metatable || ra[2].type != LuaType::Integer) {
+                goto generic_tforcall;
+            }
+            if (!openUpvalues.empty()) closeUpvalues(base + inst->a + 3);
+            int64_t i = ra[2].i + 1;
+            LuaValue v = ra[1].t->getInt(i);
+            ra[3] = v.isNil() ? LuaValue() : LuaValue::integer(i);
+            if (inst->c > 1) ra[4] = v;
+            for (int j = 2; j < inst->c; ++j) ra[3 + j] = LuaValue();
+        } VM_NEXT;
+        VM_CASE(OP_TFORPAIRS) {
+            LuaValue* ra = &RA;
+            if (ra[0].type != LuaType::Function || ra[0].f != stockNext || ra[1].type != LuaType::Table) {
+                goto generic_tforcall;
+            }
+            if (!openUpvalues.empty()) closeUpvalues(base + inst->a + 3);
+            LuaValue key, value;
+            bool more;
+            try {
+                more = ra[1].t->next(ra[2], key, value);
+            } catch (const std::invalid_argument& e) {
+                runtimeError(e.what());
+            }
+            ra[3] = more ? key : LuaValue();
+            if (inst->c > 1) ra[4] = more ? value : LuaValue();
+            for (int j = 2; j < inst->c; ++j) ra[3 + j] = LuaValue();
+        } VM_NEXT;
+        // A string buffer is a hidden table whose array part holds the
+        // accumulator's first value and the pieces appended since
+        VM_CASE(OP_BUFINIT) {
+            checkGC();
+            LuaTable* t = newTable();
+            t->array.push_back(RB);
+            RA = LuaValue::table(t);
+        } VM_NEXT;
+        VM_CASE(OP_BUFAPPEND) {
+            LuaTable* t = RA.t;
+            bool appendable = plain(t->array[0]);
+            for (int k = inst->b; appendable && k <= inst->c; ++k) appendable = plain(R[k]);
+            if (appendable) {
+                t->array.insert(t->array.end(), &R[inst->b], &R[inst->c] + 1);
+            } else {
+                // Metamethods see the accumulated string, as without the buffer
+                checkGC();
+                t->array.assign(1, bufferContents(t));
+                LuaValue rest = RB;
+                if (inst->c > inst->b) rest = concat(base + inst->b, base + inst->c);
+                LuaValue r = concat(t->array[0], rest);
+                RELOAD();
+                t->array.assign(1, r);
+            }
+        } VM_NEXT;
+        VM_CASE(OP_BUFFLUSH) {
+            checkGC();
+            RA = bufferContents(RB.t);
+        } VM_NEXT;
+        VM_CASE(OP_SWITCH) {
+            LuaValue arm = k[inst->b].t->get(RA);
+            pc += arm.type == LuaType::Integer ? arm.i : inst->c;
+        } VM_NEXT;
+        VM_CASE(OP_TFORLOOP) {
+            LuaValue* ra = &RA;
+            if (!ra[1].isNil()) {
+                ra[0] = ra[1];
+                pc += inst->b;
+            }
+        } VM_NEXT;
+        VM_CASE(OP_RETURN) {
+            int n = inst->b - 1;
+            if (n < 0) n = 0;
+            // Close first: results may land on registers that upvalues still point to
+            closeUpvalues(base);
+            for (int i = 0; i < n; ++i) stack[funcSlot + i] = R[inst->a + i];
+            if (frames.size() == entryFrame + 1) return n;
+            frames.pop_back();
+            depth--;
+            LOAD_FRAME();
+            // Results are at the callee's slot, the top of this frame
+            inst = pc - 1;
+            for (int i = 0; i < inst->c - 1; ++i) R[inst->a + i] = i < n ? stack[frameTop + i] : LuaValue();
+        } VM_NEXT;
+#ifdef NATIVE_COMPUTED_GOTO
+        L_UNKNOWN:
+#else
+        default:
+#endif
+            runtimeError(std::string("unknown opcode ") + opName(static_cast<OpCode>(inst->op)));
+#ifndef NATIVE_COMPUTED_GOTO
+            }
+        }
+#endif
+    } catch (LuaError& e) {
+        frames.back().pc = pc;
+        // Level 1 is the innermost frame, 2 its caller, and so on
+        for (size_t f = frames.size(); f-- > entryFrame && e.level > 0;) {
+            if (e.level > 1) {
+                e.level--;
+                continue;
+            }
+            e.level = 0;
+            if (e.value.type != LuaType::String) break;
+            const LuaFrame& frame = frames[f];
+            const NativeProto* fp = frame.closure->proto;
+            int line = fp->source->lineAt((int)(frame.pc - fp->code.data()) - 1);
+            std::string msg = chunkName + ":" + std::to_string(line) + ": " + e.value.s->data;
+            throw LuaError(string(msg), msg, 0, depth);
+        }
+        throw;
+    }
+
+#undef ARITH
+#undef VM_CASE
+#undef VM_NEXT
+#undef RA
+#undef RB
+#undef RC
+#undef LOAD_FRAME
+#undef RELOAD
+}
+
+// --- Garbage collection ---
+
+void Interpreter::markObject(GCObject* object) {
+    if (object && !object->marked) {
+        object->marked = true;
+        grayList.push_back(object);
+    }
+}
+
+void Interpreter::mark(const LuaValue& v) {
+    if (v.isCollectable()) markObject(v.gc);
+}
+
+void Interpreter::collectGarbage() {
+    for (const LuaValue& v : stack) mark(v);
+    for (const LuaValue& v : pinned) mark(v);
+    for (LuaString* s : events) markObject(s);
+    for (LuaUpvalue* uv : openUpvalues) markObject(uv);
+    markObject(stockNext);
+    markObject(stockIpairsAux);
+    for (const auto& p : protos) {
+        for (const LuaValue& v : p->constants) mark(v);
+    }
+    markObject(globals);
+    markObject(stringMeta);
+
+    while (!grayList.empty()) {
+        GCObject* object = grayList.back();
+        grayList.pop_back();
+        if (LuaTable* t = dynamic_cast<LuaTable*>(object)) {
+            for (const LuaValue& v : t->array) mark(v);
+            for (const auto& entry : t->hash) {
+                mark(entry.first);
+                mark(entry.second);
+            }
+            markObject(t->metatable);
+        } else if (LuaClosure* cl = dynamic_cast<LuaClosure*>(object)) {
+            for (LuaUpvalue* uv : cl->upvalues) markObject(uv);
+        } else if (LuaUpvalue* uv = dynamic_cast<LuaUpvalue*>(object)) {
+            mark(uv->closed);
+        } else if (LuaNativeFunction* nf = dynamic_cast<LuaNativeFunction*>(object)) {
+            for (const LuaValue& v : nf->upvalues) mark(v);
+        }
+    }
+
+    size_t live = 0;
+    GCObject** link = &objects;
+    while (*link) {
+        GCObject* object = *link;
+        if (object->marked) {
+            object->marked = false;
+            live++;
+            link = &object->gcNext;
+        } else {
+            *link = object->gcNext;
+            if (LuaString* s = dynamic_cast<LuaString*>(object)) strings.erase(std::string_view(s->data));
+            delete object;
+        }
+    }
+    gcCount = live;
+    gcThreshold = live * 2 > 100000 ? live * 2 : 100000;
+}
@@ -0,0 +1,161 @@
+#ifndef NATIVE_INTERPRETER_H
+#define NATIVE_INTERPRETER_H
+
+#include "Object.h"
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// A Lua error in flight. `value` is the error object passed to error() (or
+// the message string of a runtime error); string messages get a
+// "chunk:line:" prefix from the frame `level` frames above the one running at
+// call depth `depth` when it was raised (0: no prefix).
+class LuaError : public std::runtime_error {
+public:
+    LuaValue value;
+    int level;
+    int depth;
+
+    LuaError(const LuaValue& value, const std::string& text, int level, int depth)
+        : std::runtime_error(text), value(value), level(level), depth(depth) {}
+};
+
+// View of a native function call: arguments are stack[base, base + nargs),
+// results are pushed above them
+struct CallInfo {
+    Interpreter& vm;
+    int base;
+    int nargs;
+    int nresults;
+    LuaNativeFunction* self;
+
+    const LuaValue& arg(int i) const;
+    int top() const { return base + nargs + nresults; }
+    void push(LuaValue v); // By value: growing the stack may move the source
+
+    // Argument checks raise "bad argument #n to 'name' (...)"
+    [[noreturn]] void argError(int i, const std::string& msg) const;
+    void checkAny(int i) const;
+    int64_t checkInteger(int i) const;
+    int64_t optInteger(int i, int64_t def) const;
+    double checkNumber(int i) const;
+    LuaString* checkString(int i) const; // Numbers are converted
+    LuaTable* checkTable(int i) const;
+};
+
+// Metamethod names, interned once per interpreter
+enum MetaEvent {
+    EVENT_INDEX, EVENT_NEWINDEX, EVENT_CALL, EVENT_TOSTRING, EVENT_LEN, EVENT_EQ, EVENT_LT, EVENT_LE,
+    EVENT_CONCAT, EVENT_ADD, EVENT_SUB, EVENT_MUL, EVENT_DIV, EVENT_MOD, EVENT_IDIV, EVENT_PAIRS,
+    EVENT_METATABLE,
+    NUM_EVENTS
+};
+
+// Register-based interpreter executing a Prototype tree directly, with the
+// semantics of the generated Lua VM (OpCodes.h is the contract). Opcodes are
+// dispatched with computed goto where the compiler supports it; define
+// SIMPLELUA_NO_COMPUTED_GOTO to force the portable switch loop.
+class Interpreter {
+public:
+    explicit Interpreter(std::ostream& out = std::cout);
+    ~Interpreter();
+    Interpreter(const Interpreter&) = delete;
+    Interpreter& operator=(const Interpreter&) = delete;
+
+    // Runs the main chunk; uncaught Lua errors surface as std::runtime_error
+    void run(const Prototype* main, const std::string& chunkName);
+
+    // Calls stack[funcSlot] with the nargs values above it. Results replace
+    // them starting at funcSlot; returns their count.
+    int call(int funcSlot, int nargs);
+
+    LuaString* intern(std::string_view s);
+    LuaValue string(std::string_view s) { return LuaValue::string(intern(s)); }
+    LuaTable* newTable();
+    LuaNativeFunction* newNative(const char* name, LuaCFunction fn);
+    void setField(LuaTable* table, const char* name, const LuaValue& value);
+    void setFunction(LuaTable* table, const char* name, LuaCFunction fn);
+
+    // Indexing and conversions with metamethods; may call back into Lua
+    LuaValue index(LuaValue object, LuaValue key);
+    void setIndex(LuaValue object, LuaValue key, LuaValue value);
+    std::string toString(LuaValue v);
+    LuaValue metamethod(const LuaValue& v, MetaEvent event);
+    // Calls fn at the top of the stack and returns its first result
+    LuaValue call1(const LuaValue& fn, std::initializer_list<LuaValue> args);
+
+    // Comparisons with metamethods
+    bool lessThan(const LuaValue& x, const LuaValue& y);
+    bool lessEqual(const LuaValue& x, const LuaValue& y);
+
+    static std::string numberToString(const LuaValue& v);
+    static bool stringToNumber(const std::string& s, LuaValue& out);
+    static bool toNumber(const LuaValue& v, LuaValue& out);
+    static const char* typeName(const LuaValue& v);
+
+    [[noreturn]] void runtimeError(const std::string& msg, int level = 1);
+
+    void ensureStack(int size);
+
+    std::ostream& out;
+    std::vector<LuaValue> stack;
+    int top = 0;                   // First free slot: callbacks place functions here
+    LuaTable* globals;
+    LuaTable* stringMeta;          // Metatable shared by all strings
+    std::vector<LuaValue> pinned;  // Temporaries of native functions, treated as roots
+    int depth = 0;                 // Active calls
+    int nativeDepth = 0;           // Nested execute() invocations
+    // Iterators returned by the stock pairs and ipairs, which generic for
+    // loops over them run inline (set by openStdlib)
+    LuaFunction* stockNext = nullptr;
+    LuaFunction* stockIpairsAux = nullptr;
+
+private:
+    // A Lua function activation; Lua-to-Lua calls push one instead of recursing
+    struct LuaFrame {
+        LuaClosure* closure;
+        const NativeInstruction* pc; // Saved while a callee runs
+        int funcSlot;
+        int base;
+        int numVarargs;
+    };
+
+    int execute(LuaClosure* closure, int funcSlot, int nargs);
+    void enterFrame(LuaClosure* closure, int funcSlot, int nargs);
+    LuaValue arith(int op, const LuaValue& x, const LuaValue& y);
+    LuaValue concat(const LuaValue& x, const LuaValue& y);
+    LuaValue concat(int from, int to); // stack[from] .. ... .. stack[to]
+    LuaValue bufferContents(const LuaTable* buffer);
+    LuaValue length(const LuaValue& v);
+    LuaUpvalue* findUpvalue(int index);
+    void closeUpvalues(int level);
+    NativeProto* loadProto(const Prototype* proto);
+    void track(GCObject* object);
+    void checkGC() { if (gcCount >= gcThreshold) collectGarbage(); }
+    void collectGarbage();
+    void mark(const LuaValue& v);
+    void markObject(GCObject* object);
+
+    friend struct FrameGuard;
+
+    std::string chunkName;
+    LuaString* events[NUM_EVENTS];
+    std::vector<std::unique_ptr<NativeProto>> protos;
+    std::unordered_map<std::string_view, LuaString*> strings;
+    std::vector<LuaFrame> frames;
+    std::vector<LuaUpvalue*> openUpvalues; // Sorted by stack index
+    std::vector<GCObject*> grayList;
+    GCObject* objects = nullptr;
+    size_t gcCount = 0;
+    size_t gcThreshold = 100000;
+};
+
+// Installs print, type, pairs, ..., and the math, string, table and os tables
+void openStdlib(Interpreter& vm);
+
+#endif
@@ -0,0 +1,191 @@
+#include "Object.h"
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+
+bool rawEquals(const LuaValue& x, const LuaValue& y) {
+    if (x.type == y.type) {
+        switch (x.type) {
+        case LuaType::Nil: return true;
+        case LuaType::Boolean: return x.b == y.b;
+        case LuaType::Integer: return x.i == y.i;
+        case LuaType::Float: return x.n == y.n;
+        default: return x.gc == y.gc;
+        }
+    }
+    if (x.type == LuaType::Integer && y.type == LuaType::Float) return (double)x.i == y.n;
+    if (x.type == LuaType::Float && y.type == LuaType::Integer) return x.n == (double)y.i;
+    return false;
+}
+
+size_t LuaKeyHash::operator()(const LuaValue& v) const {
+    switch (v.type) {
+    case LuaType::Boolean: return v.b ? 1 : 2;
+    case LuaType::Integer: return std::hash<int64_t>()(v.i);
+    case LuaType::Float: return std::hash<double>()(v.n);
+    case LuaType::String: return v.s->hash;
+    default: return std::hash<const void*>()(v.gc);
+    }
+}
+
+bool LuaKeyEqual::operator()(const LuaValue& x, const LuaValue& y) const {
+    if (x.type != y.type) return false;
+    switch (x.type) {
+    case LuaType::Nil: return true;
+    case LuaType::Boolean: return x.b == y.b;
+    case LuaType::Integer: return x.i == y.i;
+    case LuaType::Float: return x.n == y.n;
+    default: return x.gc == y.gc;
+    }
+}
+
+// Integral floats index the same slot as the equal integer
+static bool normalizeKey(const LuaValue& key, LuaValue& out) {
+    if (key.type == LuaType::Float) {
+        double d = key.n;
+        if (std::isnan(d)) return false;
+        if (std::floor(d) == d && d >= -9223372036854775808.0 && d < 9223372036854775808.0) {
+            out = LuaValue::integer((int64_t)d);
+            return true;
+        }
+    }
+    out = key;
+    return key.type != LuaType::Nil;
+}
+
+LuaValue LuaTable::getInt(int64_t key) const {
+    if (key >= 1 && (uint64_t)key <= array.size()) return array[key - 1];
+    if (hash.empty()) return LuaValue();
+    auto it = hash.find(LuaValue::integer(key));
+    return it == hash.end() ? LuaValue() : it->second;
+}
+
+LuaValue LuaTable::getStr(LuaString* key) const {
+    if (hash.empty()) return LuaValue();
+    auto it = hash.find(LuaValue::string(key));
+    return it == hash.end() ? LuaValue() : it->second;
+}
+
+LuaValue LuaTable::get(const LuaValue& key) const {
+    switch (key.type) {
+    case LuaType::Integer: return getInt(key.i);
+    case LuaType::String: return getStr(key.s);
+    case LuaType::Nil: return LuaValue();
+    default: {
+        LuaValue k;
+        if (!normalizeKey(key, k)) return LuaValue();
+        if (k.type == LuaType::Integer) return getInt(k.i);
+        auto it = hash.find(k);
+        return it == hash.end() ? LuaValue() : it->second;
+    }
+    }
+}
+
+void LuaTable::migrateFromHash() {
+    // Keys n+1, n+2, ... that were stored in the hash move to the array part
+    while (!hash.empty()) {
+        auto it = hash.find(LuaValue::integer((int64_t)array.size() + 1));
+        if (it == hash.end()) break;
+        if (it->second.isNil()) {
+            hash.erase(it);
+            tombstones--;
+            break;
+        }
+        array.push_back(it->second);
+        hash.erase(it);
+    }
+}
+
+void LuaTable::setHash(const LuaValue& key, const LuaValue& value) {
+    auto it = hash.find(key);
+    if (it != hash.end()) {
+        if (it->second.isNil() && !value.isNil()) tombstones--;
+        else if (!it->second.isNil() && value.isNil()) tombstones++;
+        it->second = value;
+        return;
+    }
+    if (value.isNil()) return;
+    // New keys invalidate traversals anyway, so tombstones can go now
+    if (tombstones > 8 && tombstones * 2 > hash.size()) {
+        for (auto h = hash.begin(); h != hash.end();) {
+            if (h->second.isNil()) h = hash.erase(h);
+            else ++h;
+        }
+        tombstones = 0;
+    }
+    hash.emplace(key, value);
+}
+
+void LuaTable::setInt(int64_t key, const LuaValue& value) {
+    if (key >= 1 && (uint64_t)key <= array.size()) {
+        array[key - 1] = value;
+        if (value.isNil() && (uint64_t)key == array.size()) {
+            while (!array.empty() && array.back().isNil()) array.pop_back();
+        }
+        return;
+    }
+    if ((uint64_t)key == array.size() + 1 && key >= 1) {
+        if (value.isNil()) return; // Key n+1 is never stored in the hash
+        array.push_back(value);
+        if (!hash.empty()) migrateFromHash();
+        return;
+    }
+    setHash(LuaValue::integer(key), value);
+}
+
+void LuaTable::set(const LuaValue& key, const LuaValue& value) {
+    LuaValue k;
+    if (!normalizeKey(key, k)) {
+        if (key.type == LuaType::Float && std::isnan(key.n)) throw std::invalid_argument("table index is NaN");
+        if (key.type == LuaType::Nil) throw std::invalid_argument("table index is nil");
+        return;
+    }
+    if (k.type == LuaType::Integer) {
+        setInt(k.i, value);
+        return;
+    }
+    setHash(k, value);
+}
+
+int64_t LuaTable::length() const {
+    // The array part never ends in nil and key n+1 never lives in the hash,
+    // so its size is a border
+    return (int64_t)array.size();
+}
+
+bool LuaTable::next(const LuaValue& key, LuaValue& nextKey, LuaValue& nextValue) const {
+    size_t start = 0;
+    auto hashIt = hash.begin();
+    if (!key.isNil()) {
+        LuaValue k;
+        normalizeKey(key, k);
+        hashIt = hash.end();
+        if (k.type != LuaType::Integer || k.i < 1 || (uint64_t)k.i > array.size()) hashIt = hash.find(k);
+        if (hashIt != hash.end()) {
+            ++hashIt;
+            start = array.size();
+        } else if (k.type == LuaType::Integer && k.i >= 1) {
+            // An array key; the array may have shrunk since it was returned
+            start = (size_t)k.i;
+            hashIt = hash.begin();
+        } else {
+            throw std::invalid_argument("invalid key to 'next'");
+        }
+    }
+    for (size_t i = start; i < array.size(); ++i) {
+        if (!array[i].isNil()) {
+            nextKey = LuaValue::integer((int64_t)i + 1);
+            nextValue = array[i];
+            return true;
+        }
+    }
+    for (; hashIt != hash.end(); ++hashIt) {
+        if (!hashIt->second.isNil()) {
+            nextKey = hashIt->first;
+            nextValue = hashIt->second;
+            return true;
+        }
+    }
+    return false;
+}
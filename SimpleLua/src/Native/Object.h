@@ -0,0 +1,147 @@
+#ifndef NATIVE_OBJECT_H
+#define NATIVE_OBJECT_H
+
+#include "../Compiler.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Runtime values of the native interpreter. LuaValue is a 16-byte tagged
+// union; strings, tables, functions and upvalue boxes are heap objects owned
+// by the Interpreter's mark-and-sweep collector.
+
+enum class LuaType : uint8_t { Nil, Boolean, Integer, Float, String, Table, Function };
+
+struct GCObject {
+    GCObject* gcNext = nullptr;
+    bool marked = false;
+    virtual ~GCObject() = default;
+};
+
+struct LuaString;
+struct LuaTable;
+struct LuaFunction;
+
+struct LuaValue {
+    LuaType type;
+    union {
+        bool b;
+        int64_t i;
+        double n;
+        LuaString* s;
+        LuaTable* t;
+        LuaFunction* f;
+        GCObject* gc;
+    };
+
+    LuaValue() : type(LuaType::Nil), i(0) {}
+    static LuaValue boolean(bool v) { LuaValue r; r.type = LuaType::Boolean; r.b = v; return r; }
+    static LuaValue integer(int64_t v) { LuaValue r; r.type = LuaType::Integer; r.i = v; return r; }
+    static LuaValue number(double v) { LuaValue r; r.type = LuaType::Float; r.n = v; return r; }
+    static LuaValue string(LuaString* v) { LuaValue r; r.type = LuaType::String; r.s = v; return r; }
+    static LuaValue table(LuaTable* v) { LuaValue r; r.type = LuaType::Table; r.t = v; return r; }
+    static LuaValue function(LuaFunction* v) { LuaValue r; r.type = LuaType::Function; r.f = v; return r; }
+
+    bool isNil() const { return type == LuaType::Nil; }
+    bool isNumber() const { return type == LuaType::Integer || type == LuaType::Float; }
+    bool isFalsy() const { return type == LuaType::Nil || (type == LuaType::Boolean && !b); }
+    bool isCollectable() const { return type >= LuaType::String; }
+    double toFloat() const { return type == LuaType::Integer ? (double)i : n; }
+};
+
+// Interned, immutable: equal strings are the same object
+struct LuaString : GCObject {
+    std::string data;
+    size_t hash;
+};
+
+// Raw equality (no __eq); integers and floats compare by value
+bool rawEquals(const LuaValue& x, const LuaValue& y);
+
+// Table keys are normalized (integral floats become integers), so hashing
+// and equality can compare tag and payload directly
+struct LuaKeyHash {
+    size_t operator()(const LuaValue& v) const;
+};
+
+struct LuaKeyEqual {
+    bool operator()(const LuaValue& x, const LuaValue& y) const;
+};
+
+// Array part for keys 1..n plus a hash part. Removed hash entries stay as nil
+// tombstones until the next insertion so that next() survives assignments of
+// nil during traversal.
+struct LuaTable : GCObject {
+    std::vector<LuaValue> array;
+    std::unordered_map<LuaValue, LuaValue, LuaKeyHash, LuaKeyEqual> hash;
+    size_t tombstones = 0;
+    LuaTable* metatable = nullptr;
+
+    LuaValue get(const LuaValue& key) const;
+    LuaValue getInt(int64_t key) const;
+    LuaValue getStr(LuaString* key) const;
+    // Throws std::invalid_argument for nil and NaN keys
+    void set(const LuaValue& key, const LuaValue& value);
+    void setInt(int64_t key, const LuaValue& value);
+    int64_t length() const;
+    // Advances the traversal; returns false when `key` was the last one.
+    // Throws std::invalid_argument if `key` is not in the table.
+    bool next(const LuaValue& key, LuaValue& nextKey, LuaValue& nextValue) const;
+
+private:
+    void setHash(const LuaValue& key, const LuaValue& value);
+    void migrateFromHash();
+};
+
+class Interpreter;
+struct NativeProto;
+
+struct LuaUpvalue : GCObject {
+    int index;         // Stack slot while open
+    bool open = true;
+    LuaValue closed;   // Value once the owning frame has returned
+};
+
+struct LuaFunction : GCObject {
+    bool isNative;
+    explicit LuaFunction(bool native) : isNative(native) {}
+};
+
+struct LuaClosure : LuaFunction {
+    NativeProto* proto;
+    std::vector<LuaUpvalue*> upvalues;
+    LuaClosure() : LuaFunction(false), proto(nullptr) {}
+};
+
+// Arguments live on the interpreter stack at [base, base + nargs); results are
+// pushed above them and counted by the return value
+struct CallInfo;
+using LuaCFunction = int (*)(CallInfo& ci);
+
+struct LuaNativeFunction : LuaFunction {
+    LuaCFunction fn;
+    std::string name; // As reported in argument errors, e.g. "string.rep"
+    std::vector<LuaValue> upvalues; // State for iterators such as gmatch
+    LuaNativeFunction() : LuaFunction(true), fn(nullptr) {}
+};
+
+// Decoded instruction; operands keep the Instruction layout
+struct NativeInstruction {
+    uint8_t op;
+    uint8_t a;
+    int32_t b;
+    int32_t c;
+};
+
+struct NativeProto {
+    std::vector<NativeInstruction> code;
+    std::vector<LuaValue> constants;
+    std::vector<NativeProto*> protos;
+    std::vector<UpvalueInfo> upvalues;
+    int numParams = 0;
+    int frameSize = 0;
+    const Prototype* source = nullptr;
+};
+
+#endif
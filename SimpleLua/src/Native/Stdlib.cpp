@@ -0,0 +1,1234 @@
+#include "Interpreter.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+// Subset of the Lua 5.3 standard library used by SimpleLua programs: the base
+// functions plus math, string (with Lua patterns), table, os and io.write.
+
+static LuaValue nil() { return LuaValue(); }
+
+// Pins values on Interpreter::pinned for the lifetime of the guard
+struct PinGuard {
+    Interpreter& vm;
+    size_t size;
+    explicit PinGuard(Interpreter& vm) : vm(vm), size(vm.pinned.size()) {}
+    ~PinGuard() { vm.pinned.resize(size); }
+};
+
+// --- Base library ---
+
+static int basePrint(CallInfo& ci) {
+    std::string line;
+    for (int i = 0; i < ci.nargs; ++i) {
+        if (i > 0) line += '\t';
+        line += ci.vm.toString(ci.arg(i));
+    }
+    line += '\n';
+    ci.vm.out << line;
+    return 0;
+}
+
+static int baseType(CallInfo& ci) {
+    ci.checkAny(0);
+    ci.push(ci.vm.string(Interpreter::typeName(ci.arg(0))));
+    return 1;
+}
+
+static int baseToString(CallInfo& ci) {
+    ci.checkAny(0);
+    ci.push(ci.vm.string(ci.vm.toString(ci.arg(0))));
+    return 1;
+}
+
+static int baseToNumber(CallInfo& ci) {
+    if (ci.arg(1).isNil()) {
+        LuaValue v;
+        if (ci.arg(0).isNumber()) v = ci.arg(0);
+        else if (ci.arg(0).type == LuaType::String) Interpreter::stringToNumber(ci.arg(0).s->data, v);
+        else ci.checkAny(0);
+        ci.push(v);
+        return 1;
+    }
+    int64_t base = ci.checkInteger(1);
+    if (base < 2 || base > 36) ci.argError(1, "base out of range");
+    std::string s = ci.checkString(0)->data;
+    size_t begin = s.find_first_not_of(" \t\n\r\f\v");
+    size_t end = s.find_last_not_of(" \t\n\r\f\v");
+    bool negative = false;
+    if (begin != std::string::npos && s[begin] == '-') {
+        negative = true;
+        begin++;
+    }
+    if (begin == std::string::npos || begin > end) {
+        ci.push(nil());
+        return 1;
+    }
+    uint64_t value = 0;
+    for (size_t i = begin; i <= end; ++i) {
+        int c = std::tolower((unsigned char)s[i]);
+        int digit = std::isdigit(c) ? c - '0' : (std::isalpha(c) ? c - 'a' + 10 : 99);
+        if (digit >= base) {
+            ci.push(nil());
+            return 1;
+        }
+        value = value * (uint64_t)base + (uint64_t)digit;
+    }
+    ci.push(LuaValue::integer(negative ? (int64_t)(0 - value) : (int64_t)value));
+    return 1;
+}
+
+static int baseNext(CallInfo& ci) {
+    LuaTable* t = ci.checkTable(0);
+    LuaValue key, value;
+    bool more;
+    try {
+        more = t->next(ci.arg(1), key, value);
+    } catch (const std::invalid_argument& e) {
+        ci.vm.runtimeError(e.what());
+    }
+    if (!more) {
+        ci.push(nil());
+        return 1;
+    }
+    ci.push(key);
+    ci.push(value);
+    return 2;
+}
+
+static int basePairs(CallInfo& ci) {
+    ci.checkAny(0);
+    LuaValue handler = ci.vm.metamethod(ci.arg(0), EVENT_PAIRS);
+    if (!handler.isNil()) {
+        int slot = ci.top();
+        ci.vm.ensureStack(slot + 2);
+        ci.vm.stack[slot] = handler;
+        ci.vm.stack[slot + 1] = ci.arg(0);
+        int n = ci.vm.call(slot, 1);
+        LuaValue results[3];
+        for (int i = 0; i < 3; ++i) results[i] = i < n ? ci.vm.stack[slot + i] : nil();
+        for (const LuaValue& v : results) ci.push(v);
+        return 3;
+    }
+    ci.checkTable(0);
+    ci.push(ci.vm.globals->getStr(ci.vm.intern("next")));
+    ci.push(ci.arg(0));
+    ci.push(nil());
+    return 3;
+}
+
+static int ipairsAux(CallInfo& ci) {
+    int64_t i = ci.checkInteger(1) + 1;
+    const LuaValue& t = ci.arg(0);
+    LuaValue v = (t.type == LuaType::Table && !t.t->metatable) ? t.t->getInt(i)
+                                                               : ci.vm.index(t, LuaValue::integer(i));
+    if (v.isNil()) {
+        ci.push(nil());
+        return 1;
+    }
+    ci.push(LuaValue::integer(i));
+    ci.push(v);
+    return 2;
+}
+
+static int baseIpairs(CallInfo& ci) {
+    ci.checkAny(0);
+    ci.push(ci.self->upvalues[0]);
+    ci.push(ci.arg(0));
+    ci.push(LuaValue::integer(0));
+    return 3;
+}
+
+static int baseSelect(CallInfo& ci) {
+    const LuaValue& n = ci.arg(0);
+    if (n.type == LuaType::String && n.s->data == "#") {
+        ci.push(LuaValue::integer(ci.nargs - 1));
+        return 1;
+    }
+    int64_t i = ci.checkInteger(0);
+    if (i < 0) i = ci.nargs + i;
+    else if (i == 0) ci.argError(0, "index out of range");
+    if (i < 1) ci.argError(0, "index out of range");
+    int count = 0;
+    for (int64_t k = i; k < ci.nargs; ++k, ++count) {
+        LuaValue v = ci.arg((int)k);
+        ci.push(v);
+    }
+    return count;
+}
+
+static int baseError(CallInfo& ci) {
+    int level = (int)ci.optInteger(1, 1);
+    LuaValue v = ci.arg(0);
+    std::string text = v.type == LuaType::String ? v.s->data : "error object";
+    throw LuaError(v, text, v.type == LuaType::String ? level : 0, ci.vm.depth);
+}
+
+static int baseAssert(CallInfo& ci) {
+    ci.checkAny(0);
+    if (!ci.arg(0).isFalsy()) {
+        for (int i = 0; i < ci.nargs; ++i) {
+            LuaValue v = ci.arg(i);
+            ci.push(v);
+        }
+        return ci.nargs;
+    }
+    if (ci.nargs < 2) ci.vm.runtimeError("assertion failed!");
+    LuaValue v = ci.arg(1);
+    throw LuaError(v, v.type == LuaType::String ? v.s->data : "error object", 0, ci.vm.depth);
+}
+
+static int basePcall(CallInfo& ci) {
+    ci.checkAny(0);
+    Interpreter& vm = ci.vm;
+    std::vector<LuaValue> results;
+    try {
+        int n = vm.call(ci.base, ci.nargs - 1);
+        results.push_back(LuaValue::boolean(true));
+        for (int i = 0; i < n; ++i) results.push_back(vm.stack[ci.base + i]);
+    } catch (const LuaError& e) {
+        results.push_back(LuaValue::boolean(false));
+        results.push_back(e.value);
+    }
+    ci.nargs = 0; // The arguments were consumed by the call
+    for (const LuaValue& v : results) ci.push(v);
+    return (int)results.size();
+}
+
+static int baseRawGet(CallInfo& ci) {
+    LuaTable* t = ci.checkTable(0);
+    ci.push(t->get(ci.arg(1)));
+    return 1;
+}
+
+static int baseRawSet(CallInfo& ci) {
+    LuaTable* t = ci.checkTable(0);
+    try {
+        t->set(ci.arg(1), ci.arg(2));
+    } catch (const std::invalid_argument& e) {
+        ci.vm.runtimeError(e.what());
+    }
+    LuaValue v = ci.arg(0);
+    ci.push(v);
+    return 1;
+}
+
+static int baseRawEqual(CallInfo& ci) {
+    ci.checkAny(0);
+    ci.checkAny(1);
+    ci.push(LuaValue::boolean(rawEquals(ci.arg(0), ci.arg(1))));
+    return 1;
+}
+
+static int baseRawLen(CallInfo& ci) {
+    const LuaValue& v = ci.arg(0);
+    if (v.type == LuaType::Table) ci.push(LuaValue::integer(v.t->length()));
+    else if (v.type == LuaType::String) ci.push(LuaValue::integer((int64_t)v.s->data.size()));
+    else ci.argError(0, "table or string expected");
+    return 1;
+}
+
+static int baseSetMetatable(CallInfo& ci) {
+    LuaTable* t = ci.checkTable(0);
+    const LuaValue& mt = ci.arg(1);
+    if (!mt.isNil() && mt.type != LuaType::Table) ci.argError(1, "nil or table expected");
+    if (t->metatable && !t->metatable->getStr(ci.vm.intern("__metatable")).isNil()) {
+        ci.vm.runtimeError("cannot change a protected metatable");
+    }
+    t->metatable = mt.isNil() ? nullptr : mt.t;
+    LuaValue v = ci.arg(0);
+    ci.push(v);
+    return 1;
+}
+
+static int baseGetMetatable(CallInfo& ci) {
+    ci.checkAny(0);
+    const LuaValue& v = ci.arg(0);
+    LuaTable* mt = v.type == LuaType::Table ? v.t->metatable : v.type == LuaType::String ? ci.vm.stringMeta : nullptr;
+    if (!mt) {
+        ci.push(nil());
+        return 1;
+    }
+    LuaValue protectedValue = mt->getStr(ci.vm.intern("__metatable"));
+    ci.push(protectedValue.isNil() ? LuaValue::table(mt) : protectedValue);
+    return 1;
+}
+
+static int tableUnpack(CallInfo& ci) {
+    LuaTable* t = ci.checkTable(0);
+    int64_t i = ci.optInteger(1, 1);
+    int64_t j = ci.arg(2).isNil() ? t->length() : ci.checkInteger(2);
+    if (i > j) return 0;
+    if (j - i >= 1000000) ci.vm.runtimeError("too many results to unpack");
+    for (int64_t k = i; k <= j; ++k) ci.push(t->getInt(k));
+    return (int)(j - i + 1);
+}
+
+// --- math ---
+
+static void pushFloorResult(CallInfo& ci, double d) {
+    if (d >= -9223372036854775808.0 && d < 9223372036854775808.0) ci.push(LuaValue::integer((int64_t)d));
+    else ci.push(LuaValue::number(d));
+}
+
+static LuaValue checkNumberValue(CallInfo& ci, int i) {
+    LuaValue v;
+    if (!Interpreter::toNumber(ci.arg(i), v)) ci.checkNumber(i); // Raises the argument error
+    return v;
+}
+
+static int mathFloor(CallInfo& ci) {
+    LuaValue v = checkNumberValue(ci, 0);
+    if (v.type == LuaType::Integer) ci.push(v);
+    else pushFloorResult(ci, std::floor(v.n));
+    return 1;
+}
+
+static int mathCeil(CallInfo& ci) {
+    LuaValue v = checkNumberValue(ci, 0);
+    if (v.type == LuaType::Integer) ci.push(v);
+    else pushFloorResult(ci, std::ceil(v.n));
+    return 1;
+}
+
+static int mathAbs(CallInfo& ci) {
+    LuaValue v = checkNumberValue(ci, 0);
+    if (v.type == LuaType::Integer) ci.push(LuaValue::integer(v.i < 0 ? (int64_t)(0 - (uint64_t)v.i) : v.i));
+    else ci.push(LuaValue::number(std::fabs(v.n)));
+    return 1;
+}
+
+static int mathMinMax(CallInfo& ci, bool max) {
+    LuaValue best = checkNumberValue(ci, 0);
+    for (int i = 1; i < ci.nargs; ++i) {
+        LuaValue v = checkNumberValue(ci, i);
+        if (max ? ci.vm.lessThan(best, v) : ci.vm.lessThan(v, best)) best = v;
+    }
+    ci.push(best);
+    return 1;
+}
+
+static int mathMax(CallInfo& ci) { return mathMinMax(ci, true); }
+static int mathMin(CallInfo& ci) { return mathMinMax(ci, false); }
+
+#define MATH_UNARY(name, expr) \
+    static int name(CallInfo& ci) { \
+        double x = ci.checkNumber(0); \
+        ci.push(LuaValue::number(expr)); \
+        return 1; \
+    }
+
+MATH_UNARY(mathSqrt, std::sqrt(x))
+MATH_UNARY(mathSin, std::sin(x))
+MATH_UNARY(mathCos, std::cos(x))
+MATH_UNARY(mathTan, std::tan(x))
+MATH_UNARY(mathAsin, std::asin(x))
+MATH_UNARY(mathAcos, std::acos(x))
+MATH_UNARY(mathExp, std::exp(x))
+
+#undef MATH_UNARY
+
+static int mathAtan(CallInfo& ci) {
+    double y = ci.checkNumber(0);
+    double x = ci.arg(1).isNil() ? 1.0 : ci.checkNumber(1);
+    ci.push(LuaValue::number(std::atan2(y, x)));
+    return 1;
+}
+
+static int mathLog(CallInfo& ci) {
+    double x = ci.checkNumber(0);
+    if (ci.arg(1).isNil()) {
+        ci.push(LuaValue::number(std::log(x)));
+    } else {
+        double b = ci.checkNumber(1);
+        ci.push(LuaValue::number(b == 2.0 ? std::log2(x) : b == 10.0 ? std::log10(x) : std::log(x) / std::log(b)));
+    }
+    return 1;
+}
+
+static int mathFmod(CallInfo& ci) {
+    LuaValue a = checkNumberValue(ci, 0);
+    LuaValue b = checkNumberValue(ci, 1);
+    if (a.type == LuaType::Integer && b.type == LuaType::Integer) {
+        if (b.i == 0) ci.argError(1, "zero");
+        ci.push(LuaValue::integer(b.i == -1 ? 0 : a.i % b.i));
+    } else {
+        ci.push(LuaValue::number(std::fmod(a.toFloat(), b.toFloat())));
+    }
+    return 1;
+}
+
+static int mathModf(CallInfo& ci) {
+    double x = ci.checkNumber(0);
+    double ip = x >= 0 ? std::floor(x) : std::ceil(x);
+    ci.push(LuaValue::number(ip));
+    ci.push(LuaValue::number(std::isinf(x) ? 0.0 : x - ip));
+    return 2;
+}
+
+static int mathToInteger(CallInfo& ci) {
+    LuaValue v;
+    const LuaValue& x = ci.arg(0);
+    if (x.type == LuaType::Integer) v = x;
+    else if (x.type == LuaType::Float && std::floor(x.n) == x.n && x.n >= -9223372036854775808.0 &&
+             x.n < 9223372036854775808.0) v = LuaValue::integer((int64_t)x.n);
+    ci.push(v);
+    return 1;
+}
+
+static int mathType(CallInfo& ci) {
+    ci.checkAny(0);
+    const LuaValue& x = ci.arg(0);
+    if (x.type == LuaType::Integer) ci.push(ci.vm.string("integer"));
+    else if (x.type == LuaType::Float) ci.push(ci.vm.string("float"));
+    else ci.push(nil());
+    return 1;
+}
+
+static uint64_t randomState = 0x2545F4914F6CDD1DULL;
+
+static uint64_t nextRandom() {
+    // xorshift64*
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    return randomState * 0x2545F4914F6CDD1DULL;
+}
+
+static int mathRandom(CallInfo& ci) {
+    double r = (double)(nextRandom() >> 11) * (1.0 / 9007199254740992.0);
+    if (ci.nargs == 0) {
+        ci.push(LuaValue::number(r));
+        return 1;
+    }
+    int64_t low = 1, up;
+    if (ci.nargs == 1) {
+        up = ci.checkInteger(0);
+    } else {
+        low = ci.checkInteger(0);
+        up = ci.checkInteger(1);
+    }
+    if (low > up) ci.argError(ci.nargs == 1 ? 0 : 1, "interval is empty");
+    uint64_t span = (uint64_t)up - (uint64_t)low;
+    uint64_t offset = span == UINT64_MAX ? nextRandom() : nextRandom() % (span + 1);
+    ci.push(LuaValue::integer((int64_t)((uint64_t)low + offset)));
+    return 1;
+}
+
+static int mathRandomSeed(CallInfo& ci) {
+    LuaValue v = checkNumberValue(ci, 0);
+    uint64_t seed = v.type == LuaType::Integer ? (uint64_t)v.i : (uint64_t)(int64_t)v.n;
+    randomState = seed ^ 0x9E3779B97F4A7C15ULL;
+    if (randomState == 0) randomState = 1;
+    for (int i = 0; i < 16; ++i) nextRandom();
+    return 0;
+}
+
+// --- string ---
+
+// Lua's relative string positions: negative values count from the end
+static int64_t startPosition(int64_t pos, size_t len) {
+    if (pos > 0) return pos;
+    if (pos == 0) return 1;
+    if (pos < -(int64_t)len) return 1;
+    return (int64_t)len + pos + 1;
+}
+
+static int64_t endPosition(int64_t pos, size_t len) {
+    if (pos > (int64_t)len) return (int64_t)len;
+    if (pos >= 0) return pos;
+    if (pos < -(int64_t)len) return 0;
+    return (int64_t)len + pos + 1;
+}
+
+static int strLen(CallInfo& ci) {
+    ci.push(LuaValue::integer((int64_t)ci.checkString(0)->data.size()));
+    return 1;
+}
+
+static int strSub(CallInfo& ci) {
+    const std::string& s = ci.checkString(0)->data;
+    int64_t i = startPosition(ci.optInteger(1, 1), s.size());
+    int64_t j = endPosition(ci.optInteger(2, -1), s.size());
+    if (i > j) ci.push(ci.vm.string(""));
+    else ci.push(ci.vm.string(std::string_view(s).substr((size_t)i - 1, (size_t)(j - i + 1))));
+    return 1;
+}
+
+static int strUpper(CallInfo& ci) {
+    std::string s = ci.checkString(0)->data;
+    for (char& c : s) c = (char)std::toupper((unsigned char)c);
+    ci.push(ci.vm.string(s));
+    return 1;
+}
+
+static int strLower(CallInfo& ci) {
+    std::string s = ci.checkString(0)->data;
+    for (char& c : s) c = (char)std::tolower((unsigned char)c);
+    ci.push(ci.vm.string(s));
+    return 1;
+}
+
+static int strRep(CallInfo& ci) {
+    const std::string& s = ci.checkString(0)->data;
+    int64_t n = ci.checkInteger(1);
+    std::string sep = ci.arg(2).isNil() ? "" : ci.checkString(2)->data;
+    std::string result;
+    if (n > 0) {
+        if ((s.size() + sep.size()) * (uint64_t)n >= (1u << 30)) ci.vm.runtimeError("resulting string too large");
+        result.reserve((s.size() + sep.size()) * (size_t)n);
+        for (int64_t i = 0; i < n; ++i) {
+            if (i > 0) result += sep;
+            result += s;
+        }
+    }
+    ci.push(ci.vm.string(result));
+    return 1;
+}
+
+static int strReverse(CallInfo& ci) {
+    std::string s = ci.checkString(0)->data;
+    std::reverse(s.begin(), s.end());
+    ci.push(ci.vm.string(s));
+    return 1;
+}
+
+static int strByte(CallInfo& ci) {
+    const std::string& s = ci.checkString(0)->data;
+    int64_t i = startPosition(ci.optInteger(1, 1), s.size());
+    int64_t j = endPosition(ci.arg(2).isNil() ? i : ci.checkInteger(2), s.size());
+    int count = 0;
+    for (int64_t k = i; k <= j; ++k, ++count) ci.push(LuaValue::integer((unsigned char)s[(size_t)k - 1]));
+    return count;
+}
+
+static int strChar(CallInfo& ci) {
+    std::string s;
+    for (int i = 0; i < ci.nargs; ++i) {
+        int64_t c = ci.checkInteger(i);
+        if (c < 0 || c > 255) ci.argError(i, "value out of range");
+        s += (char)c;
+    }
+    ci.push(ci.vm.string(s));
+    return 1;
+}
+
+static int strFormat(CallInfo& ci) {
+    const std::string& fmt = ci.checkString(0)->data;
+    std::string result;
+    int arg = 1;
+    char buf[512];
+    for (size_t i = 0; i < fmt.size(); ++i) {
+        if (fmt[i] != '%') {
+            result += fmt[i];
+            continue;
+        }
+        if (++i >= fmt.size()) ci.vm.runtimeError("invalid conversion '%' to 'format'");
+        if (fmt[i] == '%') {
+            result += '%';
+            continue;
+        }
+        size_t specStart = i;
+        while (i < fmt.size() && std::strchr("-+ #0", fmt[i])) ++i;
+        while (i < fmt.size() && std::isdigit((unsigned char)fmt[i])) ++i;
+        if (i < fmt.size() && fmt[i] == '.') {
+            ++i;
+            while (i < fmt.size() && std::isdigit((unsigned char)fmt[i])) ++i;
+        }
+        if (i >= fmt.size() || i - specStart > 20) ci.vm.runtimeError("invalid conversion to 'format'");
+        std::string spec = "%" + fmt.substr(specStart, i - specStart);
+        char conv = fmt[i];
+        if (arg >= ci.nargs) ci.argError(arg, "no value");
+        switch (conv) {
+        case 'd': case 'i': {
+            spec += "lld";
+            std::snprintf(buf, sizeof(buf), spec.c_str(), (long long)ci.checkInteger(arg));
+            result += buf;
+            break;
+        }
+        case 'u': case 'c': case 'x': case 'X': case 'o': {
+            int64_t v = ci.checkInteger(arg);
+            if (conv == 'c') {
+                spec += 'c';
+                std::snprintf(buf, sizeof(buf), spec.c_str(), (int)v);
+            } else {
+                spec += "ll";
+                spec += conv;
+                std::snprintf(buf, sizeof(buf), spec.c_str(), (unsigned long long)v);
+            }
+            result += buf;
+            break;
+        }
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            spec += conv;
+            std::snprintf(buf, sizeof(buf), spec.c_str(), ci.checkNumber(arg));
+            result += buf;
+            break;
+        case 's': {
+            std::string s = ci.vm.toString(ci.arg(arg));
+            if (spec == "%") {
+                result += s;
+            } else {
+                spec += 's';
+                std::snprintf(buf, sizeof(buf), spec.c_str(), s.c_str());
+                result += buf;
+            }
+            break;
+        }
+        case 'q': {
+            const std::string& s = ci.checkString(arg)->data;
+            result += '"';
+            for (char c : s) {
+                if (c == '"' || c == '\\' || c == '\n') {
+                    result += '\\';
+                    result += c;
+                } else if (c == '\r') {
+                    result += "\\r";
+                } else if (c == '\0') {
+                    result += "\\0";
+                } else {
+                    result += c;
+                }
+            }
+            result += '"';
+            break;
+        }
+        default:
+            ci.vm.runtimeError(std::string("invalid option '%") + conv + "' to 'format'");
+        }
+        arg++;
+    }
+    ci.push(ci.vm.string(result));
+    return 1;
+}
+
+// Lua patterns, following lstrlib.c
+
+static const int kMaxCaptures = 32;
+static const int CAP_UNFINISHED = -1;
+static const int CAP_POSITION = -2;
+static const char L_ESC = '%';
+
+struct MatchState {
+    const char* srcInit;
+    const char* srcEnd;
+    const char* patEnd;
+    Interpreter* vm;
+    int level;
+    int depth;
+    struct {
+        const char* init;
+        ptrdiff_t len;
+    } capture[kMaxCaptures];
+};
+
+static const char* doMatch(MatchState* ms, const char* s, const char* p);
+
+static int checkCapture(MatchState* ms, int l) {
+    l -= '1';
+    if (l < 0 || l >= ms->level || ms->capture[l].len == CAP_UNFINISHED) {
+        ms->vm->runtimeError("invalid capture index %" + std::to_string(l + 1));
+    }
+    return l;
+}
+
+static int captureToClose(MatchState* ms) {
+    int level = ms->level;
+    for (level--; level >= 0; level--) {
+        if (ms->capture[level].len == CAP_UNFINISHED) return level;
+    }
+    ms->vm->runtimeError("invalid pattern capture");
+}
+
+static const char* classEnd(MatchState* ms, const char* p) {
+    switch (*p++) {
+    case L_ESC:
+        if (p == ms->patEnd) ms->vm->runtimeError("malformed pattern (ends with '%')");
+        return p + 1;
+    case '[':
+        if (*p == '^') p++;
+        do {
+            if (p == ms->patEnd) ms->vm->runtimeError("malformed pattern (missing ']')");
+            if (*(p++) == L_ESC && p < ms->patEnd) p++;
+        } while (*p != ']');
+        return p + 1;
+    default:
+        return p;
+    }
+}
+
+static bool matchClass(int c, int cl) {
+    bool res;
+    switch (std::tolower(cl)) {
+    case 'a': res = std::isalpha(c); break;
+    case 'c': res = std::iscntrl(c); break;
+    case 'd': res = std::isdigit(c); break;
+    case 'g': res = std::isgraph(c); break;
+    case 'l': res = std::islower(c); break;
+    case 'p': res = std::ispunct(c); break;
+    case 's': res = std::isspace(c); break;
+    case 'u': res = std::isupper(c); break;
+    case 'w': res = std::isalnum(c); break;
+    case 'x': res = std::isxdigit(c); break;
+    default: return cl == c;
+    }
+    if (std::isupper(cl)) res = !res;
+    return res;
+}
+
+static bool matchBracketClass(int c, const char* p, const char* ec) {
+    bool sig = true;
+    if (*(p + 1) == '^') {
+        sig = false;
+        p++;
+    }
+    while (++p < ec) {
+        if (*p == L_ESC) {
+            p++;
+            if (matchClass(c, (unsigned char)*p)) return sig;
+        } else if (*(p + 1) == '-' && (p + 2 < ec)) {
+            p += 2;
+            if ((unsigned char)*(p - 2) <= c && c <= (unsigned char)*p) return sig;
+        } else if ((unsigned char)*p == c) {
+            return sig;
+        }
+    }
+    return !sig;
+}
+
+static bool singleMatch(MatchState* ms, const char* s, const char* p, const char* ep) {
+    if (s >= ms->srcEnd) return false;
+    int c = (unsigned char)*s;
+    switch (*p) {
+    case '.': return true;
+    case L_ESC: return matchClass(c, (unsigned char)*(p + 1));
+    case '[': return matchBracketClass(c, p, ep - 1);
+    default: return (unsigned char)*p == c;
+    }
+}
+
+static const char* matchBalance(MatchState* ms, const char* s, const char* p) {
+    if (p >= ms->patEnd - 1) ms->vm->runtimeError("malformed pattern (missing arguments to '%b')");
+    if (*s != *p) return nullptr;
+    int b = *p;
+    int e = *(p + 1);
+    int cont = 1;
+    while (++s < ms->srcEnd) {
+        if (*s == e) {
+            if (--cont == 0) return s + 1;
+        } else if (*s == b) {
+            cont++;
+        }
+    }
+    return nullptr;
+}
+
+static const char* maxExpand(MatchState* ms, const char* s, const char* p, const char* ep) {
+    ptrdiff_t i = 0;
+    while (singleMatch(ms, s + i, p, ep)) i++;
+    while (i >= 0) {
+        const char* res = doMatch(ms, s + i, ep + 1);
+        if (res) return res;
+        i--;
+    }
+    return nullptr;
+}
+
+static const char* minExpand(MatchState* ms, const char* s, const char* p, const char* ep) {
+    for (;;) {
+        const char* res = doMatch(ms, s, ep + 1);
+        if (res) return res;
+        if (singleMatch(ms, s, p, ep)) s++;
+        else return nullptr;
+    }
+}
+
+static const char* startCapture(MatchState* ms, const char* s, const char* p, int what) {
+    if (ms->level >= kMaxCaptures) ms->vm->runtimeError("too many captures");
+    ms->capture[ms->level].init = s;
+    ms->capture[ms->level].len = what;
+    ms->level++;
+    const char* res = doMatch(ms, s, p);
+    if (!res) ms->level--;
+    return res;
+}
+
+static const char* endCapture(MatchState* ms, const char* s, const char* p) {
+    int l = captureToClose(ms);
+    ms->capture[l].len = s - ms->capture[l].init;
+    const char* res = doMatch(ms, s, p);
+    if (!res) ms->capture[l].len = CAP_UNFINISHED;
+    return res;
+}
+
+static const char* matchCapture(MatchState* ms, const char* s, int l) {
+    l = checkCapture(ms, l);
+    size_t len = (size_t)ms->capture[l].len;
+    if ((size_t)(ms->srcEnd - s) >= len && std::memcmp(ms->capture[l].init, s, len) == 0) return s + len;
+    return nullptr;
+}
+
+static const char* doMatch(MatchState* ms, const char* s, const char* p) {
+    if (ms->depth-- == 0) ms->vm->runtimeError("pattern too complex");
+    while (p != ms->patEnd) {
+        switch (*p) {
+        case '(':
+            s = *(p + 1) == ')' ? startCapture(ms, s, p + 2, CAP_POSITION) : startCapture(ms, s, p + 1, CAP_UNFINISHED);
+            goto done;
+        case ')':
+            s = endCapture(ms, s, p + 1);
+            goto done;
+        case '$':
+            if (p + 1 != ms->patEnd) goto dflt;
+            s = s == ms->srcEnd ? s : nullptr;
+            goto done;
+        case L_ESC:
+            switch (*(p + 1)) {
+            case 'b':
+                s = matchBalance(ms, s, p + 2);
+                if (s) {
+                    p += 4;
+                    continue;
+                }
+                goto done;
+            case 'f': {
+                p += 2;
+                if (*p != '[') ms->vm->runtimeError("missing '[' after '%f' in pattern");
+                const char* ep = classEnd(ms, p);
+                int previous = (s == ms->srcInit) ? '\0' : (unsigned char)*(s - 1);
+                int current = (s < ms->srcEnd) ? (unsigned char)*s : '\0';
+                if (!matchBracketClass(previous, p, ep - 1) && matchBracketClass(current, p, ep - 1)) {
+                    p = ep;
+                    continue;
+                }
+                s = nullptr;
+                goto done;
+            }
+            case '0': case '1': case '2': case '3': case '4':
+            case '5': case '6': case '7': case '8': case '9':
+                s = matchCapture(ms, s, (unsigned char)*(p + 1));
+                if (s) {
+                    p += 2;
+                    continue;
+                }
+                goto done;
+            default:
+                goto dflt;
+            }
+        default:
+        dflt: {
+            const char* ep = classEnd(ms, p);
+            if (!singleMatch(ms, s, p, ep)) {
+                if (*ep == '*' || *ep == '?' || *ep == '-') {
+                    p = ep + 1;
+                    continue;
+                }
+                s = nullptr;
+            } else {
+                switch (*ep) {
+                case '?': {
+                    const char* res = doMatch(ms, s + 1, ep + 1);
+                    if (res) {
+                        s = res;
+                    } else {
+                        p = ep + 1;
+                        continue;
+                    }
+                    break;
+                }
+                case '+':
+                    s = maxExpand(ms, s + 1, p, ep);
+                    break;
+                case '*':
+                    s = maxExpand(ms, s, p, ep);
+                    break;
+                case '-':
+                    s = minExpand(ms, s, p, ep);
+                    break;
+                default:
+                    s++;
+                    p = ep;
+                    continue;
+                }
+            }
+            goto done;
+        }
+        }
+    }
+done:
+    ms->depth++;
+    return s;
+}
+
+static void prepareMatch(MatchState& ms, Interpreter& vm, const std::string& s, const std::string& p) {
+    ms.srcInit = s.data();
+    ms.srcEnd = s.data() + s.size();
+    ms.patEnd = p.data() + p.size();
+    ms.vm = &vm;
+    ms.level = 0;
+    ms.depth = 200;
+}
+
+static LuaValue getCapture(MatchState& ms, int i, const char* s, const char* e) {
+    if (i >= ms.level) {
+        if (i != 0) ms.vm->runtimeError("invalid capture index %" + std::to_string(i + 1));
+        return ms.vm->string(std::string_view(s, (size_t)(e - s)));
+    }
+    ptrdiff_t l = ms.capture[i].len;
+    if (l == CAP_UNFINISHED) ms.vm->runtimeError("unfinished capture");
+    if (l == CAP_POSITION) return LuaValue::integer(ms.capture[i].init - ms.srcInit + 1);
+    return ms.vm->string(std::string_view(ms.capture[i].init, (size_t)l));
+}
+
+// Pushes the captures (or the whole match when there are none)
+static int pushCaptures(CallInfo& ci, MatchState& ms, const char* s, const char* e, bool wholeIfNone) {
+    int n = (ms.level == 0 && wholeIfNone) ? 1 : ms.level;
+    for (int i = 0; i < n; ++i) ci.push(getCapture(ms, i, s, e));
+    return n;
+}
+
+static bool hasSpecials(const std::string& p) {
+    return p.find_first_of("^$*+?.([%-") != std::string::npos;
+}
+
+static int strFindAux(CallInfo& ci, bool find) {
+    const std::string& s = ci.checkString(0)->data;
+    const std::string& p = ci.checkString(1)->data;
+    int64_t init = startPosition(ci.optInteger(2, 1), s.size());
+    if (init > (int64_t)s.size() + 1) {
+        ci.push(nil());
+        return 1;
+    }
+    if (find && (!ci.arg(3).isFalsy() || !hasSpecials(p))) {
+        size_t pos = s.find(p, (size_t)init - 1);
+        if (pos == std::string::npos) {
+            ci.push(nil());
+            return 1;
+        }
+        ci.push(LuaValue::integer((int64_t)pos + 1));
+        ci.push(LuaValue::integer((int64_t)(pos + p.size())));
+        return 2;
+    }
+    MatchState ms;
+    prepareMatch(ms, ci.vm, s, p);
+    const char* pat = p.data();
+    bool anchor = !p.empty() && p[0] == '^';
+    if (anchor) pat++;
+    const char* s1 = s.data() + init - 1;
+    do {
+        ms.level = 0;
+        const char* e = doMatch(&ms, s1, pat);
+        if (e) {
+            if (find) {
+                ci.push(LuaValue::integer(s1 - s.data() + 1));
+                ci.push(LuaValue::integer(e - s.data()));
+                return 2 + pushCaptures(ci, ms, nullptr, nullptr, false);
+            }
+            return pushCaptures(ci, ms, s1, e, true);
+        }
+    } while (s1++ < ms.srcEnd && !anchor);
+    ci.push(nil());
+    return 1;
+}
+
+static int strFind(CallInfo& ci) { return strFindAux(ci, true); }
+static int strMatch(CallInfo& ci) { return strFindAux(ci, false); }
+
+// gmatch iterator state: upvalues are {subject, pattern, next offset, end of the last match}
+static int gmatchAux(CallInfo& ci) {
+    std::vector<LuaValue>& state = ci.self->upvalues;
+    const std::string& s = state[0].s->data;
+    const std::string& p = state[1].s->data;
+    MatchState ms;
+    prepareMatch(ms, ci.vm, s, p);
+    for (const char* src = s.data() + state[2].i; src <= ms.srcEnd; src++) {
+        ms.level = 0;
+        const char* e = doMatch(&ms, src, p.data());
+        // An empty match right after the previous one does not count
+        if (e && e - s.data() != state[3].i) {
+            state[2] = LuaValue::integer(e - s.data());
+            state[3] = state[2];
+            return pushCaptures(ci, ms, src, e, true);
+        }
+    }
+    state[2] = LuaValue::integer((int64_t)s.size() + 1);
+    ci.push(nil());
+    return 1;
+}
+
+static int strGmatch(CallInfo& ci) {
+    LuaString* s = ci.checkString(0);
+    LuaString* p = ci.checkString(1);
+    LuaNativeFunction* iter = ci.vm.newNative("gmatch_aux", gmatchAux);
+    iter->upvalues = {LuaValue::string(s), LuaValue::string(p), LuaValue::integer(0), LuaValue::integer(-1)};
+    ci.push(LuaValue::function(iter));
+    return 1;
+}
+
+static int strGsub(CallInfo& ci) {
+    Interpreter& vm = ci.vm;
+    const std::string& src = ci.checkString(0)->data;
+    const std::string& p = ci.checkString(1)->data;
+    LuaValue repl = ci.arg(2);
+    if (repl.isNumber()) repl = LuaValue::string(ci.checkString(2));
+    if (repl.type != LuaType::String && repl.type != LuaType::Table && repl.type != LuaType::Function) {
+        ci.argError(2, std::string("string/function/table expected, got ") + Interpreter::typeName(repl));
+    }
+    int64_t maxN = ci.arg(3).isNil() ? (int64_t)src.size() + 1 : ci.checkInteger(3);
+
+    MatchState ms;
+    prepareMatch(ms, vm, src, p);
+    const char* pat = p.data();
+    bool anchor = !p.empty() && p[0] == '^';
+    if (anchor) pat++;
+    const char* s = src.data();
+    std::string result;
+    int64_t n = 0;
+    while (n < maxN) {
+        ms.level = 0;
+        const char* e = doMatch(&ms, s, pat);
+        if (e) {
+            n++;
+            LuaValue whole = getCapture(ms, 0, s, e);
+            if (repl.type == LuaType::String) {
+                const std::string& r = repl.s->data;
+                for (size_t i = 0; i < r.size(); ++i) {
+                    if (r[i] != L_ESC) {
+                        result += r[i];
+                        continue;
+                    }
+                    i++;
+                    if (i >= r.size()) vm.runtimeError("invalid use of '%' in replacement string");
+                    if (r[i] == L_ESC) {
+                        result += L_ESC;
+                    } else if (std::isdigit((unsigned char)r[i])) {
+                        LuaValue cap = r[i] == '0' ? LuaValue::string(vm.intern(std::string_view(s, (size_t)(e - s))))
+                                                   : getCapture(ms, r[i] - '1', s, e);
+                        result += vm.toString(cap);
+                    } else {
+                        vm.runtimeError("invalid use of '%' in replacement string");
+                    }
+                }
+            } else {
+                LuaValue value;
+                if (repl.type == LuaType::Table) {
+                    value = vm.index(repl, whole);
+                } else {
+                    PinGuard pin(vm);
+                    int slot = ci.top();
+                    int count = ms.level == 0 ? 1 : ms.level;
+                    vm.ensureStack(slot + 1 + count);
+                    vm.stack[slot] = repl;
+                    for (int i = 0; i < count; ++i) vm.stack[slot + 1 + i] = getCapture(ms, i, s, e);
+                    int got = vm.call(slot, count);
+                    value = got > 0 ? vm.stack[slot] : LuaValue();
+                }
+                if (value.isFalsy()) {
+                    result.append(s, (size_t)(e - s)); // Keep the original match
+                } else if (value.type == LuaType::String || value.isNumber()) {
+                    result += vm.toString(value);
+                } else {
+                    vm.runtimeError(std::string("invalid replacement value (a ") + Interpreter::typeName(value) + ")");
+                }
+            }
+        }
+        if (e && e > s) {
+            s = e;
+        } else if (s < ms.srcEnd) {
+            result += *s++;
+        } else {
+            break;
+        }
+        if (anchor) break;
+    }
+    result.append(s, (size_t)(ms.srcEnd - s));
+    ci.push(vm.string(result));
+    ci.push(LuaValue::integer(n));
+    return 2;
+}
+
+// --- table ---
+
+static int tableInsert(CallInfo& ci) {
+    LuaTable* t = ci.checkTable(0);
+    int64_t e = t->length() + 1;
+    if (ci.nargs == 2) {
+        t->setInt(e, ci.arg(1));
+        return 0;
+    }
+    if (ci.nargs != 3) ci.vm.runtimeError("wrong number of arguments to 'insert'");
+    int64_t pos = ci.checkInteger(1);
+    if (pos < 1 || pos > e) ci.argError(1, "position out of bounds");
+    for (int64_t i = e; i > pos; --i) t->setInt(i, t->getInt(i - 1));
+    t->setInt(pos, ci.arg(2));
+    return 0;
+}
+
+static int tableRemove(CallInfo& ci) {
+    LuaTable* t = ci.checkTable(0);
+    int64_t size = t->length();
+    int64_t pos = ci.optInteger(1, size);
+    if (ci.nargs > 1 && size + 1 != pos && (pos < 1 || pos > size + 1)) {
+        ci.argError(1, "position out of bounds");
+    }
+    LuaValue removed = t->getInt(pos);
+    for (; pos < size; ++pos) t->setInt(pos, t->getInt(pos + 1));
+    if (pos <= size || ci.nargs > 1) t->setInt(pos, LuaValue());
+    ci.push(removed);
+    return 1;
+}
+
+static int tableConcat(CallInfo& ci) {
+    LuaTable* t = ci.checkTable(0);
+    std::string sep = ci.arg(1).isNil() ? "" : ci.checkString(1)->data;
+    int64_t i = ci.optInteger(2, 1);
+    int64_t j = ci.arg(3).isNil() ? t->length() : ci.checkInteger(3);
+    std::string result;
+    for (int64_t k = i; k <= j; ++k) {
+        LuaValue v = t->getInt(k);
+        if (v.type == LuaType::String) result += v.s->data;
+        else if (v.isNumber()) result += Interpreter::numberToString(v);
+        else ci.vm.runtimeError("invalid value (at index " + std::to_string(k) + ") in table for 'concat'");
+        if (k < j) result += sep;
+    }
+    ci.push(ci.vm.string(result));
+    return 1;
+}
+
+// Merge sort over a pinned copy: a comparator that errors or is inconsistent
+// cannot corrupt the table
+static void mergeSort(CallInfo& ci, std::vector<LuaValue>& v, std::vector<LuaValue>& tmp, size_t lo, size_t hi,
+                      const LuaValue& comp) {
+    if (hi - lo < 2) return;
+    size_t mid = lo + (hi - lo) / 2;
+    mergeSort(ci, v, tmp, lo, mid, comp);
+    mergeSort(ci, v, tmp, mid, hi, comp);
+    Interpreter& vm = ci.vm;
+    auto less = [&](const LuaValue& x, const LuaValue& y) {
+        if (comp.isNil()) return vm.lessThan(x, y);
+        return !vm.call1(comp, {x, y}).isFalsy();
+    };
+    size_t i = lo, j = mid, k = lo;
+    while (i < mid && j < hi) {
+        if (less(v[j], v[i])) tmp[k++] = v[j++];
+        else tmp[k++] = v[i++];
+    }
+    while (i < mid) tmp[k++] = v[i++];
+    while (j < hi) tmp[k++] = v[j++];
+    for (k = lo; k < hi; ++k) v[k] = tmp[k];
+}
+
+static int tableSort(CallInfo& ci) {
+    LuaTable* t = ci.checkTable(0);
+    LuaValue comp = ci.arg(1);
+    if (!comp.isNil() && comp.type != LuaType::Function) {
+        ci.argError(1, std::string("function expected, got ") + Interpreter::typeName(comp));
+    }
+    int64_t n = t->length();
+    PinGuard pin(ci.vm);
+    std::vector<LuaValue> values, tmp((size_t)n);
+    for (int64_t i = 1; i <= n; ++i) values.push_back(t->getInt(i));
+    ci.vm.pinned.insert(ci.vm.pinned.end(), values.begin(), values.end());
+    mergeSort(ci, values, tmp, 0, values.size(), comp);
+    for (int64_t i = 1; i <= n; ++i) t->setInt(i, values[(size_t)i - 1]);
+    return 0;
+}
+
+// --- os / io ---
+
+static int osClock(CallInfo& ci) {
+    ci.push(LuaValue::number((double)std::clock() / CLOCKS_PER_SEC));
+    return 1;
+}
+
+static int osTime(CallInfo& ci) {
+    ci.push(LuaValue::integer((int64_t)std::time(nullptr)));
+    return 1;
+}
+
+static int ioWrite(CallInfo& ci) {
+    for (int i = 0; i < ci.nargs; ++i) {
+        const LuaValue& v = ci.arg(i);
+        if (v.type == LuaType::Float) {
+            // Unlike tostring(), io.write prints floats without a ".0" suffix
+            char buf[64];
+            std::snprintf(buf, sizeof(buf), "%.14g", v.n);
+            ci.vm.out << buf;
+        } else {
+            ci.vm.out << ci.checkString(i)->data;
+        }
+    }
+    return 0;
+}
+
+struct LibFunction {
+    const char* name;
+    LuaCFunction fn;
+};
+
+static void registerLib(Interpreter& vm, const char* lib, std::initializer_list<LibFunction> functions) {
+    LuaTable* table = vm.newTable();
+    vm.setField(vm.globals, lib, LuaValue::table(table));
+    for (const LibFunction& f : functions) {
+        LuaNativeFunction* native = vm.newNative(f.name, f.fn);
+        native->name = std::string(lib) + "." + f.name;
+        vm.setField(table, f.name, LuaValue::function(native));
+    }
+}
+
+void openStdlib(Interpreter& vm) {
+    LuaTable* g = vm.globals;
+    vm.setField(g, "_G", LuaValue::table(g));
+    vm.setField(g, "_VERSION", vm.string("Lua 5.3"));
+    vm.setFunction(g, "print", basePrint);
+    vm.setFunction(g, "type", baseType);
+    vm.setFunction(g, "tostring", baseToString);
+    vm.setFunction(g, "tonumber", baseToNumber);
+    vm.setFunction(g, "next", baseNext);
+    vm.setFunction(g, "pairs", basePairs);
+    vm.setFunction(g, "select", baseSelect);
+    vm.setFunction(g, "error", baseError);
+    vm.setFunction(g, "assert", baseAssert);
+    vm.setFunction(g, "pcall", basePcall);
+    vm.setFunction(g, "rawget", baseRawGet);
+    vm.setFunction(g, "rawset", baseRawSet);
+    vm.setFunction(g, "rawequal", baseRawEqual);
+    vm.setFunction(g, "rawlen", baseRawLen);
+    vm.setFunction(g, "setmetatable", baseSetMetatable);
+    vm.setFunction(g, "getmetatable", baseGetMetatable);
+    LuaNativeFunction* ipairs = vm.newNative("ipairs", baseIpairs);
+    vm.stockIpairsAux = vm.newNative("ipairs_aux", ipairsAux);
+    ipairs->upvalues.push_back(LuaValue::function(vm.stockIpairsAux));
+    vm.setField(g, "ipairs", LuaValue::function(ipairs));
+    vm.stockNext = g->getStr(vm.intern("next")).f;
+
+    registerLib(vm, "math", {
+        {"floor", mathFloor}, {"ceil", mathCeil}, {"abs", mathAbs}, {"max", mathMax}, {"min", mathMin},
+        {"sqrt", mathSqrt}, {"sin", mathSin}, {"cos", mathCos}, {"tan", mathTan}, {"asin", mathAsin},
+        {"acos", mathAcos}, {"atan", mathAtan}, {"exp", mathExp}, {"log", mathLog}, {"fmod", mathFmod},
+        {"modf", mathModf}, {"tointeger", mathToInteger}, {"type", mathType}, {"random", mathRandom},
+        {"randomseed", mathRandomSeed},
+    });
+    LuaTable* math = g->getStr(vm.intern("math")).t;
+    vm.setField(math, "pi", LuaValue::number(3.141592653589793238462643383279502884));
+    vm.setField(math, "huge", LuaValue::number(HUGE_VAL));
+    vm.setField(math, "maxinteger", LuaValue::integer(INT64_MAX));
+    vm.setField(math, "mininteger", LuaValue::integer(INT64_MIN));
+
+    registerLib(vm, "string", {
+        {"len", strLen}, {"sub", strSub}, {"upper", strUpper}, {"lower", strLower}, {"rep", strRep},
+        {"reverse", strReverse}, {"byte", strByte}, {"char", strChar}, {"format", strFormat},
+        {"find", strFind}, {"match", strMatch}, {"gmatch", strGmatch}, {"gsub", strGsub},
+    });
+    vm.setField(vm.stringMeta, "__index", g->getStr(vm.intern("string")));
+
+    registerLib(vm, "table", {
+        {"insert", tableInsert}, {"remove", tableRemove}, {"concat", tableConcat}, {"sort", tableSort},
+        {"unpack", tableUnpack},
+    });
+    registerLib(vm, "os", {{"clock", osClock}, {"time", osTime}});
+    registerLib(vm, "io", {{"write", ioWrite}});
+}
@@ -1,6 +1,8 @@
 #ifndef OPCODES_H
 #define OPCODES_H
 
+#include <string>
+
 enum OpCode {
     OP_MOVE,    // R(A) := R(B)
     OP_LOADK,   // R(A) := K(Bx)
@@ -10,7 +12,7 @@ enum OpCode {
     OP_DIV,     // R(A) := R(B) / R(C)
     OP_IDIV,    // R(A) := R(B) // R(C)
     OP_MOD,     // R(A) := R(B) % R(C)
-    OP_CONCAT,  // R(A) := R(B) .. R(C)
+    OP_CONCAT,  // R(A) := R(B) .. ... .. R(C)
     OP_LEN,     // R(A) := #R(B)
     OP_NOT,     // R(A) := not R(B)
     OP_EQ,      // R(A) := (R(B) == R(C))
@@ -32,7 +34,71 @@ enum OpCode {
     OP_FORLOOP,   // R(A)+=R(A+2); if cmp(R(A), R(A+1)) then { pc+=sBx; R(A+3)=R(A) }
     OP_TFORCALL,  // R(A+3), ... ,R(A+2+C) := R(A)(R(A+1), R(A+2))
     OP_TFORLOOP,  // if R(A+1) ~= nil then { R(A)=R(A+1); pc += sBx }
-    OP_RETURN   // return R(A) ... (or variable returns)
+    OP_RETURN,  // return R(A) ... (or variable returns)
+
+    // Integer-specialized forms, emitted where the compiler has proved both
+    // operands are integers
+    OP_ADD_INT,   // R(A) := R(B) + R(C)
+    OP_SUB_INT,   // R(A) := R(B) - R(C)
+    OP_MUL_INT,   // R(A) := R(B) * R(C)
+    OP_IDIV_INT,  // R(A) := R(B) // R(C)
+    OP_MOD_INT,   // R(A) := R(B) % R(C)
+    // OP_FORLOOP for a constant step known to be positive or negative
+    OP_FORLOOP_UP,   // R(A)+=R(A+2); if R(A) <= R(A+1) then { pc+=sBx; R(A+3)=R(A) }
+    OP_FORLOOP_DOWN, // R(A)+=R(A+2); if R(A) >= R(A+1) then { pc+=sBx; R(A+3)=R(A) }
+    // OP_TFORCALL for ipairs(t) / pairs(t) loops: when R(A) is the iterator
+    // the stock ipairs / pairs return, the next index and value (or next(t,
+    // key)) go straight into R(A+3), ... without calling it
+    OP_TFORIPAIRS,
+    OP_TFORPAIRS,
+    // String buffers for a local accumulated with `s = s .. x` in a loop
+    OP_BUFINIT,   // R(A) := buffer holding R(B)
+    OP_BUFAPPEND, // R(A) := R(A) .. R(B) .. ... .. R(C) (in buffer R(A))
+    OP_BUFFLUSH,  // R(A) := contents of buffer R(B)
+    // Constant loads with the value in the instruction, not the constant table
+    OP_LOADNIL,   // R(A), ..., R(A+B) := nil
+    OP_LOADBOOL,  // R(A) := (Bool)B
+    OP_LOADI,     // R(A) := B (an integer)
+    OP_LOADF,     // R(A) := B (converted to a float)
+    // Jump table for an if/elseif chain comparing one local against constants
+    OP_SWITCH,    // pc += i if R(A) == K(B+i) for some i < C, else pc += C (each lands on a JMP)
+    OP_JMP_TRUE,  // PC := PC + B if R(A)
+
+    // Superinstructions synthesized from a profile (see Superinstructions.h):
+    // operands are those of the first fused instruction, the others follow it
+    OP_SUPER0, OP_SUPER1, OP_SUPER2, OP_SUPER3,
+    OP_SUPER4, OP_SUPER5, OP_SUPER6, OP_SUPER7,
+
+    NUM_OPCODES // Not an opcode: number of opcodes above
 };
 
+// Symbolic name used in the generated VM and in profiles
+inline const char* opName(OpCode op) {
+    static const char* const names[NUM_OPCODES] = {
+        "OP_MOVE", "OP_LOADK", "OP_ADD", "OP_SUB", "OP_MUL", "OP_DIV", "OP_IDIV", "OP_MOD",
+        "OP_CONCAT", "OP_LEN", "OP_NOT", "OP_EQ", "OP_LT", "OP_LE", "OP_JMP", "OP_JMP_FALSE",
+        "OP_GETGLOBAL", "OP_SETGLOBAL", "OP_NEWTABLE", "OP_GETTABLE", "OP_SETTABLE", "OP_CALL",
+        "OP_CLOSURE", "OP_GETUPVAL", "OP_SETUPVAL", "OP_VARARG", "OP_FORPREP", "OP_FORLOOP",
+        "OP_TFORCALL", "OP_TFORLOOP", "OP_RETURN",
+        "OP_ADD_INT", "OP_SUB_INT", "OP_MUL_INT", "OP_IDIV_INT", "OP_MOD_INT",
+        "OP_FORLOOP_UP", "OP_FORLOOP_DOWN", "OP_TFORIPAIRS", "OP_TFORPAIRS",
+        "OP_BUFINIT", "OP_BUFAPPEND", "OP_BUFFLUSH",
+        "OP_LOADNIL", "OP_LOADBOOL", "OP_LOADI", "OP_LOADF", "OP_SWITCH", "OP_JMP_TRUE",
+        "OP_SUPER0", "OP_SUPER1", "OP_SUPER2", "OP_SUPER3",
+        "OP_SUPER4", "OP_SUPER5", "OP_SUPER6", "OP_SUPER7"
+    };
+    if (op < 0 || op >= NUM_OPCODES) return "OP_UNKNOWN";
+    return names[op];
+}
+
+// Inverse of opName(); returns NUM_OPCODES for unknown names
+inline OpCode opFromName(const std::string& name) {
+    for (int i = 0; i < NUM_OPCODES; ++i) {
+        if (name == opName(static_cast<OpCode>(i))) return static_cast<OpCode>(i);
+    }
+    return NUM_OPCODES;
+}
+
+const int MAX_SUPERINSTRUCTIONS = NUM_OPCODES - OP_SUPER0;
+
 #endif
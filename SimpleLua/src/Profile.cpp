@@ -0,0 +1,122 @@
+#include "Profile.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <iomanip>
+#include <algorithm>
+
+void Profile::load(std::istream& in) {
+    Profile parsed;
+    std::string line;
+    int lineNo = 0;
+    while (std::getline(in, line)) {
+        lineNo++;
+        if (line.empty() || line[0] == '#') continue;
+
+        std::istringstream fields(line);
+        std::string kind;
+        fields >> kind;
+        bool ok = true;
+        if (kind == "runs") {
+            int n = 0;
+            ok = static_cast<bool>(fields >> n);
+            parsed.runs += n;
+        } else if (kind == "op") {
+            std::string name;
+            uint64_t count = 0;
+            ok = static_cast<bool>(fields >> name >> count);
+            parsed.opCounts[name] += count;
+        } else if (kind == "proto") {
+            int id = 0;
+            ProtoProfile p;
+            ok = static_cast<bool>(fields >> id >> p.calls >> p.instructions >> p.seconds);
+            ProtoProfile& dst = parsed.protos[id];
+            dst.calls += p.calls;
+            dst.instructions += p.instructions;
+            dst.seconds += p.seconds;
+        } else if (kind == "pc") {
+            int id = 0, pc = 0;
+            PcProfile p;
+            ok = static_cast<bool>(fields >> id >> pc >> p.op >> p.count);
+            PcProfile& dst = parsed.pcs[{id, pc}];
+            dst.op = p.op;
+            dst.count += p.count;
+        } else if (kind == "seq") {
+            std::string ops;
+            uint64_t count = 0;
+            ok = static_cast<bool>(fields >> ops >> count);
+            parsed.sequences[ops] += count;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            throw std::runtime_error("Malformed profile record at line " + std::to_string(lineNo) + ": " + line);
+        }
+    }
+    merge(parsed);
+}
+
+void Profile::loadFile(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("Could not open profile: " + path);
+    }
+    load(in);
+}
+
+void Profile::save(std::ostream& out) const {
+    out << "# simplelua profile\n";
+    out << "runs " << runs << "\n";
+    for (const auto& kv : opCounts) {
+        out << "op " << kv.first << " " << kv.second << "\n";
+    }
+    for (const auto& kv : protos) {
+        out << "proto " << kv.first << " " << kv.second.calls << " " << kv.second.instructions << " "
+            << std::fixed << std::setprecision(6) << kv.second.seconds << "\n";
+    }
+    for (const auto& kv : pcs) {
+        out << "pc " << kv.first.first << " " << kv.first.second << " " << kv.second.op << " " << kv.second.count << "\n";
+    }
+    for (const auto& kv : sequences) {
+        out << "seq " << kv.first << " " << kv.second << "\n";
+    }
+}
+
+void Profile::merge(const Profile& other) {
+    runs += other.runs;
+    for (const auto& kv : other.opCounts) {
+        opCounts[kv.first] += kv.second;
+    }
+    for (const auto& kv : other.protos) {
+        ProtoProfile& dst = protos[kv.first];
+        dst.calls += kv.second.calls;
+        dst.instructions += kv.second.instructions;
+        dst.seconds += kv.second.seconds;
+    }
+    for (const auto& kv : other.pcs) {
+        PcProfile& dst = pcs[kv.first];
+        dst.op = kv.second.op;
+        dst.count += kv.second.count;
+    }
+    for (const auto& kv : other.sequences) {
+        sequences[kv.first] += kv.second;
+    }
+}
+
+uint64_t Profile::totalInstructions() const {
+    uint64_t total = 0;
+    for (const auto& kv : opCounts) total += kv.second;
+    return total;
+}
+
+std::vector<OpCode> Profile::opcodesByFrequency() const {
+    std::vector<std::pair<OpCode, uint64_t>> counts;
+    for (const auto& kv : opCounts) {
+        OpCode op = opFromName(kv.first);
+        if (op != NUM_OPCODES) counts.push_back({op, kv.second});
+    }
+    std::stable_sort(counts.begin(), counts.end(), [](const auto& x, const auto& y) { return x.second > y.second; });
+    std::vector<OpCode> order;
+    for (const auto& kv : counts) order.push_back(kv.first);
+    return order;
+}
@@ -0,0 +1,52 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "OpCodes.h"
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Execution profile dumped by VMs generated with -profile. Text, one record
+// per line; counts from several runs are summed by merge():
+//   runs <n>
+//   op <name> <count>
+//   proto <id> <calls> <instructions> <seconds>
+//   pc <proto id> <pc> <name> <count>
+//   seq <name>,<name>[,<name>] <count>
+// Proto ids number the prototype tree in preorder (main chunk = 0) and pcs are
+// 0-based instruction indices, so records line up with Prototype::instructions.
+// seq records count opcode pairs and triples executed back to back without an
+// intervening branch, the candidates for superinstructions.
+
+struct ProtoProfile {
+    uint64_t calls = 0;
+    uint64_t instructions = 0;
+    double seconds = 0.0;
+};
+
+struct PcProfile {
+    std::string op;
+    uint64_t count = 0;
+};
+
+struct Profile {
+    int runs = 0;
+    std::map<std::string, uint64_t> opCounts;
+    std::map<int, ProtoProfile> protos;
+    std::map<std::pair<int, int>, PcProfile> pcs;
+    std::map<std::string, uint64_t> sequences; // "OP_A,OP_B" -> count
+
+    // Adds the records read from `in`; throws std::runtime_error on malformed input
+    void load(std::istream& in);
+    void loadFile(const std::string& path);
+    void save(std::ostream& out) const;
+    void merge(const Profile& other);
+    uint64_t totalInstructions() const;
+    // Opcodes seen in op records, most executed first; unknown names are skipped
+    std::vector<OpCode> opcodesByFrequency() const;
+};
+
+#endif
@@ -0,0 +1,113 @@
+#include "Superinstructions.h"
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+bool fallsThrough(OpCode op) {
+    switch (op) {
+    case OP_JMP:
+    case OP_JMP_FALSE:
+    case OP_JMP_TRUE:
+    case OP_FORPREP:
+    case OP_FORLOOP:
+    case OP_FORLOOP_UP:
+    case OP_FORLOOP_DOWN:
+    case OP_TFORLOOP:
+    case OP_SWITCH:
+    case OP_RETURN:
+        return false;
+    default:
+        return op < OP_SUPER0;
+    }
+}
+
+static bool parseSequence(const std::string& text, OpSequence& seq) {
+    std::istringstream in(text);
+    std::string name;
+    while (std::getline(in, name, ',')) {
+        OpCode op = opFromName(name);
+        if (op == NUM_OPCODES || op >= OP_SUPER0) return false;
+        seq.push_back(op);
+    }
+    if (seq.size() < 2) return false;
+    for (size_t i = 0; i + 1 < seq.size(); ++i) {
+        if (!fallsThrough(seq[i])) return false;
+    }
+    return true;
+}
+
+// True if one sequence contains the other or a tail of one starts the other.
+// Fusing both would rarely pay: where they chain, the first dispatch skips
+// the instruction the second was fused into.
+static bool overlaps(const OpSequence& x, const OpSequence& y) {
+    if (std::search(x.begin(), x.end(), y.begin(), y.end()) != x.end()) return true;
+    if (std::search(y.begin(), y.end(), x.begin(), x.end()) != y.end()) return true;
+    for (size_t n = 1; n < x.size() && n < y.size(); ++n) {
+        if (std::equal(x.end() - n, x.end(), y.begin())) return true;
+        if (std::equal(y.end() - n, y.end(), x.begin())) return true;
+    }
+    return false;
+}
+
+std::vector<OpSequence> selectSuperinstructions(const Profile& profile, size_t limit, double minShare) {
+    struct Candidate {
+        OpSequence ops;
+        uint64_t saved;
+    };
+    std::vector<Candidate> candidates;
+    uint64_t threshold = (uint64_t)(minShare * (double)profile.totalInstructions());
+    for (const auto& kv : profile.sequences) {
+        OpSequence seq;
+        if (kv.second == 0 || kv.second < threshold || !parseSequence(kv.first, seq)) continue;
+        candidates.push_back({seq, kv.second * (seq.size() - 1)});
+    }
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [](const Candidate& x, const Candidate& y) { return x.saved > y.saved; });
+
+    std::vector<OpSequence> selected;
+    for (size_t i = 0; i < candidates.size() && selected.size() < limit; ++i) {
+        bool redundant = false;
+        for (const OpSequence& seq : selected) {
+            if (overlaps(seq, candidates[i].ops)) {
+                redundant = true;
+                break;
+            }
+        }
+        if (!redundant) selected.push_back(candidates[i].ops);
+    }
+    return selected;
+}
+
+int fuseSuperinstructions(Prototype* proto, const std::vector<OpSequence>& superinstructions) {
+    if (superinstructions.size() > (size_t)MAX_SUPERINSTRUCTIONS) {
+        throw std::runtime_error("Too many superinstructions");
+    }
+    // Longest sequences are tried first; ties keep the profile's ranking
+    std::vector<size_t> order(superinstructions.size());
+    for (size_t k = 0; k < order.size(); ++k) order[k] = k;
+    std::stable_sort(order.begin(), order.end(), [&](size_t x, size_t y) {
+        return superinstructions[x].size() > superinstructions[y].size();
+    });
+
+    // Match against the original opcodes; a fused instruction may itself sit
+    // inside an earlier superinstruction's sequence
+    std::vector<OpCode> original;
+    for (const Instruction& inst : proto->instructions) original.push_back(inst.op);
+
+    int fused = 0;
+    for (size_t pc = 0; pc < original.size(); ++pc) {
+        for (size_t k : order) {
+            const OpSequence& seq = superinstructions[k];
+            if (pc + seq.size() > original.size()) continue;
+            if (!std::equal(seq.begin(), seq.end(), original.begin() + pc)) continue;
+            proto->instructions[pc].op = static_cast<OpCode>(OP_SUPER0 + k);
+            fused++;
+            break;
+        }
+    }
+
+    for (auto& child : proto->protos) {
+        fused += fuseSuperinstructions(child.get(), superinstructions);
+    }
+    return fused;
+}
@@ -0,0 +1,28 @@
+#ifndef SUPERINSTRUCTIONS_H
+#define SUPERINSTRUCTIONS_H
+
+#include "Compiler.h"
+#include "Profile.h"
+#include <vector>
+
+// A run of opcodes executed by one dispatch. The fused instruction keeps the
+// first instruction's operands; the generated handler fetches the operands of
+// the following instructions, which stay in place so jumps into the middle of
+// a sequence still land on the original instructions.
+using OpSequence = std::vector<OpCode>;
+
+// True if control always continues at the next instruction, i.e. `op` may be
+// followed by another opcode inside a superinstruction
+bool fallsThrough(OpCode op);
+
+// Picks at most `limit` sequences from the profile's seq records, ranked by
+// dispatches saved and skipping those that overlap a better one; sequences
+// below `minShare` of all executed instructions are ignored.
+// superinstructions[k] becomes OP_SUPER0 + k.
+std::vector<OpSequence> selectSuperinstructions(const Profile& profile, size_t limit = MAX_SUPERINSTRUCTIONS, double minShare = 0.01);
+
+// Rewrites the first instruction of every match (longest sequence first) in
+// the prototype tree; returns the number of instructions rewritten
+int fuseSuperinstructions(Prototype* proto, const std::vector<OpSequence>& superinstructions);
+
+#endif
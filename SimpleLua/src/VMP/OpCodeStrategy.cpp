@@ -4,19 +4,20 @@
 #include <random>
 
 RandomizedStrategy::RandomizedStrategy() {
-    // OpCode is contiguous from 0 to OP_RETURN
-    opMap.resize(OP_RETURN + 1);
-    for (int i = 0; i <= OP_RETURN; ++i) {
+    // OpCode is contiguous from 0 to NUM_OPCODES - 1
+    opMap.resize(NUM_OPCODES);
+    for (int i = 0; i < NUM_OPCODES; ++i) {
         opMap[i] = i;
     }
 
     // Shuffle
     std::random_device rd;
     std::mt19937 g(rd());
+    std::vector<int> values = opMap;
     std::shuffle(values.begin(), values.end(), g);
 
     // Map
-    for (int i = 0; i <= OP_RETURN; ++i) {
+    for (int i = 0; i < NUM_OPCODES; ++i) {
         opMap[static_cast<OpCode>(i)] = values[i];
     }
 }
@@ -1,53 +1,175 @@
 #ifndef VALUE_H
 #define VALUE_H
 
-#include <variant>
-#include <string>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
 
 struct Nil {};
 
-using Value = std::variant<Nil, bool, double, std::string>;
+// Strings held by Values are interned: each distinct string is stored once in
+// a process-wide table, is never modified or freed, and equal strings share
+// one address. Not thread-safe, like the rest of the compiler.
+inline const std::string* internString(const std::string& s) {
+    static std::unordered_set<std::string> table; // Nodes never move, so pointers stay valid
+    return &*table.insert(s).first;
+}
+
+// Integers too wide for the inline payload are interned the same way
+inline const int64_t* internInteger(int64_t i) {
+    static std::unordered_set<int64_t> table;
+    return &*table.insert(i).first;
+}
+
+// A constant in 8 bytes (NaN boxing). Floats are stored as plain doubles,
+// with every NaN folded into one positive quiet NaN; nil, booleans, integers
+// and strings live in the 48-bit payload of a negative quiet NaN, tagged in
+// bits 48-50. Integers that fit in 48 bits are stored inline, wider ones and
+// strings as pointers to interned copies. As in Lua 5.3, integers and floats
+// are both numbers but stay distinct subtypes.
+class Value {
+public:
+    Value() : bits(kNilBits) {}
+    Value(Nil) : bits(kNilBits) {}
+    Value(bool b) : bits(b ? kTrueBits : kFalseBits) {}
+    Value(double d) {
+        if (d != d) {
+            bits = kCanonicalNaN;
+        } else {
+            std::memcpy(&bits, &d, sizeof bits);
+        }
+    }
+    Value(int64_t i) {
+        if (i >= -kInlineLimit && i < kInlineLimit) {
+            bits = kIntTag | (static_cast<uint64_t>(i) & kPayloadMask);
+        } else {
+            bits = kBigIntTag | reinterpret_cast<uintptr_t>(internInteger(i));
+        }
+    }
+    Value(int i) : Value(static_cast<int64_t>(i)) {}
+    Value(const std::string& s) : bits(kStringTag | reinterpret_cast<uintptr_t>(internString(s))) {}
+    Value(const char* s) : Value(std::string(s)) {}
+
+    bool isNil() const { return bits == kNilBits; }
+    bool isBoolean() const { return (bits & ~uint64_t(1)) == kFalseBits; }
+    bool isFloat() const { return (bits & kBoxed) != kBoxed; }
+    bool isInteger() const { return (bits & kTagMask) == kIntTag || (bits & kTagMask) == kBigIntTag; }
+    bool isNumber() const { return isFloat() || isInteger(); }
+    bool isString() const { return (bits & kTagMask) == kStringTag; }
+
+    bool boolean() const { return bits == kTrueBits; }
+    double number() const {
+        if (isInteger()) return static_cast<double>(integer());
+        double d;
+        std::memcpy(&d, &bits, sizeof d);
+        return d;
+    }
+    int64_t integer() const {
+        if ((bits & kTagMask) == kIntTag) return static_cast<int64_t>(bits << 16) >> 16;
+        return *reinterpret_cast<const int64_t*>(bits & kPayloadMask);
+    }
+    const std::string& string() const { return *reinterpret_cast<const std::string*>(bits & kPayloadMask); }
+
+    // Raw equality as in Lua: numbers by mathematical value (NaN is unequal
+    // to itself), everything else by identity, which interning makes exact
+    // for strings and wide integers
+    friend bool operator==(const Value& x, const Value& y) {
+        if (x.isFloat() && y.isFloat()) return x.number() == y.number();
+        if (x.isFloat() && y.isInteger()) return sameNumber(y.integer(), x.number());
+        if (x.isInteger() && y.isFloat()) return sameNumber(x.integer(), y.number());
+        return x.bits == y.bits;
+    }
+    friend bool operator!=(const Value& x, const Value& y) { return !(x == y); }
+
+private:
+    // An integer equals a float only if the float converts to it exactly
+    static bool sameNumber(int64_t i, double d) {
+        return d >= -9223372036854775808.0 && d < 9223372036854775808.0 && static_cast<int64_t>(d) == i &&
+               static_cast<double>(static_cast<int64_t>(d)) == d;
+    }
+
+    static constexpr uint64_t kBoxed = 0xFFF8000000000000ull;
+    static constexpr uint64_t kTagMask = 0xFFFF000000000000ull;
+    static constexpr uint64_t kPayloadMask = 0x0000FFFFFFFFFFFFull;
+    static constexpr uint64_t kNilBits = kBoxed | (1ull << 48);
+    static constexpr uint64_t kFalseBits = kBoxed | (2ull << 48);
+    static constexpr uint64_t kTrueBits = kFalseBits | 1;
+    static constexpr uint64_t kStringTag = kBoxed | (3ull << 48);
+    static constexpr uint64_t kIntTag = kBoxed | (4ull << 48);
+    static constexpr uint64_t kBigIntTag = kBoxed | (5ull << 48);
+    static constexpr int64_t kInlineLimit = 1ll << 47;
+    static constexpr uint64_t kCanonicalNaN = 0x7FF8000000000000ull;
+
+    uint64_t bits;
+};
+
+static_assert(sizeof(Value) == 8, "Value must stay one machine word");
+static_assert(sizeof(void*) == 8, "NaN boxing needs 64-bit pointers");
 
 inline bool is_nil(const Value& v) {
-    return std::holds_alternative<Nil>(v);
+    return v.isNil();
 }
 
 inline bool is_boolean(const Value& v) {
-    return std::holds_alternative<bool>(v);
+    return v.isBoolean();
 }
 
 inline bool is_number(const Value& v) {
-    return std::holds_alternative<double>(v);
+    return v.isNumber();
+}
+
+inline bool is_integer(const Value& v) {
+    return v.isInteger();
 }
 
 inline bool is_string(const Value& v) {
-    return std::holds_alternative<std::string>(v);
+    return v.isString();
 }
 
 inline bool as_boolean(const Value& v) {
-    if (std::holds_alternative<bool>(v)) {
-        return std::get<bool>(v);
+    if (v.isBoolean()) {
+        return v.boolean();
     }
-    return !std::holds_alternative<Nil>(v); // Lua truthiness: nil is false, numbers are true
+    return !v.isNil(); // Lua truthiness: nil is false, numbers are true
 }
 
 inline double as_number(const Value& v) {
-    if (std::holds_alternative<double>(v)) {
-        return std::get<double>(v);
+    if (v.isNumber()) {
+        return v.number();
     }
     throw std::runtime_error("Value is not a number");
 }
 
+inline int64_t as_integer(const Value& v) {
+    if (v.isInteger()) {
+        return v.integer();
+    }
+    throw std::runtime_error("Value is not an integer");
+}
+
+// The interned string itself; no copy
+inline const std::string& as_string_ref(const Value& v) {
+    if (v.isString()) {
+        return v.string();
+    }
+    throw std::runtime_error("Value is not a string");
+}
+
 inline std::string as_string(const Value& v) {
-    if (std::holds_alternative<std::string>(v)) {
-        return std::get<std::string>(v);
+    if (v.isString()) {
+        return v.string();
+    }
+    if (v.isInteger()) {
+        return std::to_string(v.integer());
     }
-    if (std::holds_alternative<double>(v)) {
-        return std::to_string(std::get<double>(v));
+    if (v.isNumber()) {
+        return std::to_string(v.number());
     }
-    if (std::holds_alternative<bool>(v)) {
-        return std::get<bool>(v) ? "true" : "false";
+    if (v.isBoolean()) {
+        return v.boolean() ? "true" : "false";
     }
     return "nil";
 }
@@ -4,29 +4,112 @@
 #include <sstream>
 #include <memory>
 #include <cstring>
+#include <cstdlib>
 #include "Compiler.h"
 #include "LuaGenerator.h"
+#include "CGenerator.h"
+#include "LuacWriter.h"
 #include "VMP/OpCodeStrategy.h"
+#include "Profile.h"
+#include "Superinstructions.h"
+#include "Native/Interpreter.h"
+
+// `simple_lua run file.lua`: compile and execute with the native interpreter
+static int runNative(const std::string& inputPath, const CompilerOptions& compilerOptions) {
+    std::ifstream inFile(inputPath);
+    if (!inFile) {
+        std::cerr << "Error: Could not open input file: " << inputPath << "\n";
+        return 1;
+    }
+    std::stringstream buffer;
+    buffer << inFile.rdbuf();
+
+    try {
+        Compiler compiler(compilerOptions);
+        std::unique_ptr<Prototype> proto = compiler.compile(buffer.str());
+        Interpreter vm(std::cout);
+        vm.run(proto.get(), inputPath);
+    } catch (const std::exception& e) {
+        std::cout.flush();
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
 
 int main(int argc, char* argv[]) {
+    if (argc >= 3 && std::strcmp(argv[1], "run") == 0) {
+        CompilerOptions compilerOptions;
+        for (int i = 3; i < argc; ++i) {
+            if (std::strcmp(argv[i], "-assume-pure-calls") == 0) {
+                compilerOptions.assumePureCalls = true;
+            } else if (std::strcmp(argv[i], "-inline-budget") == 0 && i + 1 < argc) {
+                compilerOptions.inlineBudget = std::atoi(argv[++i]);
+            } else if (std::strcmp(argv[i], "-unroll-budget") == 0 && i + 1 < argc) {
+                compilerOptions.unrollBudget = std::atoi(argv[++i]);
+            } else if (std::strcmp(argv[i], "-merge-functions") == 0) {
+                compilerOptions.mergeFunctions = true;
+            } else {
+                std::cerr << "Unknown option: " << argv[i] << "\n";
+                return 1;
+            }
+        }
+        return runNative(argv[2], compilerOptions);
+    }
+
     if (argc < 3) {
-        std::cerr << "Usage: " << argv[0] << " <input_file> <output_file> [-vmp] [-pack] [-encrypt]\n";
+        std::cerr << "Usage: " << argv[0] << " run <input_file> [-assume-pure-calls] [-inline-budget <tokens>] [-unroll-budget <tokens>] [-merge-functions]\n";
+        std::cerr << "       " << argv[0] << " <input_file> <output_file> [-vmp] [-pack] [-encrypt] [-compact] [-binary] [-lazy] [-profile] [-profile-time] [-sample] [-superinstructions <profile>] [-dispatch-order <profile>] [-emit-c] [-luac] [-assume-pure-calls] [-inline-budget <tokens>] [-unroll-budget <tokens>] [-merge-functions]\n";
         return 1;
     }
 
     std::string inputPath = argv[1];
     std::string outputPath = argv[2];
     bool useVMP = false;
-    bool pack = false;
-    bool encrypt = false;
+    bool emitC = false;
+    bool emitLuac = false;
+    std::string superProfilePath;
+    std::string orderProfilePath;
+    GeneratorOptions options;
+    options.chunkName = inputPath;
+    CompilerOptions compilerOptions;
 
     for (int i = 3; i < argc; ++i) {
         if (std::strcmp(argv[i], "-vmp") == 0) {
             useVMP = true;
         } else if (std::strcmp(argv[i], "-pack") == 0) {
-            pack = true;
+            options.pack = true;
         } else if (std::strcmp(argv[i], "-encrypt") == 0) {
-            encrypt = true;
+            options.encrypt = true;
+        } else if (std::strcmp(argv[i], "-compact") == 0) {
+            options.compactCode = true;
+        } else if (std::strcmp(argv[i], "-binary") == 0) {
+            options.binary = true;
+        } else if (std::strcmp(argv[i], "-lazy") == 0) {
+            options.lazyProtos = true;
+        } else if (std::strcmp(argv[i], "-profile") == 0) {
+            options.profile = true;
+        } else if (std::strcmp(argv[i], "-profile-time") == 0) {
+            options.profile = true;
+            options.profileTiming = true;
+        } else if (std::strcmp(argv[i], "-sample") == 0) {
+            options.sample = true;
+        } else if (std::strcmp(argv[i], "-superinstructions") == 0 && i + 1 < argc) {
+            superProfilePath = argv[++i];
+        } else if (std::strcmp(argv[i], "-dispatch-order") == 0 && i + 1 < argc) {
+            orderProfilePath = argv[++i];
+        } else if (std::strcmp(argv[i], "-emit-c") == 0) {
+            emitC = true;
+        } else if (std::strcmp(argv[i], "-luac") == 0) {
+            emitLuac = true;
+        } else if (std::strcmp(argv[i], "-assume-pure-calls") == 0) {
+            compilerOptions.assumePureCalls = true;
+        } else if (std::strcmp(argv[i], "-inline-budget") == 0 && i + 1 < argc) {
+            compilerOptions.inlineBudget = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-unroll-budget") == 0 && i + 1 < argc) {
+            compilerOptions.unrollBudget = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-merge-functions") == 0) {
+            compilerOptions.mergeFunctions = true;
         }
     }
 
@@ -44,21 +127,63 @@ int main(int argc, char* argv[]) {
     std::cout << "Compiling " << inputPath << "...\n";
 
     try {
-        Compiler compiler;
+        Compiler compiler(compilerOptions);
         std::unique_ptr<Prototype> proto = compiler.compile(source);
 
         std::cout << "Compiled successfully.\n";
         std::cout << "Main Instructions: " << proto->instructions.size() << "\n";
         std::cout << "Constants: " << proto->constants.size() << "\n";
-        std::cout << "Nested Functions: " << proto->protos.size() << "\n\n";
+        std::cout << "Nested Functions: " << proto->protos.size() << "\n";
+        std::cout << "Inlined Calls: " << compiler.inlinedCallSites() << "\n\n";
+
+        if (!superProfilePath.empty()) {
+            Profile profile;
+            profile.loadFile(superProfilePath);
+            options.superinstructions = selectSuperinstructions(profile);
+            int fused = fuseSuperinstructions(proto.get(), options.superinstructions);
+            std::cout << "Superinstructions from " << superProfilePath << ": " << options.superinstructions.size()
+                      << " sequences, " << fused << " instructions fused\n";
+            for (size_t k = 0; k < options.superinstructions.size(); ++k) {
+                std::cout << "  " << opName(static_cast<OpCode>(OP_SUPER0 + k)) << " =";
+                for (OpCode op : options.superinstructions[k]) std::cout << " " << opName(op);
+                std::cout << "\n";
+            }
+            std::cout << "\n";
+        }
 
-        std::cout << "Generating Lua VM code to " << outputPath << "...\n";
-        std::ofstream outFile(outputPath);
+        if (!orderProfilePath.empty()) {
+            Profile profile;
+            profile.loadFile(orderProfilePath);
+            options.handlerOrder = profile.opcodesByFrequency();
+            std::cout << "Dispatch order from " << orderProfilePath << ":";
+            for (size_t i = 0; i < options.handlerOrder.size() && i < 8; ++i) {
+                std::cout << " " << opName(options.handlerOrder[i]);
+            }
+            std::cout << (options.handlerOrder.size() > 8 ? " ...\n\n" : "\n\n");
+        }
+
+        std::cout << (emitC ? "Generating C code to " : emitLuac ? "Writing Lua 5.3 binary chunk to " : "Generating Lua VM code to ")
+                  << outputPath << "...\n";
+        std::ofstream outFile(outputPath, emitLuac ? std::ios::binary : std::ios::out);
         if (!outFile) {
             std::cerr << "Error: Could not open output file for writing: " << outputPath << "\n";
             return 1;
         }
 
+        if (emitC) {
+            CGenerator::generate(proto.get(), outFile, options);
+            outFile.close();
+            std::cout << "Generated " << outputPath << "\n";
+            return 0;
+        }
+
+        if (emitLuac) {
+            LuacWriter::write(proto.get(), outFile, options);
+            outFile.close();
+            std::cout << "Generated " << outputPath << "\n";
+            return 0;
+        }
+
         std::unique_ptr<OpCodeStrategy> strategy;
         if (useVMP) {
             strategy = std::make_unique<RandomizedStrategy>();
@@ -67,10 +192,15 @@ int main(int argc, char* argv[]) {
             strategy = std::make_unique<DefaultStrategy>();
         }
 
-        if (pack) std::cout << "Packing enabled.\n";
-        if (encrypt) std::cout << "Encryption enabled.\n";
+        if (options.pack) std::cout << "Packing enabled.\n";
+        if (options.encrypt) std::cout << "Encryption enabled.\n";
+        if (options.compactCode) std::cout << "Compact instruction encoding enabled.\n";
+        if (options.binary) std::cout << "Binary bytecode blob enabled.\n";
+        if (options.lazyProtos) std::cout << "Lazy prototype loading enabled.\n";
+        if (options.profile) std::cout << "Profiling instrumentation enabled.\n";
+        if (options.sample) std::cout << "Sampling profiler enabled.\n";
 
-        LuaGenerator::generate(proto.get(), outFile, *strategy, pack, encrypt);
+        LuaGenerator::generate(proto.get(), outFile, *strategy, options);
         outFile.close();
 
         std::cout << "Generated " << outputPath << "\n";
@@ -0,0 +1,119 @@
+#include "../CGenerator.h"
+#include "../Compiler.h"
+#include "../LuaGenerator.h"
+#include "../LuacWriter.h"
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+// Scratch files, removed after each script
+static const char* const kLuaOut = "test_backends_out.lua";
+static const char* const kVmText = "test_backends_out.vm.txt";
+static const char* const kBackendText = "test_backends_out.txt";
+static const char* const kCOut = "test_backends_out.c";
+static const char* const kExe = "./test_backends_out";
+static const char* const kChunkOut = "test_backends_out.luac";
+
+// Writes the prototype to another backend's output and returns the shell
+// command running it
+using Backend = std::function<std::string(Prototype*, const GeneratorOptions&)>;
+
+static std::string readFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    return buffer.str();
+}
+
+static bool haveCommand(const std::string& name) {
+    return std::system(("command -v " + name + " > /dev/null 2>&1").c_str()) == 0;
+}
+
+// Compiles `path` to both the Lua VM and `backend`; the backend's output
+// must print exactly what the VM script prints under `lua`
+static void checkScript(const std::string& path, const std::string& lua, const Backend& backend) {
+    std::string source = readFile(path);
+    Compiler compiler;
+    std::unique_ptr<Prototype> proto = compiler.compile(source);
+    GeneratorOptions options;
+    options.chunkName = path;
+    {
+        std::ofstream luaOut(kLuaOut);
+        DefaultStrategy strategy;
+        LuaGenerator::generate(proto.get(), luaOut, strategy, options);
+    }
+    std::string run = backend(proto.get(), options);
+
+    assert(std::system((lua + " " + kLuaOut + " > " + kVmText + " 2>&1").c_str()) == 0);
+    assert(std::system((run + " > " + kBackendText + " 2>&1").c_str()) == 0);
+    assert(readFile(kBackendText) == readFile(kVmText));
+
+    for (const char* file : {kLuaOut, kVmText, kBackendText, kCOut, kExe, kChunkOut}) std::remove(file);
+    std::cout << "  " << path << " matches" << std::endl;
+}
+
+static std::string emitC(Prototype* proto, const GeneratorOptions& options) {
+    {
+        std::ofstream cOut(kCOut);
+        CGenerator::generate(proto, cOut, options);
+    }
+    std::string build = std::string("cc -std=c99 -O1 -DSIMPLELUA_MAIN -o ") + kExe + " " + kCOut + " -lm";
+    assert(std::system(build.c_str()) == 0);
+    return kExe;
+}
+
+static std::string emitChunk(Prototype* proto, const GeneratorOptions& options) {
+    std::ofstream chunkOut(kChunkOut, std::ios::binary);
+    LuacWriter::write(proto, chunkOut, options);
+    return std::string("lua5.3 ") + kChunkOut;
+}
+
+void test_superinstructions_rejected() {
+    Compiler compiler;
+    std::unique_ptr<Prototype> proto = compiler.compile("print(1)");
+    proto->instructions[0].op = OP_SUPER0;
+    // Neither backend has handlers for them
+    for (const Backend& backend : {Backend(emitC), Backend(emitChunk)}) {
+        bool thrown = false;
+        try {
+            backend(proto.get(), GeneratorOptions());
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+    for (const char* file : {kCOut, kChunkOut}) std::remove(file);
+    std::cout << "test_superinstructions_rejected passed" << std::endl;
+}
+
+void test_matches_lua_vm() {
+    // Sample scripts in the repo whose output does not depend on the backend
+    // (no error positions, which refer to the generated VM script)
+    const char* const scripts[] = {"test.lua", "test_break.lua", "../test_insert.lua"};
+    std::string lua = haveCommand("lua5.3") ? "lua5.3" : haveCommand("lua") ? "lua" : "";
+    if (lua.empty() || !haveCommand("cc")) {
+        std::cout << "C backend comparison skipped (needs cc and lua5.3)" << std::endl;
+    } else {
+        for (const char* path : scripts) checkScript(path, lua, emitC);
+    }
+    // Binary chunks only load in Lua 5.3 itself
+    if (!haveCommand("lua5.3")) {
+        std::cout << "Binary chunk comparison skipped (needs lua5.3)" << std::endl;
+    } else {
+        for (const char* path : scripts) checkScript(path, "lua5.3", emitChunk);
+    }
+    std::cout << "test_matches_lua_vm passed" << std::endl;
+}
+
+int main() {
+    test_superinstructions_rejected();
+    test_matches_lua_vm();
+    std::cout << "All backend comparison tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,26 @@
+#include "../CGenerator.h"
+#include "../Compiler.h"
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+void test_constants_and_labels() {
+    Compiler compiler;
+    std::unique_ptr<Prototype> proto = compiler.compile("local s = \"a\\b?\"\nwhile true do break end\nprint(s, 0.5)");
+    std::ostringstream out;
+    CGenerator::generate(proto.get(), out);
+    std::string code = out.str();
+    // Backslashes and question marks are escaped in C string literals
+    assert(code.find("sl_const(\"a\\\\b\\?\", 4)") != std::string::npos);
+    assert(code.find("sl_flt(0.5)") != std::string::npos);
+    assert(code.find("int simplelua_run(void)") != std::string::npos);
+    std::cout << "test_constants_and_labels passed" << std::endl;
+}
+
+int main() {
+    test_constants_and_labels();
+    std::cout << "All C backend tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,346 @@
+#include "../Compiler.h"
+#include "../Superinstructions.h"
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <string>
+
+void test_line_table() {
+    Compiler compiler;
+    std::unique_ptr<Prototype> main = compiler.compile(
+        "local x = 1\n"
+        "\n"
+        "local function add(a, b)\n"
+        "    return a + b\n"
+        "end\n"
+        "print(add(x, 2))\n");
+
+    int total = 0;
+    for (const LineRun& run : main->lineInfo) total += run.count;
+    assert(total == (int)main->instructions.size());
+    assert(main->lineAt(0) == 1);
+    assert(main->lineAt((int)main->instructions.size() - 1) == 6);
+
+    // Runs are merged, so a single-line statement is one entry
+    for (size_t i = 1; i < main->lineInfo.size(); ++i) {
+        assert(main->lineInfo[i].line != main->lineInfo[i - 1].line);
+    }
+
+    std::cout << "test_line_table passed" << std::endl;
+}
+
+void test_function_names() {
+    Compiler compiler;
+    std::unique_ptr<Prototype> main = compiler.compile(
+        "function f() end\n"
+        "local function g() end\n"
+        "local h = function() end\n");
+
+    assert(main->name == "main");
+    assert(main->protos.size() == 3);
+    assert(main->protos[0]->name == "f");
+    assert(main->protos[1]->name == "g");
+    assert(main->protos[2]->name.empty());
+    assert(main->protos[2]->lineDefined == 3);
+    assert(main->protos[1]->lineAt(0) == 2);
+
+    std::cout << "test_function_names passed" << std::endl;
+}
+
+void test_superinstructions() {
+    Profile profile;
+    profile.opCounts["OP_ADD"] = 1000;
+    profile.sequences["OP_LOADK,OP_ADD"] = 400;
+    profile.sequences["OP_LOADK,OP_ADD,OP_MOVE"] = 300; // Saves more: picked first
+    profile.sequences["OP_ADD,OP_MOVE"] = 350;          // Overlaps the triple
+    profile.sequences["OP_JMP,OP_MOVE"] = 900;          // JMP never falls through
+    profile.sequences["OP_MOVE,OP_CALL"] = 5;           // Below 1%
+
+    std::vector<OpSequence> supers = selectSuperinstructions(profile);
+    assert(supers.size() == 1);
+    assert((supers[0] == OpSequence{OP_LOADK, OP_ADD, OP_MOVE}));
+
+    Compiler compiler;
+    std::unique_ptr<Prototype> main = compiler.compile(
+        "local x = 1\n"
+        "local function f(n) local y = n + 2.5 return y end\n"
+        "x = x + 1\n");
+    std::vector<OpCode> before;
+    for (const Instruction& inst : main->protos[0]->instructions) before.push_back(inst.op);
+
+    int fused = fuseSuperinstructions(main.get(), supers);
+    assert(fused > 0);
+    // Only the opcode of the first instruction changes
+    const auto& code = main->protos[0]->instructions;
+    for (size_t pc = 0; pc < code.size(); ++pc) {
+        if (code[pc].op == OP_SUPER0) {
+            assert(before[pc] == OP_LOADK && before[pc + 1] == OP_ADD && before[pc + 2] == OP_MOVE);
+            assert(code[pc + 1].op == OP_ADD);
+        } else {
+            assert(code[pc].op == before[pc]);
+        }
+    }
+
+    std::cout << "test_superinstructions passed" << std::endl;
+}
+
+static int countOps(const Prototype* proto, OpCode op) {
+    int n = 0;
+    for (const Instruction& inst : proto->instructions) n += inst.op == op;
+    return n;
+}
+
+void test_integer_specialization() {
+    Compiler compiler;
+    std::unique_ptr<Prototype> main = compiler.compile(
+        "local n = 0\n"
+        "for i = 1, 10 do n = n + i * 2 end\n"   // n is reassigned: only i * 2 is integer
+        "local k = 7 // 2 % 0x10\n"
+        "local late = 1\n"
+        "print(late + k)\n"                      // Assigned a float below
+        "late = 0.5\n"
+        "for j = 10, 1, -1 do end\n"
+        "for f = 1.5, n do end\n");
+
+    assert(countOps(main.get(), OP_MUL_INT) == 1);
+    assert(countOps(main.get(), OP_ADD_INT) == 0);
+    assert(countOps(main.get(), OP_ADD) == 2);
+    assert(countOps(main.get(), OP_IDIV_INT) == 1);
+    assert(countOps(main.get(), OP_MOD_INT) == 1);
+    assert(countOps(main.get(), OP_FORLOOP_UP) == 2);
+    assert(countOps(main.get(), OP_FORLOOP_DOWN) == 1);
+    assert(countOps(main.get(), OP_FORLOOP) == 0);
+
+    // Numerals keep their subtype; hex ones are integers
+    bool sawHex = false, sawFloat = false;
+    for (const Instruction& inst : main->instructions) {
+        sawHex = sawHex || (inst.op == OP_LOADI && inst.b == 16);
+    }
+    for (const Value& v : main->constants) {
+        sawFloat = sawFloat || (!is_integer(v) && is_number(v) && as_number(v) == 1.5);
+    }
+    assert(sawHex && sawFloat);
+
+    std::cout << "test_integer_specialization passed" << std::endl;
+}
+
+void test_immediate_loads() {
+    Compiler compiler;
+    std::unique_ptr<Prototype> main = compiler.compile(
+        "local a, b, c\n"
+        "local t = {true, false, nil, -3, 2.0, 0.25, 2147483648}\n"
+        "print(a, b, c, t, -0.0)\n");
+
+    const auto& code = main->instructions;
+    assert(code[0].op == OP_LOADNIL && code[0].b == 2);
+    assert(countOps(main.get(), OP_LOADNIL) == 2);
+    assert(countOps(main.get(), OP_LOADBOOL) == 2);
+    assert(countOps(main.get(), OP_LOADF) == 1);
+    // Only 0.25, 2147483648 and -0.0 need constants (besides names)
+    int numbers = 0;
+    for (const Value& v : main->constants) numbers += is_number(v) || is_nil(v) || is_boolean(v);
+    assert(numbers == 3);
+    std::cout << "test_immediate_loads passed" << std::endl;
+}
+
+void test_switch_lowering() {
+    Compiler compiler;
+    std::unique_ptr<Prototype> main = compiler.compile(
+        "local cmd = \"b\"\n"
+        "if cmd == \"a\" then print(1) elseif cmd == \"b\" then print(2)\n"
+        "elseif cmd == 3 then print(3) elseif cmd == -4 then print(4)\n"
+        "elseif cmd == 3.0 then print(5) else print(6) end\n"     // Same key as 3: tested in order
+        "if cmd == 1 then elseif cmd == 2 then elseif cmd == 3 then end\n"  // Too short
+        "if op == 1 then elseif op == 2 then elseif op == 3 then elseif op == 4 then end\n"); // Global
+
+    assert(countOps(main.get(), OP_SWITCH) == 1);
+    const auto& code = main->instructions;
+    for (size_t pc = 0; pc < code.size(); ++pc) {
+        if (code[pc].op != OP_SWITCH) continue;
+        assert(code[pc].c == 4);
+        for (int i = 0; i <= code[pc].c; ++i) assert(code[pc + 1 + i].op == OP_JMP);
+    }
+    std::cout << "test_switch_lowering passed" << std::endl;
+}
+
+void test_condition_jumps() {
+    Compiler compiler;
+    std::unique_ptr<Prototype> main = compiler.compile(
+        "local function f(a, b, c) if a and b or c then return 1 end end\n"
+        "local function g(a, b, c) return a or b and c end\n");
+
+    // Only jumps on the operands themselves: no result register
+    const Prototype* f = main->protos[0].get();
+    assert(countOps(f, OP_NOT) == 0);
+    assert(f->instructions[0].op == OP_JMP_FALSE && f->instructions[0].a == 0);
+    assert(f->instructions[1].op == OP_JMP_TRUE && f->instructions[1].a == 1);
+    assert(f->instructions[2].op == OP_JMP_FALSE && f->instructions[2].a == 2);
+    // As a value, `and` still binds tighter than `or`
+    const Prototype* g = main->protos[1].get();
+    assert(countOps(g, OP_NOT) == 0);
+    assert(g->instructions[1].op == OP_JMP_TRUE && g->instructions[1].a == g->instructions[0].a);
+    std::cout << "test_condition_jumps passed" << std::endl;
+}
+
+void test_concat_chain() {
+    Compiler compiler;
+    std::unique_ptr<Prototype> main = compiler.compile(
+        "local a = \"x\"\n"
+        "print(a .. 1 .. \"y\" .. a .. 2.5)\n");
+
+    assert(countOps(main.get(), OP_CONCAT) == 1);
+    for (const Instruction& inst : main->instructions) {
+        if (inst.op == OP_CONCAT) assert(inst.c - inst.b == 4);
+    }
+    std::cout << "test_concat_chain passed" << std::endl;
+}
+
+void test_string_buffers() {
+    Compiler compiler;
+    std::unique_ptr<Prototype> main = compiler.compile(
+        "local s = \"\"\n"
+        "for i = 1, 3 do s = s .. i .. \",\" end\n"
+        "local read = \"\"\n"
+        "while #read < 3 do read = read .. \"x\" end\n"   // Read by the loop test
+        "local seen = \"\"\n"
+        "local f = function() return seen end\n"
+        "for i = 1, 3 do seen = seen .. i end\n"            // A closure could read it
+        "print(s, read, f())\n");
+
+    assert(countOps(main.get(), OP_BUFINIT) == 1);
+    assert(countOps(main.get(), OP_BUFAPPEND) == 1);
+    assert(countOps(main.get(), OP_BUFFLUSH) == 1);
+    assert(countOps(main.get(), OP_CONCAT) == 2);
+    std::cout << "test_string_buffers passed" << std::endl;
+}
+
+void test_hoisted_loads() {
+    const char* source =
+        "local self = {config = {limit = 3}}\n"
+        "local n = 0\n"
+        "while n < self.config.limit do n = n + math.floor(self.config.limit / 2) end\n"
+        "for i = 1, 3 do self.config.limit = i end\n"    // Only self.config is unchanged
+        "return self\n";                                   // Keeps it a table
+    std::unique_ptr<Prototype> main = Compiler().compile(source);
+    assert(countOps(main.get(), OP_JMP_TRUE) == 0);   // Any read could run __index
+
+    CompilerOptions options;
+    options.assumePureCalls = true;
+    main = Compiler(options).compile(source);
+    // self.config.limit twice and math.floor once, each from its cache
+    assert(countOps(main.get(), OP_JMP_TRUE) == 4);
+    assert(countOps(main.get(), OP_GETGLOBAL) == 1);
+    std::cout << "test_hoisted_loads passed" << std::endl;
+}
+
+void test_inlining() {
+    const char* source =
+        "local function clamp(x, lo, hi)\n"
+        "    if x < lo then return lo elseif x > hi then return hi end\n"
+        "    return x\n"
+        "end\n"
+        "local function fact(n) if n <= 1 then return 1 end return n * fact(n - 1) end\n"
+        "local s = 0\n"
+        "for i = 1, 10 do s = s + clamp(i, 2, 8) + fact(3) end\n"
+        "local a, b = clamp(1, 2, 3)\n"      // Would need two results
+        "print(clamp(s, 0, 50))\n";
+    Compiler compiler;
+    std::unique_ptr<Prototype> main = compiler.compile(source);
+    assert(compiler.inlinedCallSites() == 2);
+    // fact, the two-result call and print stay calls
+    assert(countOps(main.get(), OP_CALL) == 3);
+
+    CompilerOptions options;
+    options.inlineBudget = 0;
+    Compiler plain(options);
+    main = plain.compile(source);
+    assert(plain.inlinedCallSites() == 0);
+    assert(countOps(main.get(), OP_CALL) == 5);
+    std::cout << "test_inlining passed" << std::endl;
+}
+
+void test_unrolling() {
+    const char* source =
+        "local v, s = {1, 2, 3, 4}, 0\n"
+        "for i = 1, 4 do v[i] = v[i] * 3 end\n"          // Four constant copies
+        "for i = 1, 102 do s = s + i end\n"              // Four copies a pass, two left over
+        "for i = 1, 3 do v[i] = function() end end\n";   // Makes closures: kept
+    std::unique_ptr<Prototype> main = Compiler().compile(source);
+    assert(countOps(main.get(), OP_FORPREP) == 3);
+
+    CompilerOptions options;
+    options.unrollBudget = 64;
+    main = Compiler(options).compile(source);
+    assert(countOps(main.get(), OP_FORPREP) == 2);
+    assert(countOps(main.get(), OP_SETTABLE) == 4 + 4 + 1);   // Constructor, copies, closure
+    for (const Instruction& inst : main->instructions) {
+        if (inst.op == OP_FORPREP) {
+            // The unrolled loop steps by four up to its last full pass
+            const Instruction* setup = &inst - 3;
+            assert(setup[0].op == OP_LOADI && setup[0].b == 1);
+            assert(setup[1].op == OP_LOADI && setup[1].b == 97);
+            assert(setup[2].op == OP_LOADI && setup[2].b == 4);
+            break;
+        }
+    }
+    std::cout << "test_unrolling passed" << std::endl;
+}
+
+void test_scalar_tables() {
+    std::unique_ptr<Prototype> main = Compiler().compile(
+        "local p = {x = 1, y = 2}\n"
+        "p.x = p.x + p.y\n"
+        "p.z = p.x\n"                                 // A field the constructor lacks
+        "local q = {x = 1}\n"
+        "local f = function() return q.x end\n"       // Captured: kept
+        "local r = {x = 1}\n"
+        "print(p.z, f(), r)\n");                       // Passed on: kept
+    assert(countOps(main.get(), OP_NEWTABLE) == 2);
+    assert(countOps(main.get(), OP_SETTABLE) == 2);
+    assert(countOps(main.get(), OP_GETTABLE) == 0);
+    std::cout << "test_scalar_tables passed" << std::endl;
+}
+
+void test_merged_functions() {
+    const char* source =
+        "local a = function(x, y) return x > y end\n"
+        "local b = function(x, y) return x > y end\n"
+        "local c = function() return 1 end\n"
+        "local d = function() return 1.0 end\n"    // Another load: kept
+        // The same code, told apart by an integer and a float constant: kept
+        "local e = function() return 2147483648 end\n"
+        "local f = function() return 2147483648.0 end\n";
+    std::unique_ptr<Prototype> main = Compiler().compile(source);
+    assert(main->protos.size() == 6);
+    assert(main->protos[4]->instructions[0].op == OP_LOADK && main->protos[5]->instructions[0].op == OP_LOADK);
+
+    CompilerOptions options;
+    options.mergeFunctions = true;
+    main = Compiler(options).compile(source);
+    assert(main->protos.size() == 5);
+    std::vector<int> made;
+    for (const Instruction& inst : main->instructions) {
+        if (inst.op == OP_CLOSURE) made.push_back(inst.b);
+    }
+    assert((made == std::vector<int>{0, 0, 1, 2, 3, 4}));
+    std::cout << "test_merged_functions passed" << std::endl;
+}
+
+int main() {
+    test_line_table();
+    test_function_names();
+    test_superinstructions();
+    test_integer_specialization();
+    test_immediate_loads();
+    test_switch_lowering();
+    test_condition_jumps();
+    test_concat_chain();
+    test_string_buffers();
+    test_hoisted_loads();
+    test_inlining();
+    test_unrolling();
+    test_scalar_tables();
+    test_merged_functions();
+    std::cout << "All Compiler tests passed!" << std::endl;
+    return 0;
+}
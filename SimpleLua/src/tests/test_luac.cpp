@@ -0,0 +1,31 @@
+#include "../LuacWriter.h"
+#include "../Compiler.h"
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+void test_header() {
+    Compiler compiler;
+    std::unique_ptr<Prototype> proto = compiler.compile("print(\"hi\", 1.5, 2)");
+    std::ostringstream out;
+    GeneratorOptions options;
+    options.chunkName = "hi.lua";
+    LuacWriter::write(proto.get(), out, options);
+    std::string chunk = out.str();
+    // Signature, version 5.3, official format and the LUAC_DATA check bytes
+    assert(chunk.compare(0, 12, std::string("\x1bLua\x53\x00\x19\x93\r\n\x1a\n", 12)) == 0);
+    // Sizes of int, size_t, Instruction, lua_Integer and lua_Number
+    assert(chunk.compare(12, 5, "\x04\x08\x04\x08\x08") == 0);
+    // One upvalue (_ENV) for the main closure, then the source name
+    assert(chunk[33] == 1);
+    assert(chunk.compare(34, 8, "\x08@hi.lua") == 0);
+    std::cout << "test_header passed" << std::endl;
+}
+
+int main() {
+    test_header();
+    std::cout << "All luac writer tests passed!" << std::endl;
+    return 0;
+}
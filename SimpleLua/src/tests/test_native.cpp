@@ -0,0 +1,93 @@
+#include "../Compiler.h"
+#include "../Native/Interpreter.h"
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+// Compiles and runs `source` natively, returning what it printed
+static std::string run(const std::string& source) {
+    Compiler compiler;
+    std::unique_ptr<Prototype> main = compiler.compile(source);
+    std::ostringstream out;
+    Interpreter vm(out);
+    vm.run(main.get(), "test");
+    return out.str();
+}
+
+void test_arithmetic() {
+    assert(run("print(1 + 2, 7 // 2, 7 % 3, 10 / 4, -7 // 2)") == "3\t3\t1\t2.5\t-4\n");
+    assert(run("print(1 < 2, 2 <= 1, 1 == 1, \"a\" < \"b\")") == "true\tfalse\ttrue\ttrue\n");
+    assert(run("print(\"10\" + 5, 1 .. 2, #\"abc\")") == "15.0\t12\t3\n");
+    std::cout << "test_arithmetic passed" << std::endl;
+}
+
+void test_tables_and_closures() {
+    assert(run("local t = {}\n"
+               "for i = 1, 10 do t[i] = i * i end\n"
+               "t.name = \"sq\"\n"
+               "print(#t, t[3], t.name)\n") == "10\t9\tsq\n");
+    assert(run("local function counter()\n"
+               "    local c = 0\n"
+               "    return function() c = c + 1 return c end\n"
+               "end\n"
+               "local a = counter()\n"
+               "a()\n"
+               "print(a(), counter()())\n") == "2\t1\n");
+    // Each iteration captures its own loop variable
+    assert(run("local fs = {}\n"
+               "for i = 1, 3 do fs[i] = function() return i end end\n"
+               "local a = fs[1]()\n"
+               "local b = fs[3]()\n"
+               "print(a, b)\n") == "1\t3\n");
+    std::cout << "test_tables_and_closures passed" << std::endl;
+}
+
+void test_stdlib() {
+    assert(run("print(string.format(\"%d-%s-%.1f\", 7, \"x\", 2.5))") == "7-x-2.5\n");
+    assert(run("local s = string.gsub(\"hello world\", \"(%w+)\", \"<%1>\")\nprint(s)") == "<hello> <world>\n");
+    assert(run("local t = {3, 1, 2}\ntable.sort(t)\nprint(table.concat(t, \",\"))") == "1,2,3\n");
+    assert(run("print(math.floor(3.7), math.max(1, 9, 4), select(\"#\", 1, 2))") == "3\t9\t2\n");
+    std::cout << "test_stdlib passed" << std::endl;
+}
+
+void test_metamethod_reads_in_loops() {
+    // A field read through __index runs it on every pass
+    assert(run("local reads = 0\n"
+               "local holder = {p = setmetatable({}, {__index = function(t, k)\n"
+               "    reads = reads + 1 return reads end})}\n"
+               "local sum = 0\n"
+               "for j = 1, 3 do sum = sum + holder.p.val end\n"
+               "print(sum, reads)\n") == "6\t3\n");
+    std::cout << "test_metamethod_reads_in_loops passed" << std::endl;
+}
+
+void test_errors() {
+    assert(run("local ok, e = pcall(function() local x = nil\nreturn x.y end)\nprint(ok, e)") ==
+           "false\ttest:2: attempt to index a nil value\n");
+    assert(run("local ok, e = pcall(error, \"plain\", 0)\nprint(e)") == "plain\n");
+
+    bool thrown = false;
+    try {
+        run("local t = nil\nt.x = 1\n");
+    } catch (const std::runtime_error& e) {
+        thrown = std::string(e.what()) == "test:2: attempt to index a nil value";
+    }
+    assert(thrown);
+
+    // Deep recursion does not consume the C++ stack
+    assert(run("local function f(n) if n == 0 then return 0 end return 1 + f(n - 1) end\nprint(f(20000))") ==
+           "20000\n");
+    std::cout << "test_errors passed" << std::endl;
+}
+
+int main() {
+    test_arithmetic();
+    test_tables_and_closures();
+    test_stdlib();
+    test_metamethod_reads_in_loops();
+    test_errors();
+    std::cout << "All native interpreter tests passed!" << std::endl;
+    return 0;
+}
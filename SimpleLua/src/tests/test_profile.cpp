@@ -0,0 +1,107 @@
+#include "../Profile.h"
+#include <cassert>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static const char* kRun =
+    "# simplelua profile\n"
+    "runs 1\n"
+    "pc 1 3 OP_ADD 40\n"
+    "pc 0 0 OP_CLOSURE 1\n"
+    "proto 1 10 40 0.250000\n"
+    "proto 0 1 1 0.500000\n"
+    "op OP_ADD 40\n"
+    "op OP_CLOSURE 1\n"
+    "seq OP_LOADK,OP_ADD 30\n";
+
+void test_load() {
+    Profile p;
+    std::istringstream in(kRun);
+    p.load(in);
+
+    assert(p.runs == 1);
+    assert(p.opCounts["OP_ADD"] == 40);
+    assert(p.protos[1].calls == 10);
+    assert(p.protos[0].seconds == 0.5);
+    assert((p.pcs[{1, 3}].op == "OP_ADD"));
+    assert(p.totalInstructions() == 41);
+
+    std::cout << "test_load passed" << std::endl;
+}
+
+void test_merge_runs() {
+    Profile p;
+    std::istringstream first(kRun);
+    std::istringstream second(kRun);
+    p.load(first);
+    p.load(second);
+
+    assert(p.runs == 2);
+    assert(p.opCounts["OP_ADD"] == 80);
+    assert(p.protos[1].calls == 20);
+    assert(p.protos[1].seconds == 0.5);
+    assert((p.pcs[{1, 3}].count == 80));
+    assert(p.sequences["OP_LOADK,OP_ADD"] == 60);
+
+    std::cout << "test_merge_runs passed" << std::endl;
+}
+
+void test_save_round_trip() {
+    Profile p;
+    std::istringstream in(kRun);
+    p.load(in);
+
+    std::stringstream saved;
+    p.save(saved);
+    Profile q;
+    q.load(saved);
+
+    assert(q.runs == p.runs);
+    assert(q.opCounts == p.opCounts);
+    assert(q.protos[1].instructions == 40);
+    assert((q.pcs[{0, 0}].op == "OP_CLOSURE"));
+    assert(q.sequences == p.sequences);
+
+    std::cout << "test_save_round_trip passed" << std::endl;
+}
+
+void test_malformed() {
+    Profile p;
+    std::istringstream in("runs 1\npc 1 OP_ADD\n");
+    try {
+        p.load(in);
+        assert(false && "Should have thrown std::runtime_error");
+    } catch (const std::runtime_error& e) {
+        assert(std::string(e.what()).find("line 2") != std::string::npos);
+    }
+    assert(p.runs == 0);
+
+    std::cout << "test_malformed passed" << std::endl;
+}
+
+void test_opcodes_by_frequency() {
+    Profile p;
+    std::istringstream in("op OP_MOVE 5\nop OP_ADD 40\nop OP_BOGUS 100\nop OP_CALL 40\n");
+    p.load(in);
+
+    std::vector<OpCode> order = p.opcodesByFrequency();
+    assert(order.size() == 3);
+    assert(order[0] == OP_ADD); // Ties keep name order
+    assert(order[1] == OP_CALL);
+    assert(order[2] == OP_MOVE);
+
+    std::cout << "test_opcodes_by_frequency passed" << std::endl;
+}
+
+int main() {
+    test_load();
+    test_merge_runs();
+    test_save_round_trip();
+    test_malformed();
+    test_opcodes_by_frequency();
+    std::cout << "All Profile tests passed!" << std::endl;
+    return 0;
+}
@@ -1,6 +1,7 @@
 #include "../Value.h"
 #include <cassert>
 #include <iostream>
+#include <limits>
 #include <stdexcept>
 #include <string>
 
@@ -75,11 +76,63 @@ void test_as_string() {
     std::cout << "test_as_string passed" << std::endl;
 }
 
+void test_boxing() {
+    static_assert(sizeof(Value) == 8, "Value is one word");
+    Value a = std::string("shared");
+    Value b = "shared";
+    // Interned strings share storage and compare by identity
+    assert(&as_string_ref(a) == &as_string_ref(b));
+    assert(a == b);
+    assert(a != Value("other"));
+    assert(Value(0.0) == Value(-0.0));
+    assert(Value(1.0) != Value(true));
+    assert(Value(Nil{}) == Value());
+
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    assert(is_number(nan) && is_number(-nan));
+    assert(Value(nan) != Value(nan));
+    assert(is_number(std::numeric_limits<double>::infinity()));
+
+    try {
+        as_string_ref(1.0);
+        assert(false && "Should have thrown std::runtime_error");
+    } catch (const std::runtime_error& e) {
+        assert(std::string(e.what()) == "Value is not a string");
+    }
+
+    std::cout << "test_boxing passed" << std::endl;
+}
+
+void test_integers() {
+    // Inline and interned (wider than 48 bits) integers, at the edges of each
+    for (int64_t i : {(int64_t)0, (int64_t)-1, (int64_t)1 << 47, -((int64_t)1 << 47), INT64_MAX, INT64_MIN}) {
+        Value v(i);
+        assert(is_integer(v) && is_number(v));
+        assert(as_integer(v) == i);
+    }
+    assert(!is_integer(1.0));
+    assert(Value((int64_t)3) == Value(3.0));
+    assert(Value(INT64_MAX) != Value(9223372036854775807.0)); // The float is 2^63
+    assert(as_number((int64_t)-5) == -5.0);
+    assert(as_string((int64_t)42) == "42");
+
+    try {
+        as_integer(1.0);
+        assert(false && "Should have thrown std::runtime_error");
+    } catch (const std::runtime_error& e) {
+        assert(std::string(e.what()) == "Value is not an integer");
+    }
+
+    std::cout << "test_integers passed" << std::endl;
+}
+
 int main() {
     test_is_functions();
     test_as_boolean();
     test_as_number();
     test_as_string();
+    test_boxing();
+    test_integers();
     std::cout << "All Value tests passed!" << std::endl;
     return 0;
 }
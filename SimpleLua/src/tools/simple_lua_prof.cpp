@@ -0,0 +1,93 @@
+#include "../Profile.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Aggregates profiles dumped by VMs generated with -profile and prints the
+// hottest opcodes, functions, instructions and opcode sequences.
+
+static double percent(uint64_t part, uint64_t total) {
+    return total ? 100.0 * (double)part / (double)total : 0.0;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> inputs;
+    std::string mergedPath;
+    size_t top = 20;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            mergedPath = argv[++i];
+        } else if (std::strcmp(argv[i], "-top") == 0 && i + 1 < argc) {
+            top = (size_t)std::atoi(argv[++i]);
+        } else {
+            inputs.push_back(argv[i]);
+        }
+    }
+
+    if (inputs.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [-o merged.prof] [-top N] <profile>...\n";
+        return 1;
+    }
+
+    Profile profile;
+    try {
+        for (const auto& path : inputs) {
+            profile.loadFile(path);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    uint64_t total = profile.totalInstructions();
+    std::printf("%d run(s), %llu instructions executed\n\n", profile.runs, (unsigned long long)total);
+
+    std::vector<std::pair<std::string, uint64_t>> ops(profile.opCounts.begin(), profile.opCounts.end());
+    std::sort(ops.begin(), ops.end(), [](const auto& x, const auto& y) { return x.second > y.second; });
+    std::printf("%-16s %14s %7s\n", "opcode", "count", "%");
+    for (const auto& kv : ops) {
+        std::printf("%-16s %14llu %6.2f%%\n", kv.first.c_str(), (unsigned long long)kv.second, percent(kv.second, total));
+    }
+
+    std::vector<std::pair<int, ProtoProfile>> protos(profile.protos.begin(), profile.protos.end());
+    std::sort(protos.begin(), protos.end(), [](const auto& x, const auto& y) { return x.second.instructions > y.second.instructions; });
+    std::printf("\n%-8s %12s %14s %7s %10s\n", "proto", "calls", "instructions", "%", "seconds");
+    for (size_t i = 0; i < protos.size() && i < top; ++i) {
+        const ProtoProfile& p = protos[i].second;
+        std::printf("%-8d %12llu %14llu %6.2f%% %10.4f\n", protos[i].first, (unsigned long long)p.calls,
+                    (unsigned long long)p.instructions, percent(p.instructions, total), p.seconds);
+    }
+
+    std::vector<std::pair<std::pair<int, int>, PcProfile>> pcs(profile.pcs.begin(), profile.pcs.end());
+    std::sort(pcs.begin(), pcs.end(), [](const auto& x, const auto& y) { return x.second.count > y.second.count; });
+    std::printf("\n%-8s %6s %-16s %14s %7s\n", "proto", "pc", "opcode", "count", "%");
+    for (size_t i = 0; i < pcs.size() && i < top; ++i) {
+        const auto& kv = pcs[i];
+        std::printf("%-8d %6d %-16s %14llu %6.2f%%\n", kv.first.first, kv.first.second, kv.second.op.c_str(),
+                    (unsigned long long)kv.second.count, percent(kv.second.count, total));
+    }
+
+    std::vector<std::pair<std::string, uint64_t>> seqs(profile.sequences.begin(), profile.sequences.end());
+    std::sort(seqs.begin(), seqs.end(), [](const auto& x, const auto& y) { return x.second > y.second; });
+    std::printf("\n%-44s %14s %7s\n", "sequence", "count", "%");
+    for (size_t i = 0; i < seqs.size() && i < top; ++i) {
+        std::printf("%-44s %14llu %6.2f%%\n", seqs[i].first.c_str(), (unsigned long long)seqs[i].second,
+                    percent(seqs[i].second, total));
+    }
+
+    if (!mergedPath.empty()) {
+        std::ofstream out(mergedPath);
+        if (!out) {
+            std::cerr << "Error: Could not open output file for writing: " << mergedPath << "\n";
+            return 1;
+        }
+        profile.save(out);
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include "../Value.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <variant>
+#include <vector>
+
+// Times construction, copying and comparison of Value against the
+// std::variant layout it replaced, over a mix of the constants a compiler
+// sees (numbers, a few repeated names, nil and booleans).
+
+using VariantValue = std::variant<Nil, bool, double, std::string>;
+
+static bool operator==(Nil, Nil) { return true; }
+
+static const int kValues = 4096;
+
+static volatile size_t sink; // Keeps results observable so loops are not removed
+
+template <typename F>
+static double timeNs(int rounds, F body) {
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r) body();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / (double)rounds / kValues;
+}
+
+static std::vector<std::string> names() {
+    std::vector<std::string> out;
+    for (int i = 0; i < 64; ++i) out.push_back("identifier_" + std::to_string(i) + "_with_a_long_name");
+    return out;
+}
+
+template <typename V>
+static V make(int i, const std::vector<std::string>& strings) {
+    switch (i % 4) {
+    case 0: return V(strings[i % strings.size()]);
+    case 1: return V((double)i);
+    case 2: return V(i % 8 == 2);
+    default: return V(Nil{});
+    }
+}
+
+template <typename V>
+static void bench(const char* label, int rounds) {
+    std::vector<std::string> strings = names();
+    std::vector<V> values;
+    double construct = timeNs(rounds, [&] {
+        values.clear();
+        for (int i = 0; i < kValues; ++i) values.push_back(make<V>(i, strings));
+        sink = sink + values.size();
+    });
+    std::vector<V> copies;
+    double copy = timeNs(rounds, [&] {
+        copies = values;
+        sink = sink + copies.size();
+    });
+    double compare = timeNs(rounds, [&] {
+        size_t equal = 0;
+        for (int i = 0; i < kValues; ++i) equal += values[i] == values[(i * 7 + 64) % kValues];
+        sink = sink + equal;
+    });
+    std::printf("%-10s %3zu bytes  construct %6.2f ns  copy %6.2f ns  compare %6.2f ns\n", label, sizeof(V),
+                construct, copy, compare);
+}
+
+int main(int argc, char* argv[]) {
+    int rounds = argc > 1 ? std::atoi(argv[1]) : 2000;
+    if (rounds <= 0) rounds = 1;
+    bench<VariantValue>("variant", rounds);
+    bench<Value>("nan-boxed", rounds);
+    return 0;
+}